@@ -0,0 +1,92 @@
+#ifndef ALBUMINDEX_H
+#define ALBUMINDEX_H
+
+#include <windows.h>
+#include "mp3player.h"
+
+// Aggregated information about one album (album name + album artist)
+typedef struct {
+    char name[MAX_ALBUM_LENGTH];     // Album name as first seen ("" if untagged)
+    char artist[MAX_ARTIST_LENGTH];  // Artist the album is grouped under
+    UINT64 key;                      // Hash of the folded album and artist names
+    int artist_id;                   // Owning artist entry
+    int year;                        // Year of the first track seen
+    TrackId* tracks;                 // Ids of the tracks in the album
+    int track_count;                 // Number of tracks (0 = free slot)
+    int track_capacity;              // Allocated capacity for tracks
+    int total_duration;              // Sum of track durations in seconds
+} AlbumEntry;
+
+// Aggregated information about one artist
+typedef struct {
+    char name[MAX_ARTIST_LENGTH];    // Artist name as first seen ("" if untagged)
+    UINT64 key;                      // Hash of the folded artist name
+    int* albums;                     // Ids of the artist's albums
+    int album_count;                 // Number of albums (0 = free slot)
+    int album_capacity;              // Allocated capacity for albums
+    int track_count;                 // Number of tracks over all albums
+    int total_duration;              // Sum of track durations in seconds
+} ArtistEntry;
+
+// Open addressing table mapping a key hash to an entry id
+typedef struct {
+    int* slots;                      // Entry id + 1 (0 = empty, -1 = deleted)
+    int capacity;                    // Always a power of 2
+    int count;
+    int tombstones;
+} AlbumKeyTable;
+
+// Album/artist index, kept up to date by library_add_file/library_remove_file.
+// Album and artist ids are slot numbers: they stay valid while the entry has tracks.
+struct AlbumIndex {
+    AlbumEntry* albums;
+    int album_slots;                 // Number of slots in use (including free ones)
+    int album_capacity;
+    int album_count;                 // Number of non-empty albums
+    int* free_albums;                // Recycled album slots
+    int free_album_count;
+    int free_album_capacity;
+    AlbumKeyTable album_keys;
+    
+    ArtistEntry* artists;
+    int artist_slots;
+    int artist_capacity;
+    int artist_count;
+    int* free_artists;
+    int free_artist_count;
+    int free_artist_capacity;
+    AlbumKeyTable artist_keys;
+};
+
+// Create an empty index
+AlbumIndex* album_index_create(void);
+
+// Free the index and all its entries
+void album_index_free(AlbumIndex* index);
+
+// Remove every entry, keeping the allocated memory
+void album_index_clear(AlbumIndex* index);
+
+// Rebuild the index from scratch from a track list
+BOOL album_index_rebuild(AlbumIndex* index, MP3File* list);
+
+// Account for a track added to the library
+BOOL album_index_add(AlbumIndex* index, MP3File* file);
+
+// Account for a track removed from the library
+void album_index_remove(AlbumIndex* index, MP3File* file);
+
+// Find an album by name and artist, returns the album id or -1
+int album_index_find_album(AlbumIndex* index, const char* album, const char* artist);
+
+// Find the album a track belongs to, returns the album id or -1
+int album_index_find_track_album(AlbumIndex* index, MP3File* file);
+
+// Find an artist by name, returns the artist id or -1
+int album_index_find_artist(AlbumIndex* index, const char* artist);
+
+// Get an album/artist entry by id (NULL if the id is not in use)
+AlbumEntry* album_index_get_album(AlbumIndex* index, int album_id);
+ArtistEntry* album_index_get_artist(AlbumIndex* index, int artist_id);
+
+#endif // ALBUMINDEX_H
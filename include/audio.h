@@ -30,7 +30,8 @@ typedef struct MP3Queue PlaybackQueue;
 typedef struct {
     PlaybackState state;      // Stato attuale della riproduzione
     PlaybackMode mode;        // Modalità di riproduzione
-    MP3Queue* queue;          // Coda di riproduzione
+    MP3Queue* queue;          // Coda di riproduzione (id delle tracce)
+    MP3Library* library;      // Libreria usata per risolvere gli id della coda
     HWND notifyWindow;        // Finestra da notificare per gli eventi di riproduzione
     UINT notifyMessage;       // Messaggio di notifica per la riproduzione
     int volume;               // Volume (0-100)
@@ -40,6 +41,7 @@ typedef struct {
 // Funzioni per la riproduzione audio
 AudioPlayer* create_audio_player(HWND notifyWindow, UINT notifyMessage);
 void free_audio_player(AudioPlayer* player);
+void set_player_library(AudioPlayer* player, MP3Library* library);
 
 // Controlli di base
 BOOL play_file(AudioPlayer* player, const char* filepath);
@@ -55,6 +57,7 @@ BOOL add_to_queue(AudioPlayer* player, MP3File* file);
 BOOL clear_queue(AudioPlayer* player);
 int get_queue_size(AudioPlayer* player);
 MP3File* get_current_file(AudioPlayer* player);
+TrackId get_current_track_id(AudioPlayer* player);
 
 // Impostazioni
 BOOL set_volume(AudioPlayer* player, int volume);
@@ -0,0 +1,53 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <windows.h>
+#include "mp3player.h"
+
+// Default number of synthetic tracks used by the benchmarks
+#define BENCH_DEFAULT_TRACKS 100000
+
+// Simple high resolution timer based on QueryPerformanceCounter
+typedef struct {
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+} BenchTimer;
+
+void bench_timer_start(BenchTimer* timer);
+double bench_timer_elapsed_ms(BenchTimer* timer);
+
+// Synthetic library helpers (files are never touched on disk)
+MP3Library* bench_create_library(int track_count);
+void bench_fill_track(MP3File* file, int index, char* path, size_t path_size);
+
+// Benchmark entry points
+void bench_track_ids(int track_count);
+void bench_album_index(int track_count);
+void bench_path_trie(int track_count);
+void bench_memory_tags(int track_count);
+void bench_sort(int track_count);
+void bench_collation(int track_count);
+void bench_parallel_sort(int track_count);
+void bench_sorted_view(int track_count);
+void bench_track_views(int track_count);
+void bench_text_index(int track_count);
+void bench_trigram_index(int track_count);
+void bench_search_session(int track_count);
+void bench_filter_query(int track_count);
+void bench_strscan(int track_count);
+void bench_playlist_load(int track_count);
+void bench_playlist_startup(int track_count);
+void bench_playlist_binary(int track_count);
+void bench_playlist_save(int track_count);
+void bench_playlist_sequence(int track_count);
+void bench_smart_playlists(int track_count);
+void bench_playlist_import(int track_count);
+void bench_playlist_undo(int track_count);
+void bench_playlist_names(int track_count);
+void bench_playlist_diff(int track_count);
+
+// Runs a benchmark by name ("all" or NULL runs everything), returns FALSE if unknown
+BOOL run_benchmark(const char* name, int track_count);
+void bench_list(void);
+
+#endif // BENCH_H
@@ -0,0 +1,45 @@
+#ifndef DUPLICATES_H
+#define DUPLICATES_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "threadpool.h"
+
+// A set of tracks whose audio payload (file content without ID3 tags) is identical: copies
+// with the same size and hash are compared byte for byte before they are grouped
+typedef struct {
+    TrackId* tracks;           // Ids of the copies, sorted by path
+    int count;                 // Number of copies (always >= 2)
+    UINT64 payload_size;       // Audio payload size in bytes
+    UINT64 hash;               // Payload hash shared by the copies
+} DuplicateGroup;
+
+// Result of a duplicate detection pass
+typedef struct {
+    DuplicateGroup* groups;    // Duplicate groups, largest payload first
+    int group_count;           // Number of groups
+    int files_total;           // Tracks examined
+    int files_unreadable;      // Tracks that could not be opened
+    int files_skipped;         // Tracks with a unique payload size (never hashed)
+    int files_hashed;          // Tracks that had their payload hashed
+    int hash_mismatches;       // Tracks sharing a size and hash whose bytes matched no other
+    int redundant_files;       // Copies beyond the first in each group
+    UINT64 bytes_hashed;       // Payload bytes read and hashed
+    UINT64 bytes_compared;     // Payload bytes read again to confirm the groups
+    UINT64 redundant_bytes;    // Bytes taken by the redundant copies
+    double probe_ms;           // Time spent reading sizes and tag headers
+    double hash_ms;            // Time spent hashing candidates
+    double compare_ms;         // Time spent comparing the candidates of each group
+    int thread_count;          // Worker threads used
+} DuplicateReport;
+
+// Find tracks with identical audio payloads (pool may be NULL to run serially)
+DuplicateReport* find_duplicate_tracks(MP3Library* library, ThreadPool* pool);
+
+// Print the groups and the throughput statistics of a report
+void print_duplicate_report(DuplicateReport* report, MP3Library* library);
+
+// Free a report
+void free_duplicate_report(DuplicateReport* report);
+
+#endif // DUPLICATES_H
@@ -0,0 +1,103 @@
+#ifndef FILTERQUERY_H
+#define FILTERQUERY_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "textindex.h"
+#include "trackview.h"
+
+// Limits of a parsed query
+#define FILTER_QUERY_MAX_NODES    64
+#define FILTER_QUERY_MAX_CHILDREN 16
+#define FILTER_QUERY_MAX_WORDS    8  // Words of one text term (further words are ignored)
+#define FILTER_QUERY_ERROR_MAX    128
+
+// Library records tested to estimate how many tracks a numeric range keeps
+#define FILTER_SAMPLE_SIZE 512
+
+// Node kinds
+#define FILTER_NODE_AND   0
+#define FILTER_NODE_OR    1
+#define FILTER_NODE_NOT   2
+#define FILTER_NODE_TEXT  3          // Every word of the value in a text field, as text_index_match
+                                     // finds them with TEXT_MATCH_SUBSTRING
+#define FILTER_NODE_RANGE 4          // Numeric field within [low, high]
+#define FILTER_NODE_CONTAINS 5       // The value as written anywhere in a text field
+
+// How the planner evaluates a node
+#define FILTER_ACCESS_INDEX   0      // Posting lists of the word index
+#define FILTER_ACCESS_VIEW    1      // Range of a registered sorted view on the field
+#define FILTER_ACCESS_SCAN    2      // Test every library record
+#define FILTER_ACCESS_COMBINE 3      // Intersect, merge or complement the children's sets
+#define FILTER_ACCESS_CHECK   4      // Test each track left by the earlier terms of an AND
+#define FILTER_ACCESS_POOL    5      // Substring scan of the field's string pool in the word index
+
+// Term or operator of a query
+typedef struct {
+    int kind;                        // FILTER_NODE_*
+    int field;                       // TEXT_FIELD_* for text terms, SORT_BY_* for ranges
+    char value[MAX_FILTER_LENGTH];   // Text as written
+    char words[FILTER_QUERY_MAX_WORDS][TEXT_TOKEN_MAX]; // Folded words of a text term
+    int word_length[FILTER_QUERY_MAX_WORDS];
+    int word_count;
+    int low;                         // Inclusive bounds of a range
+    int high;
+    int children[FILTER_QUERY_MAX_CHILDREN]; // Operands (node numbers)
+    int child_count;
+    
+    // Chosen by the planner
+    int access;                      // FILTER_ACCESS_*
+    SortedView* view;                // View walked by FILTER_ACCESS_VIEW
+    double rows;                     // Estimated matching tracks
+    double cost;                     // Estimated work, in posting visits
+    int actual;                      // Tracks left after the node ran (-1 if it did not)
+} FilterNode;
+
+// Boolean query over the track metadata, for example
+//   artist:queen AND year:1975..1980 AND NOT genre:live
+// Terms are field:value (title, artist, album, genre, any; year, track, disc, duration)
+// or a bare word, searched in every text field; field~value finds the value as written
+// anywhere in a text field, ignoring the case of ASCII letters ("title~n't st").
+// Adjacent terms are ANDed; AND, OR and NOT must be written in capitals, and parentheses
+// group. Text values match like the word index (each word as part of a word, ignoring
+// case and accents), quotes keep several words in one term. Numbers accept N,
+// A..B, A.., ..B, <N, <=N, >N and >=N; durations are seconds or m:ss.
+typedef struct {
+    FilterNode nodes[FILTER_QUERY_MAX_NODES];
+    int node_count;
+    int root;
+    BOOL indexed;                    // The last plan could use the word index
+    double cost;                     // Estimated cost of the last plan
+    double scan_cost;                // What testing every record would have cost instead
+} FilterQuery;
+
+// Parse a query. Returns NULL on a syntax error (described in error) or without memory.
+FilterQuery* filter_query_parse(const char* text, char* error, size_t error_size);
+
+void filter_query_free(FilterQuery* query);
+
+// Choose how to evaluate each node from estimated costs: an AND starts from the term that
+// makes it cheapest, then takes the others most selective first, intersecting each as a
+// set or testing it per remaining track. Any node may instead test every record.
+// Done by filter_query_run; FALSE without memory.
+BOOL filter_query_plan(FilterQuery* query, MP3Library* library);
+
+// Plan and run the query. Matches are in insertion order. Returns their number, -1 without memory.
+int filter_query_run(FilterQuery* query, MP3Library* library, TrackView* result);
+
+// TRUE if a library record matches the query
+BOOL filter_query_matches(const FilterQuery* query, const MP3File* file);
+
+// TRUE if every track matching next also matches previous: each term ANDed in previous
+// is ANDed in next too, or narrowed (longer text, smaller range)
+BOOL filter_query_narrows(const FilterQuery* next, const FilterQuery* previous);
+
+// Keep only the tracks of result (the result of a query it narrows) that match the query.
+// Returns the number kept.
+int filter_query_refine(const FilterQuery* query, MP3Library* library, TrackView* result);
+
+// Describe the last plan, one node per line with its access path, estimates and actual
+// rows. Returns the length written (the text is cut to size).
+int filter_query_explain(const FilterQuery* query, char* buffer, size_t size);
+
+#endif // FILTERQUERY_H
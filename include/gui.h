@@ -6,9 +6,11 @@
 #include "mp3player.h"
 #include "audio.h"
 #include "settings.h"
+#include "threadpool.h"
+#include "trackview.h"
+#include "searchsession.h"
 
 // Alias per compatibilità
-typedef MP3File* MP3FileList;
 typedef int SortType;  // Per compatibilità con il tipo di ordinamento, utilizzando l'enum in mp3player.h
 
 // Dimensioni della finestra
@@ -26,6 +28,7 @@ typedef int SortType;  // Per compatibilità con il tipo di ordinamento, utilizz
 #define ALBUMART_ID 107
 #define DETAIL_VIEW_ID 108
 #define TABS_ID 109
+#define SEARCHBOX_ID 110
 
 // ID dei comandi menu/toolbar
 #define ID_FILE_OPEN 200
@@ -76,6 +79,7 @@ enum {
 
 // Messaggi personalizzati
 #define WM_AUDIO_NOTIFY (WM_USER + 1)
+#define WM_SEARCH_RESULTS (WM_USER + 2) // lParam = SearchBatch* (liberato da chi lo riceve)
 
 // Costanti per gli ID dei menu
 #define ID_PLAY_PAUSE 2202
@@ -91,6 +95,7 @@ typedef struct {
     HWND hAlbumArt;          // Controllo per mostrare l'immagine dell'album
     HWND hDetailView;        // View per mostrare dettagli del brano
     HWND hTabs;              // Tab control per cambiare vista
+    HWND hSearchBox;         // Casella di ricerca (cerca mentre si scrive)
     
     // Finestra di dialogo dell'equalizzatore
     HWND hEqDialog;          // Dialog dell'equalizzatore
@@ -102,16 +107,31 @@ typedef struct {
     
     int selected_item;       // Indice dell'elemento selezionato
     SortType sort_type;      // Tipo di ordinamento corrente
+    ThreadPool* sort_pool;   // Thread per ordinare le liste grandi (NULL = ordinamento seriale)
     int view_mode;           // Modalità di visualizzazione corrente
     
     BOOL using_filtered_list; // Indica se stiamo visualizzando una lista filtrata
-    MP3FileList* current_list; // Lista attualmente visualizzata
+    TrackView filtered;      // Id della lista filtrata visualizzata (nessuna copia dei record)
+    SearchSession* search;   // Ricerca in corso dalla casella di ricerca (creata al primo tasto)
+    
+    TrackId* view_ids;       // Id delle tracce mostrate nella ListView (lParam = indice in questo array)
+    int view_count;          // Numero di id validi in view_ids
+    int view_capacity;       // Capacità allocata di view_ids
     
     UINT_PTR timer_id;       // ID del timer per aggiornamento della progress bar
     
     HBITMAP hAlbumBitmap;    // Handle per il bitmap dell'album
 } GUIData;
 
+// Blocco di risultati della ricerca inviato dal thread della sessione alla finestra
+typedef struct {
+    LONG query_id;           // Ricerca a cui appartiene (scartato se nel frattempo ne è partita un'altra)
+    int first;               // Posizione del primo id nei risultati
+    int count;
+    BOOL last;               // Ultimo blocco della ricerca
+    TrackId ids[];
+} SearchBatch;
+
 // Funzioni per l'interfaccia grafica
 BOOL init_gui_controls();                        // Inizializza i controlli comuni di Windows
 HWND create_main_window(HINSTANCE hInstance);    // Crea la finestra principale
@@ -122,6 +142,7 @@ void update_details_view(GUIData* gui);          // Aggiorna la vista dei dettag
 void create_menu(HWND hWnd);                     // Crea il menu principale
 void handle_menu_action(HWND hWnd, WPARAM wParam, GUIData* gui); // Gestisce le azioni del menu
 void handle_list_view_notification(HWND hWnd, LPARAM lParam, GUIData* gui); // Gestisce le notifiche della ListView
+void sort_current_view(GUIData* gui, SortType sort_type); // Ordina la lista visualizzata
 void show_filter_dialog(HWND hWnd, GUIData* gui); // Mostra la finestra di dialogo per il filtro
 void create_toolbar(HWND hWnd, GUIData* gui);    // Crea la barra degli strumenti
 
@@ -139,6 +160,9 @@ void create_album_art_view(HWND hWnd, GUIData* gui);  // Crea il controllo per l
 void update_album_art(GUIData* gui, MP3File* file);   // Aggiorna l'immagine dell'album
 void create_detail_view(HWND hWnd, GUIData* gui);     // Crea la vista dettagli
 void create_tabs(HWND hWnd, GUIData* gui);            // Crea i tabs per cambiare visualizzazione
+void create_search_box(HWND hWnd, GUIData* gui);      // Crea la casella di ricerca
+void handle_search_input(GUIData* gui);               // Avvia la ricerca del testo della casella
+void handle_search_results(GUIData* gui, SearchBatch* batch); // Mostra un blocco di risultati
 void switch_view_mode(GUIData* gui, int view_mode);   // Cambia modalità di visualizzazione
 HBITMAP create_album_art_bitmap(MP3File* file);       // Crea un bitmap dall'album art
 void free_album_art_bitmap(GUIData* gui);             // Libera il bitmap dell'album art
@@ -187,6 +211,8 @@ void create_tabs(HWND hWnd, GUIData* gui);
 void switch_view_mode(GUIData* gui, int view_mode);
 void prepare_grid_view_items(GUIData* gui);
 void handle_album_selection(GUIData* gui, MP3File* representative_file);
+TrackId get_list_item_id(GUIData* gui, int item);
+MP3File* get_list_item_file(GUIData* gui, int item);
 void adjust_column_widths(HWND hListView, int totalWidth);
 
 #endif // GUI_H 
\ No newline at end of file
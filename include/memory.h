@@ -6,6 +6,28 @@
 #include <stdlib.h>
 #include <string.h>
 
+// Subsystems allocations are attributed to
+typedef enum {
+    MEM_CAT_GENERAL,            // Untagged allocations
+    MEM_CAT_LIBRARY,            // Track records, file names and directories
+    MEM_CAT_INDEX,              // Id table, album/artist index and cached sort keys
+    MEM_CAT_ART,                // Album art images
+    MEM_CAT_PLAYLIST,           // Playlists and the playlist manager
+    MEM_CAT_QUEUE,              // Playback queue
+    MEM_CAT_FILTER,             // Filtered and album track lists
+    MEM_CAT_GUI,                // GUI view state
+    MEM_CATEGORY_COUNT
+} MemCategory;
+
+// Per category statistics
+typedef struct {
+    size_t allocated;           // Memory currently allocated
+    size_t peak;                // Peak memory usage
+    unsigned int alloc_count;   // Number of active allocations
+    size_t budget;              // Soft budget in bytes (0 = none)
+    unsigned int evictions;     // Times the eviction hook ran
+} MemoryCategoryStats;
+
 // Memory tracking statistics
 typedef struct {
     size_t total_allocated;     // Total memory currently allocated
@@ -13,8 +35,13 @@ typedef struct {
     unsigned int alloc_count;   // Number of active allocations
     unsigned int total_allocs;  // Total number of allocations made
     unsigned int total_frees;   // Total number of frees made
+    MemoryCategoryStats categories[MEM_CATEGORY_COUNT];
 } MemoryStats;
 
+// Called when a category goes over its budget, with the number of bytes over.
+// Runs on the allocating thread after the allocation succeeded; returns the bytes released.
+typedef size_t (*MemEvictHook)(MemCategory category, size_t excess, void* context);
+
 // Memory tracking functions
 void* mem_alloc(size_t size, const char* file, int line);
 void* mem_calloc(size_t num, size_t size, const char* file, int line);
@@ -22,12 +49,26 @@ void* mem_realloc(void* ptr, size_t size, const char* file, int line);
 void mem_free(void* ptr, const char* file, int line);
 char* mem_strdup(const char* str, const char* file, int line);
 
+// Tagged variants (reallocating keeps the category of the original block,
+// the tag of mem_realloc_tagged is only used when ptr is NULL)
+void* mem_alloc_tagged(size_t size, MemCategory category, const char* file, int line);
+void* mem_calloc_tagged(size_t num, size_t size, MemCategory category, const char* file, int line);
+void* mem_realloc_tagged(void* ptr, size_t size, MemCategory category, const char* file, int line);
+char* mem_strdup_tagged(const char* str, MemCategory category, const char* file, int line);
+
 // Memory management functions
 void mem_init(void);
 void mem_shutdown(void);
 void mem_report(void);
 MemoryStats mem_get_stats(void);
 
+// Per category accounting and soft budgets (only effective with MEMORY_TRACKING)
+const char* mem_category_name(MemCategory category);
+MemCategory mem_find_category(const char* name);
+void mem_report_categories(void);
+void mem_set_budget(MemCategory category, size_t budget);
+void mem_set_evict_hook(MemCategory category, MemEvictHook hook, void* context);
+
 // Helper macros to automatically include file and line info
 #ifdef MEMORY_TRACKING
     #define MEM_ALLOC(size) mem_alloc(size, __FILE__, __LINE__)
@@ -35,12 +76,20 @@ MemoryStats mem_get_stats(void);
     #define MEM_REALLOC(ptr, size) mem_realloc(ptr, size, __FILE__, __LINE__)
     #define MEM_FREE(ptr) mem_free(ptr, __FILE__, __LINE__)
     #define MEM_STRDUP(str) mem_strdup(str, __FILE__, __LINE__)
+    #define MEM_ALLOC_TAGGED(size, category) mem_alloc_tagged(size, category, __FILE__, __LINE__)
+    #define MEM_CALLOC_TAGGED(num, size, category) mem_calloc_tagged(num, size, category, __FILE__, __LINE__)
+    #define MEM_REALLOC_TAGGED(ptr, size, category) mem_realloc_tagged(ptr, size, category, __FILE__, __LINE__)
+    #define MEM_STRDUP_TAGGED(str, category) mem_strdup_tagged(str, category, __FILE__, __LINE__)
 #else
     #define MEM_ALLOC(size) malloc(size)
     #define MEM_CALLOC(num, size) calloc(num, size)
     #define MEM_REALLOC(ptr, size) realloc(ptr, size)
     #define MEM_FREE(ptr) free(ptr)
     #define MEM_STRDUP(str) _strdup(str)
+    #define MEM_ALLOC_TAGGED(size, category) malloc(size)
+    #define MEM_CALLOC_TAGGED(num, size, category) calloc(num, size)
+    #define MEM_REALLOC_TAGGED(ptr, size, category) realloc(ptr, size)
+    #define MEM_STRDUP_TAGGED(str, category) _strdup(str)
 #endif
 
 #endif // MEMORY_H 
\ No newline at end of file
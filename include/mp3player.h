@@ -20,7 +20,9 @@ enum {
     SORT_BY_ALBUM,
     SORT_BY_YEAR,
     SORT_BY_GENRE,
-    SORT_BY_TRACK
+    SORT_BY_TRACK,
+    SORT_BY_DISC,
+    SORT_BY_DURATION
 };
 
 // Costanti per i formati delle immagini dell'album
@@ -39,6 +41,7 @@ typedef struct {
     char genre[MAX_GENRE_LENGTH];
     int year;
     int track_number;
+    int disc_number; // numero del disco (0 se assente)
     int duration; // in secondi
     char* album_art; // puntatore all'immagine dell'album (se presente)
     size_t album_art_size; // dimensione dell'immagine dell'album
@@ -46,27 +49,92 @@ typedef struct {
     unsigned char album_art_type; // tipo di immagine (0=Other, 3=Cover front)
 } MP3Metadata;
 
+// Identificativo stabile di una traccia: non dipende dalla posizione nella lista
+// né dall'indirizzo del record, quindi sopravvive alle riscansioni
+typedef UINT64 TrackId;
+#define INVALID_TRACK_ID ((TrackId)0)
+
+// Nodo directory del trie dei percorsi (vedi pathtrie.h)
+struct DirNode;
+
+// Chiavi di ordinamento precalcolate di una traccia (vedi sortspec.h)
+struct CollationKeys;
+
 // Struttura per rappresentare un file MP3
+// Il percorso non è memorizzato per intero: la directory è un nodo condiviso del trie
+// e il record tiene solo il nome del file (vedi mp3_file_path)
 typedef struct MP3File {
-    char filepath[MAX_PATH_LENGTH];
+    TrackId id; // identificativo stabile (derivato dal percorso)
+    struct DirNode* dir; // directory che contiene il file
+    char* filename; // nome del file senza directory
     MP3Metadata metadata;
     struct MP3File* next; // per lista collegata
+    struct MP3File* dir_prev; // lista dei file della stessa directory
+    struct MP3File* dir_next;
+    struct CollationKeys* collation; // chiavi di ordinamento in cache (solo nei record della libreria)
+    UINT32 search_doc; // numero del documento nell'indice di ricerca (vedi textindex.h)
 } MP3File;
 
 // Struttura per la playlist/coda di riproduzione
+// La coda memorizza solo gli id delle tracce: i record restano di proprietà della libreria
 typedef struct {
-    MP3File* head;
-    MP3File* current;
+    TrackId* items; // id delle tracce in coda
     int count;
+    int capacity;
+    int current; // posizione del brano corrente (-1 se nessuno)
     BOOL repeat; // modalità ripeti
     BOOL shuffle; // modalità casuale
 } MP3Queue;
 
+// Tabella id -> record (hash a indirizzamento aperto) per lookup in O(1)
+typedef struct {
+    MP3File** slots;
+    int capacity; // sempre una potenza di 2
+    int count;
+    int tombstones; // slot liberati ma ancora nella catena di probing
+} TrackTable;
+
+// Record che ha ricevuto un id diverso dall'hash del proprio percorso perché questo era già
+// usato da un altro percorso: la ricerca per percorso lo trova qui anche se l'altro viene rimosso
+typedef struct {
+    TrackId path_id; // make_track_id del percorso
+    MP3File* file;
+} TrackCollision;
+
+// Indice album/artisti (vedi albumindex.h)
+typedef struct AlbumIndex AlbumIndex;
+
+// Trie delle directory (vedi pathtrie.h)
+typedef struct PathTrie PathTrie;
+
+// Vista ordinata mantenuta durante le scansioni (vedi sortview.h)
+typedef struct SortedView SortedView;
+
+// Playlist intelligente: i brani che soddisfano una query salvata (vedi smartplaylist.h)
+typedef struct SmartPlaylist SmartPlaylist;
+
+// Sottoinsieme della libreria come elenco di id, senza copie dei record (vedi trackview.h)
+typedef struct TrackView TrackView;
+
+// Indice invertito delle parole di titolo, artista, album e genere (vedi textindex.h)
+typedef struct TextIndex TextIndex;
+
 // Struttura per la libreria MP3
 typedef struct {
     MP3File* all_files; // lista collegata di tutti i file MP3
     int total_files;
     char library_path[MAX_PATH_LENGTH]; // percorso della directory principale
+    TrackTable tracks; // indice id -> record
+    TrackCollision* collisions; // record con l'id spostato da una collisione (quasi sempre nessuno)
+    int collision_count;
+    int collision_capacity;
+    AlbumIndex* albums; // aggregati per album e artista, aggiornati ad ogni aggiunta/rimozione
+    PathTrie* paths; // directory dei file, condivise tra tutti i record
+    SortedView* views; // viste ordinate registrate, aggiornate ad ogni aggiunta/rimozione
+    SmartPlaylist* smart; // playlist intelligenti registrate, aggiornate ad ogni aggiunta/rimozione
+    TextIndex* text; // indice delle parole per la ricerca, aggiornato ad ogni aggiunta/rimozione
+    UINT32 changes; // contatore di aggiunte e rimozioni, per riconoscere risultati non più attuali
+    CRITICAL_SECTION lock; // serializza le modifiche del thread di scansione e chi scorre la lista
 } MP3Library;
 
 // Struttura per i filtri
@@ -89,13 +157,42 @@ int scan_directory(MP3Library* library, const char* directory_path, BOOL recursi
 void start_continuous_scan(MP3Library* library, int interval_seconds, const char* directory_path);
 void stop_continuous_scan();
 
+// Funzioni per la gestione dei record della libreria
+TrackId make_track_id(const char* filepath);
+BOOL library_add_file(MP3Library* library, MP3File* file, const char* filepath);
+void library_remove_file(MP3Library* library, MP3File* file, MP3File* prev);
+int library_remove_files(MP3Library* library, MP3File** files, int count);
+MP3File* library_get_track(MP3Library* library, TrackId id);
+MP3File* library_find_by_path(MP3Library* library, const char* filepath);
+int library_find_paths(MP3Library* library, const char* const* paths, int count, MP3File** found);
+
+// Accesso esclusivo alla libreria (rientrante). Aggiunte, rimozioni e le ricerche
+// (per id, per percorso, per cartella) lo prendono da sole; chi scorre all_files, il trie o
+// gli indici mentre la scansione continua deve prenderlo. Un record restituito da una
+// ricerca resta valido solo finché il lock è preso: la scansione può liberarlo subito dopo.
+void library_lock(MP3Library* library);
+void library_unlock(MP3Library* library);
+
+// Funzioni per i percorsi e le cartelle della libreria
+size_t mp3_file_path(const MP3File* file, char* buffer, size_t size);
+char* mp3_file_dup_path(const MP3File* file);
+int library_count_in_folder(MP3Library* library, const char* folder);
+int library_get_folder_tracks(MP3Library* library, const char* folder, TrackId** ids);
+int library_remove_folder(MP3Library* library, const char* folder);
+
+// Funzioni per le copertine (possono essere scaricate per rispettare il budget di memoria)
+size_t library_evict_album_art(MP3Library* library, size_t bytes);
+BOOL library_load_album_art(MP3Library* library, MP3File* file);
+void library_set_art_eviction(MP3Library* library, BOOL enable);
+
 // Funzioni per i metadati
 int read_mp3_metadata(const char* filepath, MP3Metadata* metadata);
-MP3File* filter_mp3_files(MP3Library* library, MP3Filter* filter);
+int filter_mp3_files(MP3Library* library, MP3Filter* filter, TrackView* result);
 void sort_mp3_files(MP3File** file_list, int sort_type);
 
 // Funzioni per la coda di riproduzione
 MP3Queue* create_queue();
+BOOL queue_add_track(MP3Queue* queue, TrackId id);
 
 // Funzioni di pulizia
 void free_mp3_file(MP3File* file);
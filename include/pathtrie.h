@@ -0,0 +1,70 @@
+#ifndef PATHTRIE_H
+#define PATHTRIE_H
+
+#include <windows.h>
+#include "mp3player.h"
+
+// A directory in the path trie. Each component is stored once and shared by
+// every track and subdirectory below it.
+typedef struct DirNode {
+    char* name;                    // Path component (NULL for the root)
+    size_t name_length;
+    size_t path_length;            // Length of the full directory path, without trailing separator
+    struct DirNode* parent;
+    struct DirNode* children;      // First subdirectory
+    struct DirNode* next_sibling;
+    MP3File* files;                // Tracks stored directly in this directory (dir_next chain)
+    int file_count;                // Tracks directly in this directory
+    int subtree_count;             // Tracks in this directory and all subdirectories
+} DirNode;
+
+// Directory trie with a (parent, name) -> node hash for O(depth) path lookups
+struct PathTrie {
+    DirNode root;                  // Unnamed root, top level components are its children
+    DirNode** slots;               // Open addressing table of child nodes
+    int capacity;                  // Always a power of 2
+    int count;
+    int tombstones;
+    int node_count;                // Directories currently in the trie
+    size_t name_bytes;             // Bytes used by directory and file names
+};
+
+// Create an empty trie
+PathTrie* path_trie_create(void);
+
+// Free the trie and all its nodes (tracks are not freed)
+void path_trie_free(PathTrie* trie);
+
+// Find the directory for the first length characters of path (NULL if unknown).
+// A trailing separator is optional; length 0 is the root.
+DirNode* path_trie_find_dir(PathTrie* trie, const char* path, size_t length);
+
+// Same as path_trie_find_dir, creating missing nodes
+DirNode* path_trie_get_dir(PathTrie* trie, const char* path, size_t length);
+
+// Link a track into a directory (file->filename must already be set)
+void path_trie_attach(PathTrie* trie, DirNode* dir, MP3File* file);
+
+// Unlink a track from its directory, pruning directories left empty
+void path_trie_detach(PathTrie* trie, MP3File* file);
+
+// Write the full path of a directory/track into buffer (truncated like snprintf).
+// Returns the full length, so a buffer of length + 1 bytes always fits.
+size_t path_trie_format_dir(const DirNode* dir, char* buffer, size_t size);
+size_t path_trie_format(const MP3File* file, char* buffer, size_t size);
+
+// Call fn for every track in a directory and its subdirectories
+void path_trie_for_each(DirNode* dir, void (*fn)(MP3File* file, void* context), void* context);
+
+// Next directory in a depth-first walk of the subtree rooted at top (NULL at the end).
+// skip_children moves on without descending into dir.
+DirNode* path_trie_next_dir(DirNode* top, DirNode* dir, BOOL skip_children);
+
+// Split a path into its leaf name and the length of the directory part
+// (including the trailing separator, 0 if there is none)
+const char* path_split_name(const char* path, size_t* dir_length);
+
+// Allocate "dir\name"
+char* path_join(const char* dir, const char* name);
+
+#endif // PATHTRIE_H
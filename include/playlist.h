@@ -6,14 +6,87 @@
 #include <stdlib.h>
 #include <string.h>
 #include "mp3player.h"
+#include "strscan.h"
+#include "threadpool.h"
+#include "trackseq.h"
+
+// Edits kept for the change log (see playlist_save)
+#define PLAYLIST_CHANGE_ADD    0     // Track inserted at index
+#define PLAYLIST_CHANGE_REMOVE 1     // Track removed at index
+#define PLAYLIST_CHANGE_MOVE   2     // count tracks moved from index to to
+
+typedef struct {
+    int kind;                  // PLAYLIST_CHANGE_*
+    int index;
+    int to;
+    int count;
+    TrackId id;                // Track inserted
+} PlaylistChange;
+
+// Edits kept for playlist_undo: the PLAYLIST_CHANGE_* kinds, and a clear
+#define PLAYLIST_EDIT_CLEAR    3
+
+// Bounds of the undo history, past which the oldest edits are forgotten
+#define PLAYLIST_UNDO_MAX_EDITS 256
+#define PLAYLIST_UNDO_MAX_BYTES (16 * 1024 * 1024)
+
+// An edit as an operation record: enough to apply it again or to take it back, never a
+// copy of the playlist. A clear keeps the tracks it took away, moved out of the
+// playlist rather than copied, and hands them back when undone.
+typedef struct {
+    int kind;                  // PLAYLIST_CHANGE_* or PLAYLIST_EDIT_CLEAR
+    int index;                 // First track added or removed, or moved from
+    int to;                    // Where the moved tracks start afterwards
+    int count;                 // Tracks added, removed or moved (for a clear: held)
+    TrackId id;                // The track added or removed, when count is 1
+    TrackId* ids;              // The tracks added or removed, when count is more
+    
+    // Tracks and placeholders the playlist had before a clear (after one, once undone)
+    TrackSequence cleared;
+    TrackId* cleared_missing_ids;
+    StringPool cleared_missing_paths;
+    int cleared_missing_capacity;
+} PlaylistEdit;
+
+// Identifies a playlist within its manager, whatever its name or position
+typedef UINT32 PlaylistId;
+#define INVALID_PLAYLIST_ID 0
 
 // Playlist structure
 typedef struct {
-    char name[100];            // Playlist name
+    PlaylistId id;             // Given by playlist_manager_add, never reused (0 outside a manager)
+    char name[100];            // Playlist name (unique within a manager: see playlist_manager_rename)
     char description[256];     // Optional description
-    MP3File** tracks;          // Array of pointers to MP3File objects
+    TrackSequence tracks;      // Stable track ids (resolved through the library)
     int track_count;           // Number of tracks in the playlist
-    int capacity;              // Allocated capacity for tracks array
+    
+    // Placeholders for entries whose file was not in the library when loaded. Their id
+    // is the one the file gets once it is back (ids derive from the path), so they
+    // resolve by themselves; the path is kept to save them.
+    TrackId* missing_ids;      // Ids of the placeholders
+    StringPool missing_paths;  // Entry i is the path of missing_ids[i]
+    int missing_capacity;
+    
+    // Set by playlist_index until the tracks are first needed; track_count then holds
+    // the count from the file header and tracks is not filled yet
+    char* source;              // File to read the tracks from (NULL once loaded)
+    MP3Library* library;       // Library to resolve them against
+    
+    // What changed since the playlist was last loaded or saved
+    char* file;                // That file (NULL for a new playlist)
+    DWORD revision;            // Revision written in its header (0 if none)
+    BOOL dirty;                // Changed since
+    PlaylistChange* changes;   // The edits, while the change log can take them
+    int change_count;          // -1 once it cannot: the next save rewrites the file
+    int change_capacity;
+    int logged;                // Edits already in the change log of the file
+    
+    // Undo history, oldest edit first
+    PlaylistEdit* history;
+    int history_count;         // Edits kept
+    int history_position;      // Edits applied: the ones after it can be redone
+    int history_capacity;
+    size_t history_bytes;      // Memory the kept edits hold
 } Playlist;
 
 // Playlist collection
@@ -21,6 +94,12 @@ typedef struct {
     Playlist** playlists;      // Array of playlists
     int count;                 // Number of playlists
     int capacity;              // Allocated capacity
+    
+    // Hash indexes by name and by id: position in playlists + 1 per slot, 0 free
+    int* name_slots;
+    int* id_slots;
+    int slot_capacity;         // Always a power of 2, at least twice count
+    PlaylistId next_id;
 } PlaylistManager;
 
 // Create a new playlist manager
@@ -35,43 +114,124 @@ Playlist* playlist_create(const char* name, const char* description);
 // Add a track to a playlist
 BOOL playlist_add_track(Playlist* playlist, MP3File* track);
 
+// Insert a track so that it ends up at index (0 to track_count)
+BOOL playlist_insert_track(Playlist* playlist, int index, MP3File* track);
+
+// Insert count track ids so that the first one ends up at index, as one edit to undo.
+// Ids of files missing from the library need their path kept: see
+// playlist_add_placeholder.
+BOOL playlist_insert_ids(Playlist* playlist, int index, const TrackId* ids, int count);
+
+// Append the entries at paths, resolved through the library in one batch. Entries not
+// in the library are kept as placeholders.
+BOOL playlist_add_paths(Playlist* playlist, const char* const* paths, int count, MP3Library* library);
+
 // Remove a track from a playlist
 BOOL playlist_remove_track(Playlist* playlist, int index);
 
+// Remove count tracks from first on, as one edit to undo
+BOOL playlist_remove_tracks(Playlist* playlist, int first, int count);
+
 // Move a track within a playlist (change order)
 BOOL playlist_move_track(Playlist* playlist, int from_index, int to_index);
 
-// Get the track at the specified index
-MP3File* playlist_get_track(Playlist* playlist, int index);
+// Move count tracks from first on so that they start at to_index once moved (a
+// selection dragged elsewhere). Every edit takes O(log n), whatever the playlist size.
+BOOL playlist_move_tracks(Playlist* playlist, int first, int count, int to_index);
+
+// Get the id of the track at the specified index
+TrackId playlist_get_track_id(Playlist* playlist, int index);
+
+// Get the track at the specified index (NULL if it is no longer in the library)
+MP3File* playlist_get_track(Playlist* playlist, MP3Library* library, int index);
+
+// Path of a placeholder entry (see missing_ids), NULL if id is not one
+const char* playlist_missing_path(Playlist* playlist, TrackId id);
 
-// Clear all tracks from a playlist
+// Keep path as the placeholder of the id make_track_id gives it (TRUE if already kept)
+BOOL playlist_add_placeholder(Playlist* playlist, const char* path);
+
+// Clear all tracks from a playlist (loading an indexed one first, so that the clear can
+// be undone)
 void playlist_clear(Playlist* playlist);
 
+// Take back the last edit still applied: added, inserted, removed, moved tracks or a
+// clear. Edits are kept as operation records, a few dozen bytes each (a removal of
+// several tracks keeps their ids, a clear the tracks it took away), up to
+// PLAYLIST_UNDO_MAX_EDITS edits and PLAYLIST_UNDO_MAX_BYTES. Every undo takes the
+// O(log n) of the edit itself. FALSE if there is nothing to undo or without memory.
+BOOL playlist_undo(Playlist* playlist);
+
+// Apply again the last edit undone. A new edit forgets the ones that could be redone.
+BOOL playlist_redo(Playlist* playlist);
+
+// Forget every edit kept for undo and redo
+void playlist_clear_history(Playlist* playlist);
+
 // Free a playlist and its resources
 void playlist_free(Playlist* playlist);
 
-// Save a playlist to file
-BOOL playlist_save(Playlist* playlist, const char* filename);
+// Save a playlist to file. The file is written under a temporary name and then renamed,
+// so a crash leaves either the old or the new file. Saving a large playlist again to the
+// file it came from appends its edits to a change log beside the file (filename.log),
+// replayed on load; the file is rewritten whole once the log grows long.
+BOOL playlist_save(Playlist* playlist, const char* filename, MP3Library* library);
+
+// Save a playlist in the binary format: the track ids themselves, and the path of the
+// placeholders only, so that loading it looks nothing up. Always written whole (and
+// atomically), without a change log.
+BOOL playlist_save_binary(Playlist* playlist, const char* filename, MP3Library* library);
 
-// Load a playlist from file
+// Load a playlist from file, text or binary (told apart by its first bytes). A text file
+// is read in one pass and its paths are resolved in one batch; entries not in the
+// library are kept as placeholders.
 Playlist* playlist_load(const char* filename, MP3Library* library);
 
-// Add a playlist to the manager
+// Read only the name, description and track count of a playlist file. The tracks are
+// loaded by playlist_materialize, which every function working on them calls first.
+Playlist* playlist_index(const char* filename, MP3Library* library);
+
+// Load the tracks of an indexed playlist (TRUE at once if already loaded). FALSE if
+// the file cannot be read, which leaves the playlist empty.
+BOOL playlist_materialize(Playlist* playlist);
+
+// Add a playlist to the manager, which gives it an id. A name already taken gets a
+// number: "Name (2)".
 BOOL playlist_manager_add(PlaylistManager* manager, Playlist* playlist);
 
-// Remove a playlist from the manager
+// Remove and free a playlist. The last playlist takes its place, so that nothing is
+// shifted; ids do not change.
 BOOL playlist_manager_remove(PlaylistManager* manager, int index);
 
 // Get a playlist by index
 Playlist* playlist_manager_get(PlaylistManager* manager, int index);
 
-// Get a playlist by name
+// Get a playlist by name, through the name index
 Playlist* playlist_manager_find_by_name(PlaylistManager* manager, const char* name);
 
-// Save all playlists to files
-BOOL playlist_manager_save_all(PlaylistManager* manager, const char* directory);
+// Get a playlist by id (NULL if it was removed)
+Playlist* playlist_manager_find_by_id(PlaylistManager* manager, PlaylistId id);
+
+// Position of a playlist in the manager (-1 if it is not there)
+int playlist_manager_index_of(PlaylistManager* manager, PlaylistId id);
+
+// Rename a playlist of the manager, keeping the name index up to date (names are never
+// changed in place). FALSE if another playlist has the name.
+BOOL playlist_manager_rename(PlaylistManager* manager, Playlist* playlist, const char* name);
 
-// Load all playlists from files in a directory
+// Save the playlists changed since they were last loaded or saved (clean ones whose file
+// has another name, after a rename, are saved too, and their old file is deleted). File
+// names come from playlist names: characters and device names Windows refuses are
+// replaced, long names are cut to fit MAX_PATH, and names that would end up on the same
+// file (Windows ignores case) get the playlist id: "Name ~0000002A.m3plist".
+BOOL playlist_manager_save_all(PlaylistManager* manager, const char* directory, MP3Library* library);
+
+// Index all playlists from files in a directory: only their headers are read, the
+// tracks of each one on first use
 BOOL playlist_manager_load_all(PlaylistManager* manager, const char* directory, MP3Library* library);
 
+// Load the tracks of every indexed playlist now, spread over the pool (inline if NULL).
+// The library must not change meanwhile. FALSE if some file could not be read.
+BOOL playlist_manager_materialize_all(PlaylistManager* manager, ThreadPool* pool);
+
 #endif // PLAYLIST_H 
\ No newline at end of file
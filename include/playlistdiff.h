@@ -0,0 +1,72 @@
+#ifndef PLAYLISTDIFF_H
+#define PLAYLISTDIFF_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "playlist.h"
+
+// Largest edit distance searched track by track (Myers) in a stretch of the playlists
+// where no track appears once on each side; past it the stretch is replaced whole
+#define PLAYLIST_DIFF_MAX_COST 512
+
+// Nesting of the patience passes before a stretch is handed to Myers directly
+#define PLAYLIST_DIFF_MAX_DEPTH 64
+
+// base_count tracks of the base removed from base_index on, and insert_count tracks
+// put there instead (ids[insert_first] on)
+typedef struct {
+    int base_index;
+    int base_count;
+    int insert_first;
+    int insert_count;
+} PlaylistDiffHunk;
+
+// Edit script turning one version of a playlist into another: hunks in the order of
+// the base, never touching each other, and the ids they insert. Tracks kept in place
+// cost nothing, so a script is as small as the edits.
+typedef struct {
+    PlaylistDiffHunk* hunks;
+    int hunk_count;
+    int hunk_capacity;
+    TrackId* ids;                    // Inserted ids, hunk after hunk
+    int id_count;
+    int id_capacity;
+    StringPool missing_paths;        // Paths of the inserted ids that are placeholders
+    
+    // The versions the script goes between, so that it is never applied to another one
+    int base_length;
+    int result_length;
+    UINT64 base_hash;
+    UINT64 result_hash;
+} PlaylistDiff;
+
+// Edit script from one version of a playlist to another. Tracks found once in each
+// version anchor the match (patience diff, with a hash table of the ids), the stretches
+// between anchors are matched the same way in turn, and those without such tracks by
+// Myers' algorithm. Moved tracks show as removed in one place and inserted in another.
+// NULL without memory.
+PlaylistDiff* playlist_diff(Playlist* from, Playlist* to);
+
+void playlist_diff_free(PlaylistDiff* diff);
+
+// Apply a script to the version it was made from (FALSE, changing nothing, for any
+// other version). The hunks are applied from the last one back as removals and
+// insertions, which the undo history and the change log keep like any edit. Without
+// memory the playlist may be left partway, every step done still in its history.
+BOOL playlist_diff_apply(const PlaylistDiff* diff, Playlist* playlist);
+
+// Three-way merge: the script turning ours into ours merged with the changes theirs
+// made since base. Changes to different parts of base are all kept, the same change
+// made on both sides once. Where both sides changed the same tracks differently, ours
+// is kept and the tracks theirs added there follow it; conflicts counts such places.
+PlaylistDiff* playlist_merge(Playlist* base, Playlist* ours, Playlist* theirs, int* conflicts);
+
+// Compact encoding of a script to send to another machine: varints, hunk positions as
+// gaps from the previous hunk. Returns the size, 0 without memory. *out is allocated
+// with MEM_ALLOC_TAGGED: the caller releases it with MEM_FREE, not free().
+size_t playlist_diff_encode(const PlaylistDiff* diff, unsigned char** out);
+
+// Decode a script encoded by playlist_diff_encode (NULL if the bytes are not one)
+PlaylistDiff* playlist_diff_decode(const unsigned char* bytes, size_t size);
+
+#endif // PLAYLISTDIFF_H
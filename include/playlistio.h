@@ -0,0 +1,39 @@
+#ifndef PLAYLISTIO_H
+#define PLAYLISTIO_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "playlist.h"
+
+// Playlist formats shared with other players
+#define PLAYLIST_FORMAT_UNKNOWN 0
+#define PLAYLIST_FORMAT_M3U     1    // A path per line, #EXTINF lines; system code page
+#define PLAYLIST_FORMAT_M3U8    2    // The same in UTF-8
+#define PLAYLIST_FORMAT_PLS     3    // [playlist] section of FileN=, TitleN= and LengthN= keys
+#define PLAYLIST_FORMAT_XSPF    4    // XML, a file URI in the <location> of each <track>
+
+// Files are read and written in blocks of this size, whatever their length
+#define PLAYLIST_IO_BUFFER 65536
+
+// Entries resolved together through the library
+#define PLAYLIST_IO_BATCH 1024
+
+// Longest line or element of an entry kept (longer entries are skipped)
+#define PLAYLIST_IO_LINE_MAX 4096
+
+// Format told by the extension of a file name (.m3u, .m3u8, .pls, .xspf)
+int playlist_format_from_name(const char* filename);
+
+// Import a playlist written by another player, in format (PLAYLIST_FORMAT_UNKNOWN: from
+// the extension). The file is read in fixed blocks and its entries resolved in batches,
+// so memory does not grow with the file beyond the playlist itself. Relative paths start
+// from the directory of the file; entries not in the library are kept as placeholders.
+// Returns NULL if the file cannot be read or the format is unknown.
+Playlist* playlist_import(const char* filename, int format, MP3Library* library);
+
+// Export a playlist for another player, in format (PLAYLIST_FORMAT_UNKNOWN: from the
+// extension). M3U and PLS entries below the directory of the file are written relative
+// to it, XSPF ones as absolute file URIs. Placeholders are written with their path.
+BOOL playlist_export(Playlist* playlist, const char* filename, int format, MP3Library* library);
+
+#endif // PLAYLISTIO_H
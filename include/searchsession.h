@@ -0,0 +1,107 @@
+#ifndef SEARCHSESSION_H
+#define SEARCHSESSION_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "textindex.h"
+#include "threadpool.h"
+#include "trackview.h"
+
+// Longest query text kept by a session
+#define SEARCH_QUERY_MAX 256
+
+// Results delivered per batch: a small first batch so the best matches show at once
+#define SEARCH_FIRST_BATCH 128
+#define SEARCH_BATCH_SIZE  4096
+
+// The previous results are narrowed only while they are at most 1/SEARCH_REFINE_SHARE
+// of the library: marking a larger set costs about as much as asking the index again
+#define SEARCH_REFINE_SHARE 16
+
+// Folded words of a query, as the index looks them up
+typedef struct {
+    char text[TEXT_QUERY_MAX_TOKENS][TEXT_TOKEN_MAX];
+    int length[TEXT_QUERY_MAX_TOKENS];
+    int count;
+} SearchWords;
+
+// Ranked results of one query
+typedef struct {
+    TrackView tracks;                // Track ids, best first
+    unsigned short* ranks;           // Rank of each track (sum of TEXT_RANK_*)
+    UINT32* docs;                    // Index document of each track, to narrow them later
+    int capacity;                    // Room in ranks and docs
+} SearchResults;
+
+// Ranked batch of results of query query_id, in rank order. first is the position
+// of ids[0] in the whole result, total the number of results; last is TRUE on the
+// final batch (which may be empty). Called on the session thread in background mode.
+typedef void (*SearchResultsCallback)(void* context, LONG query_id, const TrackId* ids, const unsigned short* ranks,
+                                      int first, int count, int total, BOOL last);
+
+// Search-as-you-type over the word index. Each new query cancels the one still
+// running; a query extending the previous one ("pink f" after "pink") is only
+// matched against the previous results (see text_index_match_within).
+// Queries match words as substrings (TEXT_MATCH_SUBSTRING is implied), reading the
+// index under the library lock so that a background scan can keep updating it.
+typedef struct SearchSession {
+    MP3Library* library;
+    int field;                       // TEXT_FIELD_*
+    DWORD options;                   // TEXT_MATCH_*; with TEXT_MATCH_FUZZY typos are only
+                                     // tried when the query has no other match
+    SearchResultsCallback callback;  // May be NULL: read results after search_session_update
+    void* context;
+    
+    ThreadPool* worker;              // Single thread running the queries, NULL = run on the caller
+    ThreadPoolJob* job;              // Worker task taking the queries handed over below
+    volatile LONG current;           // Id of the newest query, older ones stop at the next check
+    LONG completed;                  // Id of the last query that ran to the end
+    
+    // Hand-over to the worker, guarded by lock: the caller writes the newest query and
+    // never waits for the one running, the worker takes it when that one stops
+    CRITICAL_SECTION lock;
+    LONG pending_id;                 // Id and text of the newest query handed over
+    char pending[SEARCH_QUERY_MAX];
+    LONG taken_id;                   // Last query the worker took (pending_id once it is idle)
+    BOOL running;                    // The worker task is still taking queries
+    BOOL forget;                     // Cancelled while running: drop the last results when done
+    
+    // Last completed query, reused when a later one implies it
+    char query[SEARCH_QUERY_MAX];
+    SearchWords words;
+    BOOL reusable;                   // FALSE if there is no such query or it needed typo matching
+    UINT32 library_changes;          // library->changes when it started
+    SearchResults results;
+    
+    // Results being built; swapped with the ones above when the query completes,
+    // so a cancelled query leaves the last results usable
+    SearchResults spare;
+    
+    // Counters for the status bar and the benchmarks
+    int refined;                     // Queries answered from the previous results
+    int indexed;                     // Queries answered by the index
+    int cancelled;                   // Queries stopped by a newer one
+} SearchSession;
+
+// Create a session on a library. With background set, queries run on a thread of
+// their own and results are delivered to callback from there.
+SearchSession* search_session_create(MP3Library* library, int field, DWORD options, BOOL background,
+                                     SearchResultsCallback callback, void* context);
+
+// Cancel any running query and free the session
+void search_session_free(SearchSession* session);
+
+// Start a query, cancelling the previous one, and return its id. In background mode
+// this returns at once, without waiting for the query still running (it is run once
+// that one stops, unless a newer one replaces it first); otherwise results are in
+// session->results when it returns. Returns 0 without memory.
+LONG search_session_update(SearchSession* session, const char* query);
+
+// Stop the running query (its results are never delivered) and forget the last one,
+// without waiting for the worker
+void search_session_cancel(SearchSession* session);
+
+// Wait until the newest query has finished (background mode)
+void search_session_wait(SearchSession* session);
+
+#endif // SEARCHSESSION_H
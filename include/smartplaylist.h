@@ -0,0 +1,53 @@
+#ifndef SMARTPLAYLIST_H
+#define SMARTPLAYLIST_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "filterquery.h"
+#include "trackview.h"
+
+// Slots of the member table of an empty smart playlist (a power of 2)
+#define SMART_PLAYLIST_INITIAL_SLOTS 64
+
+// A playlist whose tracks are the library records matching a stored query, for example
+//   genre:rock year:1990..1999 duration:<5:00
+// The query runs once when the playlist is created; after that every registered smart
+// playlist tests only the records library_add_file and the remove functions hand it,
+// so a scan never runs the whole query again.
+struct SmartPlaylist {
+    MP3Library* library;
+    char name[100];
+    char* query_text;                // Query as written, kept to save and edit it
+    FilterQuery* query;
+    
+    // Members in no particular order (a removal moves the last one into the hole): sort
+    // a copy with track_view_sort to show them
+    TrackView members;
+    int* slots;                      // Open addressing by track id: position in members + 1, 0 free
+    int slot_capacity;               // Always a power of 2
+    
+    BOOL valid;                      // FALSE after a failed update, until smart_playlist_refresh
+    UINT32 changes;                  // Counts membership changes, to spot a stale display
+    struct SmartPlaylist* next_smart; // Next smart playlist registered with the library
+};
+
+// Parse the query, evaluate it over the library and register the playlist. Returns NULL
+// on a syntax error (described in error) or without memory.
+SmartPlaylist* smart_playlist_create(MP3Library* library, const char* name, const char* query, char* error,
+                                     size_t error_size);
+
+// Unregister and free a smart playlist
+void smart_playlist_free(SmartPlaylist* playlist);
+
+// Evaluate the whole query again. FALSE without memory.
+BOOL smart_playlist_refresh(SmartPlaylist* playlist);
+
+// TRUE if the track is a member. The scan thread updates members under library_lock:
+// hold it while reading them.
+BOOL smart_playlist_contains(const SmartPlaylist* playlist, TrackId id);
+
+// Called by the library when a record is added or is about to be removed
+void smart_playlists_track_added(MP3Library* library, MP3File* file);
+void smart_playlists_track_removed(MP3Library* library, MP3File* file);
+
+#endif // SMARTPLAYLIST_H
@@ -0,0 +1,86 @@
+#ifndef SORTSPEC_H
+#define SORTSPEC_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "threadpool.h"
+
+#define SORT_SPEC_MAX_KEYS 8
+
+// Lists shorter than this are always sorted on the calling thread
+#define SORT_PARALLEL_THRESHOLD 65536
+#define SORT_MAX_CHUNKS 64
+
+// Collation options of a sort spec
+#define SORT_FOLD_CASE        0x01   // Ignore case differences
+#define SORT_FOLD_ACCENTS     0x02   // Ignore accents and other diacritics
+#define SORT_IGNORE_ARTICLES  0x04   // Skip a leading "The", "A", "Il", "La", ... in title, artist and album
+#define SORT_BYTE_ORDER       0x08   // Compare the raw tag bytes with strcmp (no collation keys)
+
+#define SORT_DEFAULT_FLAGS (SORT_FOLD_CASE | SORT_FOLD_ACCENTS | SORT_IGNORE_ARTICLES)
+
+// One level of a multi-key sort
+typedef struct {
+    int field;                       // SORT_BY_* constant
+    BOOL descending;
+} SortKey;
+
+// Ordered list of keys: later keys only break ties of the earlier ones.
+// Tracks equal on every key keep their previous relative order.
+typedef struct {
+    SortKey keys[SORT_SPEC_MAX_KEYS];
+    int key_count;
+    DWORD flags;                     // SORT_FOLD_* / SORT_IGNORE_ARTICLES / SORT_BYTE_ORDER
+} SortSpec;
+
+// Normalised binary keys of a track's string fields, built once and cached on the
+// library record. Two keys compare like the collated strings when compared with strcmp.
+// A record keeps one set per collation options in use (at most one per combination of
+// the SORT_FOLD_* and SORT_IGNORE_ARTICLES flags).
+typedef struct CollationKeys {
+    struct CollationKeys* next;      // Keys of the same record built with other flags
+    DWORD flags;                     // Collation options the keys were built with
+    unsigned short offsets[4];       // Start of the title, artist, album and genre keys in data
+    unsigned char data[];            // Zero terminated keys, back to back
+} CollationKeys;
+
+// Initialise an empty spec
+void sort_spec_init(SortSpec* spec, DWORD flags);
+
+// Append a key, FALSE if the spec is full or the field is unknown
+BOOL sort_spec_add_key(SortSpec* spec, int field, BOOL descending);
+
+// Parse a comma separated key list such as "artist,album,disc,track" ("-year" sorts descending).
+// The flags of the spec are left unchanged.
+BOOL sort_spec_parse(SortSpec* spec, const char* text);
+
+// Field name <-> SORT_BY_* constant (-1 / NULL if unknown)
+int sort_field_from_name(const char* name);
+const char* sort_field_name(int field);
+
+// Get the collation keys of a library record for these flags, building them if missing
+const CollationKeys* collation_get_keys(MP3File* file, DWORD flags);
+
+// Free every set of collation keys cached on a record
+void collation_free_keys(MP3File* file);
+
+// Build the keys of every library record ahead of sorting, returns the number built
+int collation_prepare(MP3Library* library, DWORD flags);
+
+// Compare two library records key by key: < 0, 0 (equal on every key) or > 0
+int sort_compare_tracks(MP3File* a, MP3File* b, const SortSpec* spec);
+
+// Stable sort of a track list (library list or filter copies) according to spec.
+// Copies resolve their keys through the library, so pass it whenever possible.
+// Returns FALSE if there is not enough memory (the list is left unchanged).
+BOOL sort_tracks(MP3Library* library, MP3File** file_list, const SortSpec* spec);
+
+// Same as sort_tracks, splitting large lists into one chunk per pool thread: chunks are
+// sorted in parallel, then merged in parallel ranges. The result is exactly the serial order.
+// pool may be NULL to sort serially.
+BOOL sort_tracks_parallel(MP3Library* library, MP3File** file_list, const SortSpec* spec, ThreadPool* pool);
+
+// Same as sort_tracks_parallel for an array of records (e.g. a resolved track view)
+BOOL sort_track_array(MP3Library* library, MP3File** tracks, int count, const SortSpec* spec, ThreadPool* pool);
+
+#endif // SORTSPEC_H
@@ -0,0 +1,56 @@
+#ifndef SORTVIEW_H
+#define SORTVIEW_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "sortspec.h"
+#include "threadpool.h"
+
+#define SORTED_VIEW_MAX_LEVEL 24
+
+// Skip list node, one per library record
+typedef struct SortedViewNode {
+    MP3File* file;                       // Library record (records never move while in the library)
+    int level;                           // Number of links
+    struct SortedViewNode* next[];       // Successor on each level
+} SortedViewNode;
+
+// The library records kept in spec order, with ties ordered by track id.
+// Registered views are updated in O(log n) by library_add_file and the remove functions,
+// so the order survives background scans without re-sorting.
+struct SortedView {
+    MP3Library* library;
+    SortSpec spec;
+    SortedViewNode* head;                // Sentinel with SORTED_VIEW_MAX_LEVEL links
+    int level;                           // Highest level in use
+    int count;                           // Records in the view
+    BOOL valid;                          // FALSE after a failed update, until sorted_view_rebuild
+    UINT32 random_state;                 // Level generator
+    struct SortedView* next_view;        // Next view registered with the library
+};
+
+// Build a view of the whole library and register it (the library list is left in view order)
+SortedView* sorted_view_create(MP3Library* library, const SortSpec* spec, ThreadPool* pool);
+
+// Unregister and free a view
+void sorted_view_free(SortedView* view);
+
+// Rebuild a view from the library from scratch
+BOOL sorted_view_rebuild(SortedView* view, ThreadPool* pool);
+
+// Add/remove one library record (done automatically for registered views)
+BOOL sorted_view_insert(SortedView* view, MP3File* file);
+BOOL sorted_view_remove(SortedView* view, MP3File* file);
+
+// Called by the library when a record is added or is about to be removed
+void sorted_views_track_added(MP3Library* library, MP3File* file);
+void sorted_views_track_removed(MP3Library* library, MP3File* file);
+
+// First node in view order (walk with node->next[0])
+SortedViewNode* sorted_view_first(const SortedView* view);
+
+// Relink the library list in view order, in O(n) without comparisons, under the
+// library lock. Callers walking the list afterwards hold the lock themselves.
+void sorted_view_relink(SortedView* view);
+
+#endif // SORTVIEW_H
@@ -0,0 +1,64 @@
+#ifndef STRSCAN_H
+#define STRSCAN_H
+
+#include <windows.h>
+
+// Returned by str_find_nocase when the needle does not occur
+#define STR_NOT_FOUND ((size_t)-1)
+
+// Instruction sets of the substring kernel, in increasing order
+#define STR_SCAN_SCALAR 0
+#define STR_SCAN_SSE2   1
+#define STR_SCAN_AVX2   2
+#define STR_SCAN_LEVELS 3
+
+// Initial room of a string pool
+#define STRING_POOL_INITIAL_BYTES   65536
+#define STRING_POOL_INITIAL_ENTRIES 1024
+
+// Strings stored back to back, each zero terminated, so that a substring search
+// runs over one contiguous buffer instead of visiting every record
+typedef struct {
+    char* text;
+    size_t size;                     // Bytes used in text
+    size_t capacity;
+    UINT32* offsets;                 // Start of each entry in text
+    UINT32 count;                    // Entries
+    UINT32 entry_capacity;
+} StringPool;
+
+// Position of the first occurrence of needle in text[0, length), comparing ASCII
+// letters without case (other bytes must be equal), or STR_NOT_FOUND. An empty needle
+// is found at 0. Runs the widest kernel the processor supports (see str_scan_set_level).
+size_t str_find_nocase(const char* text, size_t length, const char* needle, size_t needle_length);
+
+// Kernel in use (STR_SCAN_*), and whether the processor can run a level
+int str_scan_level(void);
+BOOL str_scan_supported(int level);
+
+// Force a kernel (for benchmarks), capped to what the processor supports.
+// Returns the level actually selected.
+int str_scan_set_level(int level);
+
+// Name of a level ("scalar", "sse2", "avx2")
+const char* str_scan_level_name(int level);
+
+void string_pool_init(StringPool* pool);
+void string_pool_free(StringPool* pool);
+
+// Append a string as the next entry. FALSE without memory (the pool is unchanged).
+BOOL string_pool_append(StringPool* pool, const char* text);
+
+// Drop the entries from count on
+void string_pool_truncate(StringPool* pool, UINT32 count);
+
+// Renumber the entries: entry i becomes remap[i], or is dropped if remap[i] is
+// (UINT32)-1. Kept entries must keep their order and be numbered 0, 1, 2...
+void string_pool_compact(StringPool* pool, const UINT32* remap);
+
+// Call match for each entry containing needle (ASCII letters compared without case),
+// in entry order, once per entry. Returns the number of matching entries.
+int string_pool_find(const StringPool* pool, const char* needle, size_t needle_length,
+                     void (*match)(UINT32 entry, void* context), void* context);
+
+#endif // STRSCAN_H
@@ -0,0 +1,146 @@
+#ifndef TEXTINDEX_H
+#define TEXTINDEX_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "trackview.h"
+#include "strscan.h"
+
+// Indexed text fields
+#define TEXT_FIELD_TITLE  0
+#define TEXT_FIELD_ARTIST 1
+#define TEXT_FIELD_ALBUM  2
+#define TEXT_FIELD_GENRE  3
+#define TEXT_FIELD_ANY    4          // Token found in any of the fields above
+#define TEXT_FIELD_COUNT  5
+
+// Longest token kept (longer words are cut)
+#define TEXT_TOKEN_MAX 64
+
+// Query words looked up at most (further words are ignored)
+#define TEXT_QUERY_MAX_TOKENS 32
+
+// Deleted documents are reclaimed once there are at least this many and more than live ones
+#define TEXT_COMPACT_MIN_DELETED 65536
+
+// Sentinel for "not in the index" in MP3File.search_doc
+#define TEXT_NO_DOC ((UINT32)-1)
+
+// Options of text_index_match
+#define TEXT_MATCH_SUBSTRING 0x01    // A query word may be any part of a word ("beatl" finds "beatles")
+#define TEXT_MATCH_FUZZY     0x02    // Tolerate typos: 1 edit for words of 4-7 letters, 2 from 8 letters
+
+// Match quality of a query word, summed over the query to rank results (lower is better)
+#define TEXT_RANK_EXACT  0
+#define TEXT_RANK_PREFIX 1
+#define TEXT_RANK_INFIX  2
+#define TEXT_RANK_FUZZY  3           // Plus the edit distance
+
+// Token of one field with its posting list. Documents are numbered in insertion
+// order, so appending keeps every list sorted without moving anything.
+typedef struct TextToken {
+    UINT32 hash;
+    unsigned char field;             // TEXT_FIELD_*
+    unsigned char length;
+    unsigned short query_hits;       // Trigrams shared with the current fuzzy query word
+    UINT32 query_stamp;              // Query word that last looked at this token
+    UINT32* postings;                // Ascending document numbers
+    int count;
+    int capacity;
+    char text[];                     // Folded token, zero terminated
+} TextToken;
+
+// Words (TEXT_FIELD_ANY tokens) containing a trigram. Words are padded with a
+// boundary byte on both sides, so "\x01be" only lists words starting with "be".
+typedef struct {
+    UINT32 key;                      // The three bytes, 0 for a free slot
+    TextToken** words;
+    int count;
+    int capacity;
+} TrigramList;
+
+// Inverted index over title, artist, album and genre, maintained by the library
+// on every add and remove. Text is split into words and folded (case, accents)
+// before indexing; queries use the same folding.
+struct TextIndex {
+    TextToken** slots;               // Open addressing table of (field, token)
+    int capacity;                    // Always a power of 2
+    int token_count;
+    TrackId* docs;                   // Document number -> track id (INVALID_TRACK_ID once removed)
+    UINT32 doc_count;                // Document numbers handed out
+    UINT32 doc_capacity;
+    UINT32 deleted_count;            // Removed documents still referenced by postings
+    size_t posting_bytes;            // Memory used by the posting lists
+    size_t token_bytes;              // Memory used by the token entries
+    
+    TrigramList* trigrams;           // Open addressing table of trigram -> words
+    int trigram_capacity;            // Always a power of 2
+    int trigram_count;
+    size_t trigram_bytes;            // Memory used by the word lists of the trigrams
+    UINT32 query_stamp;
+    
+    // Per document scratch of text_index_match, all zero between queries
+    unsigned char* doc_hits;         // Query words matched so far
+    unsigned short* doc_scores;      // Sum of the match ranks
+    UINT32* touched;                 // Documents matched by the first query word
+    UINT32 scratch_capacity;
+    unsigned short* ranks;           // Ranks of the last text_index_match results
+    UINT32* result_docs;             // Their document numbers (see text_index_match_within)
+    int result_capacity;
+    
+    // Field text as stored on the records, entry = document number, for raw substring
+    // scans (title, artist, album, genre; TEXT_FIELD_ANY has no pool of its own)
+    StringPool pools[TEXT_FIELD_ANY];
+};
+
+TextIndex* text_index_create(void);
+void text_index_free(TextIndex* index);
+
+// Index a library record (sets file->search_doc). FALSE without memory, in which case
+// the record is left out of the index.
+BOOL text_index_add(TextIndex* index, MP3File* file);
+
+// Remove a record: O(1), its postings are dropped lazily by text_index_compact,
+// which runs from here once enough documents are deleted
+void text_index_remove(TextIndex* index, MP3Library* library, MP3File* file);
+
+// Renumber the live documents and drop removed ones from every posting list.
+// The library is needed to update the document number stored on each record.
+BOOL text_index_compact(TextIndex* index, MP3Library* library);
+
+// Split text into folded tokens, calling emit for each one. Returns the number of tokens.
+int text_tokenize(const char* text, void (*emit)(const char* token, int length, void* context), void* context);
+
+// Tracks whose field (TEXT_FIELD_*) contains every word of query, in insertion order.
+// Returns the number of matches (written to result), -1 without memory.
+int text_index_search(TextIndex* index, int field, const char* query, TrackView* result);
+
+// Ranked matching: every query word must match a word of the field exactly, or also as
+// a part of it or with typos depending on options (TEXT_MATCH_*). Best matches come first.
+// If ranks is not NULL it receives the rank of each result (sum of TEXT_RANK_* over the
+// query words), in an array owned by the index and valid until the next query.
+// Returns the number of matches, -1 without memory.
+int text_index_match(TextIndex* index, int field, const char* query, DWORD options, TrackView* result,
+                     unsigned short** ranks);
+
+// Same as text_index_match, keeping only the documents in within: the result_docs of
+// a broader query, whose order is kept between equal ranks. They stay valid until a
+// removal compacts the index. When few documents are left, query words are checked
+// per document instead of walking their postings, so narrowing a small result costs
+// little whatever the size of the library.
+int text_index_match_within(TextIndex* index, int field, const char* query, DWORD options, const UINT32* within,
+                            int within_count, TrackView* result, unsigned short** ranks);
+
+// Estimate text_index_match without running it: returns an upper bound of the matches
+// (the fewest postings of any query word) and sets walk to the postings the match
+// would visit. Returns -1 without memory.
+int text_index_estimate(TextIndex* index, int field, const char* query, DWORD options, size_t* walk);
+
+// Pool of a field's raw text, NULL for TEXT_FIELD_ANY. Entries of removed documents
+// stay until text_index_compact (check docs[entry] against INVALID_TRACK_ID).
+const StringPool* text_index_pool(const TextIndex* index, int field);
+
+// Field name ("title", "artist", "album", "genre", "any") -> TEXT_FIELD_*, -1 if unknown
+int text_field_from_name(const char* name);
+
+#endif // TEXTINDEX_H
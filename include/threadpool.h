@@ -0,0 +1,44 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <windows.h>
+
+// Work item callback: called once for every index in [0, task_count)
+typedef void (*ThreadPoolTask)(void* context, int index);
+
+typedef struct ThreadPoolJob ThreadPoolJob;
+
+// Fixed set of worker threads sharing a FIFO of jobs.
+// A job is split into task_count independent calls that any worker may pick up.
+typedef struct {
+    HANDLE* threads;           // Worker thread handles
+    int thread_count;          // Number of workers
+    CRITICAL_SECTION lock;     // Protects the job queue
+    HANDLE work_event;         // Manual reset event, signaled while jobs are queued
+    ThreadPoolJob* head;       // First queued job
+    ThreadPoolJob* tail;       // Last queued job
+    volatile LONG shutdown;    // Set when the workers must exit
+} ThreadPool;
+
+// Create a pool (thread_count <= 0 uses one thread per processor)
+ThreadPool* thread_pool_create(int thread_count);
+
+// Stop the workers and free the pool (queued jobs must have been waited for)
+void thread_pool_free(ThreadPool* pool);
+
+// Queue a job and return immediately; the handle must be passed to thread_pool_wait
+ThreadPoolJob* thread_pool_submit(ThreadPool* pool, int task_count, ThreadPoolTask task, void* context);
+
+// Check whether a submitted job has finished
+BOOL thread_pool_is_done(ThreadPoolJob* job);
+
+// Wait for a submitted job to finish and release its handle
+void thread_pool_wait(ThreadPoolJob* job);
+
+// Run a job and wait for it (runs inline if the pool is NULL or the job cannot be queued)
+void thread_pool_run(ThreadPool* pool, int task_count, ThreadPoolTask task, void* context);
+
+// Number of processors available to the process
+int thread_pool_cpu_count(void);
+
+#endif // THREADPOOL_H
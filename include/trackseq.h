@@ -0,0 +1,64 @@
+#ifndef TRACKSEQ_H
+#define TRACKSEQ_H
+
+#include <windows.h>
+#include "mp3player.h"
+
+// Node sizes of a track sequence
+#define TRACK_SEQ_LEAF_SIZE 256      // Ids per leaf
+#define TRACK_SEQ_FANOUT    64       // Children per inner node
+#define TRACK_SEQ_FLAT_SIZE 2048     // Longest sequence kept as one flat array
+
+// Ordered list of track ids kept as a B+-tree of small arrays: every inner node knows
+// how many ids lie under each child, so a position is found, and an id inserted or
+// removed there, in O(log n) instead of shifting everything after it.
+// Up to TRACK_SEQ_FLAT_SIZE ids the tree costs more than it saves (shifting a few
+// kilobytes is cheaper than walking and splitting nodes), so a short sequence is one
+// flat array, turned into a tree when it grows past that and back when it falls under
+// half of it.
+typedef struct {
+    void* root;                // A leaf while height is 0, NULL when flat or empty
+    int height;                // Levels of inner nodes above the leaves
+    int count;                 // Ids in the sequence
+    TrackId* flat;             // The ids while root is NULL
+    int flat_capacity;
+    
+    // Kept between edits so that an insertion never allocates halfway through
+    void* spare_leaves;        // Nodes for the next splits, linked through their first bytes
+    void* spare_inners;
+    int spare_leaf_count;
+    int spare_inner_count;
+    void** scratch;            // Node lists of the splits of one insertion
+    int scratch_capacity;
+} TrackSequence;
+
+void track_seq_init(TrackSequence* seq);
+
+// Release every node, leaving an empty sequence
+void track_seq_free(TrackSequence* seq);
+
+// Id at index (INVALID_TRACK_ID out of range)
+TrackId track_seq_get(const TrackSequence* seq, int index);
+
+// Ids stored contiguously from index on: returns them and their number in length
+// (NULL and 0 out of range). Reading run after run visits the sequence in O(n).
+const TrackId* track_seq_run(const TrackSequence* seq, int index, int* length);
+
+// Copy count ids from first on to out. Returns the number copied.
+int track_seq_copy(const TrackSequence* seq, int first, int count, TrackId* out);
+
+// Insert count ids so that the first one ends up at index (0 to count). FALSE without
+// memory, leaving the sequence unchanged.
+BOOL track_seq_insert(TrackSequence* seq, int index, const TrackId* ids, int count);
+
+// Append ids at the end
+BOOL track_seq_append(TrackSequence* seq, const TrackId* ids, int count);
+
+// Remove count ids from first on (the range must lie in the sequence)
+void track_seq_remove(TrackSequence* seq, int first, int count);
+
+// Move count ids from first on so that they start at to in the result (to + count must
+// not pass the end). FALSE without memory, leaving the sequence unchanged.
+BOOL track_seq_move(TrackSequence* seq, int first, int count, int to);
+
+#endif // TRACKSEQ_H
@@ -0,0 +1,43 @@
+#ifndef TRACKVIEW_H
+#define TRACKVIEW_H
+
+#include <windows.h>
+#include "mp3player.h"
+#include "sortspec.h"
+#include "threadpool.h"
+
+// Records resolved at a time when a view is walked page by page
+#define TRACK_VIEW_PAGE_SIZE 256
+
+// A subset of the library (filter result, album tracks, ...) in display order.
+// Only track ids are stored: no record copies, and a track removed by a scan
+// is simply skipped when the view is resolved.
+struct TrackView {
+    TrackId* ids;
+    int count;
+    int capacity;
+};
+
+// Initialise an empty view
+void track_view_init(TrackView* view);
+
+// Release the ids, leaving an empty view
+void track_view_free(TrackView* view);
+
+// Empty the view, keeping its memory for the next result
+void track_view_clear(TrackView* view);
+
+// Append a track id, FALSE without memory
+BOOL track_view_add(TrackView* view, TrackId id);
+
+// Make room for at least capacity ids, FALSE without memory
+BOOL track_view_reserve(TrackView* view, int capacity);
+
+// Resolve the ids in [first, first + count) to library records, skipping removed tracks.
+// Returns the number of records written to out.
+int track_view_page(MP3Library* library, const TrackView* view, int first, int count, MP3File** out);
+
+// Sort the view with a sort spec (removed tracks are dropped). FALSE without memory.
+BOOL track_view_sort(MP3Library* library, TrackView* view, const SortSpec* spec, ThreadPool* pool);
+
+#endif // TRACKVIEW_H
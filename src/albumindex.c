@@ -0,0 +1,444 @@
+#include "../include/albumindex.h"
+#include "../include/memory.h"
+#include <stddef.h>
+
+#define INITIAL_KEY_TABLE_CAPACITY 256
+#define INITIAL_ENTRY_CAPACITY 64
+#define INITIAL_ALBUM_TRACKS 16
+#define INITIAL_ARTIST_ALBUMS 4
+
+#define KEY_SLOT_EMPTY 0
+#define KEY_SLOT_DELETED (-1)
+
+// Hash a name ignoring ASCII case, continuing from seed (FNV-1a)
+static UINT64 fold_hash(const char* text, UINT64 seed) {
+    UINT64 hash = seed;
+    
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        unsigned char c = *p;
+        if (c >= 'A' && c <= 'Z') {
+            c = (unsigned char)(c - 'A' + 'a');
+        }
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    
+    return hash;
+}
+
+static UINT64 artist_key(const char* artist) {
+    return fold_hash(artist, 14695981039346656037ULL);
+}
+
+static UINT64 album_key(const char* album, const char* artist) {
+    // The separator keeps ("ab", "c") and ("a", "bc") apart
+    UINT64 hash = fold_hash(album, 14695981039346656037ULL);
+    hash ^= 0x1F;
+    hash *= 1099511628211ULL;
+    return fold_hash(artist, hash);
+}
+
+// Ensure a dynamic array can hold one more element
+static BOOL grow_array(void** items, int* capacity, int count, int initial, size_t item_size) {
+    if (count < *capacity) return TRUE;
+    
+    int new_capacity = *capacity ? *capacity * 2 : initial;
+    void* new_items = MEM_REALLOC_TAGGED(*items, new_capacity * item_size, MEM_CAT_INDEX);
+    if (!new_items) return FALSE;
+    
+    *items = new_items;
+    *capacity = new_capacity;
+    return TRUE;
+}
+
+// Initialize an empty key table (capacity must be a power of 2)
+static BOOL key_table_init(AlbumKeyTable* table, int capacity) {
+    table->slots = (int*)MEM_CALLOC_TAGGED(capacity, sizeof(int), MEM_CAT_INDEX);
+    if (!table->slots) return FALSE;
+    
+    table->capacity = capacity;
+    table->count = 0;
+    table->tombstones = 0;
+    return TRUE;
+}
+
+// Insert an entry id without checking the load factor
+static void key_table_put(AlbumKeyTable* table, UINT64 key, int id) {
+    int mask = table->capacity - 1;
+    int slot = (int)(key & mask);
+    
+    while (table->slots[slot] != KEY_SLOT_EMPTY && table->slots[slot] != KEY_SLOT_DELETED) {
+        slot = (slot + 1) & mask;
+    }
+    
+    if (table->slots[slot] == KEY_SLOT_DELETED) {
+        table->tombstones--;
+    }
+    table->slots[slot] = id + 1;
+    table->count++;
+}
+
+// Make room for one more key, growing the table or dropping tombstones.
+// entries/entry_size/key_offset locate the key of each entry so the table can be rebuilt.
+static BOOL key_table_reserve(AlbumKeyTable* table, const void* entries, size_t entry_size, size_t key_offset) {
+    if ((table->count + table->tombstones + 1) * 4 < table->capacity * 3) {
+        return TRUE;
+    }
+    
+    int new_capacity = table->capacity;
+    if ((table->count + 1) * 2 >= table->capacity) {
+        new_capacity *= 2;
+    }
+    
+    AlbumKeyTable resized;
+    if (!key_table_init(&resized, new_capacity)) return FALSE;
+    
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->slots[i] != KEY_SLOT_EMPTY && table->slots[i] != KEY_SLOT_DELETED) {
+            int id = table->slots[i] - 1;
+            UINT64 key = *(const UINT64*)((const char*)entries + (size_t)id * entry_size + key_offset);
+            key_table_put(&resized, key, id);
+        }
+    }
+    
+    MEM_FREE(table->slots);
+    *table = resized;
+    return TRUE;
+}
+
+// Remove an entry id from the table
+static void key_table_erase(AlbumKeyTable* table, UINT64 key, int id) {
+    int mask = table->capacity - 1;
+    int slot = (int)(key & mask);
+    
+    while (table->slots[slot] != KEY_SLOT_EMPTY) {
+        if (table->slots[slot] == id + 1) {
+            table->slots[slot] = KEY_SLOT_DELETED;
+            table->count--;
+            table->tombstones++;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+// Create an empty index
+AlbumIndex* album_index_create(void) {
+    AlbumIndex* index = (AlbumIndex*)MEM_CALLOC_TAGGED(1, sizeof(AlbumIndex), MEM_CAT_INDEX);
+    if (!index) return NULL;
+    
+    if (!key_table_init(&index->album_keys, INITIAL_KEY_TABLE_CAPACITY) ||
+        !key_table_init(&index->artist_keys, INITIAL_KEY_TABLE_CAPACITY)) {
+        MEM_FREE(index->album_keys.slots);
+        MEM_FREE(index);
+        return NULL;
+    }
+    
+    return index;
+}
+
+// Remove every entry, keeping the allocated memory
+void album_index_clear(AlbumIndex* index) {
+    if (!index) return;
+    
+    for (int i = 0; i < index->album_slots; i++) {
+        MEM_FREE(index->albums[i].tracks);
+    }
+    for (int i = 0; i < index->artist_slots; i++) {
+        MEM_FREE(index->artists[i].albums);
+    }
+    
+    index->album_slots = 0;
+    index->album_count = 0;
+    index->free_album_count = 0;
+    index->artist_slots = 0;
+    index->artist_count = 0;
+    index->free_artist_count = 0;
+    
+    memset(index->album_keys.slots, 0, index->album_keys.capacity * sizeof(int));
+    index->album_keys.count = 0;
+    index->album_keys.tombstones = 0;
+    memset(index->artist_keys.slots, 0, index->artist_keys.capacity * sizeof(int));
+    index->artist_keys.count = 0;
+    index->artist_keys.tombstones = 0;
+}
+
+// Free the index and all its entries
+void album_index_free(AlbumIndex* index) {
+    if (!index) return;
+    
+    album_index_clear(index);
+    
+    MEM_FREE(index->albums);
+    MEM_FREE(index->free_albums);
+    MEM_FREE(index->album_keys.slots);
+    MEM_FREE(index->artists);
+    MEM_FREE(index->free_artists);
+    MEM_FREE(index->artist_keys.slots);
+    MEM_FREE(index);
+}
+
+// Find an artist by name, returns the artist id or -1
+int album_index_find_artist(AlbumIndex* index, const char* artist) {
+    if (!index || !artist) return -1;
+    
+    UINT64 key = artist_key(artist);
+    int mask = index->artist_keys.capacity - 1;
+    int slot = (int)(key & mask);
+    
+    while (index->artist_keys.slots[slot] != KEY_SLOT_EMPTY) {
+        int id = index->artist_keys.slots[slot] - 1;
+        if (id >= 0 && index->artists[id].key == key && _stricmp(index->artists[id].name, artist) == 0) {
+            return id;
+        }
+        slot = (slot + 1) & mask;
+    }
+    
+    return -1;
+}
+
+// Find an album by name and artist, returns the album id or -1
+int album_index_find_album(AlbumIndex* index, const char* album, const char* artist) {
+    if (!index || !album || !artist) return -1;
+    
+    UINT64 key = album_key(album, artist);
+    int mask = index->album_keys.capacity - 1;
+    int slot = (int)(key & mask);
+    
+    while (index->album_keys.slots[slot] != KEY_SLOT_EMPTY) {
+        int id = index->album_keys.slots[slot] - 1;
+        if (id >= 0) {
+            AlbumEntry* entry = &index->albums[id];
+            if (entry->key == key && _stricmp(entry->name, album) == 0 && _stricmp(entry->artist, artist) == 0) {
+                return id;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+    
+    return -1;
+}
+
+// Find the album a track belongs to, returns the album id or -1
+int album_index_find_track_album(AlbumIndex* index, MP3File* file) {
+    if (!file) return -1;
+    return album_index_find_album(index, file->metadata.album, file->metadata.artist);
+}
+
+// Get an album entry by id (NULL if the id is not in use)
+AlbumEntry* album_index_get_album(AlbumIndex* index, int album_id) {
+    if (!index || album_id < 0 || album_id >= index->album_slots) return NULL;
+    
+    AlbumEntry* entry = &index->albums[album_id];
+    return entry->track_count > 0 ? entry : NULL;
+}
+
+// Get an artist entry by id (NULL if the id is not in use)
+ArtistEntry* album_index_get_artist(AlbumIndex* index, int artist_id) {
+    if (!index || artist_id < 0 || artist_id >= index->artist_slots) return NULL;
+    
+    ArtistEntry* entry = &index->artists[artist_id];
+    return entry->album_count > 0 ? entry : NULL;
+}
+
+// Release an artist that no longer has albums
+static void release_artist(AlbumIndex* index, int artist_id) {
+    ArtistEntry* entry = &index->artists[artist_id];
+    
+    key_table_erase(&index->artist_keys, entry->key, artist_id);
+    MEM_FREE(entry->albums);
+    entry->albums = NULL;
+    entry->album_capacity = 0;
+    entry->album_count = 0;
+    index->artist_count--;
+    
+    // If the free list cannot grow the slot is simply not reused
+    if (grow_array((void**)&index->free_artists, &index->free_artist_capacity,
+                   index->free_artist_count, INITIAL_ENTRY_CAPACITY, sizeof(int))) {
+        index->free_artists[index->free_artist_count++] = artist_id;
+    }
+}
+
+// Release an album that no longer has tracks
+static void release_album(AlbumIndex* index, int album_id) {
+    AlbumEntry* entry = &index->albums[album_id];
+    ArtistEntry* artist = &index->artists[entry->artist_id];
+    
+    // Unlink the album from its artist
+    for (int i = 0; i < artist->album_count; i++) {
+        if (artist->albums[i] == album_id) {
+            memmove(&artist->albums[i], &artist->albums[i + 1], (artist->album_count - i - 1) * sizeof(int));
+            artist->album_count--;
+            break;
+        }
+    }
+    if (artist->album_count == 0) {
+        release_artist(index, entry->artist_id);
+    }
+    
+    key_table_erase(&index->album_keys, entry->key, album_id);
+    MEM_FREE(entry->tracks);
+    entry->tracks = NULL;
+    entry->track_capacity = 0;
+    entry->track_count = 0;
+    index->album_count--;
+    
+    if (grow_array((void**)&index->free_albums, &index->free_album_capacity,
+                   index->free_album_count, INITIAL_ENTRY_CAPACITY, sizeof(int))) {
+        index->free_albums[index->free_album_count++] = album_id;
+    }
+}
+
+// Get (or create) the artist entry for a name
+static int get_or_add_artist(AlbumIndex* index, const char* artist) {
+    int artist_id = album_index_find_artist(index, artist);
+    if (artist_id >= 0) return artist_id;
+    
+    if (!key_table_reserve(&index->artist_keys, index->artists, sizeof(ArtistEntry), offsetof(ArtistEntry, key))) {
+        return -1;
+    }
+    
+    if (index->free_artist_count > 0) {
+        artist_id = index->free_artists[--index->free_artist_count];
+    } else {
+        if (!grow_array((void**)&index->artists, &index->artist_capacity, index->artist_slots,
+                        INITIAL_ENTRY_CAPACITY, sizeof(ArtistEntry))) {
+            return -1;
+        }
+        artist_id = index->artist_slots++;
+    }
+    
+    ArtistEntry* entry = &index->artists[artist_id];
+    memset(entry, 0, sizeof(ArtistEntry));
+    strncpy(entry->name, artist, MAX_ARTIST_LENGTH - 1);
+    entry->name[MAX_ARTIST_LENGTH - 1] = '\0';
+    entry->key = artist_key(artist);
+    
+    key_table_put(&index->artist_keys, entry->key, artist_id);
+    index->artist_count++;
+    return artist_id;
+}
+
+// Create the album entry for a track (the artist is created as needed)
+static int add_album(AlbumIndex* index, MP3File* file) {
+    int artist_id = get_or_add_artist(index, file->metadata.artist);
+    if (artist_id < 0) return -1;
+    
+    int album_id = -1;
+    BOOL recycled = FALSE;
+    if (key_table_reserve(&index->album_keys, index->albums, sizeof(AlbumEntry), offsetof(AlbumEntry, key))) {
+        if (index->free_album_count > 0) {
+            album_id = index->free_albums[--index->free_album_count];
+            recycled = TRUE;
+        } else if (grow_array((void**)&index->albums, &index->album_capacity, index->album_slots,
+                              INITIAL_ENTRY_CAPACITY, sizeof(AlbumEntry))) {
+            album_id = index->album_slots++;
+        }
+    }
+    
+    ArtistEntry* artist = &index->artists[artist_id];
+    if (album_id < 0 || !grow_array((void**)&artist->albums, &artist->album_capacity, artist->album_count,
+                                    INITIAL_ARTIST_ALBUMS, sizeof(int))) {
+        // Give the slot back
+        if (recycled) {
+            index->free_albums[index->free_album_count++] = album_id;
+        } else if (album_id >= 0) {
+            index->album_slots--;
+        }
+        if (artist->album_count == 0) {
+            release_artist(index, artist_id);
+        }
+        return -1;
+    }
+    
+    AlbumEntry* entry = &index->albums[album_id];
+    memset(entry, 0, sizeof(AlbumEntry));
+    strncpy(entry->name, file->metadata.album, MAX_ALBUM_LENGTH - 1);
+    entry->name[MAX_ALBUM_LENGTH - 1] = '\0';
+    strncpy(entry->artist, file->metadata.artist, MAX_ARTIST_LENGTH - 1);
+    entry->artist[MAX_ARTIST_LENGTH - 1] = '\0';
+    entry->key = album_key(file->metadata.album, file->metadata.artist);
+    entry->artist_id = artist_id;
+    entry->year = file->metadata.year;
+    
+    artist->albums[artist->album_count++] = album_id;
+    key_table_put(&index->album_keys, entry->key, album_id);
+    index->album_count++;
+    return album_id;
+}
+
+// Account for a track added to the library
+BOOL album_index_add(AlbumIndex* index, MP3File* file) {
+    if (!index || !file) return FALSE;
+    
+    BOOL created = FALSE;
+    int album_id = album_index_find_track_album(index, file);
+    if (album_id < 0) {
+        album_id = add_album(index, file);
+        if (album_id < 0) return FALSE;
+        created = TRUE;
+    }
+    
+    AlbumEntry* album = &index->albums[album_id];
+    if (!grow_array((void**)&album->tracks, &album->track_capacity, album->track_count,
+                    INITIAL_ALBUM_TRACKS, sizeof(TrackId))) {
+        if (created) {
+            release_album(index, album_id);
+        }
+        return FALSE;
+    }
+    
+    album->tracks[album->track_count++] = file->id;
+    album->total_duration += file->metadata.duration;
+    if (album->year <= 0) {
+        album->year = file->metadata.year;
+    }
+    
+    ArtistEntry* artist = &index->artists[album->artist_id];
+    artist->track_count++;
+    artist->total_duration += file->metadata.duration;
+    
+    return TRUE;
+}
+
+// Account for a track removed from the library
+void album_index_remove(AlbumIndex* index, MP3File* file) {
+    if (!index || !file) return;
+    
+    int album_id = album_index_find_track_album(index, file);
+    if (album_id < 0) return;
+    
+    AlbumEntry* album = &index->albums[album_id];
+    for (int i = album->track_count - 1; i >= 0; i--) {
+        if (album->tracks[i] == file->id) {
+            memmove(&album->tracks[i], &album->tracks[i + 1], (album->track_count - i - 1) * sizeof(TrackId));
+            album->track_count--;
+            album->total_duration -= file->metadata.duration;
+            
+            ArtistEntry* artist = &index->artists[album->artist_id];
+            artist->track_count--;
+            artist->total_duration -= file->metadata.duration;
+            break;
+        }
+    }
+    
+    if (album->track_count == 0) {
+        release_album(index, album_id);
+    }
+}
+
+// Rebuild the index from scratch from a track list
+BOOL album_index_rebuild(AlbumIndex* index, MP3File* list) {
+    if (!index) return FALSE;
+    
+    album_index_clear(index);
+    
+    BOOL ok = TRUE;
+    for (MP3File* current = list; current; current = current->next) {
+        if (!album_index_add(index, current)) {
+            ok = FALSE;
+        }
+    }
+    
+    return ok;
+}
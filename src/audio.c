@@ -6,6 +6,7 @@
  */
 
 #include "../include/audio.h"
+#include "../include/memory.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -108,21 +109,13 @@ AudioPlayer* create_audio_player(HWND notifyWindow, UINT notifyMessage) {
     
     // Inizializza il player
     memset(player, 0, sizeof(AudioPlayer));
-    player->queue = (MP3Queue*)malloc(sizeof(MP3Queue));
+    player->queue = create_queue();
     if (!player->queue) {
         printf("DEBUG: Error allocating playback queue\n");
         free(player);
         return NULL;
     }
     
-    // Inizializza la coda
-    memset(player->queue, 0, sizeof(MP3Queue));
-    player->queue->head = NULL;
-    player->queue->current = NULL;
-    player->queue->count = 0;
-    player->queue->repeat = FALSE;
-    player->queue->shuffle = FALSE;
-    
     // Imposta le proprietà del player
     player->notifyWindow = notifyWindow;
     player->notifyMessage = notifyMessage;
@@ -151,7 +144,7 @@ void free_audio_player(AudioPlayer* player) {
     // Libera la coda
     if (player->queue) {
         clear_queue(player);
-        free(player->queue);
+        free_mp3_queue(player->queue);
     }
     
     free(player);
@@ -188,11 +181,24 @@ BOOL play_file(AudioPlayer* player, const char* filepath) {
     return FALSE;
 }
 
+// Imposta la libreria usata per risolvere gli id della coda
+void set_player_library(AudioPlayer* player, MP3Library* library) {
+    if (!player) return;
+    player->library = library;
+}
+
 // Riproduce il file corrente nella coda
 BOOL play_current(AudioPlayer* player) {
-    if (!player || !player->queue || !player->queue->current) return FALSE;
+    MP3File* current = get_current_file(player);
+    if (!current) return FALSE; // Nessun brano o traccia rimossa dalla libreria
+    
+    // Il percorso completo viene ricostruito dal trie delle directory
+    char* filepath = mp3_file_dup_path(current);
+    if (!filepath) return FALSE;
     
-    return play_file(player, player->queue->current->filepath);
+    BOOL result = play_file(player, filepath);
+    MEM_FREE(filepath);
+    return result;
 }
 
 // Mette in pausa la riproduzione
@@ -286,43 +292,33 @@ BOOL stop_playback(AudioPlayer* player) {
 
 // Passa al brano successivo
 BOOL next_track(AudioPlayer* player) {
-    if (!player || !player->queue || !player->queue->current) return FALSE;
+    if (!player || !player->queue || player->queue->current < 0) return FALSE;
     
-    MP3File* next = NULL;
+    MP3Queue* queue = player->queue;
+    int next = -1;
     
     // Determina il prossimo brano in base alla modalità di riproduzione
     switch (player->mode) {
         case PLAYBACK_MODE_NORMAL:
         case PLAYBACK_MODE_REPEAT_ALL:
-            next = player->queue->current->next;
-            if (!next && player->mode == PLAYBACK_MODE_REPEAT_ALL) {
-                next = player->queue->head; // Torna all'inizio
+            next = queue->current + 1;
+            if (next >= queue->count) {
+                next = (player->mode == PLAYBACK_MODE_REPEAT_ALL) ? 0 : -1; // Torna all'inizio
             }
             break;
             
         case PLAYBACK_MODE_REPEAT_ONE:
-            next = player->queue->current; // Riproduce lo stesso brano
+            next = queue->current; // Riproduce lo stesso brano
             break;
             
         case PLAYBACK_MODE_SHUFFLE:
-            {
-                // Scegli un brano casuale dalla coda
-                if (player->queue->count <= 1) {
-                    next = player->queue->current;
-                } else {
-                    int random_index = rand() % player->queue->count;
-                    MP3File* temp = player->queue->head;
-                    for (int i = 0; i < random_index && temp; i++) {
-                        temp = temp->next;
-                    }
-                    next = temp;
-                }
-            }
+            // Scegli un brano casuale dalla coda (accesso diretto per posizione)
+            next = (queue->count <= 1) ? queue->current : rand() % queue->count;
             break;
     }
     
-    if (next) {
-        player->queue->current = next;
+    if (next >= 0) {
+        queue->current = next;
         return play_current(player);
     }
     
@@ -331,79 +327,35 @@ BOOL next_track(AudioPlayer* player) {
 
 // Passa al brano precedente
 BOOL previous_track(AudioPlayer* player) {
-    if (!player || !player->queue || !player->queue->current) return FALSE;
+    if (!player || !player->queue || player->queue->current < 0) return FALSE;
+    
+    MP3Queue* queue = player->queue;
     
-    // La gestione del brano precedente è più complessa perché la lista è unidirezionale
-    // In una implementazione reale andremmo con una lista doppiamente collegata
-    // Per ora, se siamo all'inizio, torniamo alla fine se in modalità repeat all
-    if (player->queue->current == player->queue->head) {
+    // Se siamo all'inizio, torniamo alla fine in modalità repeat all,
+    // altrimenti riavviamo il brano corrente
+    if (queue->current == 0) {
         if (player->mode == PLAYBACK_MODE_REPEAT_ALL) {
-            // Trova l'ultimo brano
-            MP3File* last = player->queue->head;
-            while (last && last->next) {
-                last = last->next;
-            }
-            player->queue->current = last;
-            return play_current(player);
-        } else {
-            // Se non siamo in modalità repeat all, riavviamo il brano corrente
-            return play_current(player);
+            queue->current = queue->count - 1;
         }
     } else {
-        // Dobbiamo trovare il brano precedente
-        MP3File* prev = player->queue->head;
-        while (prev && prev->next != player->queue->current) {
-            prev = prev->next;
-        }
-        
-        if (prev) {
-            player->queue->current = prev;
-            return play_current(player);
-        }
+        queue->current--;
     }
     
-    return FALSE;
+    return play_current(player);
 }
 
 // Aggiungi un file alla coda
 BOOL add_to_queue(AudioPlayer* player, MP3File* file) {
     if (!player || !player->queue || !file) return FALSE;
     
-    // Crea una copia del file MP3
-    MP3File* new_file = (MP3File*)malloc(sizeof(MP3File));
-    if (!new_file) return FALSE;
-    
-    // Copia le informazioni del file
-    memcpy(new_file, file, sizeof(MP3File));
-    new_file->next = NULL;
+    MP3Queue* queue = player->queue;
     
-    // Se c'è l'immagine dell'album, copia anche quella
-    if (file->metadata.album_art && file->metadata.album_art_size > 0) {
-        new_file->metadata.album_art = (char*)malloc(file->metadata.album_art_size);
-        if (new_file->metadata.album_art) {
-            memcpy(new_file->metadata.album_art, file->metadata.album_art, file->metadata.album_art_size);
-        } else {
-            new_file->metadata.album_art = NULL;
-            new_file->metadata.album_art_size = 0;
-        }
-    } else {
-        new_file->metadata.album_art = NULL;
-        new_file->metadata.album_art_size = 0;
-    }
-    
-    // Aggiungi il file alla fine della coda
-    if (player->queue->head == NULL) {
-        player->queue->head = new_file;
-        player->queue->current = new_file;
-    } else {
-        MP3File* temp = player->queue->head;
-        while (temp->next) {
-            temp = temp->next;
-        }
-        temp->next = new_file;
+    // Memorizziamo solo l'id: nessuna copia del record né dell'immagine dell'album
+    if (!queue_add_track(queue, file->id)) return FALSE;
+    if (queue->current < 0) {
+        queue->current = queue->count - 1;
     }
     
-    player->queue->count++;
     return TRUE;
 }
 
@@ -414,23 +366,8 @@ BOOL clear_queue(AudioPlayer* player) {
     // Ferma la riproduzione
     stop_playback(player);
     
-    // Libera la memoria dei file nella coda
-    MP3File* current = player->queue->head;
-    while (current) {
-        MP3File* next = current->next;
-        
-        // Libera la memoria dell'immagine dell'album, se presente
-        if (current->metadata.album_art) {
-            free(current->metadata.album_art);
-        }
-        
-        free(current);
-        current = next;
-    }
-    
-    player->queue->head = NULL;
-    player->queue->current = NULL;
     player->queue->count = 0;
+    player->queue->current = -1;
     
     return TRUE;
 }
@@ -441,10 +378,19 @@ int get_queue_size(AudioPlayer* player) {
     return player->queue->count;
 }
 
+// Ottieni l'id del brano corrente nella coda
+TrackId get_current_track_id(AudioPlayer* player) {
+    if (!player || !player->queue || player->queue->current < 0 ||
+        player->queue->current >= player->queue->count) {
+        return INVALID_TRACK_ID;
+    }
+    return player->queue->items[player->queue->current];
+}
+
 // Ottieni il file attualmente in riproduzione
 MP3File* get_current_file(AudioPlayer* player) {
-    if (!player || !player->queue) return NULL;
-    return player->queue->current;
+    if (!player) return NULL;
+    return library_get_track(player->library, get_current_track_id(player));
 }
 
 // Imposta il volume
@@ -0,0 +1,3182 @@
+#include "../include/bench.h"
+#include "../include/memory.h"
+#include "../include/albumindex.h"
+#include "../include/pathtrie.h"
+#include "../include/sortspec.h"
+#include "../include/sortview.h"
+#include "../include/trackview.h"
+#include "../include/textindex.h"
+#include "../include/searchsession.h"
+#include "../include/filterquery.h"
+#include "../include/strscan.h"
+#include "../include/playlist.h"
+#include "../include/playlistio.h"
+#include "../include/playlistdiff.h"
+#include "../include/smartplaylist.h"
+#include "../include/threadpool.h"
+
+// Sample values used to build synthetic metadata
+static const char* bench_artists[] = {
+    "The Beatles", "Pink Floyd", "Led Zeppelin", "Queen", "Radiohead",
+    "Lucio Battisti", "Fabrizio De Andre", "Miles Davis", "Nirvana", "Bjork"
+};
+static const char* bench_genres[] = {
+    "Rock", "Pop", "Jazz", "Classical", "Electronic", "Folk", "Metal", "Blues"
+};
+
+#define BENCH_ARTIST_COUNT (sizeof(bench_artists) / sizeof(bench_artists[0]))
+#define BENCH_GENRE_COUNT (sizeof(bench_genres) / sizeof(bench_genres[0]))
+#define BENCH_TRACKS_PER_ALBUM 12
+
+// Cheap deterministic generator so runs are reproducible
+static UINT32 bench_rand_state = 12345;
+
+static UINT32 bench_rand(void) {
+    bench_rand_state = bench_rand_state * 1103515245u + 12345u;
+    return bench_rand_state >> 8;
+}
+
+void bench_timer_start(BenchTimer* timer) {
+    QueryPerformanceFrequency(&timer->frequency);
+    QueryPerformanceCounter(&timer->start);
+}
+
+double bench_timer_elapsed_ms(BenchTimer* timer) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)(now.QuadPart - timer->start.QuadPart) * 1000.0 / (double)timer->frequency.QuadPart;
+}
+
+// Fill a record with plausible metadata derived from its index, and write its path
+void bench_fill_track(MP3File* file, int index, char* path, size_t path_size) {
+    int album = index / BENCH_TRACKS_PER_ALBUM;
+    const char* artist = bench_artists[album % BENCH_ARTIST_COUNT];
+    
+    memset(file, 0, sizeof(MP3File));
+    snprintf(path, path_size, "C:\\Music\\%s\\Album %d\\%02d - Track %d.mp3",
+             artist, album, index % BENCH_TRACKS_PER_ALBUM + 1, index);
+    snprintf(file->metadata.title, MAX_TITLE_LENGTH, "Track %d", (int)(bench_rand() % 1000000));
+    snprintf(file->metadata.artist, MAX_ARTIST_LENGTH, "%s", artist);
+    snprintf(file->metadata.album, MAX_ALBUM_LENGTH, "Album %d", album);
+    snprintf(file->metadata.genre, MAX_GENRE_LENGTH, "%s", bench_genres[album % BENCH_GENRE_COUNT]);
+    file->metadata.year = 1960 + (int)(album % 60);
+    file->metadata.track_number = index % BENCH_TRACKS_PER_ALBUM + 1;
+    file->metadata.duration = 120 + (int)(bench_rand() % 300);
+}
+
+// Build a library of synthetic tracks through the normal insertion path
+MP3Library* bench_create_library(int track_count) {
+    MP3Library* library = create_library("C:\\Music");
+    if (!library) {
+        return NULL;
+    }
+    
+    char path[MAX_PATH_LENGTH];
+    bench_rand_state = 12345;
+    for (int i = 0; i < track_count; i++) {
+        MP3File* file = (MP3File*)MEM_ALLOC(sizeof(MP3File));
+        if (!file) {
+            break;
+        }
+        
+        bench_fill_track(file, i, path, sizeof(path));
+        if (!library_add_file(library, file, path)) {
+            free_mp3_file(file);
+        }
+    }
+    
+    return library;
+}
+
+// Compare id lookups against the positional walk they replace, and check
+// that ids survive rebuilding the library in a different order
+void bench_track_ids(int track_count) {
+    BenchTimer timer;
+    
+    bench_timer_start(&timer);
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    printf("Built library with %d tracks in %.2f ms\n", library->total_files, bench_timer_elapsed_ms(&timer));
+    
+    int count = library->total_files;
+    TrackId* ids = (TrackId*)MEM_ALLOC(count * sizeof(TrackId));
+    if (!ids) {
+        free_mp3_library(library);
+        return;
+    }
+    
+    int n = 0;
+    for (MP3File* current = library->all_files; current; current = current->next) {
+        ids[n++] = current->id;
+    }
+    
+    // Random lookups through the id table
+    int lookups = 1000000;
+    int found = 0;
+    bench_timer_start(&timer);
+    for (int i = 0; i < lookups; i++) {
+        if (library_get_track(library, ids[bench_rand() % count])) {
+            found++;
+        }
+    }
+    double id_ms = bench_timer_elapsed_ms(&timer);
+    printf("Id lookup:       %d lookups in %.2f ms (%.1f ns/lookup, %d found)\n",
+           lookups, id_ms, id_ms * 1000000.0 / lookups, found);
+    
+    // Random lookups by walking the list to a position (old behaviour)
+    int walks = count > 2000 ? 2000 : count;
+    found = 0;
+    bench_timer_start(&timer);
+    for (int i = 0; i < walks; i++) {
+        int position = (int)(bench_rand() % count);
+        MP3File* current = library->all_files;
+        while (current && position-- > 0) {
+            current = current->next;
+        }
+        if (current) {
+            found++;
+        }
+    }
+    double walk_ms = bench_timer_elapsed_ms(&timer);
+    printf("Positional walk: %d lookups in %.2f ms (%.1f ns/lookup, %d found)\n",
+           walks, walk_ms, walk_ms * 1000000.0 / walks, found);
+    
+    // Rebuild the library in reverse order: every id must be unchanged
+    MP3Library* rebuilt = create_library("C:\\Music");
+    int mismatches = 0;
+    if (rebuilt) {
+        char path[MAX_PATH_LENGTH];
+        bench_rand_state = 12345;
+        for (int i = count - 1; i >= 0; i--) {
+            MP3File* file = (MP3File*)MEM_ALLOC(sizeof(MP3File));
+            if (!file) {
+                break;
+            }
+            bench_fill_track(file, i, path, sizeof(path));
+            if (!library_add_file(rebuilt, file, path)) {
+                free_mp3_file(file);
+            }
+        }
+        
+        char original_path[MAX_PATH_LENGTH], again_path[MAX_PATH_LENGTH];
+        for (int i = 0; i < count; i++) {
+            MP3File* original = library_get_track(library, ids[i]);
+            MP3File* again = library_get_track(rebuilt, ids[i]);
+            if (!original || !again) {
+                mismatches++;
+                continue;
+            }
+            mp3_file_path(original, original_path, sizeof(original_path));
+            mp3_file_path(again, again_path, sizeof(again_path));
+            if (_stricmp(original_path, again_path) != 0) {
+                mismatches++;
+            }
+        }
+        free_mp3_library(rebuilt);
+    }
+    printf("Rescan check:    %d of %d ids changed after rebuilding the library\n", mismatches, count);
+    
+    MEM_FREE(ids);
+    free_mp3_library(library);
+}
+
+// Group tracks into albums with the nested list scan the grid view used before the index
+static int bench_legacy_album_scan(MP3File* list, int limit) {
+    typedef struct LegacyAlbum {
+        const char* album;
+        int track_count;
+        struct LegacyAlbum* next;
+    } LegacyAlbum;
+    
+    LegacyAlbum* albums = NULL;
+    int album_count = 0;
+    
+    for (MP3File* current = list; current && limit-- > 0; current = current->next) {
+        LegacyAlbum* album = albums;
+        while (album && _stricmp(album->album, current->metadata.album) != 0) {
+            album = album->next;
+        }
+        
+        if (album) {
+            album->track_count++;
+        } else {
+            album = (LegacyAlbum*)MEM_ALLOC(sizeof(LegacyAlbum));
+            if (!album) break;
+            album->album = current->metadata.album;
+            album->track_count = 1;
+            album->next = albums;
+            albums = album;
+            album_count++;
+        }
+    }
+    
+    while (albums) {
+        LegacyAlbum* next = albums->next;
+        MEM_FREE(albums);
+        albums = next;
+    }
+    
+    return album_count;
+}
+
+// Full rebuild vs incremental maintenance of the album/artist index
+void bench_album_index(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    int count = library->total_files;
+    MP3File** files = (MP3File**)MEM_ALLOC(count * sizeof(MP3File*));
+    if (!files) {
+        free_mp3_library(library);
+        return;
+    }
+    
+    int n = 0;
+    for (MP3File* current = library->all_files; current; current = current->next) {
+        files[n++] = current;
+    }
+    
+    // Full rebuild from the track list
+    bench_timer_start(&timer);
+    album_index_rebuild(library->albums, library->all_files);
+    double rebuild_ms = bench_timer_elapsed_ms(&timer);
+    printf("Rebuild:      %.2f ms (%d albums, %d artists)\n",
+           rebuild_ms, library->albums->album_count, library->albums->artist_count);
+    
+    // Incremental updates: remove and re-add random tracks
+    int updates = count < 10000 ? count : 10000;
+    bench_timer_start(&timer);
+    for (int i = 0; i < updates; i++) {
+        MP3File* file = files[bench_rand() % count];
+        album_index_remove(library->albums, file);
+        album_index_add(library->albums, file);
+    }
+    double update_ms = bench_timer_elapsed_ms(&timer);
+    printf("Incremental:  %d remove+add pairs in %.2f ms (%.1f ns/pair)\n",
+           updates, update_ms, update_ms * 1000000.0 / updates);
+    
+    // After the updates the aggregates must match a fresh rebuild
+    int albums_after = library->albums->album_count;
+    int tracks_after = 0;
+    for (int i = 0; i < library->albums->album_slots; i++) {
+        AlbumEntry* album = album_index_get_album(library->albums, i);
+        if (album) {
+            tracks_after += album->track_count;
+        }
+    }
+    album_index_rebuild(library->albums, library->all_files);
+    printf("Consistency:  %s (%d albums, %d tracks)\n",
+           albums_after == library->albums->album_count && tracks_after == count ? "ok" : "MISMATCH",
+           albums_after, tracks_after);
+    
+    // The nested scan is quadratic, so it only runs on a prefix of the library
+    int legacy_tracks = count < 20000 ? count : 20000;
+    bench_timer_start(&timer);
+    int legacy_albums = bench_legacy_album_scan(library->all_files, legacy_tracks);
+    double legacy_ms = bench_timer_elapsed_ms(&timer);
+    printf("Legacy scan:  %.2f ms for %d tracks (%d albums by name)\n", legacy_ms, legacy_tracks, legacy_albums);
+    
+    MEM_FREE(files);
+    free_mp3_library(library);
+}
+
+// Count the paths below a folder with a prefix scan over flat path strings (old layout)
+static int bench_prefix_count(char** paths, int count, const char* folder) {
+    size_t length = strlen(folder);
+    int matches = 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (_strnicmp(paths[i], folder, length) == 0 && paths[i][length] == '\\') {
+            matches++;
+        }
+    }
+    
+    return matches;
+}
+
+// Memory and subtree query latency of the directory trie vs fixed size path buffers
+void bench_path_trie(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    int count = library->total_files;
+    char** paths = (char**)MEM_ALLOC(count * sizeof(char*));
+    if (!paths) {
+        free_mp3_library(library);
+        return;
+    }
+    
+    // Flat copies of every path stand in for the old per-record buffers
+    int n = 0;
+    size_t path_bytes = 0;
+    for (MP3File* current = library->all_files; current; current = current->next) {
+        paths[n] = mp3_file_dup_path(current);
+        if (!paths[n]) break;
+        path_bytes += strlen(paths[n]) + 1;
+        n++;
+    }
+    count = n;
+    
+    PathTrie* trie = library->paths;
+    size_t legacy_bytes = (size_t)count * MAX_PATH_LENGTH;
+    size_t trie_bytes = trie->name_bytes + (size_t)trie->node_count * sizeof(DirNode) +
+                        (size_t)trie->capacity * sizeof(DirNode*) +
+                        (size_t)count * (sizeof(DirNode*) + sizeof(char*) + 2 * sizeof(MP3File*));
+    printf("Memory:       %.2f MB fixed buffers, %.2f MB flat strings, %.2f MB trie (%d directories)\n",
+           legacy_bytes / (1024.0 * 1024.0), path_bytes / (1024.0 * 1024.0),
+           trie_bytes / (1024.0 * 1024.0), trie->node_count);
+    
+    // Subtree counts for random album folders
+    char folder[MAX_PATH_LENGTH];
+    int album_count = (count + BENCH_TRACKS_PER_ALBUM - 1) / BENCH_TRACKS_PER_ALBUM;
+    int queries = 100000;
+    long long found = 0;
+    bench_timer_start(&timer);
+    for (int i = 0; i < queries; i++) {
+        int album = (int)(bench_rand() % album_count);
+        snprintf(folder, sizeof(folder), "C:\\Music\\%s\\Album %d",
+                 bench_artists[album % BENCH_ARTIST_COUNT], album);
+        found += library_count_in_folder(library, folder);
+    }
+    double trie_ms = bench_timer_elapsed_ms(&timer);
+    printf("Trie count:   %d queries in %.2f ms (%.1f ns/query, %lld tracks)\n",
+           queries, trie_ms, trie_ms * 1000000.0 / queries, found);
+    
+    int scans = count > 100000 ? 20 : 200;
+    found = 0;
+    bench_timer_start(&timer);
+    for (int i = 0; i < scans; i++) {
+        int album = (int)(bench_rand() % album_count);
+        snprintf(folder, sizeof(folder), "C:\\Music\\%s\\Album %d",
+                 bench_artists[album % BENCH_ARTIST_COUNT], album);
+        found += bench_prefix_count(paths, count, folder);
+    }
+    double scan_ms = bench_timer_elapsed_ms(&timer);
+    printf("Prefix scan:  %d queries in %.2f ms (%.1f ns/query, %lld tracks)\n",
+           scans, scan_ms, scan_ms * 1000000.0 / scans, found);
+    
+    // Enumerate the tracks of a whole artist
+    snprintf(folder, sizeof(folder), "C:\\Music\\%s", bench_artists[0]);
+    TrackId* ids = NULL;
+    bench_timer_start(&timer);
+    int artist_tracks = library_get_folder_tracks(library, folder, &ids);
+    double enumerate_ms = bench_timer_elapsed_ms(&timer);
+    MEM_FREE(ids);
+    printf("Enumerate:    %d tracks below %s in %.3f ms\n", artist_tracks, folder, enumerate_ms);
+    
+    // Drop the same artist in one bulk removal
+    bench_timer_start(&timer);
+    int removed = library_remove_folder(library, folder);
+    double remove_ms = bench_timer_elapsed_ms(&timer);
+    printf("Remove:       %d tracks in %.2f ms (%d left, %d directories)\n",
+           removed, remove_ms, library->total_files, trie->node_count);
+    
+    int root_count = library_count_in_folder(library, "C:\\Music");
+    printf("Consistency:  %s (folder count %d, library %d)\n",
+           removed == artist_tracks && root_count == library->total_files &&
+           library_count_in_folder(library, folder) == 0 ? "ok" : "MISMATCH",
+           root_count, library->total_files);
+    
+    for (int i = 0; i < count; i++) {
+        MEM_FREE(paths[i]);
+    }
+    MEM_FREE(paths);
+    free_mp3_library(library);
+}
+
+// Bubble sort by title that relinks nodes, as sort_mp3_files did before the merge sort
+static void bench_bubble_sort(MP3File** file_list) {
+    int swapped;
+    MP3File* last = NULL;
+    
+    do {
+        swapped = 0;
+        MP3File** link = file_list;
+        
+        while ((*link)->next != last) {
+            MP3File* first = *link;
+            if (strcmp(first->metadata.title, first->next->metadata.title) > 0) {
+                MP3File* second = first->next;
+                first->next = second->next;
+                second->next = first;
+                *link = second;
+                swapped = 1;
+            }
+            link = &(*link)->next;
+        }
+        last = *link;
+    } while (swapped);
+}
+
+// Check that a list is ordered by title, and by year when stability is required
+static BOOL bench_check_sorted(MP3File* list, int expected_count, BOOL by_year) {
+    int count = 0;
+    
+    for (MP3File* current = list; current; current = current->next) {
+        count++;
+        MP3File* next = current->next;
+        if (!next) break;
+        
+        if (by_year) {
+            // Sorting by year after title must keep titles ordered within a year
+            if (current->metadata.year > next->metadata.year) return FALSE;
+            if (current->metadata.year == next->metadata.year &&
+                strcmp(current->metadata.title, next->metadata.title) > 0) return FALSE;
+        } else if (strcmp(current->metadata.title, next->metadata.title) > 0) {
+            return FALSE;
+        }
+    }
+    
+    return count == expected_count;
+}
+
+// Merge sort of the library list vs the bubble sort it replaced
+void bench_sort(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    int count = library->total_files;
+    
+    bench_timer_start(&timer);
+    sort_mp3_files(&library->all_files, SORT_BY_TITLE);
+    double title_ms = bench_timer_elapsed_ms(&timer);
+    BOOL title_ok = bench_check_sorted(library->all_files, count, FALSE);
+    printf("Merge sort:   %d tracks by title in %.2f ms (%s)\n", count, title_ms, title_ok ? "ok" : "NOT SORTED");
+    
+    bench_timer_start(&timer);
+    sort_mp3_files(&library->all_files, SORT_BY_YEAR);
+    double year_ms = bench_timer_elapsed_ms(&timer);
+    BOOL year_ok = bench_check_sorted(library->all_files, count, TRUE);
+    printf("Merge sort:   %d tracks by year in %.2f ms (%s)\n", count, year_ms, year_ok ? "stable" : "NOT STABLE");
+    
+    // Every record must still be reachable through its id
+    int lost = 0;
+    for (MP3File* current = library->all_files; current; current = current->next) {
+        if (library_get_track(library, current->id) != current) {
+            lost++;
+        }
+    }
+    printf("Ids:          %d records moved or lost\n", lost);
+    free_mp3_library(library);
+    
+    // The bubble sort is quadratic, so it only runs on a small library
+    int legacy_count = track_count < 5000 ? track_count : 5000;
+    library = bench_create_library(legacy_count);
+    if (!library) {
+        return;
+    }
+    bench_timer_start(&timer);
+    sort_mp3_files(&library->all_files, SORT_BY_TITLE);
+    double merge_ms = bench_timer_elapsed_ms(&timer);
+    free_mp3_library(library);
+    
+    library = bench_create_library(legacy_count);
+    if (!library) {
+        return;
+    }
+    bench_timer_start(&timer);
+    bench_bubble_sort(&library->all_files);
+    double bubble_ms = bench_timer_elapsed_ms(&timer);
+    printf("Small list:   %d tracks, merge sort %.2f ms, bubble sort %.2f ms (%s)\n", legacy_count, merge_ms,
+           bubble_ms, bench_check_sorted(library->all_files, library->total_files, FALSE) ? "ok" : "NOT SORTED");
+    free_mp3_library(library);
+}
+
+#define BENCH_ALLOC_BATCH 64
+
+// Eviction hook used to check that budgets fire
+static size_t bench_count_evictions(MemCategory category, size_t excess, void* context) {
+    (void)category;
+    (void)excess;
+    (*(int*)context)++;
+    return 0;
+}
+
+// Cost of allocation tagging: plain malloc (tracking disabled) vs tracked, untagged and tagged
+void bench_memory_tags(int track_count) {
+    BenchTimer timer;
+    void* blocks[BENCH_ALLOC_BATCH];
+    int rounds = track_count / BENCH_ALLOC_BATCH > 0 ? track_count / BENCH_ALLOC_BATCH : 1;
+    int pairs = rounds * BENCH_ALLOC_BATCH;
+    
+    // Blocks are freed in reverse order, as in most of the program
+    bench_timer_start(&timer);
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < BENCH_ALLOC_BATCH; i++) {
+            blocks[i] = malloc(16 + (i * 16) % 1024);
+        }
+        for (int i = BENCH_ALLOC_BATCH - 1; i >= 0; i--) {
+            free(blocks[i]);
+        }
+    }
+    double plain_ms = bench_timer_elapsed_ms(&timer);
+    printf("Disabled:     %d alloc/free pairs in %.2f ms (%.1f ns/pair)\n",
+           pairs, plain_ms, plain_ms * 1000000.0 / pairs);
+    
+    bench_timer_start(&timer);
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < BENCH_ALLOC_BATCH; i++) {
+            blocks[i] = mem_alloc(16 + (i * 16) % 1024, __FILE__, __LINE__);
+        }
+        for (int i = BENCH_ALLOC_BATCH - 1; i >= 0; i--) {
+            mem_free(blocks[i], __FILE__, __LINE__);
+        }
+    }
+    double tracked_ms = bench_timer_elapsed_ms(&timer);
+    printf("Tracked:      %d alloc/free pairs in %.2f ms (%.1f ns/pair)\n",
+           pairs, tracked_ms, tracked_ms * 1000000.0 / pairs);
+    
+    bench_timer_start(&timer);
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < BENCH_ALLOC_BATCH; i++) {
+            blocks[i] = mem_alloc_tagged(16 + (i * 16) % 1024, (MemCategory)(i % MEM_CATEGORY_COUNT),
+                                         __FILE__, __LINE__);
+        }
+        for (int i = BENCH_ALLOC_BATCH - 1; i >= 0; i--) {
+            mem_free(blocks[i], __FILE__, __LINE__);
+        }
+    }
+    double tagged_ms = bench_timer_elapsed_ms(&timer);
+    printf("Tagged:       %d alloc/free pairs in %.2f ms (%.1f ns/pair, %+.1f%% vs untagged)\n",
+           pairs, tagged_ms, tagged_ms * 1000000.0 / pairs,
+           tracked_ms > 0 ? (tagged_ms - tracked_ms) * 100.0 / tracked_ms : 0.0);
+    
+    // A budget just above the current usage must run the hook once per allocation past it
+    int evictions = 0;
+    MemoryStats stats = mem_get_stats();
+    size_t budget = stats.categories[MEM_CAT_GENERAL].allocated + 4096;
+    mem_set_evict_hook(MEM_CAT_GENERAL, bench_count_evictions, &evictions);
+    mem_set_budget(MEM_CAT_GENERAL, budget);
+    for (int i = 0; i < 8; i++) {
+        blocks[i] = mem_alloc(1024, __FILE__, __LINE__);
+    }
+    for (int i = 7; i >= 0; i--) {
+        mem_free(blocks[i], __FILE__, __LINE__);
+    }
+    mem_set_budget(MEM_CAT_GENERAL, 0);
+    mem_set_evict_hook(MEM_CAT_GENERAL, NULL, NULL);
+    printf("Budget:       %s (hook ran %d times for 4 allocations over budget)\n",
+           evictions == 4 ? "ok" : "MISMATCH", evictions);
+}
+
+// Check that a list follows artist, album, disc, track using the cached collation keys
+static BOOL bench_check_collated(MP3File* list, int expected_count, DWORD flags) {
+    int count = 0;
+    
+    for (MP3File* current = list; current; current = current->next) {
+        count++;
+        MP3File* next = current->next;
+        if (!next) break;
+        
+        const CollationKeys* a = collation_get_keys(current, flags);
+        const CollationKeys* b = collation_get_keys(next, flags);
+        if (!a || !b) return FALSE;
+        
+        int result = strcmp((const char*)a->data + a->offsets[1], (const char*)b->data + b->offsets[1]);
+        if (result == 0) {
+            result = strcmp((const char*)a->data + a->offsets[2], (const char*)b->data + b->offsets[2]);
+        }
+        if (result == 0) {
+            result = current->metadata.disc_number - next->metadata.disc_number;
+        }
+        if (result == 0) {
+            result = current->metadata.track_number - next->metadata.track_number;
+        }
+        if (result > 0) return FALSE;
+    }
+    
+    return count == expected_count;
+}
+
+// Multi-key sort: key generation and sorting timed separately
+void bench_collation(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    int count = library->total_files;
+    SortSpec spec;
+    sort_spec_init(&spec, SORT_DEFAULT_FLAGS);
+    sort_spec_parse(&spec, "artist,album,disc,track");
+    
+    bench_timer_start(&timer);
+    int built = collation_prepare(library, spec.flags);
+    double keys_ms = bench_timer_elapsed_ms(&timer);
+    printf("Key build:    %d tracks in %.2f ms (%.2f us/track)\n", built, keys_ms,
+           built > 0 ? keys_ms * 1000.0 / built : 0.0);
+    
+    bench_timer_start(&timer);
+    BOOL sorted = sort_tracks(library, &library->all_files, &spec);
+    double sort_ms = bench_timer_elapsed_ms(&timer);
+    printf("Sort:         %d tracks by artist,album,disc,track in %.2f ms with cached keys (%s)\n", count, sort_ms,
+           sorted && bench_check_collated(library->all_files, count, spec.flags) ? "ok" : "NOT SORTED");
+    
+    bench_timer_start(&timer);
+    sort_tracks(library, &library->all_files, &spec);
+    double resort_ms = bench_timer_elapsed_ms(&timer);
+    printf("Re-sort:      %.2f ms on already sorted input\n", resort_ms);
+    
+    // Different options have keys of their own: built during the first sort with them
+    spec.flags = SORT_FOLD_CASE;
+    bench_timer_start(&timer);
+    sort_tracks(library, &library->all_files, &spec);
+    double cold_ms = bench_timer_elapsed_ms(&timer);
+    printf("Cold sort:    %.2f ms including key build (case folding only)\n", cold_ms);
+    
+    // The default keys are still cached beside them
+    spec.flags = SORT_DEFAULT_FLAGS;
+    bench_timer_start(&timer);
+    sort_tracks(library, &library->all_files, &spec);
+    double back_ms = bench_timer_elapsed_ms(&timer);
+    printf("Back:         %.2f ms with the default options again, %d keys rebuilt\n", back_ms,
+           collation_prepare(library, spec.flags));
+    
+    // Raw byte comparison, as sort_mp3_files does
+    spec.flags = SORT_BYTE_ORDER;
+    bench_timer_start(&timer);
+    sort_tracks(library, &library->all_files, &spec);
+    double raw_ms = bench_timer_elapsed_ms(&timer);
+    printf("Byte order:   %.2f ms without collation\n", raw_ms);
+    
+    free_mp3_library(library);
+}
+
+// Relink a list in the order stored in an array
+static void bench_relink(MP3File** list, MP3File** order, int count) {
+    for (int i = 0; i < count - 1; i++) {
+        order[i]->next = order[i + 1];
+    }
+    order[count - 1]->next = NULL;
+    *list = order[0];
+}
+
+// Parallel sort on 1..N threads against the serial sort, which must give the same order
+void bench_parallel_sort(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    int count = library->total_files;
+    MP3File** input = (MP3File**)MEM_ALLOC(count * sizeof(MP3File*));
+    MP3File** expected = (MP3File**)MEM_ALLOC(count * sizeof(MP3File*));
+    if (!input || !expected) {
+        MEM_FREE(input);
+        MEM_FREE(expected);
+        free_mp3_library(library);
+        return;
+    }
+    
+    int i = 0;
+    for (MP3File* current = library->all_files; current; current = current->next) {
+        input[i++] = current;
+    }
+    
+    SortSpec spec;
+    sort_spec_init(&spec, SORT_DEFAULT_FLAGS);
+    sort_spec_parse(&spec, "artist,album,disc,track");
+    collation_prepare(library, spec.flags);
+    
+    bench_timer_start(&timer);
+    sort_tracks(library, &library->all_files, &spec);
+    double serial_ms = bench_timer_elapsed_ms(&timer);
+    i = 0;
+    for (MP3File* current = library->all_files; current; current = current->next) {
+        expected[i++] = current;
+    }
+    printf("Serial:       %d tracks by artist,album,disc,track in %.2f ms\n", count, serial_ms);
+    if (count < SORT_PARALLEL_THRESHOLD) {
+        printf("              (below the parallel threshold of %d tracks: every run is serial)\n", SORT_PARALLEL_THRESHOLD);
+    }
+    
+    // Past the processor count the runs only check the result
+    int cpus = thread_pool_cpu_count();
+    int max_threads = cpus > 4 ? cpus : 4;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        ThreadPool* pool = thread_pool_create(threads);
+        if (!pool) break;
+        
+        bench_relink(&library->all_files, input, count);
+        bench_timer_start(&timer);
+        sort_tracks_parallel(library, &library->all_files, &spec, pool);
+        double parallel_ms = bench_timer_elapsed_ms(&timer);
+        thread_pool_free(pool);
+        
+        BOOL same = TRUE;
+        i = 0;
+        for (MP3File* current = library->all_files; current; current = current->next) {
+            if (i >= count || current != expected[i++]) {
+                same = FALSE;
+                break;
+            }
+        }
+        printf("%2d threads:   %.2f ms, speedup %.2fx%s (%s)\n", threads, parallel_ms,
+               parallel_ms > 0 ? serial_ms / parallel_ms : 0.0, threads > cpus ? " [more threads than CPUs]" : "",
+               same && i == count ? "same order" : "ORDER DIFFERS");
+    }
+    
+    MEM_FREE(input);
+    MEM_FREE(expected);
+    free_mp3_library(library);
+}
+
+// Check that the library list, relinked from the view, matches a view built from scratch
+static BOOL bench_check_view(MP3Library* library, SortedView* view, ThreadPool* pool) {
+    sorted_view_relink(view);
+    if (view->count != library->total_files) return FALSE;
+    
+    int count = view->count;
+    MP3File** order = (MP3File**)MEM_ALLOC((count > 0 ? count : 1) * sizeof(MP3File*));
+    if (!order) return FALSE;
+    
+    int i = 0;
+    for (MP3File* current = library->all_files; current; current = current->next) {
+        order[i++] = current;
+    }
+    
+    BOOL same = FALSE;
+    SortedView* fresh = sorted_view_create(library, &view->spec, pool);
+    if (fresh) {
+        same = TRUE;
+        i = 0;
+        for (SortedViewNode* node = sorted_view_first(fresh); node; node = node->next[0]) {
+            if (i >= count || node->file != order[i++]) {
+                same = FALSE;
+                break;
+            }
+        }
+        same = same && i == count;
+        sorted_view_free(fresh);
+    }
+    
+    MEM_FREE(order);
+    return same;
+}
+
+// Sorted view maintained under simulated scans, against re-sorting the whole library
+void bench_sorted_view(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    int count = library->total_files;
+    int changes = count / 10 < 1000 ? count / 10 : 1000;
+    MP3File** victims = (MP3File**)MEM_ALLOC((changes > 0 ? changes : 1) * sizeof(MP3File*));
+    ThreadPool* pool = count >= SORT_PARALLEL_THRESHOLD ? thread_pool_create(0) : NULL;
+    if (!victims) {
+        thread_pool_free(pool);
+        free_mp3_library(library);
+        return;
+    }
+    
+    SortSpec spec;
+    sort_spec_init(&spec, SORT_DEFAULT_FLAGS);
+    sort_spec_parse(&spec, "artist,album,disc,track");
+    
+    bench_timer_start(&timer);
+    SortedView* view = sorted_view_create(library, &spec, pool);
+    double create_ms = bench_timer_elapsed_ms(&timer);
+    if (!view) {
+        printf("Unable to create the sorted view.\n");
+        MEM_FREE(victims);
+        thread_pool_free(pool);
+        free_mp3_library(library);
+        return;
+    }
+    printf("Create:       %d tracks by artist,album,disc,track in %.2f ms\n", count, create_ms);
+    
+    // Pick records spread over the whole library
+    int step = changes > 0 ? count / changes : 1;
+    int picked = 0;
+    int i = 0;
+    for (MP3File* current = library->all_files; current && picked < changes; current = current->next, i++) {
+        if (i % step == 0) {
+            victims[picked++] = current;
+        }
+    }
+    
+    // View maintenance alone: take each record out and put it back
+    bench_timer_start(&timer);
+    for (i = 0; i < picked; i++) {
+        sorted_view_remove(view, victims[i]);
+    }
+    double remove_ms = bench_timer_elapsed_ms(&timer);
+    bench_timer_start(&timer);
+    for (i = 0; i < picked; i++) {
+        sorted_view_insert(view, victims[i]);
+    }
+    double insert_ms = bench_timer_elapsed_ms(&timer);
+    printf("Update:       remove %.2f us, insert %.2f us per track (%d tracks)\n",
+           picked > 0 ? remove_ms * 1000.0 / picked : 0.0, picked > 0 ? insert_ms * 1000.0 / picked : 0.0, picked);
+    
+    // A scan pass: tracks disappear and new ones are found, the view follows the library
+    bench_timer_start(&timer);
+    library_remove_files(library, victims, picked);
+    char path[MAX_PATH_LENGTH];
+    for (i = 0; i < picked; i++) {
+        MP3File* file = (MP3File*)MEM_ALLOC(sizeof(MP3File));
+        if (!file) break;
+        
+        bench_fill_track(file, count + i, path, sizeof(path));
+        if (!library_add_file(library, file, path)) {
+            free_mp3_file(file);
+        }
+    }
+    double scan_ms = bench_timer_elapsed_ms(&timer);
+    printf("Scan pass:    %d removed, %d added in %.2f ms (library and view)\n", picked, picked, scan_ms);
+    
+    bench_timer_start(&timer);
+    sorted_view_relink(view);
+    double relink_ms = bench_timer_elapsed_ms(&timer);
+    
+    // What a view saves: sorting the whole library again after the scan
+    bench_timer_start(&timer);
+    sort_tracks_parallel(library, &library->all_files, &spec, pool);
+    double resort_ms = bench_timer_elapsed_ms(&timer);
+    printf("List:         relink %.2f ms vs full re-sort %.2f ms\n", relink_ms, resort_ms);
+    
+    printf("Order:        %s\n", bench_check_view(library, view, pool) &&
+           bench_check_collated(library->all_files, library->total_files, spec.flags) ? "ok" : "MISMATCH");
+    
+    sorted_view_free(view);
+    MEM_FREE(victims);
+    thread_pool_free(pool);
+    free_mp3_library(library);
+}
+
+// Filter by copying every matching record, as filter_mp3_files did before track views
+static int bench_legacy_filter(MP3Library* library, const MP3Filter* filter, MP3File** result) {
+    int count = 0;
+    *result = NULL;
+    
+    for (MP3File* current = library->all_files; current; current = current->next) {
+        const char* text = filter->filter_type == FILTER_BY_ARTIST ? current->metadata.artist
+                         : filter->filter_type == FILTER_BY_GENRE ? current->metadata.genre : current->metadata.title;
+        if (str_find_nocase(text, strlen(text), filter->filter_text, strlen(filter->filter_text)) == STR_NOT_FOUND) continue;
+        
+        MP3File* copy = (MP3File*)MEM_ALLOC_TAGGED(sizeof(MP3File), MEM_CAT_FILTER);
+        if (!copy) break;
+        *copy = *current;
+        copy->metadata.album_art = NULL;
+        copy->collation = NULL;
+        copy->next = *result;
+        *result = copy;
+        count++;
+    }
+    
+    return count;
+}
+
+// Filter results as id views against record copies: time, memory, sorting and paging
+void bench_track_views(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    static const struct {
+        int type;
+        const char* text;
+    } queries[] = {
+        { FILTER_BY_GENRE, "Rock" },
+        { FILTER_BY_ARTIST, "Pink Floyd" },
+        { FILTER_BY_TITLE, "Track 12" },
+        { FILTER_BY_TITLE, "no such title" },
+    };
+    
+    TrackView view;
+    track_view_init(&view);
+    
+    for (int q = 0; q < (int)(sizeof(queries) / sizeof(queries[0])); q++) {
+        MP3Filter filter;
+        filter.filter_type = queries[q].type;
+        snprintf(filter.filter_text, MAX_FILTER_LENGTH, "%s", queries[q].text);
+        
+        bench_timer_start(&timer);
+        int matches = filter_mp3_files(library, &filter, &view);
+        double view_ms = bench_timer_elapsed_ms(&timer);
+        
+        MP3File* copies;
+        bench_timer_start(&timer);
+        int copied = bench_legacy_filter(library, &filter, &copies);
+        double copy_ms = bench_timer_elapsed_ms(&timer);
+        
+        bench_timer_start(&timer);
+        while (copies) {
+            MP3File* next = copies->next;
+            MEM_FREE(copies);
+            copies = next;
+        }
+        double free_ms = bench_timer_elapsed_ms(&timer);
+        
+        printf("\"%s\": %d matches%s\n", queries[q].text, matches, matches == copied ? "" : " (MISMATCH with copies)");
+        printf("  View:       %.2f ms, %.1f KB of ids (%.1f KB allocated, reused by the next filter)\n", view_ms,
+               view.count * sizeof(TrackId) / 1024.0, view.capacity * sizeof(TrackId) / 1024.0);
+        printf("  Copies:     %.2f ms + %.2f ms to free, %.1f KB of records\n", copy_ms, free_ms,
+               copied * (double)sizeof(MP3File) / 1024.0);
+    }
+    
+    // Views compose with sorting and paging: sort the biggest result, then read one page
+    MP3Filter filter;
+    filter.filter_type = FILTER_BY_GENRE;
+    snprintf(filter.filter_text, MAX_FILTER_LENGTH, "%s", "Rock");
+    filter_mp3_files(library, &filter, &view);
+    
+    SortSpec spec;
+    sort_spec_init(&spec, SORT_DEFAULT_FLAGS);
+    sort_spec_parse(&spec, "artist,album,disc,track");
+    ThreadPool* pool = view.count >= SORT_PARALLEL_THRESHOLD ? thread_pool_create(0) : NULL;
+    bench_timer_start(&timer);
+    BOOL sorted = track_view_sort(library, &view, &spec, pool);
+    double sort_ms = bench_timer_elapsed_ms(&timer);
+    thread_pool_free(pool);
+    
+    MP3File* page[TRACK_VIEW_PAGE_SIZE];
+    int middle = view.count / 2;
+    bench_timer_start(&timer);
+    int resolved = track_view_page(library, &view, middle, TRACK_VIEW_PAGE_SIZE, page);
+    double page_ms = bench_timer_elapsed_ms(&timer);
+    
+    BOOL ordered = sorted;
+    for (int i = 0; ordered && i + 1 < resolved; i++) {
+        ordered = sort_compare_tracks(page[i], page[i + 1], &spec) <= 0;
+    }
+    printf("Sort view:    %d ids by artist,album,disc,track in %.2f ms\n", view.count, sort_ms);
+    printf("Page:         %d records from position %d resolved in %.3f ms (%s)\n", resolved, middle, page_ms,
+           ordered ? "ok" : "NOT SORTED");
+    
+    track_view_free(&view);
+    free_mp3_library(library);
+}
+
+static int bench_compare_ms(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Check a word search against the linear filter on the same field
+static BOOL bench_check_search(MP3Library* library, int field, int filter_type, const char* text, TrackView* view) {
+    MP3Filter filter;
+    filter.filter_type = filter_type;
+    snprintf(filter.filter_text, MAX_FILTER_LENGTH, "%s", text);
+    
+    int expected = filter_mp3_files(library, &filter, view);
+    return text_index_search(library->text, field, text, view) == expected;
+}
+
+// Inverted word index: build cost, memory, query latency percentiles and upkeep under removals
+void bench_text_index(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    int count = library->total_files;
+    TrackView view;
+    track_view_init(&view);
+    
+    // Build a second index from scratch; the library's own one was built track by track
+    UINT32* saved_docs = (UINT32*)MEM_ALLOC((count > 0 ? count : 1) * sizeof(UINT32));
+    TextIndex* fresh = text_index_create();
+    if (saved_docs && fresh) {
+        int i = 0;
+        for (MP3File* current = library->all_files; current; current = current->next) {
+            saved_docs[i++] = current->search_doc;
+        }
+        bench_timer_start(&timer);
+        for (MP3File* current = library->all_files; current; current = current->next) {
+            text_index_add(fresh, current);
+        }
+        double build_ms = bench_timer_elapsed_ms(&timer);
+        i = 0;
+        for (MP3File* current = library->all_files; current; current = current->next) {
+            current->search_doc = saved_docs[i++];
+        }
+        printf("Build:        %d tracks in %.2f ms (%.2f us/track)\n", count, build_ms,
+               count > 0 ? build_ms * 1000.0 / count : 0.0);
+    }
+    text_index_free(fresh);
+    MEM_FREE(saved_docs);
+    
+    TextIndex* index = library->text;
+    printf("Memory:       %d tokens, %.1f MB of postings, %.1f MB of tokens, %.1f MB of table and documents\n",
+           index->token_count, index->posting_bytes / 1048576.0, index->token_bytes / 1048576.0,
+           (index->capacity * sizeof(TextToken*) + index->doc_capacity * sizeof(TrackId)) / 1048576.0);
+    
+    static const struct {
+        int field;
+        const char* query;
+    } queries[] = {
+        { TEXT_FIELD_ANY, "floyd" },
+        { TEXT_FIELD_ANY, "pink floyd" },
+        { TEXT_FIELD_ANY, "the beatles" },
+        { TEXT_FIELD_ANY, "rock" },
+        { TEXT_FIELD_ANY, "miles davis blues" },
+        { TEXT_FIELD_ANY, "track 4711" },
+        { TEXT_FIELD_ANY, "album 123" },
+        { TEXT_FIELD_ANY, "Bj\xc3\xb6rk" },
+        { TEXT_FIELD_ARTIST, "davis" },
+        { TEXT_FIELD_ANY, "zeppelin queen" },
+        { TEXT_FIELD_ANY, "nothing matches this" },
+    };
+    int query_count = (int)(sizeof(queries) / sizeof(queries[0]));
+    
+    // Every query repeated, so that the percentiles cover the whole mix
+    int rounds = 100;
+    double* samples = (double*)MEM_ALLOC((size_t)rounds * query_count * sizeof(double));
+    if (!samples) {
+        track_view_free(&view);
+        free_mp3_library(library);
+        return;
+    }
+    
+    for (int q = 0; q < query_count; q++) {
+        double total_ms = 0.0;
+        int matches = 0;
+        for (int r = 0; r < rounds; r++) {
+            bench_timer_start(&timer);
+            matches = text_index_search(index, queries[q].field, queries[q].query, &view);
+            double ms = bench_timer_elapsed_ms(&timer);
+            samples[r * query_count + q] = ms;
+            total_ms += ms;
+        }
+        printf("  %-22s %7d matches, %.3f ms\n", queries[q].query, matches, total_ms / rounds);
+    }
+    
+    int sample_count = rounds * query_count;
+    qsort(samples, sample_count, sizeof(double), bench_compare_ms);
+    printf("Latency:      p50 %.3f ms, p99 %.3f ms, max %.3f ms over %d queries\n", samples[sample_count / 2],
+           samples[sample_count * 99 / 100], samples[sample_count - 1], sample_count);
+    MEM_FREE(samples);
+    
+    MP3Filter filter;
+    filter.filter_type = FILTER_BY_ARTIST;
+    snprintf(filter.filter_text, MAX_FILTER_LENGTH, "%s", "Pink Floyd");
+    bench_timer_start(&timer);
+    filter_mp3_files(library, &filter, &view);
+    double linear_ms = bench_timer_elapsed_ms(&timer);
+    printf("Linear:       filter by artist \"Pink Floyd\" in %.2f ms\n", linear_ms);
+    
+    BOOL same = bench_check_search(library, TEXT_FIELD_ARTIST, FILTER_BY_ARTIST, "Pink Floyd", &view) &&
+                bench_check_search(library, TEXT_FIELD_GENRE, FILTER_BY_GENRE, "Rock", &view);
+    printf("Check:        %s\n", same ? "ok" : "MISMATCH with the linear filter");
+    
+    // Remove 60% of the tracks: removals are O(1), then the index compacts itself
+    MP3File** victims = (MP3File**)MEM_ALLOC((count > 0 ? count : 1) * sizeof(MP3File*));
+    if (victims) {
+        int picked = 0;
+        int i = 0;
+        for (MP3File* current = library->all_files; current; current = current->next, i++) {
+            if (i % 5 < 3) {
+                victims[picked++] = current;
+            }
+        }
+        size_t postings_before = index->posting_bytes;
+        bench_timer_start(&timer);
+        library_remove_files(library, victims, picked);
+        double remove_ms = bench_timer_elapsed_ms(&timer);
+        printf("Removal:      %d tracks in %.2f ms (library and index), postings %.1f -> %.1f MB\n", picked, remove_ms,
+               postings_before / 1048576.0, index->posting_bytes / 1048576.0);
+        
+        same = bench_check_search(library, TEXT_FIELD_ARTIST, FILTER_BY_ARTIST, "Pink Floyd", &view) &&
+               bench_check_search(library, TEXT_FIELD_GENRE, FILTER_BY_GENRE, "Rock", &view);
+        printf("Check:        %s after removal (%u deleted documents left)\n", same ? "ok" : "MISMATCH", index->deleted_count);
+        MEM_FREE(victims);
+    }
+    
+    track_view_free(&view);
+    free_mp3_library(library);
+}
+
+// Trigram matching: extra memory over the word index, substring and typo query latency,
+// exact matching checked against the plain word search
+void bench_trigram_index(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    TextIndex* index = library->text;
+    int count = library->total_files;
+    TrackView view;
+    track_view_init(&view);
+    
+    size_t word_bytes = index->posting_bytes + index->token_bytes;
+    size_t trigram_bytes = index->trigram_bytes + (size_t)index->trigram_capacity * sizeof(TrigramList);
+    printf("Memory:       %d trigrams, %.1f MB (%.1f bytes/track) on top of %.1f MB of words and postings\n",
+           index->trigram_count, trigram_bytes / 1048576.0, count > 0 ? (double)trigram_bytes / count : 0.0,
+           word_bytes / 1048576.0);
+    
+    static const struct {
+        const char* query;
+        DWORD options;
+    } queries[] = {
+        { "beatl", TEXT_MATCH_SUBSTRING },
+        { "floy", TEXT_MATCH_SUBSTRING },
+        { "eppel", TEXT_MATCH_SUBSTRING },
+        { "471", TEXT_MATCH_SUBSTRING },
+        { "pi fl", TEXT_MATCH_SUBSTRING },
+        { "beatels", TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY },
+        { "zepelin", TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY },
+        { "pink floyed", TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY },
+        { "mlies davsi", TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY },
+        { "qxzv", TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY },
+    };
+    int query_count = (int)(sizeof(queries) / sizeof(queries[0]));
+    
+    int rounds = 50;
+    double* samples = (double*)MEM_ALLOC((size_t)rounds * query_count * sizeof(double));
+    if (!samples) {
+        track_view_free(&view);
+        free_mp3_library(library);
+        return;
+    }
+    
+    for (int q = 0; q < query_count; q++) {
+        double total_ms = 0.0;
+        int matches = 0;
+        unsigned short* ranks = NULL;
+        for (int r = 0; r < rounds; r++) {
+            bench_timer_start(&timer);
+            matches = text_index_match(index, TEXT_FIELD_ANY, queries[q].query, queries[q].options, &view, &ranks);
+            double ms = bench_timer_elapsed_ms(&timer);
+            samples[r * query_count + q] = ms;
+            total_ms += ms;
+        }
+        printf("  %-14s %-9s %7d matches, best rank %d, %.3f ms\n", queries[q].query,
+               (queries[q].options & TEXT_MATCH_FUZZY) ? "fuzzy" : "substring", matches,
+               matches > 0 && ranks ? ranks[0] : -1, total_ms / rounds);
+    }
+    
+    int sample_count = rounds * query_count;
+    qsort(samples, sample_count, sizeof(double), bench_compare_ms);
+    printf("Latency:      p50 %.3f ms, p99 %.3f ms, max %.3f ms over %d queries\n", samples[sample_count / 2],
+           samples[sample_count * 99 / 100], samples[sample_count - 1], sample_count);
+    MEM_FREE(samples);
+    
+    // Without options only whole words match, exactly like the plain word search
+    static const char* exact[] = { "pink floyd", "rock", "Bj\xc3\xb6rk", "track 4711" };
+    BOOL same = TRUE;
+    for (int i = 0; i < (int)(sizeof(exact) / sizeof(exact[0])); i++) {
+        int expected = text_index_search(index, TEXT_FIELD_ANY, exact[i], &view);
+        same = same && text_index_match(index, TEXT_FIELD_ANY, exact[i], 0, &view, NULL) == expected;
+    }
+    
+    // A prefix finds at least the tracks of the whole word, ranked after them
+    int whole = text_index_search(index, TEXT_FIELD_ANY, "floyd", &view);
+    unsigned short* ranks = NULL;
+    int partial = text_index_match(index, TEXT_FIELD_ANY, "floyd", TEXT_MATCH_SUBSTRING, &view, &ranks);
+    same = same && partial >= whole;
+    for (int i = 1; same && i < partial; i++) {
+        same = ranks[i - 1] <= ranks[i];
+    }
+    printf("Check:        %s\n", same ? "ok" : "MISMATCH with the word search");
+    
+    track_view_free(&view);
+    free_mp3_library(library);
+}
+
+// Collects what a search session delivers, and when its first batch arrived
+typedef struct {
+    BenchTimer timer;
+    double first_ms;
+    LONG last_query;
+    int batches;
+    int delivered;
+    int malformed;                   // Batches outside the result, without ids, or a last one short of total
+} BenchSearchSink;
+
+static void bench_search_sink(void* context, LONG query_id, const TrackId* ids, const unsigned short* ranks,
+                              int first, int count, int total, BOOL last) {
+    BenchSearchSink* sink = (BenchSearchSink*)context;
+    if (first == 0) {
+        sink->first_ms = bench_timer_elapsed_ms(&sink->timer);
+        sink->delivered = 0;
+    }
+    sink->last_query = query_id;
+    sink->batches++;
+    sink->delivered += count;
+    
+    BOOL valid = first >= 0 && count >= 0 && first + count <= total && (count == 0 || (ids && ranks)) &&
+                 (!last || first + count == total);
+    for (int i = 0; valid && i < count; i++) {
+        valid = ids[i] != INVALID_TRACK_ID;
+    }
+    if (!valid) {
+        sink->malformed++;
+    }
+}
+
+static int bench_compare_ids(const void* a, const void* b) {
+    TrackId x = *(const TrackId*)a;
+    TrackId y = *(const TrackId*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Same tracks and same rank total as a fresh index query (the order of equal ranks may differ)
+static BOOL bench_check_session(SearchSession* session, TrackView* fresh, unsigned short* fresh_ranks) {
+    if (session->results.tracks.count != fresh->count) return FALSE;
+    
+    long rank_total = 0;
+    for (int i = 0; i < fresh->count; i++) {
+        rank_total += fresh_ranks[i] - session->results.ranks[i];
+        if (i > 0 && session->results.ranks[i - 1] > session->results.ranks[i]) return FALSE;
+    }
+    
+    TrackId* ids = (TrackId*)MEM_ALLOC((size_t)(fresh->count > 0 ? fresh->count : 1) * sizeof(TrackId));
+    if (!ids) return FALSE;
+    memcpy(ids, session->results.tracks.ids, (size_t)fresh->count * sizeof(TrackId));
+    qsort(ids, fresh->count, sizeof(TrackId), bench_compare_ids);
+    qsort(fresh->ids, fresh->count, sizeof(TrackId), bench_compare_ids);
+    BOOL same = rank_total == 0 && (fresh->count == 0 || memcmp(ids, fresh->ids, (size_t)fresh->count * sizeof(TrackId)) == 0);
+    MEM_FREE(ids);
+    return same;
+}
+
+// Search as you type: every prefix of a few queries, answered by a session that refines
+// the previous results, against a fresh index query per keystroke; then a burst of
+// keystrokes on a background session, where stale queries are cancelled
+void bench_search_session(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    static const char* typed[] = {
+        "pink floyd blues", "miles davis jazz", "the beatles album 7", "radiohead electronic", "track 4711", "zepelin",
+    };
+    int typed_count = (int)(sizeof(typed) / sizeof(typed[0]));
+    
+    int keystrokes = 0;
+    for (int t = 0; t < typed_count; t++) {
+        keystrokes += (int)strlen(typed[t]);
+    }
+    
+    double* session_ms = (double*)MEM_ALLOC((size_t)keystrokes * sizeof(double));
+    double* first_ms = (double*)MEM_ALLOC((size_t)keystrokes * sizeof(double));
+    double* fresh_ms = (double*)MEM_ALLOC((size_t)keystrokes * sizeof(double));
+    BenchSearchSink sink;
+    memset(&sink, 0, sizeof(sink));
+    SearchSession* session = search_session_create(library, TEXT_FIELD_ANY, TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY, FALSE,
+                                                    bench_search_sink, &sink);
+    TrackView fresh;
+    track_view_init(&fresh);
+    unsigned short* fresh_ranks = NULL;
+    int fresh_capacity = 0;
+    
+    BOOL same = TRUE;
+    int k = 0;
+    for (int t = 0; session && session_ms && first_ms && fresh_ms && t < typed_count; t++) {
+        char query[SEARCH_QUERY_MAX];
+        int length = (int)strlen(typed[t]);
+        
+        // A new query from scratch, then one more letter per keystroke
+        search_session_cancel(session);
+        for (int l = 1; l <= length; l++, k++) {
+            memcpy(query, typed[t], l);
+            query[l] = '\0';
+            
+            bench_timer_start(&sink.timer);
+            search_session_update(session, query);
+            session_ms[k] = bench_timer_elapsed_ms(&sink.timer);
+            first_ms[k] = sink.first_ms;
+            
+            unsigned short* ranks = NULL;
+            bench_timer_start(&timer);
+            int count = text_index_match(library->text, TEXT_FIELD_ANY, query, TEXT_MATCH_SUBSTRING, &fresh, &ranks);
+            if (count == 0) {
+                count = text_index_match(library->text, TEXT_FIELD_ANY, query, TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY,
+                                         &fresh, &ranks);
+            }
+            fresh_ms[k] = bench_timer_elapsed_ms(&timer);
+            
+            if (count > fresh_capacity) {
+                unsigned short* grown = (unsigned short*)MEM_REALLOC(fresh_ranks, (size_t)count * sizeof(unsigned short));
+                if (!grown) break;
+                fresh_ranks = grown;
+                fresh_capacity = count;
+            }
+            if (count > 0) {
+                memcpy(fresh_ranks, ranks, (size_t)count * sizeof(unsigned short));
+            }
+            same = same && count >= 0 && bench_check_session(session, &fresh, fresh_ranks);
+        }
+        printf("  %-22s %7d matches after %d keystrokes\n", typed[t], session->results.tracks.count, length);
+    }
+    
+    if (session && k == keystrokes) {
+        double session_total = 0.0;
+        double fresh_total = 0.0;
+        for (int i = 0; i < keystrokes; i++) {
+            session_total += session_ms[i];
+            fresh_total += fresh_ms[i];
+        }
+        qsort(session_ms, keystrokes, sizeof(double), bench_compare_ms);
+        qsort(first_ms, keystrokes, sizeof(double), bench_compare_ms);
+        qsort(fresh_ms, keystrokes, sizeof(double), bench_compare_ms);
+        printf("Session:      p50 %.3f ms, p99 %.3f ms, max %.3f ms per keystroke, total %.1f ms\n",
+               session_ms[keystrokes / 2], session_ms[keystrokes * 99 / 100], session_ms[keystrokes - 1], session_total);
+        printf("First batch:  p50 %.3f ms, p99 %.3f ms (%d results)\n", first_ms[keystrokes / 2],
+               first_ms[keystrokes * 99 / 100], SEARCH_FIRST_BATCH);
+        printf("Fresh query:  p50 %.3f ms, p99 %.3f ms, max %.3f ms per keystroke, total %.1f ms\n",
+               fresh_ms[keystrokes / 2], fresh_ms[keystrokes * 99 / 100], fresh_ms[keystrokes - 1], fresh_total);
+        printf("Reuse:        %d of %d keystrokes refined the previous results, %d asked the index\n",
+               session->refined, keystrokes, session->indexed);
+        printf("Check:        %s\n", !same ? "MISMATCH with fresh index queries" :
+                                      sink.malformed ? "MALFORMED batches delivered" : "ok");
+    }
+    search_session_free(session);
+    
+    // Keystrokes faster than the queries: every query but the last is cancelled or never delivered
+    memset(&sink, 0, sizeof(sink));
+    session = search_session_create(library, TEXT_FIELD_ANY, TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY, TRUE,
+                                    bench_search_sink, &sink);
+    if (session) {
+        const char* burst = "the beatles album 1";
+        int length = (int)strlen(burst);
+        char query[SEARCH_QUERY_MAX];
+        LONG last_id = 0;
+        
+        bench_timer_start(&timer);
+        bench_timer_start(&sink.timer);
+        for (int l = 1; l <= length; l++) {
+            memcpy(query, burst, l);
+            query[l] = '\0';
+            last_id = search_session_update(session, query);
+        }
+        search_session_wait(session);
+        double burst_ms = bench_timer_elapsed_ms(&timer);
+        
+        int expected = text_index_match(library->text, TEXT_FIELD_ANY, burst, TEXT_MATCH_SUBSTRING, &fresh, NULL);
+        printf("Burst:        %d keystrokes in %.2f ms, %d queries cancelled, %d batches delivered\n", length, burst_ms,
+               session->cancelled, sink.batches);
+        printf("Check:        %s\n", sink.last_query != last_id || sink.delivered != expected ? "STALE RESULTS delivered" :
+                                      sink.malformed ? "MALFORMED batches delivered" : "ok");
+        search_session_free(session);
+    }
+    
+    MEM_FREE(session_ms);
+    MEM_FREE(first_ms);
+    MEM_FREE(fresh_ms);
+    MEM_FREE(fresh_ranks);
+    track_view_free(&fresh);
+    free_mp3_library(library);
+}
+
+// Planned boolean filters against testing every record, with and without a
+// sorted view on year for the planner to use
+void bench_filter_query(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library) {
+        printf("Unable to create benchmark library.\n");
+        return;
+    }
+    
+    static const char* queries[] = {
+        "artist:queen AND year:1975..1980 AND NOT genre:jazz",
+        "year:1990",
+        "duration:3:00..3:30",
+        "genre:blues OR genre:folk",
+        "NOT artist:beatles",
+        "title:4711",
+        "artist:\"pink floyd\" track:1..3",
+        "(artist:queen OR artist:nirvana) AND year:>=2000 AND duration:<200",
+        "album:12 year:1960..1999 NOT (genre:rock OR genre:pop)",
+        "title~\"ck 4711\"",
+        "artist~oyd year:1970..1979",
+    };
+    int query_count = (int)(sizeof(queries) / sizeof(queries[0]));
+    
+    TrackView planned;
+    TrackView scanned;
+    track_view_init(&planned);
+    track_view_init(&scanned);
+    SortedView* years = NULL;
+    BOOL all_ok = TRUE;
+    int rounds = 5;
+    
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            SortSpec spec;
+            sort_spec_init(&spec, SORT_DEFAULT_FLAGS);
+            sort_spec_add_key(&spec, SORT_BY_YEAR, FALSE);
+            years = sorted_view_create(library, &spec, NULL);
+            if (!years) break;
+            printf("With a sorted view on year:\n");
+        } else {
+            printf("Word index only:\n");
+        }
+        
+        for (int q = 0; q < query_count; q++) {
+            char error[FILTER_QUERY_ERROR_MAX];
+            FilterQuery* query = filter_query_parse(queries[q], error, sizeof(error));
+            if (!query) {
+                printf("  %s: %s\n", queries[q], error);
+                all_ok = FALSE;
+                continue;
+            }
+            
+            double planned_ms = 0.0;
+            double scanned_ms = 0.0;
+            for (int r = 0; r < rounds; r++) {
+                bench_timer_start(&timer);
+                filter_query_run(query, library, &planned);
+                planned_ms += bench_timer_elapsed_ms(&timer);
+                
+                bench_timer_start(&timer);
+                track_view_clear(&scanned);
+                for (MP3File* current = library->all_files; current; current = current->next) {
+                    if (filter_query_matches(query, current)) {
+                        track_view_add(&scanned, current->id);
+                    }
+                }
+                scanned_ms += bench_timer_elapsed_ms(&timer);
+            }
+            
+            // Same tracks, whatever the order
+            BOOL same = planned.count == scanned.count;
+            if (same && planned.count > 0) {
+                qsort(planned.ids, planned.count, sizeof(TrackId), bench_compare_ids);
+                qsort(scanned.ids, scanned.count, sizeof(TrackId), bench_compare_ids);
+                same = memcmp(planned.ids, scanned.ids, (size_t)planned.count * sizeof(TrackId)) == 0;
+            }
+            all_ok = all_ok && same;
+            
+            printf("  %-68s %7d matches, planned %8.3f ms, scan %8.3f ms%s\n", queries[q], planned.count,
+                   planned_ms / rounds, scanned_ms / rounds, same ? "" : "  MISMATCH");
+            
+            if (q == 0 || (pass == 1 && q == 1)) {
+                char plan[2048];
+                filter_query_explain(query, plan, sizeof(plan));
+                printf("%s", plan);
+            }
+            filter_query_free(query);
+        }
+    }
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    
+    sorted_view_free(years);
+    track_view_free(&planned);
+    track_view_free(&scanned);
+    free_mp3_library(library);
+}
+
+static void bench_count_entry(UINT32 entry, void* context) {
+    (void)entry;
+    (*(int*)context)++;
+}
+
+// Case-insensitive substring scan of the word index's string pools: throughput of each
+// kernel the processor supports, against strstr on every record
+void bench_strscan(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library || !library->text) {
+        printf("Unable to create benchmark library.\n");
+        free_mp3_library(library);
+        return;
+    }
+    
+    static const struct {
+        int field;
+        const char* needle;
+    } scans[] = {
+        { TEXT_FIELD_TITLE, "track 4711" },
+        { TEXT_FIELD_TITLE, "k 9" },
+        { TEXT_FIELD_TITLE, "no such title" },
+        { TEXT_FIELD_ARTIST, "ZEPPELIN" },
+        { TEXT_FIELD_ALBUM, "album 1234" },
+    };
+    int scan_count = (int)(sizeof(scans) / sizeof(scans[0]));
+    int rounds = 10;
+    int selected = str_scan_level();
+    BOOL all_ok = TRUE;
+    
+    printf("Kernels:      best available is %s\n", str_scan_level_name(selected));
+    for (int s = 0; s < scan_count; s++) {
+        const StringPool* pool = text_index_pool(library->text, scans[s].field);
+        size_t length = strlen(scans[s].needle);
+        printf("  \"%s\" over %.1f MB:\n", scans[s].needle, pool->size / (1024.0 * 1024.0));
+        
+        int expected = -1;
+        for (int level = STR_SCAN_SCALAR; level < STR_SCAN_LEVELS; level++) {
+            if (!str_scan_supported(level)) continue;
+            
+            str_scan_set_level(level);
+            int matches = 0;
+            bench_timer_start(&timer);
+            for (int r = 0; r < rounds; r++) {
+                matches = 0;
+                string_pool_find(pool, scans[s].needle, length, bench_count_entry, &matches);
+            }
+            double ms = bench_timer_elapsed_ms(&timer) / rounds;
+            
+            if (expected < 0) expected = matches;
+            BOOL same = matches == expected;
+            all_ok = all_ok && same;
+            printf("    %-8s %7d matches, %8.3f ms, %6.2f GB/s%s\n", str_scan_level_name(level), matches, ms,
+                   ms > 0 ? pool->size / (ms * 1e6) : 0.0, same ? "" : "  MISMATCH");
+        }
+        
+        // strstr per record is case sensitive, so only its speed compares
+        int found = 0;
+        bench_timer_start(&timer);
+        for (int r = 0; r < rounds; r++) {
+            found = 0;
+            for (UINT32 entry = 0; entry < pool->count; entry++) {
+                if (strstr(pool->text + pool->offsets[entry], scans[s].needle)) found++;
+            }
+        }
+        double ms = bench_timer_elapsed_ms(&timer) / rounds;
+        printf("    %-8s %7d matches, %8.3f ms, %6.2f GB/s (case sensitive)\n", "strstr", found, ms,
+               ms > 0 ? pool->size / (ms * 1e6) : 0.0);
+    }
+    str_scan_set_level(selected);
+    
+    // The legacy filter tests each record in list order with the selected kernel
+    MP3Filter filter;
+    filter.filter_type = FILTER_BY_TITLE;
+    snprintf(filter.filter_text, MAX_FILTER_LENGTH, "%s", "track 4711");
+    TrackView view;
+    track_view_init(&view);
+    bench_timer_start(&timer);
+    int matches = filter_mp3_files(library, &filter, &view);
+    printf("Filter:       title \"track 4711\" per record in %.3f ms, %d matches\n", bench_timer_elapsed_ms(&timer),
+           matches);
+    track_view_free(&view);
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH between kernels");
+    free_mp3_library(library);
+}
+
+#define BENCH_PLAYLIST_FILE "bench_playlist.m3plist"
+
+// Same track ids, in the same order, in two playlists
+static BOOL bench_same_tracks(Playlist* a, Playlist* b) {
+    if (a->track_count != b->track_count) return FALSE;
+    
+    int length = 0;
+    for (int i = 0; i < a->track_count; i += length) {
+        const TrackId* run = track_seq_run(&a->tracks, i, &length);
+        for (int k = 0; run && k < length; k++) {
+            if (track_seq_get(&b->tracks, i + k) != run[k]) return FALSE;
+        }
+        if (!run) return FALSE;
+    }
+    return TRUE;
+}
+
+// Load a playlist as playlist_load did before: fgets into a MAX_PATH buffer and one
+// library lookup per line. Missing tracks are dropped and long lines are cut.
+static Playlist* bench_legacy_playlist_load(const char* filename, MP3Library* library) {
+    FILE* file = fopen(filename, "r");
+    if (!file) return NULL;
+    
+    char buffer[MAX_PATH];
+    Playlist* playlist = playlist_create("Legacy", "");
+    BOOL tracks = FALSE;
+    while (playlist && fgets(buffer, sizeof(buffer), file)) {
+        buffer[strcspn(buffer, "\r\n")] = 0;
+        if (!tracks) {
+            tracks = strncmp(buffer, "[Tracks]", 8) == 0;
+            continue;
+        }
+        
+        char* separator = strchr(buffer, '=');
+        MP3File* track = separator ? library_find_by_path(library, separator + 1) : NULL;
+        if (track) {
+            playlist_add_track(playlist, track);
+        }
+    }
+    
+    fclose(file);
+    return playlist;
+}
+
+// Write a playlist text file of runs of consecutive library tracks, like albums, with
+// one entry in 20 gone and the first one at first_path. Returns the number of missing
+// entries, -1 if the file cannot be written.
+static int bench_write_playlist(const char* filename, int size, MP3File** tracks, int count,
+                                const char* first_path) {
+    FILE* file = fopen(filename, "w");
+    if (!file) return -1;
+    
+    fprintf(file, "[Playlist]\nName=Bench %d\nDescription=Synthetic\nTrackCount=%d\n\n[Tracks]\n", size, size);
+    fprintf(file, "0=%s\n", first_path);
+    int missing = 1;
+    int start = 0;
+    for (int i = 1; i < size; i++) {
+        if (i % BENCH_TRACKS_PER_ALBUM == 1) {
+            start = (int)(bench_rand() % count);
+        }
+        if (bench_rand() % 20 == 0) {
+            fprintf(file, "%d=C:\\Music\\Gone\\Missing %d.mp3\n", i, i);
+            missing++;
+            continue;
+        }
+        char* path = mp3_file_dup_path(tracks[(start + i % BENCH_TRACKS_PER_ALBUM) % count]);
+        if (path) {
+            fprintf(file, "%d=%s\n", i, path);
+            MEM_FREE(path);
+        }
+    }
+    fclose(file);
+    return missing;
+}
+
+// Playlist loading: one pass and batched path lookups against the line by line loader
+void bench_playlist_load(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    int count = library ? library->total_files : 0;
+    MP3File** tracks = count > 0 ? (MP3File**)MEM_ALLOC(count * sizeof(MP3File*)) : NULL;
+    if (!tracks) {
+        printf("Unable to create benchmark library.\n");
+        free_mp3_library(library);
+        return;
+    }
+    
+    int filled = 0;
+    for (MP3File* current = library->all_files; current && filled < count; current = current->next) {
+        tracks[filled++] = current;
+    }
+    
+    // A path longer than MAX_PATH, which fgets used to cut in two
+    char long_path[MAX_PATH + 64];
+    memset(long_path, 'x', sizeof(long_path) - 1);
+    memcpy(long_path, "C:\\Music\\Gone\\", 15);
+    long_path[sizeof(long_path) - 1] = '\0';
+    
+    static const int sizes[] = { 1000, 10000, 100000 };
+    BOOL all_ok = TRUE;
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int size = sizes[s];
+        
+        int missing = bench_write_playlist(BENCH_PLAYLIST_FILE, size, tracks, count, long_path);
+        if (missing < 0) {
+            printf("Unable to write %s.\n", BENCH_PLAYLIST_FILE);
+            break;
+        }
+        
+        bench_timer_start(&timer);
+        Playlist* legacy = bench_legacy_playlist_load(BENCH_PLAYLIST_FILE, library);
+        double legacy_ms = bench_timer_elapsed_ms(&timer);
+        
+        bench_timer_start(&timer);
+        Playlist* loaded = playlist_load(BENCH_PLAYLIST_FILE, library);
+        double load_ms = bench_timer_elapsed_ms(&timer);
+        
+        // The tracks found are the same, in the same order, and nothing else is lost
+        BOOL same = legacy && loaded && loaded->track_count == size &&
+                    (int)loaded->missing_paths.count == missing && legacy->track_count == size - missing;
+        for (int i = 0, j = 0; same && i < loaded->track_count; i++) {
+            TrackId id = track_seq_get(&loaded->tracks, i);
+            if (library_get_track(library, id)) {
+                same = track_seq_get(&legacy->tracks, j++) == id;
+            }
+        }
+        same = same && strcmp(playlist_missing_path(loaded, track_seq_get(&loaded->tracks, 0)), long_path) == 0;
+        
+        // Saving keeps the placeholders
+        Playlist* again = NULL;
+        if (same && playlist_save(loaded, BENCH_PLAYLIST_FILE, library)) {
+            again = playlist_load(BENCH_PLAYLIST_FILE, library);
+            same = again && bench_same_tracks(again, loaded);
+        }
+        all_ok = all_ok && same;
+        
+        printf("%7d entries: line by line %8.2f ms (%d kept), one pass %8.2f ms (%d placeholders)%s\n", size,
+               legacy_ms, legacy ? legacy->track_count : 0, load_ms, loaded ? (int)loaded->missing_paths.count : 0,
+               same ? "" : "  MISMATCH");
+        
+        playlist_free(legacy);
+        playlist_free(loaded);
+        playlist_free(again);
+    }
+    remove(BENCH_PLAYLIST_FILE);
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    MEM_FREE(tracks);
+    free_mp3_library(library);
+}
+
+#define BENCH_PLAYLIST_DIR "bench_playlists"
+#define BENCH_PLAYLIST_COUNT 1000
+#define BENCH_PLAYLIST_TRACKS 200
+
+// Same tracks in every playlist of two managers loaded from the same directory
+static BOOL bench_same_playlists(PlaylistManager* a, PlaylistManager* b) {
+    if (a->count != b->count) return FALSE;
+    
+    for (int i = 0; i < a->count; i++) {
+        Playlist* x = a->playlists[i];
+        Playlist* y = b->playlists[i];
+        if (!playlist_materialize(x) || !playlist_materialize(y) || !bench_same_tracks(x, y)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Startup with many playlists: indexing headers only, opening one, and loading them all
+// serially or over a thread pool
+void bench_playlist_startup(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    int count = library ? library->total_files : 0;
+    MP3File** tracks = count > 0 ? (MP3File**)MEM_ALLOC(count * sizeof(MP3File*)) : NULL;
+    PlaylistManager* saved = playlist_manager_create();
+    if (!tracks || !saved) {
+        printf("Unable to create benchmark library.\n");
+        MEM_FREE(tracks);
+        playlist_manager_free(saved);
+        free_mp3_library(library);
+        return;
+    }
+    
+    int filled = 0;
+    for (MP3File* current = library->all_files; current && filled < count; current = current->next) {
+        tracks[filled++] = current;
+    }
+    
+    // Playlists of album-like runs of tracks
+    for (int p = 0; p < BENCH_PLAYLIST_COUNT; p++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Bench %04d", p);
+        Playlist* playlist = playlist_create(name, "Synthetic");
+        if (!playlist || !playlist_manager_add(saved, playlist)) {
+            playlist_free(playlist);
+            break;
+        }
+        
+        int start = 0;
+        for (int i = 0; i < BENCH_PLAYLIST_TRACKS; i++) {
+            if (i % BENCH_TRACKS_PER_ALBUM == 0) {
+                start = (int)(bench_rand() % count);
+            }
+            playlist_add_track(playlist, tracks[(start + i % BENCH_TRACKS_PER_ALBUM) % count]);
+        }
+    }
+    
+    bench_timer_start(&timer);
+    BOOL written = playlist_manager_save_all(saved, BENCH_PLAYLIST_DIR, library);
+    printf("Save:         %d playlists of %d tracks in %.1f ms\n", saved->count, BENCH_PLAYLIST_TRACKS,
+           bench_timer_elapsed_ms(&timer));
+    
+    BOOL all_ok = written;
+    PlaylistManager* indexed = playlist_manager_create();
+    if (written && indexed) {
+        // Startup: headers only
+        bench_timer_start(&timer);
+        playlist_manager_load_all(indexed, BENCH_PLAYLIST_DIR, library);
+        double index_ms = bench_timer_elapsed_ms(&timer);
+        
+        int pending = 0;
+        long listed = 0;
+        for (int i = 0; i < indexed->count; i++) {
+            pending += indexed->playlists[i]->source != NULL;
+            listed += indexed->playlists[i]->track_count;
+        }
+        printf("Index:        %d playlists (%ld tracks listed, %d not loaded) in %.1f ms\n", indexed->count, listed,
+               pending, index_ms);
+        all_ok = all_ok && indexed->count == saved->count && listed == (long)saved->count * BENCH_PLAYLIST_TRACKS;
+        
+        // The user opens one of them
+        Playlist* first = playlist_manager_get(indexed, 0);
+        bench_timer_start(&timer);
+        BOOL opened = first && playlist_materialize(first);
+        printf("First open:   %d tracks resolved in %.3f ms\n", first ? first->track_count : 0,
+               bench_timer_elapsed_ms(&timer));
+        all_ok = all_ok && opened;
+        
+        // Everything up front, as before, then over more and more threads
+        int thread_counts[] = { 0, 2, 4, thread_pool_cpu_count() };
+        for (int t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+            if (t == 3 && thread_counts[t] <= 4) continue; // Already measured
+            
+            PlaylistManager* eager = playlist_manager_create();
+            ThreadPool* pool = thread_counts[t] > 0 ? thread_pool_create(thread_counts[t]) : NULL;
+            if (!eager) break;
+            
+            bench_timer_start(&timer);
+            playlist_manager_load_all(eager, BENCH_PLAYLIST_DIR, library);
+            BOOL loaded = playlist_manager_materialize_all(eager, pool);
+            double eager_ms = bench_timer_elapsed_ms(&timer);
+            
+            BOOL same = loaded && bench_same_playlists(eager, indexed);
+            all_ok = all_ok && same;
+            if (thread_counts[t] > 0) {
+                printf("Eager:        %d threads, %.1f ms%s\n", thread_counts[t], eager_ms, same ? "" : "  MISMATCH");
+            } else {
+                printf("Eager:        serial, %.1f ms%s\n", eager_ms, same ? "" : "  MISMATCH");
+            }
+            
+            thread_pool_free(pool);
+            playlist_manager_free(eager);
+        }
+    }
+    
+    // Remove the files written by save_all
+    for (int i = 0; i < saved->count; i++) {
+        if (saved->playlists[i]->file) {
+            DeleteFile(saved->playlists[i]->file);
+        }
+    }
+    RemoveDirectory(BENCH_PLAYLIST_DIR);
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    playlist_manager_free(indexed);
+    playlist_manager_free(saved);
+    MEM_FREE(tracks);
+    free_mp3_library(library);
+}
+
+#define BENCH_PLAYLIST_BINARY_FILE "bench_playlist.m3pbin"
+#define BENCH_PLAYLIST_COPY_FILE "bench_playlist_copy.m3plist"
+
+// Size of a file in bytes, -1 if it cannot be opened
+static long bench_file_size(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return -1;
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// Same tracks and placeholders in two playlists
+static BOOL bench_same_playlist(Playlist* a, Playlist* b) {
+    if (!a || !b || !playlist_materialize(a) || !playlist_materialize(b) || !bench_same_tracks(a, b) ||
+        a->missing_paths.count != b->missing_paths.count) {
+        return FALSE;
+    }
+    for (UINT32 i = 0; i < a->missing_paths.count; i++) {
+        if (a->missing_ids[i] != b->missing_ids[i] ||
+            strcmp(a->missing_paths.text + a->missing_paths.offsets[i],
+                   b->missing_paths.text + b->missing_paths.offsets[i]) != 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Binary playlists: save and load time and file size against the text format, and the
+// round trip text -> binary -> text
+void bench_playlist_binary(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    int count = library ? library->total_files : 0;
+    MP3File** tracks = count > 0 ? (MP3File**)MEM_ALLOC(count * sizeof(MP3File*)) : NULL;
+    if (!tracks) {
+        printf("Unable to create benchmark library.\n");
+        free_mp3_library(library);
+        return;
+    }
+    
+    int filled = 0;
+    for (MP3File* current = library->all_files; current && filled < count; current = current->next) {
+        tracks[filled++] = current;
+    }
+    
+    static const int sizes[] = { 1000, 10000, 100000 };
+    BOOL all_ok = TRUE;
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int size = sizes[s];
+        if (bench_write_playlist(BENCH_PLAYLIST_FILE, size, tracks, count, "C:\\Music\\Gone\\First.mp3") < 0) {
+            printf("Unable to write %s.\n", BENCH_PLAYLIST_FILE);
+            break;
+        }
+        Playlist* source = playlist_load(BENCH_PLAYLIST_FILE, library);
+        if (!source) break;
+        
+        bench_timer_start(&timer);
+        BOOL saved = playlist_save(source, BENCH_PLAYLIST_FILE, library);
+        double text_save_ms = bench_timer_elapsed_ms(&timer);
+        
+        bench_timer_start(&timer);
+        saved = playlist_save_binary(source, BENCH_PLAYLIST_BINARY_FILE, library) && saved;
+        double binary_save_ms = bench_timer_elapsed_ms(&timer);
+        
+        bench_timer_start(&timer);
+        Playlist* text = playlist_load(BENCH_PLAYLIST_FILE, library);
+        double text_load_ms = bench_timer_elapsed_ms(&timer);
+        
+        bench_timer_start(&timer);
+        Playlist* binary = playlist_load(BENCH_PLAYLIST_BINARY_FILE, library);
+        double binary_load_ms = bench_timer_elapsed_ms(&timer);
+        
+        // Back to text gives the same playlist, and an indexed binary file the same tracks
+        Playlist* indexed = playlist_index(BENCH_PLAYLIST_BINARY_FILE, library);
+        Playlist* copy = binary && playlist_save(binary, BENCH_PLAYLIST_COPY_FILE, library)
+                             ? playlist_load(BENCH_PLAYLIST_COPY_FILE, library)
+                             : NULL;
+        BOOL same = saved && bench_same_playlist(source, text) && bench_same_playlist(source, binary) &&
+                    indexed && indexed->source && indexed->track_count == size &&
+                    strcmp(indexed->name, source->name) == 0 && bench_same_playlist(source, indexed) &&
+                    bench_same_playlist(source, copy);
+        all_ok = all_ok && same;
+        
+        long text_bytes = bench_file_size(BENCH_PLAYLIST_FILE);
+        long binary_bytes = bench_file_size(BENCH_PLAYLIST_BINARY_FILE);
+        printf("%7d entries: text %9ld bytes, save %7.2f ms, load %7.2f ms\n", size, text_bytes, text_save_ms,
+               text_load_ms);
+        printf("%7s          binary %7ld bytes, save %7.2f ms, load %7.2f ms (%.1fx smaller, %.1fx faster load)%s\n",
+               "", binary_bytes, binary_save_ms, binary_load_ms,
+               binary_bytes > 0 ? (double)text_bytes / binary_bytes : 0.0,
+               binary_load_ms > 0 ? text_load_ms / binary_load_ms : 0.0, same ? "" : "  MISMATCH");
+        
+        playlist_free(source);
+        playlist_free(text);
+        playlist_free(binary);
+        playlist_free(indexed);
+        playlist_free(copy);
+    }
+    remove(BENCH_PLAYLIST_FILE);
+    remove(BENCH_PLAYLIST_BINARY_FILE);
+    remove(BENCH_PLAYLIST_COPY_FILE);
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    MEM_FREE(tracks);
+    free_mp3_library(library);
+}
+
+#define BENCH_PLAYLIST_LOG_FILE BENCH_PLAYLIST_FILE ".log"
+#define BENCH_SAVE_TRACKS 50000
+#define BENCH_SAVE_EDITS 100
+
+// Saving after small edits: whole atomic rewrites against appending to the change log,
+// reloading through the log, a batch cut by a crash, compaction and save_all skipping
+// unchanged playlists
+void bench_playlist_save(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    int count = library ? library->total_files : 0;
+    MP3File** tracks = count > 0 ? (MP3File**)MEM_ALLOC(count * sizeof(MP3File*)) : NULL;
+    Playlist* playlist = playlist_create("Bench Save", "Synthetic");
+    if (!tracks || !playlist) {
+        printf("Unable to create benchmark library.\n");
+        MEM_FREE(tracks);
+        playlist_free(playlist);
+        free_mp3_library(library);
+        return;
+    }
+    
+    int filled = 0;
+    for (MP3File* current = library->all_files; current && filled < count; current = current->next) {
+        tracks[filled++] = current;
+    }
+    
+    int start = 0;
+    for (int i = 0; i < BENCH_SAVE_TRACKS; i++) {
+        if (i % BENCH_TRACKS_PER_ALBUM == 0) {
+            start = (int)(bench_rand() % count);
+        }
+        playlist_add_track(playlist, tracks[(start + i % BENCH_TRACKS_PER_ALBUM) % count]);
+    }
+    
+    bench_timer_start(&timer);
+    BOOL all_ok = playlist_save(playlist, BENCH_PLAYLIST_FILE, library);
+    printf("First save:   %d tracks written whole in %.2f ms\n", playlist->track_count, bench_timer_elapsed_ms(&timer));
+    
+    // One edit then a save, as a user reordering or adding a track; every other save
+    // goes to the change log
+    double whole_ms = 0;
+    double logged_ms = 0;
+    for (int e = 0; all_ok && e < BENCH_SAVE_EDITS; e++) {
+        int from = (int)(bench_rand() % playlist->track_count);
+        int to = (int)(bench_rand() % playlist->track_count);
+        if (e % 3 == 0) {
+            all_ok = playlist_add_track(playlist, tracks[bench_rand() % count]);
+        } else if (e % 3 == 1) {
+            all_ok = playlist_move_track(playlist, from, to);
+        } else {
+            all_ok = playlist_remove_track(playlist, from);
+        }
+        
+        bench_timer_start(&timer);
+        if (e % 2 == 0) {
+            playlist->change_count = -1; // Forces the whole rewrite
+            all_ok = all_ok && playlist_save(playlist, BENCH_PLAYLIST_FILE, library);
+            whole_ms += bench_timer_elapsed_ms(&timer);
+        } else {
+            all_ok = all_ok && playlist_save(playlist, BENCH_PLAYLIST_FILE, library) && playlist->logged > 0;
+            logged_ms += bench_timer_elapsed_ms(&timer);
+        }
+    }
+    printf("One edit:     whole rewrite %.3f ms, change log %.3f ms per save (%.0fx)\n",
+           whole_ms / (BENCH_SAVE_EDITS / 2), logged_ms / (BENCH_SAVE_EDITS / 2),
+           logged_ms > 0 ? whole_ms / logged_ms : 0.0);
+    
+    // Edits logged since the last rewrite come back on load
+    for (int e = 0; all_ok && e < 10; e++) {
+        all_ok = playlist_move_track(playlist, (int)(bench_rand() % playlist->track_count), 0) &&
+                 playlist_save(playlist, BENCH_PLAYLIST_FILE, library);
+    }
+    bench_timer_start(&timer);
+    Playlist* reloaded = playlist_load(BENCH_PLAYLIST_FILE, library);
+    double reload_ms = bench_timer_elapsed_ms(&timer);
+    BOOL replayed = reloaded && reloaded->logged == playlist->logged && bench_same_playlist(playlist, reloaded);
+    printf("Reload:       %d logged edits replayed in %.2f ms%s\n", reloaded ? reloaded->logged : 0, reload_ms,
+           replayed ? "" : "  MISMATCH");
+    all_ok = all_ok && replayed;
+    playlist_free(reloaded);
+    
+    // A crash in the middle of appending leaves a batch without its "#" line
+    FILE* log = fopen(BENCH_PLAYLIST_LOG_FILE, "ab");
+    if (log) {
+        fprintf(log, "-0\n>1 2\n#%d", playlist->track_count - 1);
+        fclose(log);
+    }
+    reloaded = playlist_load(BENCH_PLAYLIST_FILE, library);
+    BOOL cut = log && reloaded && bench_same_playlist(playlist, reloaded);
+    printf("Cut batch:    %s\n", cut ? "ignored" : "MISMATCH");
+    all_ok = all_ok && cut;
+    playlist_free(reloaded);
+    
+    // Saves go to the log until it is long enough to fold back into the file
+    int saves = 0;
+    double compact_ms = 0;
+    while (all_ok && saves < 10000 && GetFileAttributes(BENCH_PLAYLIST_LOG_FILE) != INVALID_FILE_ATTRIBUTES) {
+        all_ok = playlist_move_track(playlist, (int)(bench_rand() % playlist->track_count), 0);
+        bench_timer_start(&timer);
+        all_ok = all_ok && playlist_save(playlist, BENCH_PLAYLIST_FILE, library);
+        compact_ms = bench_timer_elapsed_ms(&timer);
+        saves++;
+    }
+    reloaded = playlist_load(BENCH_PLAYLIST_FILE, library);
+    BOOL compacted = reloaded && reloaded->logged == 0 && bench_same_playlist(playlist, reloaded);
+    printf("Compaction:   after %d more saves, rewrite in %.2f ms%s\n", saves, compact_ms,
+           compacted ? "" : "  MISMATCH");
+    all_ok = all_ok && compacted;
+    playlist_free(reloaded);
+    
+    // save_all only writes what changed
+    PlaylistManager* manager = playlist_manager_create();
+    for (int p = 0; manager && p < BENCH_PLAYLIST_COUNT / 10; p++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Bench %04d", p);
+        Playlist* small = playlist_create(name, "Synthetic");
+        if (!small || !playlist_manager_add(manager, small)) {
+            playlist_free(small);
+            break;
+        }
+        for (int i = 0; i < BENCH_PLAYLIST_TRACKS; i++) {
+            playlist_add_track(small, tracks[bench_rand() % count]);
+        }
+    }
+    if (manager && manager->count > 0) {
+        bench_timer_start(&timer);
+        BOOL written = playlist_manager_save_all(manager, BENCH_PLAYLIST_DIR, library);
+        double first_ms = bench_timer_elapsed_ms(&timer);
+        
+        playlist_add_track(manager->playlists[0], tracks[0]);
+        bench_timer_start(&timer);
+        written = written && playlist_manager_save_all(manager, BENCH_PLAYLIST_DIR, library);
+        double again_ms = bench_timer_elapsed_ms(&timer);
+        
+        int dirty = 0;
+        for (int i = 0; i < manager->count; i++) {
+            dirty += manager->playlists[i]->dirty;
+        }
+        printf("Save all:     %d playlists %.1f ms, again with one changed %.2f ms%s\n", manager->count, first_ms,
+               again_ms, written && dirty == 0 ? "" : "  MISMATCH");
+        all_ok = all_ok && written && dirty == 0;
+        
+        for (int i = 0; i < manager->count; i++) {
+            if (manager->playlists[i]->file) {
+                DeleteFile(manager->playlists[i]->file);
+            }
+        }
+        RemoveDirectory(BENCH_PLAYLIST_DIR);
+    }
+    remove(BENCH_PLAYLIST_FILE);
+    remove(BENCH_PLAYLIST_LOG_FILE);
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    playlist_manager_free(manager);
+    playlist_free(playlist);
+    MEM_FREE(tracks);
+    free_mp3_library(library);
+}
+
+#define BENCH_SEQ_OPS 20000
+#define BENCH_SEQ_ARRAY_OPS 2000     // Edits of the shifting array on the largest list
+#define BENCH_SEQ_RANGE 100          // Longest range moved at once
+
+typedef struct {
+    int kind;                        // PLAYLIST_CHANGE_ADD, _REMOVE or _MOVE
+    int index;
+    int count;
+    int to;
+    TrackId id;
+} BenchSeqOp;
+
+// Apply an edit to a flat id array the way the playlist did: shift everything after it
+static void bench_array_edit(TrackId* ids, int* count, const BenchSeqOp* op, TrackId* buffer) {
+    if (op->kind == PLAYLIST_CHANGE_ADD) {
+        memmove(ids + op->index + 1, ids + op->index, (size_t)(*count - op->index) * sizeof(TrackId));
+        ids[op->index] = op->id;
+        (*count)++;
+    } else if (op->kind == PLAYLIST_CHANGE_REMOVE) {
+        memmove(ids + op->index, ids + op->index + 1, (size_t)(*count - op->index - 1) * sizeof(TrackId));
+        (*count)--;
+    } else {
+        memcpy(buffer, ids + op->index, (size_t)op->count * sizeof(TrackId));
+        memmove(ids + op->index, ids + op->index + op->count, (size_t)(*count - op->index - op->count) * sizeof(TrackId));
+        memmove(ids + op->to + op->count, ids + op->to, (size_t)(*count - op->count - op->to) * sizeof(TrackId));
+        memcpy(ids + op->to, buffer, (size_t)op->count * sizeof(TrackId));
+    }
+}
+
+// Random edits on long playlists: the chunked track sequence against the flat array,
+// both given the same edits and compared at the end
+void bench_playlist_sequence(int track_count) {
+    (void)track_count;
+    static const int sizes[] = { 1000, 100000, 1000000 };
+    BenchTimer timer;
+    BOOL all_ok = TRUE;
+    
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int size = sizes[s];
+        int op_count = size >= 1000000 ? BENCH_SEQ_ARRAY_OPS : BENCH_SEQ_OPS;
+        
+        // Room for the list growing by every insertion
+        BenchSeqOp* ops = (BenchSeqOp*)MEM_ALLOC(op_count * sizeof(BenchSeqOp));
+        TrackId* ids = (TrackId*)MEM_ALLOC((size_t)(size + op_count) * sizeof(TrackId));
+        TrackId* buffer = (TrackId*)MEM_ALLOC(BENCH_SEQ_RANGE * sizeof(TrackId));
+        TrackSequence seq;
+        track_seq_init(&seq);
+        if (!ops || !ids || !buffer) {
+            printf("Unable to allocate %d entries.\n", size);
+            MEM_FREE(ops);
+            MEM_FREE(ids);
+            MEM_FREE(buffer);
+            all_ok = FALSE;
+            break;
+        }
+        
+        // Same starting list, then a mix of inserts, removals, moves and range moves
+        for (int i = 0; i < size; i++) {
+            ids[i] = (TrackId)i + 1;
+        }
+        BOOL ok = track_seq_append(&seq, ids, size);
+        int length = size;
+        for (int i = 0; i < op_count; i++) {
+            BenchSeqOp* op = &ops[i];
+            op->kind = (int)(bench_rand() % 4);
+            op->index = (int)(bench_rand() % length);
+            op->count = 1;
+            op->id = (TrackId)(size + i) + 1;
+            if (op->kind == PLAYLIST_CHANGE_ADD) {
+                op->index = (int)(bench_rand() % (length + 1));
+                length++;
+            } else if (op->kind == PLAYLIST_CHANGE_REMOVE) {
+                length--;
+            } else {
+                // Kind 3 moves a range, like a dragged selection
+                if (op->kind == 3) {
+                    op->count = 1 + (int)(bench_rand() % BENCH_SEQ_RANGE);
+                    if (op->count > length - op->index) op->count = length - op->index;
+                    op->kind = PLAYLIST_CHANGE_MOVE;
+                }
+                op->to = (int)(bench_rand() % (length - op->count + 1));
+            }
+        }
+        
+        bench_timer_start(&timer);
+        for (int i = 0; ok && i < op_count; i++) {
+            const BenchSeqOp* op = &ops[i];
+            if (op->kind == PLAYLIST_CHANGE_ADD) {
+                ok = track_seq_insert(&seq, op->index, &op->id, 1);
+            } else if (op->kind == PLAYLIST_CHANGE_REMOVE) {
+                track_seq_remove(&seq, op->index, 1);
+            } else {
+                ok = track_seq_move(&seq, op->index, op->count, op->to);
+            }
+        }
+        double seq_ms = bench_timer_elapsed_ms(&timer);
+        
+        int array_count = size;
+        bench_timer_start(&timer);
+        for (int i = 0; i < op_count; i++) {
+            bench_array_edit(ids, &array_count, &ops[i], buffer);
+        }
+        double array_ms = bench_timer_elapsed_ms(&timer);
+        
+        // Read back in runs, as saving does
+        bench_timer_start(&timer);
+        BOOL same = ok && seq.count == array_count;
+        int run_length = 0;
+        for (int i = 0; same && i < seq.count; i += run_length) {
+            const TrackId* run = track_seq_run(&seq, i, &run_length);
+            same = run && memcmp(run, ids + i, (size_t)run_length * sizeof(TrackId)) == 0;
+        }
+        double read_ms = bench_timer_elapsed_ms(&timer);
+        all_ok = all_ok && same;
+        
+        printf("%8d entries: %5d edits, array %9.3f us/edit, sequence %7.3f us/edit (%.1fx), read %.2f ms%s\n",
+               size, op_count, array_ms * 1000.0 / op_count, seq_ms * 1000.0 / op_count,
+               seq_ms > 0 ? array_ms / seq_ms : 0.0, read_ms, same ? "" : "  MISMATCH");
+        
+        track_seq_free(&seq);
+        MEM_FREE(ops);
+        MEM_FREE(ids);
+        MEM_FREE(buffer);
+    }
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+}
+
+#define BENCH_IMPORT_FILE "bench_import.m3u"
+
+// Write an M3U file of album runs the way other players do: #EXTINF lines, file URIs
+// with escapes, ".." segments and one entry in 20 gone. The id each entry should get is
+// stored in expected. Returns the number of entries, -1 if the file cannot be written.
+static int bench_write_m3u(const char* filename, int size, MP3File** tracks, int count, TrackId* expected) {
+    FILE* file = fopen(filename, "w");
+    if (!file) return -1;
+    
+    fprintf(file, "#EXTM3U\n#PLAYLIST:Bench Import\n");
+    char path[MAX_PATH_LENGTH];
+    int start = 0;
+    for (int i = 0; i < size; i++) {
+        if (i % BENCH_TRACKS_PER_ALBUM == 0) {
+            start = (int)(bench_rand() % count);
+        }
+        if (bench_rand() % 20 == 0) {
+            snprintf(path, sizeof(path), "C:\\Music\\Gone\\Missing %d.mp3", i);
+            fprintf(file, "#EXTINF:-1,Missing %d\n%s\n", i, path);
+            expected[i] = make_track_id(path);
+            continue;
+        }
+        
+        MP3File* track = tracks[(start + i % BENCH_TRACKS_PER_ALBUM) % count];
+        mp3_file_path(track, path, sizeof(path));
+        expected[i] = track->id;
+        fprintf(file, "#EXTINF:%d,%s - %s\n", track->metadata.duration, track->metadata.artist, track->metadata.title);
+        if (i % 3 == 1) {
+            // file:///C:/Music/The%20Beatles/...
+            fputs("file:///", file);
+            for (const char* p = path; *p; p++) {
+                if (*p == '\\') {
+                    fputc('/', file);
+                } else if (*p == ' ') {
+                    fputs("%20", file);
+                } else {
+                    fputc(*p, file);
+                }
+            }
+            fputc('\n', file);
+        } else if (i % 3 == 2) {
+            // C:\Music\Artist\..\Artist\Album\file
+            const char* artist = path + strlen("C:\\Music\\");
+            const char* after = strchr(artist, '\\');
+            fprintf(file, "C:\\Music\\%.*s\\..\\%s\n", (int)(after - artist), artist, artist);
+        } else {
+            fprintf(file, "%s\n", path);
+        }
+    }
+    fclose(file);
+    return size;
+}
+
+// Streaming import and export: entries per second for M3U, M3U8, PLS and XSPF, each
+// exported file imported back to the same tracks
+void bench_playlist_import(int track_count) {
+    static const int sizes[] = { 10000, 300000 };
+    static const char* exports[] = { "bench_export.m3u8", "bench_export.pls", "bench_export.xspf" };
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    int count = library ? library->total_files : 0;
+    MP3File** tracks = count > 0 ? (MP3File**)MEM_ALLOC(count * sizeof(MP3File*)) : NULL;
+    if (!tracks) {
+        printf("Unable to create benchmark library.\n");
+        free_mp3_library(library);
+        return;
+    }
+    int filled = 0;
+    for (MP3File* current = library->all_files; current && filled < count; current = current->next) {
+        tracks[filled++] = current;
+    }
+    
+    BOOL all_ok = TRUE;
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int size = sizes[s];
+        TrackId* expected = (TrackId*)MEM_ALLOC(size * sizeof(TrackId));
+        if (!expected || bench_write_m3u(BENCH_IMPORT_FILE, size, tracks, count, expected) < 0) {
+            printf("Unable to write %s.\n", BENCH_IMPORT_FILE);
+            MEM_FREE(expected);
+            all_ok = FALSE;
+            break;
+        }
+        
+        bench_timer_start(&timer);
+        Playlist* imported = playlist_import(BENCH_IMPORT_FILE, PLAYLIST_FORMAT_UNKNOWN, library);
+        double import_ms = bench_timer_elapsed_ms(&timer);
+        
+        // Every entry resolved to the id of its path, found or not
+        BOOL same = imported && imported->track_count == size && strcmp(imported->name, "Bench Import") == 0;
+        for (int i = 0; same && i < size; i++) {
+            same = track_seq_get(&imported->tracks, i) == expected[i];
+        }
+        all_ok = all_ok && same;
+        printf("%7d entries: import m3u  %8.2f ms (%.0f entries/s, %d placeholders)%s\n", size, import_ms,
+               import_ms > 0 ? size * 1000.0 / import_ms : 0.0, imported ? (int)imported->missing_paths.count : 0,
+               same ? "" : "  MISMATCH");
+        
+        for (int f = 0; imported && f < (int)(sizeof(exports) / sizeof(exports[0])); f++) {
+            bench_timer_start(&timer);
+            BOOL exported = playlist_export(imported, exports[f], PLAYLIST_FORMAT_UNKNOWN, library);
+            double export_ms = bench_timer_elapsed_ms(&timer);
+            
+            bench_timer_start(&timer);
+            Playlist* again = exported ? playlist_import(exports[f], PLAYLIST_FORMAT_UNKNOWN, library) : NULL;
+            double again_ms = bench_timer_elapsed_ms(&timer);
+            
+            BOOL round_trip = again && bench_same_tracks(imported, again);
+            all_ok = all_ok && round_trip;
+            printf("                 %-5s export %7.2f ms, import %8.2f ms (%.0f entries/s, %ld bytes)%s\n",
+                   strrchr(exports[f], '.') + 1, export_ms, again_ms, again_ms > 0 ? size * 1000.0 / again_ms : 0.0,
+                   bench_file_size(exports[f]), round_trip ? "" : "  MISMATCH");
+            playlist_free(again);
+            remove(exports[f]);
+        }
+        
+        playlist_free(imported);
+        MEM_FREE(expected);
+    }
+    remove(BENCH_IMPORT_FILE);
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    MEM_FREE(tracks);
+    free_mp3_library(library);
+}
+
+#define BENCH_UNDO_SIZE 1000000
+#define BENCH_UNDO_EDITS 200         // Edits before the clear, all within the history
+#define BENCH_UNDO_RANGE 1000        // Longest range removed at once
+#define BENCH_UNDO_EXTRA 2000        // Edits past the bound of the history
+
+// Copy of the track ids of a playlist (NULL without memory)
+static TrackId* bench_copy_tracks(Playlist* playlist) {
+    TrackId* ids = (TrackId*)MEM_ALLOC((size_t)(playlist->track_count > 0 ? playlist->track_count : 1) * sizeof(TrackId));
+    if (ids) {
+        track_seq_copy(&playlist->tracks, 0, playlist->track_count, ids);
+    }
+    return ids;
+}
+
+// Same ids as a copy taken before
+static BOOL bench_tracks_equal(Playlist* playlist, const TrackId* ids, int count) {
+    if (playlist->track_count != count) return FALSE;
+    
+    int length = 0;
+    for (int i = 0; i < count; i += length) {
+        const TrackId* run = track_seq_run(&playlist->tracks, i, &length);
+        if (!run || memcmp(run, ids + i, (size_t)length * sizeof(TrackId)) != 0) return FALSE;
+    }
+    return TRUE;
+}
+
+// Undo history of a 1M-entry playlist: memory per edit, undo and redo latency, and the
+// playlist back to the same ids after every edit is taken back
+void bench_playlist_undo(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    int count = library ? library->total_files : 0;
+    MP3File** tracks = count > 0 ? (MP3File**)MEM_ALLOC(count * sizeof(MP3File*)) : NULL;
+    TrackId* ids = (TrackId*)MEM_ALLOC(BENCH_UNDO_SIZE * sizeof(TrackId));
+    Playlist* playlist = playlist_create("Bench Undo", "");
+    if (!tracks || !ids || !playlist) {
+        printf("Unable to create benchmark library.\n");
+        MEM_FREE(tracks);
+        MEM_FREE(ids);
+        playlist_free(playlist);
+        free_mp3_library(library);
+        return;
+    }
+    int filled = 0;
+    for (MP3File* current = library->all_files; current && filled < count; current = current->next) {
+        tracks[filled++] = current;
+    }
+    for (int i = 0; i < BENCH_UNDO_SIZE; i++) {
+        ids[i] = tracks[bench_rand() % filled]->id;
+    }
+    BOOL all_ok = track_seq_append(&playlist->tracks, ids, BENCH_UNDO_SIZE);
+    playlist->track_count = BENCH_UNDO_SIZE;
+    
+    // Single inserts, removals and moves, range moves and bulk removals, then a clear
+    int edits = 0;
+    int bulk_removed = 0;
+    bench_timer_start(&timer);
+    for (int i = 0; all_ok && i < BENCH_UNDO_EDITS; i++) {
+        int length = playlist->track_count;
+        int index = (int)(bench_rand() % length);
+        int kind = (int)(bench_rand() % 5);
+        if (kind == 0) {
+            all_ok = playlist_insert_track(playlist, index, tracks[bench_rand() % filled]);
+        } else if (kind == 1) {
+            all_ok = playlist_remove_track(playlist, index);
+        } else if (kind == 2) {
+            all_ok = playlist_move_track(playlist, index, (int)(bench_rand() % length));
+        } else {
+            int range = 1 + (int)(bench_rand() % BENCH_UNDO_RANGE);
+            if (range > length - index) range = length - index;
+            if (kind == 3) {
+                all_ok = playlist_move_tracks(playlist, index, range, (int)(bench_rand() % (length - range + 1)));
+            } else {
+                all_ok = playlist_remove_tracks(playlist, index, range);
+                bulk_removed += range;
+            }
+        }
+        edits++;
+    }
+    double edit_ms = bench_timer_elapsed_ms(&timer);
+    size_t edits_bytes = playlist->history_bytes;
+    
+    TrackId* before_clear = all_ok ? bench_copy_tracks(playlist) : NULL;
+    int before_count = playlist->track_count;
+    all_ok = all_ok && before_clear;
+    
+    bench_timer_start(&timer);
+    playlist_clear(playlist);
+    double clear_ms = bench_timer_elapsed_ms(&timer);
+    all_ok = all_ok && playlist->track_count == 0;
+    
+    printf("%d entries: %d edits (%d tracks removed in bulk) in %.2f ms, then a clear in %.3f ms\n",
+           BENCH_UNDO_SIZE, edits, bulk_removed, edit_ms, clear_ms);
+    printf("History:      %d edits, %.1f KB (%.0f bytes/edit before the clear); a snapshot per edit would "
+           "take %.1f MB\n", playlist->history_count, playlist->history_bytes / 1024.0,
+           edits > 0 ? (double)edits_bytes / edits : 0.0, (edits + 1.0) * BENCH_UNDO_SIZE * sizeof(TrackId) / 1048576.0);
+    
+    // Undo the clear, then every edit before it
+    bench_timer_start(&timer);
+    all_ok = all_ok && playlist_undo(playlist);
+    double undo_clear_ms = bench_timer_elapsed_ms(&timer);
+    all_ok = all_ok && bench_tracks_equal(playlist, before_clear, before_count);
+    
+    double undo_max_ms = 0.0;
+    bench_timer_start(&timer);
+    for (int i = 0; all_ok && i < edits; i++) {
+        BenchTimer one;
+        bench_timer_start(&one);
+        all_ok = playlist_undo(playlist);
+        double ms = bench_timer_elapsed_ms(&one);
+        if (ms > undo_max_ms) undo_max_ms = ms;
+    }
+    double undo_ms = bench_timer_elapsed_ms(&timer);
+    all_ok = all_ok && !playlist_undo(playlist) && bench_tracks_equal(playlist, ids, BENCH_UNDO_SIZE);
+    
+    // Redo everything, the clear included, and take the clear back again
+    bench_timer_start(&timer);
+    for (int i = 0; all_ok && i < edits; i++) {
+        all_ok = playlist_redo(playlist);
+    }
+    double redo_ms = bench_timer_elapsed_ms(&timer);
+    all_ok = all_ok && bench_tracks_equal(playlist, before_clear, before_count);
+    all_ok = all_ok && playlist_redo(playlist) && playlist->track_count == 0 && !playlist_redo(playlist);
+    all_ok = all_ok && playlist_undo(playlist) && bench_tracks_equal(playlist, before_clear, before_count);
+    
+    printf("Undo:         %.2f us/edit (max %.2f us), clear %.3f ms; redo %.2f us/edit\n",
+           edits > 0 ? undo_ms * 1000.0 / edits : 0.0, undo_max_ms * 1000.0, undo_clear_ms,
+           edits > 0 ? redo_ms * 1000.0 / edits : 0.0);
+    
+    // A new edit drops the clear that could be redone; past the bound the oldest edits go
+    for (int i = 0; all_ok && i < BENCH_UNDO_EXTRA; i++) {
+        all_ok = playlist_move_track(playlist, (int)(bench_rand() % playlist->track_count),
+                                     (int)(bench_rand() % playlist->track_count));
+    }
+    all_ok = all_ok && playlist->history_count <= PLAYLIST_UNDO_MAX_EDITS &&
+             playlist->history_bytes <= PLAYLIST_UNDO_MAX_BYTES;
+    printf("Bounded:      %d edits later, %d kept in %.1f KB\n", BENCH_UNDO_EXTRA, playlist->history_count,
+           playlist->history_bytes / 1024.0);
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    MEM_FREE(before_clear);
+    MEM_FREE(ids);
+    MEM_FREE(tracks);
+    playlist_free(playlist);
+    free_mp3_library(library);
+}
+
+#define BENCH_NAMES_COUNT 10000
+#define BENCH_NAMES_LOOKUPS 100000
+#define BENCH_NAMES_LEGACY_LOOKUPS 2000
+#define BENCH_NAMES_DIR_LENGTH 150   // Long enough for long names to be cut
+
+// Find a playlist the way the manager did: strcmp over every playlist
+static Playlist* bench_legacy_find_by_name(PlaylistManager* manager, const char* name) {
+    for (int i = 0; i < manager->count; i++) {
+        if (strcmp(manager->playlists[i]->name, name) == 0) {
+            return manager->playlists[i];
+        }
+    }
+    return NULL;
+}
+
+// Every playlist found by name and by id at its position
+static BOOL bench_check_manager_index(PlaylistManager* manager) {
+    for (int i = 0; i < manager->count; i++) {
+        Playlist* playlist = manager->playlists[i];
+        if (playlist_manager_find_by_name(manager, playlist->name) != playlist ||
+            playlist_manager_index_of(manager, playlist->id) != i) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Names that end up on the same file, or on none Windows accepts, saved to a directory
+// with a long name, loaded back, then one renamed and saved again
+static BOOL bench_playlist_file_names(MP3Library* library) {
+    static const char* names[] = { "Mix/Rock", "Mix_Rock", "mix_rock", "Mix/Rock", "CON", "aux.old", "Trailing. ",
+                                   "", "What? <Live>", "COM1" };
+    char directory[BENCH_NAMES_DIR_LENGTH + 1];
+    memset(directory, 'd', BENCH_NAMES_DIR_LENGTH);
+    memcpy(directory, "bench_names_", strlen("bench_names_"));
+    directory[BENCH_NAMES_DIR_LENGTH] = '\0';
+    
+    PlaylistManager* manager = playlist_manager_create();
+    BOOL ok = manager != NULL;
+    for (int i = 0; ok && i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        Playlist* playlist = playlist_create(names[i], "Names");
+        ok = playlist && playlist_manager_add(manager, playlist);
+    }
+    
+    // Two long names that differ only past what fits in a file name
+    char long_name[100];
+    for (int i = 0; ok && i < 2; i++) {
+        memset(long_name, 'L', sizeof(long_name) - 2);
+        long_name[sizeof(long_name) - 2] = (char)('a' + i);
+        long_name[sizeof(long_name) - 1] = '\0';
+        Playlist* playlist = playlist_create(long_name, "Names");
+        ok = playlist && playlist_manager_add(manager, playlist);
+    }
+    ok = ok && playlist_manager_find_by_name(manager, "Mix/Rock (2)") != NULL;
+    ok = ok && playlist_manager_save_all(manager, directory, library);
+    
+    // One file each, all of them there, whatever the case
+    for (int i = 0; ok && i < manager->count; i++) {
+        const char* file = manager->playlists[i]->file;
+        ok = file && GetFileAttributes(file) != INVALID_FILE_ATTRIBUTES;
+        for (int k = 0; ok && k < i; k++) {
+            ok = _stricmp(file, manager->playlists[k]->file) != 0;
+        }
+    }
+    
+    // The same names come back, and a rename moves the file
+    PlaylistManager* loaded = ok ? playlist_manager_create() : NULL;
+    ok = loaded && playlist_manager_load_all(loaded, directory, library) && loaded->count == manager->count;
+    for (int i = 0; ok && i < manager->count; i++) {
+        ok = playlist_manager_find_by_name(loaded, manager->playlists[i]->name) != NULL;
+    }
+    Playlist* renamed = ok ? playlist_manager_find_by_name(loaded, "Mix_Rock") : NULL;
+    char old_file[MAX_PATH] = "";
+    if (renamed && renamed->file) {
+        strcpy(old_file, renamed->file);
+    }
+    ok = renamed && !playlist_manager_rename(loaded, renamed, "mix_rock") &&
+         playlist_manager_rename(loaded, renamed, "Jazz") && playlist_manager_save_all(loaded, directory, library) &&
+         GetFileAttributes(old_file) == INVALID_FILE_ATTRIBUTES && GetFileAttributes(renamed->file) != INVALID_FILE_ATTRIBUTES;
+    PlaylistManager* again = ok ? playlist_manager_create() : NULL;
+    ok = again && playlist_manager_load_all(again, directory, library) && again->count == manager->count &&
+         playlist_manager_find_by_name(again, "Jazz") && !playlist_manager_find_by_name(again, "Mix_Rock");
+    
+    printf("File names:   %d colliding, reserved or long names saved to %d files%s\n",
+           manager ? manager->count : 0, manager ? manager->count : 0, ok ? "" : "  MISMATCH");
+    for (int i = 0; loaded && i < loaded->count; i++) {
+        if (loaded->playlists[i]->file) {
+            DeleteFile(loaded->playlists[i]->file);
+        }
+    }
+    for (int i = 0; manager && i < manager->count; i++) {
+        if (manager->playlists[i]->file) {
+            DeleteFile(manager->playlists[i]->file);
+        }
+    }
+    RemoveDirectory(directory);
+    playlist_manager_free(again);
+    playlist_manager_free(loaded);
+    playlist_manager_free(manager);
+    return ok;
+}
+
+// Thousands of playlists: lookups by name through the index against the strcmp scan,
+// lookups by id, renames and removals, and file names that would collide
+void bench_playlist_names(int track_count) {
+    BenchTimer timer;
+    
+    PlaylistManager* manager = playlist_manager_create();
+    Playlist** legacy = (Playlist**)MEM_ALLOC(BENCH_NAMES_COUNT * sizeof(Playlist*));
+    PlaylistId* ids = (PlaylistId*)MEM_ALLOC(BENCH_NAMES_COUNT * sizeof(PlaylistId));
+    if (!manager || !legacy || !ids) {
+        printf("Unable to allocate %d playlists.\n", BENCH_NAMES_COUNT);
+        playlist_manager_free(manager);
+        MEM_FREE(legacy);
+        MEM_FREE(ids);
+        return;
+    }
+    
+    char name[100];
+    bench_timer_start(&timer);
+    BOOL all_ok = TRUE;
+    for (int i = 0; all_ok && i < BENCH_NAMES_COUNT; i++) {
+        snprintf(name, sizeof(name), "Playlist %05d", i);
+        Playlist* playlist = playlist_create(name, "");
+        all_ok = playlist && playlist_manager_add(manager, playlist);
+        if (!all_ok) {
+            playlist_free(playlist);
+        }
+    }
+    double add_ms = bench_timer_elapsed_ms(&timer);
+    for (int i = 0; all_ok && i < manager->count; i++) {
+        ids[i] = manager->playlists[i]->id;
+    }
+    
+    bench_timer_start(&timer);
+    int found = 0;
+    for (int i = 0; all_ok && i < BENCH_NAMES_LOOKUPS; i++) {
+        snprintf(name, sizeof(name), "Playlist %05d", (int)(bench_rand() % BENCH_NAMES_COUNT));
+        found += playlist_manager_find_by_name(manager, name) != NULL;
+    }
+    double hashed_ms = bench_timer_elapsed_ms(&timer);
+    
+    bench_timer_start(&timer);
+    int legacy_found = 0;
+    for (int i = 0; all_ok && i < BENCH_NAMES_LEGACY_LOOKUPS; i++) {
+        snprintf(name, sizeof(name), "Playlist %05d", (int)(bench_rand() % BENCH_NAMES_COUNT));
+        legacy_found += bench_legacy_find_by_name(manager, name) != NULL;
+    }
+    double scan_ms = bench_timer_elapsed_ms(&timer);
+    
+    bench_timer_start(&timer);
+    for (int i = 0; all_ok && i < BENCH_NAMES_LOOKUPS; i++) {
+        found += playlist_manager_find_by_id(manager, ids[bench_rand() % BENCH_NAMES_COUNT]) != NULL;
+    }
+    double id_ms = bench_timer_elapsed_ms(&timer);
+    all_ok = all_ok && found == BENCH_NAMES_LOOKUPS * 2 && legacy_found == BENCH_NAMES_LEGACY_LOOKUPS;
+    
+    printf("%d playlists added in %.2f ms\n", manager->count, add_ms);
+    printf("Find by name: index %.3f us, strcmp scan %.3f us (%.0fx); by id %.3f us\n",
+           hashed_ms * 1000.0 / BENCH_NAMES_LOOKUPS, scan_ms * 1000.0 / BENCH_NAMES_LEGACY_LOOKUPS,
+           hashed_ms > 0 ? (scan_ms / BENCH_NAMES_LEGACY_LOOKUPS) / (hashed_ms / BENCH_NAMES_LOOKUPS) : 0.0,
+           id_ms * 1000.0 / BENCH_NAMES_LOOKUPS);
+    
+    // Rename every playlist; a name taken is refused
+    bench_timer_start(&timer);
+    for (int i = 0; all_ok && i < manager->count; i++) {
+        snprintf(name, sizeof(name), "Renamed %05d", i);
+        all_ok = playlist_manager_rename(manager, manager->playlists[i], name);
+    }
+    double rename_ms = bench_timer_elapsed_ms(&timer);
+    all_ok = all_ok && manager->count > 1 && !playlist_manager_find_by_name(manager, "Playlist 00000") &&
+             !playlist_manager_rename(manager, manager->playlists[0], manager->playlists[1]->name) &&
+             bench_check_manager_index(manager);
+    
+    // Remove half of them by id, in random order, against shifting the array each time
+    int legacy_count = manager->count;
+    memcpy(legacy, manager->playlists, legacy_count * sizeof(Playlist*));
+    int removals = manager->count / 2;
+    double remove_ms = 0.0;
+    double shift_ms = 0.0;
+    for (int i = 0; all_ok && i < removals; i++) {
+        PlaylistId id = ids[bench_rand() % BENCH_NAMES_COUNT];
+        while (playlist_manager_index_of(manager, id) < 0) {
+            id = id % BENCH_NAMES_COUNT + 1;
+        }
+        
+        int position = 0;
+        while (legacy[position]->id != id) {
+            position++;
+        }
+        bench_timer_start(&timer);
+        memmove(legacy + position, legacy + position + 1, (size_t)(legacy_count - position - 1) * sizeof(Playlist*));
+        legacy_count--;
+        shift_ms += bench_timer_elapsed_ms(&timer);
+        
+        bench_timer_start(&timer);
+        all_ok = playlist_manager_remove(manager, playlist_manager_index_of(manager, id)) &&
+                 !playlist_manager_find_by_id(manager, id);
+        remove_ms += bench_timer_elapsed_ms(&timer);
+    }
+    all_ok = all_ok && manager->count == legacy_count && bench_check_manager_index(manager);
+    
+    printf("Rename:       %.3f us each; remove %.3f us each, array shift %.3f us\n",
+           rename_ms * 1000.0 / BENCH_NAMES_COUNT, removals > 0 ? remove_ms * 1000.0 / removals : 0.0,
+           removals > 0 ? shift_ms * 1000.0 / removals : 0.0);
+    
+    MP3Library* library = bench_create_library(track_count);
+    all_ok = all_ok && library && bench_playlist_file_names(library);
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    free_mp3_library(library);
+    playlist_manager_free(manager);
+    MEM_FREE(legacy);
+    MEM_FREE(ids);
+}
+
+#define BENCH_DIFF_SIZE 100000
+#define BENCH_DIFF_BLOCK 10000       // Tracks of a block removed, inserted or moved at once
+
+// Random single-track edits on an array of ids: inserts of new ids, removals and moves,
+// within positions first to first + *span (which follows the edits)
+static void bench_edit_ids(TrackId* ids, int* count, int first, int* span, int edits, TrackId* next_id) {
+    for (int e = 0; e < edits && *span > 1; e++) {
+        int at = first + (int)(bench_rand() % *span);
+        int kind = (int)(bench_rand() % 3);
+        if (kind == 0) {
+            memmove(ids + at + 1, ids + at, (size_t)(*count - at) * sizeof(TrackId));
+            ids[at] = (*next_id)++;
+            (*count)++;
+            (*span)++;
+        } else if (kind == 1) {
+            memmove(ids + at, ids + at + 1, (size_t)(*count - at - 1) * sizeof(TrackId));
+            (*count)--;
+            (*span)--;
+        } else {
+            int to = first + (int)(bench_rand() % *span);
+            TrackId id = ids[at];
+            if (to > at) {
+                memmove(ids + at, ids + at + 1, (size_t)(to - at) * sizeof(TrackId));
+            } else {
+                memmove(ids + to + 1, ids + to, (size_t)(at - to) * sizeof(TrackId));
+            }
+            ids[to] = id;
+        }
+    }
+}
+
+// A playlist holding ids
+static Playlist* bench_playlist_of(const char* name, const TrackId* ids, int count) {
+    Playlist* playlist = playlist_create(name, "");
+    if (playlist && !track_seq_append(&playlist->tracks, ids, count)) {
+        playlist_free(playlist);
+        return NULL;
+    }
+    if (playlist) {
+        playlist->track_count = count;
+    }
+    return playlist;
+}
+
+// Diff from base to target: time, hunks and encoded size, and the script applied to a
+// copy of base (after an encoding round trip) giving target
+static BOOL bench_diff_case(const char* label, const TrackId* base, int base_count, const TrackId* target,
+                            int target_count) {
+    BenchTimer timer;
+    Playlist* from = bench_playlist_of("From", base, base_count);
+    Playlist* to = bench_playlist_of("To", target, target_count);
+    
+    bench_timer_start(&timer);
+    PlaylistDiff* diff = from && to ? playlist_diff(from, to) : NULL;
+    double diff_ms = bench_timer_elapsed_ms(&timer);
+    
+    unsigned char* bytes = NULL;
+    size_t size = playlist_diff_encode(diff, &bytes);
+    PlaylistDiff* decoded = size > 0 ? playlist_diff_decode(bytes, size) : NULL;
+    
+    bench_timer_start(&timer);
+    BOOL ok = decoded && playlist_diff_apply(decoded, from);
+    double apply_ms = bench_timer_elapsed_ms(&timer);
+    ok = ok && bench_same_tracks(from, to) && !playlist_diff_apply(decoded, from);
+    
+    printf("  %-16s diff %8.2f ms, %6d hunks, %8lu bytes (whole list %lu), apply %7.2f ms%s\n", label, diff_ms,
+           diff ? diff->hunk_count : 0, (unsigned long)size, (unsigned long)target_count * sizeof(TrackId), apply_ms,
+           ok ? "" : "  MISMATCH");
+    
+    MEM_FREE(bytes);
+    playlist_diff_free(decoded);
+    playlist_diff_free(diff);
+    playlist_free(from);
+    playlist_free(to);
+    return ok;
+}
+
+// Diff and three-way merge of 100k-entry playlists: time and script size for small,
+// large and block edits, a shuffle, and merges with and without conflicts
+void bench_playlist_diff(int track_count) {
+    (void)track_count;
+    BenchTimer timer;
+    int capacity = BENCH_DIFF_SIZE * 2;
+    TrackId* base = (TrackId*)MEM_ALLOC(capacity * sizeof(TrackId));
+    TrackId* target = (TrackId*)MEM_ALLOC(capacity * sizeof(TrackId));
+    TrackId* other = (TrackId*)MEM_ALLOC(capacity * sizeof(TrackId));
+    if (!base || !target || !other) {
+        printf("Unable to allocate %d entries.\n", BENCH_DIFF_SIZE);
+        MEM_FREE(base);
+        MEM_FREE(target);
+        MEM_FREE(other);
+        return;
+    }
+    
+    // Mostly distinct tracks, one in 50 repeating an earlier one
+    TrackId next_id = 1;
+    for (int i = 0; i < BENCH_DIFF_SIZE; i++) {
+        base[i] = i > 0 && bench_rand() % 50 == 0 ? base[bench_rand() % i] : next_id++;
+    }
+    
+    BOOL all_ok = TRUE;
+    static const int edit_counts[] = { 10, 100, 1000, 10000 };
+    printf("%d entries:\n", BENCH_DIFF_SIZE);
+    for (int c = 0; c < (int)(sizeof(edit_counts) / sizeof(edit_counts[0])); c++) {
+        int count = BENCH_DIFF_SIZE;
+        int span = count;
+        memcpy(target, base, count * sizeof(TrackId));
+        bench_edit_ids(target, &count, 0, &span, edit_counts[c], &next_id);
+        char label[32];
+        snprintf(label, sizeof(label), "%d edits", edit_counts[c]);
+        all_ok = bench_diff_case(label, base, BENCH_DIFF_SIZE, target, count) && all_ok;
+    }
+    
+    // A block removed, one of new tracks inserted and one moved
+    int count = 0;
+    int block = BENCH_DIFF_BLOCK;
+    memcpy(target, base, block * sizeof(TrackId));
+    count += block;
+    memcpy(target + count, base + block * 6, block * sizeof(TrackId));
+    count += block;
+    memcpy(target + count, base + block * 2, block * 3 * sizeof(TrackId));
+    count += block * 3;
+    for (int i = 0; i < block; i++) {
+        target[count++] = next_id++;
+    }
+    memcpy(target + count, base + block * 7, (BENCH_DIFF_SIZE - block * 7) * sizeof(TrackId));
+    count += BENCH_DIFF_SIZE - block * 7;
+    all_ok = bench_diff_case("block edits", base, BENCH_DIFF_SIZE, target, count) && all_ok;
+    
+    // Shuffled: nothing but anchors out of order
+    memcpy(target, base, BENCH_DIFF_SIZE * sizeof(TrackId));
+    for (int i = BENCH_DIFF_SIZE - 1; i > 0; i--) {
+        int k = (int)(bench_rand() % (i + 1));
+        TrackId id = target[i];
+        target[i] = target[k];
+        target[k] = id;
+    }
+    all_ok = bench_diff_case("shuffle", base, BENCH_DIFF_SIZE, target, BENCH_DIFF_SIZE) && all_ok;
+    
+    // Merge: ours edits the first half, theirs the second, so the merge is both
+    int half = BENCH_DIFF_SIZE / 2;
+    int ours_count = BENCH_DIFF_SIZE;
+    int ours_span = half;
+    memcpy(target, base, BENCH_DIFF_SIZE * sizeof(TrackId));
+    bench_edit_ids(target, &ours_count, 0, &ours_span, 500, &next_id);
+    int theirs_count = BENCH_DIFF_SIZE;
+    int theirs_span = BENCH_DIFF_SIZE - half;
+    memcpy(other, base, BENCH_DIFF_SIZE * sizeof(TrackId));
+    bench_edit_ids(other, &theirs_count, half, &theirs_span, 500, &next_id);
+    
+    TrackId* expected = (TrackId*)MEM_ALLOC(capacity * sizeof(TrackId));
+    Playlist* base_playlist = bench_playlist_of("Base", base, BENCH_DIFF_SIZE);
+    Playlist* ours = bench_playlist_of("Ours", target, ours_count);
+    Playlist* theirs = bench_playlist_of("Theirs", other, theirs_count);
+    BOOL merged = FALSE;
+    int conflicts = -1;
+    double merge_ms = 0.0;
+    if (expected && base_playlist && ours && theirs) {
+        memcpy(expected, target, ours_span * sizeof(TrackId));
+        memcpy(expected + ours_span, other + half, theirs_span * sizeof(TrackId));
+        
+        bench_timer_start(&timer);
+        PlaylistDiff* merge = playlist_merge(base_playlist, ours, theirs, &conflicts);
+        merge_ms = bench_timer_elapsed_ms(&timer);
+        
+        Playlist* result = bench_playlist_of("Expected", expected, ours_span + theirs_span);
+        merged = merge && conflicts == 0 && result && playlist_diff_apply(merge, ours) &&
+                 bench_same_tracks(ours, result);
+        playlist_diff_free(merge);
+        playlist_free(result);
+    }
+    printf("Merge:        500 + 500 edits on both halves %.2f ms, %d conflicts%s\n", merge_ms, conflicts,
+           merged ? "" : "  MISMATCH");
+    all_ok = all_ok && merged;
+    
+    // Both sides change the same tracks differently: ours kept, theirs' additions after
+    BOOL resolved = FALSE;
+    if (merged) {
+        TrackId mine = next_id++;
+        TrackId yours = next_id++;
+        memcpy(target, base, BENCH_DIFF_SIZE * sizeof(TrackId));
+        memcpy(other, base, BENCH_DIFF_SIZE * sizeof(TrackId));
+        target[half] = mine;
+        other[half] = yours;
+        Playlist* mine_playlist = bench_playlist_of("Ours", target, BENCH_DIFF_SIZE);
+        Playlist* yours_playlist = bench_playlist_of("Theirs", other, BENCH_DIFF_SIZE);
+        PlaylistDiff* merge = mine_playlist && yours_playlist ?
+                              playlist_merge(base_playlist, mine_playlist, yours_playlist, &conflicts) : NULL;
+        resolved = merge && conflicts == 1 && playlist_diff_apply(merge, mine_playlist) &&
+                   mine_playlist->track_count == BENCH_DIFF_SIZE + 1 &&
+                   playlist_get_track_id(mine_playlist, half) == mine &&
+                   playlist_get_track_id(mine_playlist, half + 1) == yours;
+        playlist_diff_free(merge);
+        playlist_free(mine_playlist);
+        playlist_free(yours_playlist);
+    }
+    printf("Conflict:     same track replaced on both sides, %d conflict, both kept%s\n", conflicts,
+           resolved ? "" : "  MISMATCH");
+    all_ok = all_ok && resolved;
+    
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    playlist_free(base_playlist);
+    playlist_free(ours);
+    playlist_free(theirs);
+    MEM_FREE(expected);
+    MEM_FREE(base);
+    MEM_FREE(target);
+    MEM_FREE(other);
+}
+
+#define BENCH_SMART_PLAYLISTS 100
+
+// A scan pass over records spread over the library: they are removed, and as many new
+// ones are added. Returns the number of records scanned.
+static int bench_scan_pass(MP3Library* library, int changes, int first_index) {
+    MP3File** victims = (MP3File**)MEM_ALLOC((changes > 0 ? changes : 1) * sizeof(MP3File*));
+    if (!victims) return 0;
+    
+    int step = changes > 0 && library->total_files > changes ? library->total_files / changes : 1;
+    int picked = 0;
+    int i = 0;
+    for (MP3File* current = library->all_files; current && picked < changes; current = current->next, i++) {
+        if (i % step == 0) {
+            victims[picked++] = current;
+        }
+    }
+    library_remove_files(library, victims, picked);
+    MEM_FREE(victims);
+    
+    char path[MAX_PATH_LENGTH];
+    for (i = 0; i < picked; i++) {
+        MP3File* file = (MP3File*)MEM_ALLOC(sizeof(MP3File));
+        if (!file) break;
+        
+        bench_fill_track(file, first_index + i, path, sizeof(path));
+        if (!library_add_file(library, file, path)) {
+            free_mp3_file(file);
+        }
+    }
+    return picked * 2;
+}
+
+// Same members as a fresh run of the query
+static BOOL bench_check_smart(SmartPlaylist* playlist, TrackView* fresh) {
+    if (!playlist->valid || filter_query_run(playlist->query, playlist->library, fresh) != playlist->members.count) {
+        return FALSE;
+    }
+    for (int i = 0; i < fresh->count; i++) {
+        if (!smart_playlist_contains(playlist, fresh->ids[i])) return FALSE;
+    }
+    return TRUE;
+}
+
+// Smart playlists kept up to date by the scanner: cost per scanned track with 100 of
+// them registered, against evaluating every query again
+void bench_smart_playlists(int track_count) {
+    BenchTimer timer;
+    
+    MP3Library* library = bench_create_library(track_count);
+    if (!library || library->total_files == 0) {
+        printf("Unable to create benchmark library.\n");
+        free_mp3_library(library);
+        return;
+    }
+    int count = library->total_files;
+    int changes = count / 10 < 1000 ? count / 10 : 1000;
+    int next_index = count;
+    
+    // The library and its indexes alone
+    bench_timer_start(&timer);
+    int scanned = bench_scan_pass(library, changes, next_index);
+    double plain_ms = bench_timer_elapsed_ms(&timer);
+    next_index += changes;
+    
+    // Queries mixing genres, decades, durations, artists and negations
+    SmartPlaylist* playlists[BENCH_SMART_PLAYLISTS];
+    int created = 0;
+    bench_timer_start(&timer);
+    for (int p = 0; p < BENCH_SMART_PLAYLISTS; p++) {
+        char query[256];
+        const char* genre = bench_genres[p % BENCH_GENRE_COUNT];
+        int decade = 1960 + (p / BENCH_GENRE_COUNT % 6) * 10;
+        switch (p % 4) {
+        case 0:
+            snprintf(query, sizeof(query), "genre:%s year:%d..%d duration:<5:00", genre, decade, decade + 9);
+            break;
+        case 1:
+            snprintf(query, sizeof(query), "artist:\"%s\" year:>=%d", bench_artists[p % BENCH_ARTIST_COUNT], decade);
+            break;
+        case 2:
+            snprintf(query, sizeof(query), "(genre:%s OR genre:%s) NOT year:%d..%d", genre,
+                     bench_genres[(p + 3) % BENCH_GENRE_COUNT], decade, decade + 9);
+            break;
+        default:
+            snprintf(query, sizeof(query), "title~\"Track %d\" duration:>=%d", p % 10, 120 + p);
+            break;
+        }
+        
+        char error[FILTER_QUERY_ERROR_MAX];
+        char name[32];
+        snprintf(name, sizeof(name), "Smart %d", p);
+        playlists[created] = smart_playlist_create(library, name, query, error, sizeof(error));
+        if (!playlists[created]) {
+            printf("Unable to create \"%s\": %s\n", query, error);
+            continue;
+        }
+        created++;
+    }
+    double create_ms = bench_timer_elapsed_ms(&timer);
+    
+    long long members = 0;
+    for (int p = 0; p < created; p++) {
+        members += playlists[p]->members.count;
+    }
+    printf("Create:       %d smart playlists over %d tracks in %.2f ms (%lld members)\n", created, count, create_ms,
+           members);
+    
+    // The same scan with every smart playlist following it
+    bench_timer_start(&timer);
+    int smart_scanned = bench_scan_pass(library, changes, next_index);
+    double smart_ms = bench_timer_elapsed_ms(&timer);
+    next_index += changes;
+    printf("Scan pass:    %d tracks, %.2f us per track without, %.2f us with %d smart playlists\n", smart_scanned,
+           scanned > 0 ? plain_ms * 1000.0 / scanned : 0.0, smart_scanned > 0 ? smart_ms * 1000.0 / smart_scanned : 0.0,
+           created);
+    
+    // What rebuilding them by hand after the scan costs
+    bench_timer_start(&timer);
+    for (int p = 0; p < created; p++) {
+        smart_playlist_refresh(playlists[p]);
+    }
+    double refresh_ms = bench_timer_elapsed_ms(&timer);
+    printf("Re-evaluate:  all %d queries %.2f ms vs %.2f ms of incremental updates for the scan\n", created, refresh_ms,
+           smart_ms - plain_ms > 0 ? smart_ms - plain_ms : 0.0);
+    
+    // Another scan, then every playlist against a fresh run of its query
+    bench_scan_pass(library, changes, next_index);
+    TrackView fresh;
+    track_view_init(&fresh);
+    BOOL all_ok = created == BENCH_SMART_PLAYLISTS;
+    for (int p = 0; p < created; p++) {
+        all_ok = all_ok && bench_check_smart(playlists[p], &fresh);
+    }
+    track_view_free(&fresh);
+    printf("Check:        %s\n", all_ok ? "ok" : "MISMATCH");
+    
+    // Playlists still registered are freed with the library
+    smart_playlist_free(playlists[0]);
+    free_mp3_library(library);
+}
+
+// Table of available benchmarks
+typedef struct {
+    const char* name;
+    const char* description;
+    void (*run)(int track_count);
+} BenchEntry;
+
+static const BenchEntry bench_entries[] = {
+    { "ids", "track id lookup vs positional walk, id stability", bench_track_ids },
+    { "albums", "album index rebuild vs incremental update", bench_album_index },
+    { "paths", "directory trie memory, subtree queries and removal", bench_path_trie },
+    { "memtags", "cost of tagged memory tracking, budget hooks", bench_memory_tags },
+    { "sort", "merge sort of the track list vs the old bubble sort", bench_sort },
+    { "collate", "multi-key sort with cached collation keys", bench_collation },
+    { "psort", "parallel sort speedup on 1..N threads vs serial", bench_parallel_sort },
+    { "views", "sorted view updates under scans vs full re-sort", bench_sorted_view },
+    { "filter", "filter results as id views vs record copies", bench_track_views },
+    { "search", "inverted word index: query latency and upkeep", bench_text_index },
+    { "trigram", "substring and typo-tolerant search over the word index", bench_trigram_index },
+    { "typeahead", "search as you type: result reuse and cancellation", bench_search_session },
+    { "query", "planned boolean filters vs testing every track", bench_filter_query },
+    { "strscan", "SIMD case-insensitive substring scan, GB/s per kernel", bench_strscan },
+    { "plload", "playlist loading: one pass, batched lookups vs line by line", bench_playlist_load },
+    { "plstart", "startup with 1000 playlists: headers only, lazy and parallel loads", bench_playlist_startup },
+    { "plbin", "binary playlists: save/load time and size vs the text format", bench_playlist_binary },
+    { "plsave", "one-track edit on a 50k playlist: change log vs whole rewrite", bench_playlist_save },
+    { "plseq", "random edits on 1k..1M playlists: chunked sequence vs flat array", bench_playlist_sequence },
+    { "smart", "100 smart playlists following scans vs re-running their queries", bench_smart_playlists },
+    { "plimport", "M3U/M3U8/PLS/XSPF streaming import and export, entries/s", bench_playlist_import },
+    { "plundo", "undo/redo on a 1M playlist: latency and history memory", bench_playlist_undo },
+    { "plnames", "10k playlists: name and id index, renames, removals, file names", bench_playlist_names },
+    { "pldiff", "diff, apply and three-way merge of 100k playlists, script size", bench_playlist_diff },
+};
+
+#define BENCH_ENTRY_COUNT (sizeof(bench_entries) / sizeof(bench_entries[0]))
+
+void bench_list(void) {
+    printf("Available benchmarks:\n");
+    for (size_t i = 0; i < BENCH_ENTRY_COUNT; i++) {
+        printf("  %-10s %s\n", bench_entries[i].name, bench_entries[i].description);
+    }
+}
+
+BOOL run_benchmark(const char* name, int track_count) {
+    BOOL run_all = !name || name[0] == '\0' || strcmp(name, "all") == 0;
+    BOOL found = FALSE;
+    
+    if (track_count <= 0) {
+        track_count = BENCH_DEFAULT_TRACKS;
+    }
+    
+    for (size_t i = 0; i < BENCH_ENTRY_COUNT; i++) {
+        if (run_all || strcmp(name, bench_entries[i].name) == 0) {
+            printf("\n[%s] %d tracks\n", bench_entries[i].name, track_count);
+            bench_entries[i].run(track_count);
+            found = TRUE;
+        }
+    }
+    
+    return found;
+}
@@ -0,0 +1,554 @@
+#include "../include/duplicates.h"
+#include "../include/memory.h"
+
+#define HASH_BUFFER_SIZE (256 * 1024)
+#define ID3V2_HEADER_SIZE 10
+#define ID3V1_TAG_SIZE 128
+
+// XXH64 constants
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+// Streaming XXH64 state
+typedef struct {
+    UINT64 v[4];
+    UINT64 total;
+    unsigned char pending[32];
+    int pending_size;
+} PayloadHash;
+
+// Per track working data
+typedef struct {
+    TrackId id;
+    char* filepath;
+    UINT64 payload_offset;
+    UINT64 payload_size;
+    UINT64 hash;
+    BOOL readable;
+    int copy_of;                     // Position in hash_list of the first byte-identical candidate
+} DuplicateCandidate;
+
+// Shared state for the worker tasks
+typedef struct {
+    DuplicateCandidate* candidates;
+    DuplicateCandidate** hash_list;  // Candidates that need hashing
+    int* runs;                       // Runs of equal (size, hash) in hash_list: start, end pairs
+    volatile LONGLONG bytes_hashed;
+    volatile LONGLONG bytes_compared;
+} DuplicateJob;
+
+static UINT64 rotl64(UINT64 value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static UINT64 read64(const unsigned char* p) {
+    UINT64 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static UINT32 read32(const unsigned char* p) {
+    UINT32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static UINT64 hash_round(UINT64 acc, UINT64 input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static UINT64 hash_merge_round(UINT64 acc, UINT64 value) {
+    acc ^= hash_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static void hash_init(PayloadHash* state) {
+    memset(state, 0, sizeof(PayloadHash));
+    state->v[0] = PRIME64_1 + PRIME64_2;
+    state->v[1] = PRIME64_2;
+    state->v[2] = 0;
+    state->v[3] = 0 - PRIME64_1;
+}
+
+static void hash_stripe(PayloadHash* state, const unsigned char* p) {
+    state->v[0] = hash_round(state->v[0], read64(p));
+    state->v[1] = hash_round(state->v[1], read64(p + 8));
+    state->v[2] = hash_round(state->v[2], read64(p + 16));
+    state->v[3] = hash_round(state->v[3], read64(p + 24));
+}
+
+static void hash_update(PayloadHash* state, const unsigned char* data, size_t length) {
+    state->total += length;
+    
+    // Complete a stripe left over from the previous call
+    if (state->pending_size > 0) {
+        size_t fill = 32 - state->pending_size;
+        if (length < fill) {
+            memcpy(state->pending + state->pending_size, data, length);
+            state->pending_size += (int)length;
+            return;
+        }
+        memcpy(state->pending + state->pending_size, data, fill);
+        hash_stripe(state, state->pending);
+        data += fill;
+        length -= fill;
+        state->pending_size = 0;
+    }
+    
+    while (length >= 32) {
+        hash_stripe(state, data);
+        data += 32;
+        length -= 32;
+    }
+    
+    memcpy(state->pending, data, length);
+    state->pending_size = (int)length;
+}
+
+static UINT64 hash_final(PayloadHash* state) {
+    UINT64 h;
+    
+    if (state->total >= 32) {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = hash_merge_round(h, state->v[i]);
+        }
+    } else {
+        h = PRIME64_5;
+    }
+    h += state->total;
+    
+    const unsigned char* p = state->pending;
+    int remaining = state->pending_size;
+    
+    while (remaining >= 8) {
+        h ^= hash_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+        remaining -= 8;
+    }
+    if (remaining >= 4) {
+        h ^= (UINT64)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        remaining -= 4;
+    }
+    while (remaining > 0) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+        remaining--;
+    }
+    
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Read exactly size bytes at offset (FALSE on short reads)
+static BOOL read_at(HANDLE file, UINT64 offset, void* buffer, DWORD size) {
+    LARGE_INTEGER position;
+    position.QuadPart = (LONGLONG)offset;
+    if (!SetFilePointerEx(file, position, NULL, FILE_BEGIN)) return FALSE;
+    
+    DWORD read = 0;
+    return ReadFile(file, buffer, size, &read, NULL) && read == size;
+}
+
+// Find the audio payload of a file: everything between the ID3v2 tag and the ID3v1 tag
+static void probe_payload(void* context, int index) {
+    DuplicateJob* job = (DuplicateJob*)context;
+    DuplicateCandidate* candidate = &job->candidates[index];
+    
+    HANDLE file = CreateFile(candidate->filepath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return;
+    
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return;
+    }
+    
+    UINT64 start = 0;
+    UINT64 end = (UINT64)file_size.QuadPart;
+    unsigned char header[ID3V2_HEADER_SIZE];
+    
+    // ID3v2 at the start: 10 byte header + syncsafe size (+ optional 10 byte footer)
+    if (end >= ID3V2_HEADER_SIZE && read_at(file, 0, header, ID3V2_HEADER_SIZE) &&
+        memcmp(header, "ID3", 3) == 0) {
+        UINT64 tag_size = ((header[6] & 0x7F) << 21) | ((header[7] & 0x7F) << 14) |
+                          ((header[8] & 0x7F) << 7) | (header[9] & 0x7F);
+        tag_size += ID3V2_HEADER_SIZE;
+        if (header[5] & 0x10) {
+            tag_size += ID3V2_HEADER_SIZE;
+        }
+        start = tag_size < end ? tag_size : end;
+    }
+    
+    // ID3v1 at the end: 128 bytes starting with "TAG"
+    if (end - start >= ID3V1_TAG_SIZE && read_at(file, end - ID3V1_TAG_SIZE, header, 3) &&
+        memcmp(header, "TAG", 3) == 0) {
+        end -= ID3V1_TAG_SIZE;
+    }
+    
+    CloseHandle(file);
+    
+    candidate->payload_offset = start;
+    candidate->payload_size = end - start;
+    candidate->readable = TRUE;
+}
+
+// Hash the audio payload of one candidate
+static void hash_payload(void* context, int index) {
+    DuplicateJob* job = (DuplicateJob*)context;
+    DuplicateCandidate* candidate = job->hash_list[index];
+    
+    unsigned char* buffer = (unsigned char*)MEM_ALLOC(HASH_BUFFER_SIZE);
+    if (!buffer) {
+        candidate->readable = FALSE;
+        return;
+    }
+    
+    HANDLE file = CreateFile(candidate->filepath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        candidate->readable = FALSE;
+        MEM_FREE(buffer);
+        return;
+    }
+    
+    PayloadHash state;
+    hash_init(&state);
+    
+    LARGE_INTEGER position;
+    position.QuadPart = (LONGLONG)candidate->payload_offset;
+    UINT64 remaining = candidate->payload_size;
+    
+    if (SetFilePointerEx(file, position, NULL, FILE_BEGIN)) {
+        while (remaining > 0) {
+            DWORD chunk = remaining < HASH_BUFFER_SIZE ? (DWORD)remaining : HASH_BUFFER_SIZE;
+            DWORD read = 0;
+            if (!ReadFile(file, buffer, chunk, &read, NULL) || read == 0) break;
+            
+            hash_update(&state, buffer, read);
+            remaining -= read;
+        }
+    }
+    
+    CloseHandle(file);
+    MEM_FREE(buffer);
+    
+    // A file that changed size while reading cannot be compared
+    if (remaining > 0) {
+        candidate->readable = FALSE;
+        return;
+    }
+    
+    candidate->hash = hash_final(&state);
+    InterlockedExchangeAdd64(&job->bytes_hashed, (LONGLONG)candidate->payload_size);
+}
+
+// TRUE if the payloads of two candidates are byte for byte identical (their sizes are equal)
+static BOOL payloads_equal(const DuplicateCandidate* a, const DuplicateCandidate* b, unsigned char* buffer_a,
+                           unsigned char* buffer_b, LONGLONG* compared) {
+    HANDLE file_a = CreateFile(a->filepath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file_a == INVALID_HANDLE_VALUE) return FALSE;
+    HANDLE file_b = CreateFile(b->filepath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file_b == INVALID_HANDLE_VALUE) {
+        CloseHandle(file_a);
+        return FALSE;
+    }
+    
+    BOOL equal = TRUE;
+    UINT64 offset = 0;
+    while (equal && offset < a->payload_size) {
+        UINT64 left = a->payload_size - offset;
+        DWORD chunk = left < HASH_BUFFER_SIZE ? (DWORD)left : HASH_BUFFER_SIZE;
+        equal = read_at(file_a, a->payload_offset + offset, buffer_a, chunk) &&
+                read_at(file_b, b->payload_offset + offset, buffer_b, chunk) &&
+                memcmp(buffer_a, buffer_b, chunk) == 0;
+        offset += chunk;
+        *compared += chunk;
+    }
+    
+    CloseHandle(file_a);
+    CloseHandle(file_b);
+    return equal;
+}
+
+// Split one run of equal (size, hash) candidates into sets of byte-identical payloads: a
+// hash match alone does not prove two files are copies
+static void confirm_run(void* context, int index) {
+    DuplicateJob* job = (DuplicateJob*)context;
+    int first = job->runs[2 * index];
+    int end = job->runs[2 * index + 1];
+    
+    unsigned char* buffer_a = (unsigned char*)MEM_ALLOC(HASH_BUFFER_SIZE);
+    unsigned char* buffer_b = (unsigned char*)MEM_ALLOC(HASH_BUFFER_SIZE);
+    LONGLONG compared = 0;
+    
+    // Each candidate either joins an earlier set or starts its own. Without memory
+    // nothing can be confirmed, so every candidate stays alone.
+    for (int k = first; k < end; k++) {
+        job->hash_list[k]->copy_of = k;
+    }
+    for (int k = first; buffer_a && buffer_b && k < end; k++) {
+        if (job->hash_list[k]->copy_of != k) continue;
+        
+        for (int m = k + 1; m < end; m++) {
+            if (job->hash_list[m]->copy_of == m &&
+                payloads_equal(job->hash_list[k], job->hash_list[m], buffer_a, buffer_b, &compared)) {
+                job->hash_list[m]->copy_of = k;
+            }
+        }
+    }
+    
+    MEM_FREE(buffer_a);
+    MEM_FREE(buffer_b);
+    InterlockedExchangeAdd64(&job->bytes_compared, compared);
+}
+
+static int compare_by_size(const void* a, const void* b) {
+    const DuplicateCandidate* x = (const DuplicateCandidate*)a;
+    const DuplicateCandidate* y = (const DuplicateCandidate*)b;
+    
+    if (x->payload_size != y->payload_size) return x->payload_size < y->payload_size ? -1 : 1;
+    return 0;
+}
+
+// Order by size, then hash, then path (so groups come out contiguous and stable)
+static int compare_by_content(const void* a, const void* b) {
+    const DuplicateCandidate* x = *(const DuplicateCandidate* const*)a;
+    const DuplicateCandidate* y = *(const DuplicateCandidate* const*)b;
+    
+    if (x->payload_size != y->payload_size) return x->payload_size > y->payload_size ? -1 : 1;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return _stricmp(x->filepath, y->filepath);
+}
+
+static double elapsed_ms(LARGE_INTEGER* start, LARGE_INTEGER* frequency) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)(now.QuadPart - start->QuadPart) * 1000.0 / (double)frequency->QuadPart;
+}
+
+// Find tracks with identical audio payloads (pool may be NULL to run serially)
+DuplicateReport* find_duplicate_tracks(MP3Library* library, ThreadPool* pool) {
+    if (!library) return NULL;
+    
+    DuplicateReport* report = (DuplicateReport*)MEM_CALLOC(1, sizeof(DuplicateReport));
+    if (!report) return NULL;
+    report->thread_count = pool ? pool->thread_count : 1;
+    
+    // Snapshot ids and paths so the workers never touch the library (under its lock,
+    // so that a background scan cannot change the list halfway)
+    library_lock(library);
+    int count = library->total_files;
+    if (count <= 0) {
+        library_unlock(library);
+        return report;
+    }
+    
+    DuplicateJob job;
+    memset(&job, 0, sizeof(job));
+    job.candidates = (DuplicateCandidate*)MEM_CALLOC(count, sizeof(DuplicateCandidate));
+    job.hash_list = (DuplicateCandidate**)MEM_ALLOC(count * sizeof(DuplicateCandidate*));
+    job.runs = (int*)MEM_ALLOC((count / 2 + 1) * 2 * sizeof(int));
+    if (!job.candidates || !job.hash_list || !job.runs) {
+        library_unlock(library);
+        MEM_FREE(job.candidates);
+        MEM_FREE(job.hash_list);
+        MEM_FREE(job.runs);
+        free_duplicate_report(report);
+        return NULL;
+    }
+    
+    int n = 0;
+    for (MP3File* current = library->all_files; current && n < count; current = current->next) {
+        job.candidates[n].id = current->id;
+        job.candidates[n].filepath = mp3_file_dup_path(current);
+        if (job.candidates[n].filepath) {
+            n++;
+        }
+    }
+    library_unlock(library);
+    count = n;
+    report->files_total = count;
+    
+    LARGE_INTEGER frequency, start;
+    QueryPerformanceFrequency(&frequency);
+    
+    // Phase 1: payload boundaries (a couple of small reads per file)
+    QueryPerformanceCounter(&start);
+    thread_pool_run(pool, count, probe_payload, &job);
+    report->probe_ms = elapsed_ms(&start, &frequency);
+    
+    // Phase 2: size prefilter, only files sharing their payload size get hashed
+    qsort(job.candidates, count, sizeof(DuplicateCandidate), compare_by_size);
+    
+    int hash_count = 0;
+    for (int i = 0; i < count; ) {
+        int j = i + 1;
+        while (j < count && job.candidates[j].payload_size == job.candidates[i].payload_size) {
+            j++;
+        }
+        
+        int readable = 0;
+        for (int k = i; k < j; k++) {
+            if (job.candidates[k].readable) readable++;
+        }
+        report->files_unreadable += (j - i) - readable;
+        
+        if (readable >= 2 && job.candidates[i].payload_size > 0) {
+            for (int k = i; k < j; k++) {
+                if (job.candidates[k].readable) {
+                    job.hash_list[hash_count++] = &job.candidates[k];
+                }
+            }
+        } else {
+            report->files_skipped += readable;
+        }
+        i = j;
+    }
+    
+    // Phase 3: hash the candidates in parallel
+    QueryPerformanceCounter(&start);
+    thread_pool_run(pool, hash_count, hash_payload, &job);
+    report->hash_ms = elapsed_ms(&start, &frequency);
+    report->bytes_hashed = (UINT64)job.bytes_hashed;
+    
+    // Phase 4: group equal (size, hash) pairs
+    int hashed = 0;
+    for (int i = 0; i < hash_count; i++) {
+        if (job.hash_list[i]->readable) {
+            job.hash_list[hashed++] = job.hash_list[i];
+        } else {
+            report->files_unreadable++;
+        }
+    }
+    report->files_hashed = hashed;
+    qsort(job.hash_list, hashed, sizeof(DuplicateCandidate*), compare_by_content);
+    
+    int run_count = 0;
+    for (int i = 0; i < hashed; ) {
+        int j = i + 1;
+        while (j < hashed && job.hash_list[j]->payload_size == job.hash_list[i]->payload_size &&
+               job.hash_list[j]->hash == job.hash_list[i]->hash) {
+            j++;
+        }
+        
+        if (j - i >= 2) {
+            job.runs[2 * run_count] = i;
+            job.runs[2 * run_count + 1] = j;
+            run_count++;
+        }
+        i = j;
+    }
+    
+    // Phase 5: confirm each run by comparing the payloads byte for byte
+    QueryPerformanceCounter(&start);
+    thread_pool_run(pool, run_count, confirm_run, &job);
+    report->compare_ms = elapsed_ms(&start, &frequency);
+    report->bytes_compared = (UINT64)job.bytes_compared;
+    
+    // A run is in path order, so each set of copies comes out in path order as well
+    report->groups = (DuplicateGroup*)MEM_CALLOC(hashed / 2 + 1, sizeof(DuplicateGroup));
+    for (int r = 0; report->groups && r < run_count; r++) {
+        int first = job.runs[2 * r];
+        int end = job.runs[2 * r + 1];
+        
+        for (int k = first; k < end; k++) {
+            if (job.hash_list[k]->copy_of != k) continue;
+            
+            int copies = 0;
+            for (int m = k; m < end; m++) {
+                if (job.hash_list[m]->copy_of == k) copies++;
+            }
+            if (copies < 2) {
+                report->hash_mismatches++;
+                continue;
+            }
+            
+            DuplicateGroup* group = &report->groups[report->group_count];
+            group->tracks = (TrackId*)MEM_ALLOC(copies * sizeof(TrackId));
+            if (group->tracks) {
+                for (int m = k; m < end; m++) {
+                    if (job.hash_list[m]->copy_of == k) {
+                        group->tracks[group->count++] = job.hash_list[m]->id;
+                    }
+                }
+                group->payload_size = job.hash_list[k]->payload_size;
+                group->hash = job.hash_list[k]->hash;
+                report->redundant_files += group->count - 1;
+                report->redundant_bytes += group->payload_size * (group->count - 1);
+                report->group_count++;
+            }
+        }
+    }
+    
+    for (int i = 0; i < count; i++) {
+        MEM_FREE(job.candidates[i].filepath);
+    }
+    MEM_FREE(job.candidates);
+    MEM_FREE(job.hash_list);
+    MEM_FREE(job.runs);
+    return report;
+}
+
+// Print the groups and the throughput statistics of a report
+void print_duplicate_report(DuplicateReport* report, MP3Library* library) {
+    if (!report) return;
+    
+    for (int i = 0; i < report->group_count; i++) {
+        DuplicateGroup* group = &report->groups[i];
+        printf("\nGroup %d: %d copies, %.2f MB audio (hash %016llx)\n", i + 1, group->count,
+               group->payload_size / (1024.0 * 1024.0), (unsigned long long)group->hash);
+        
+        for (int k = 0; k < group->count; k++) {
+            MP3File* file = library_get_track(library, group->tracks[k]);
+            char* filepath = file ? mp3_file_dup_path(file) : NULL;
+            printf("  [%016llx] %s\n", (unsigned long long)group->tracks[k],
+                   filepath ? filepath : "(removed from library)");
+            MEM_FREE(filepath);
+        }
+    }
+    
+    if (report->group_count == 0) {
+        printf("\nNo duplicates found.\n");
+    }
+    
+    double skipped = report->files_total > 0 ? 100.0 * report->files_skipped / report->files_total : 0.0;
+    double seconds = report->hash_ms / 1000.0;
+    double gbps = seconds > 0 ? report->bytes_hashed / seconds / 1e9 : 0.0;
+    
+    printf("\nDuplicate groups: %d (%d redundant files, %.2f MB)\n", report->group_count,
+           report->redundant_files, report->redundant_bytes / (1024.0 * 1024.0));
+    printf("Files: %d examined, %d skipped by size prefilter (%.1f%%), %d hashed, %d unreadable\n",
+           report->files_total, report->files_skipped, skipped, report->files_hashed, report->files_unreadable);
+    printf("Probe: %.2f ms, hash: %.2f ms for %.2f MB (%.3f GB/s, %d threads)\n", report->probe_ms,
+           report->hash_ms, report->bytes_hashed / (1024.0 * 1024.0), gbps, report->thread_count);
+    printf("Confirm: %.2f ms comparing %.2f MB byte by byte, %d hash matches rejected\n", report->compare_ms,
+           report->bytes_compared / (1024.0 * 1024.0), report->hash_mismatches);
+}
+
+// Free a report
+void free_duplicate_report(DuplicateReport* report) {
+    if (!report) return;
+    
+    for (int i = 0; i < report->group_count; i++) {
+        MEM_FREE(report->groups[i].tracks);
+    }
+    MEM_FREE(report->groups);
+    MEM_FREE(report);
+}
@@ -0,0 +1,1198 @@
+#include "../include/filterquery.h"
+#include "../include/memory.h"
+#include "../include/sortview.h"
+#include "../include/strscan.h"
+#include <limits.h>
+
+// Planner costs, in posting visits of the word index (measured on 500k tracks:
+// a posting visit takes about 2 ns, resolving a document to its record 400 ns)
+#define COST_SET        (1.0 / 32)   // Per document, for a set operation over a whole bitmap
+#define COST_SCAN_STEP  60.0         // Following the library list to the next record
+#define COST_FETCH      200.0        // Resolving a candidate document to its record
+#define COST_TEXT_FIELD 60.0         // Folding and testing one text field of a record
+#define COST_RANGE      1.0          // Testing a numeric field of a record
+#define COST_VIEW_STEP  45.0         // Visiting a node of a sorted view
+#define COST_CONTAINS_FIELD 15.0     // Substring search in one text field of a record
+#define COST_POOL_BYTE  0.2          // Substring scan of one byte of a string pool
+#define COST_POOL_MATCH 50.0         // Mapping a pool match back to its document
+
+typedef struct {
+    const char* p;
+    FilterQuery* query;
+    char* error;
+    size_t error_size;
+} Parser;
+
+static void parse_error(Parser* parser, const char* format, const char* detail) {
+    if (parser->error && parser->error_size > 0 && parser->error[0] == '\0') {
+        snprintf(parser->error, parser->error_size, format, detail);
+    }
+}
+
+static void skip_spaces(Parser* parser) {
+    while (*parser->p == ' ' || *parser->p == '\t') {
+        parser->p++;
+    }
+}
+
+static BOOL ends_term(char c) {
+    return c == '\0' || c == ' ' || c == '\t' || c == '(' || c == ')';
+}
+
+// Take an operator written in capitals, as a word of its own
+static BOOL take_keyword(Parser* parser, const char* keyword) {
+    size_t length = strlen(keyword);
+    if (strncmp(parser->p, keyword, length) != 0 || !ends_term(parser->p[length])) return FALSE;
+    
+    parser->p += length;
+    return TRUE;
+}
+
+static int new_node(Parser* parser, int kind) {
+    FilterQuery* query = parser->query;
+    if (query->node_count == FILTER_QUERY_MAX_NODES) {
+        parse_error(parser, "too many terms%s", "");
+        return -1;
+    }
+    
+    int n = query->node_count++;
+    FilterNode* node = &query->nodes[n];
+    memset(node, 0, sizeof(FilterNode));
+    node->kind = kind;
+    node->low = INT_MIN;
+    node->high = INT_MAX;
+    node->actual = -1;
+    return n;
+}
+
+static BOOL add_child(Parser* parser, int n, int child) {
+    FilterNode* node = &parser->query->nodes[n];
+    if (node->child_count == FILTER_QUERY_MAX_CHILDREN) {
+        parse_error(parser, "too many terms in one AND/OR%s", "");
+        return FALSE;
+    }
+    node->children[node->child_count++] = child;
+    return TRUE;
+}
+
+static void collect_word(const char* token, int length, void* context) {
+    FilterNode* node = (FilterNode*)context;
+    if (node->word_count == FILTER_QUERY_MAX_WORDS) return;
+    
+    memcpy(node->words[node->word_count], token, length + 1);
+    node->word_length[node->word_count++] = length;
+}
+
+// A number, or minutes:seconds for durations
+static BOOL parse_number(const char** text, int field, int* value) {
+    const char* p = *text;
+    if (*p < '0' || *p > '9') return FALSE;
+    
+    long number = 0;
+    while (*p >= '0' && *p <= '9' && number < 100000000) {
+        number = number * 10 + (*p++ - '0');
+    }
+    if (field == SORT_BY_DURATION && *p == ':' && p[1] >= '0' && p[1] <= '9') {
+        p++;
+        long seconds = 0;
+        while (*p >= '0' && *p <= '9' && seconds < 100000000) {
+            seconds = seconds * 10 + (*p++ - '0');
+        }
+        number = number * 60 + seconds;
+    }
+    
+    *value = (int)number;
+    *text = p;
+    return TRUE;
+}
+
+// N, A..B, A.., ..B, <N, <=N, >N or >=N
+static BOOL parse_range(FilterNode* node) {
+    const char* p = node->value;
+    int value;
+    
+    if (*p == '<' || *p == '>') {
+        BOOL less = *p++ == '<';
+        BOOL inclusive = *p == '=';
+        if (inclusive) p++;
+        if (!parse_number(&p, node->field, &value) || *p != '\0') return FALSE;
+        
+        if (less) {
+            node->high = inclusive ? value : value - 1;
+        } else {
+            node->low = inclusive ? value : value + 1;
+        }
+        return TRUE;
+    }
+    
+    BOOL has_low = parse_number(&p, node->field, &value);
+    if (has_low) {
+        node->low = value;
+    }
+    if (strncmp(p, "..", 2) != 0) {
+        node->high = node->low;
+        return has_low && *p == '\0';
+    }
+    
+    p += 2;
+    if (parse_number(&p, node->field, &value)) {
+        node->high = value;
+    } else if (!has_low) {
+        return FALSE;
+    }
+    return *p == '\0';
+}
+
+static int parse_or(Parser* parser);
+
+// field:value, field~value or a bare word (searched in every text field)
+static int parse_term(Parser* parser) {
+    const char* start = parser->p;
+    const char* separator = NULL;
+    for (const char* p = start; (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'); p++) {
+        if (p[1] == ':' || p[1] == '~') separator = p + 1;
+    }
+    
+    char name[16] = "";
+    int text_field = TEXT_FIELD_ANY;
+    int range_field = -1;
+    BOOL contains = separator && *separator == '~';
+    if (separator) {
+        int length = (int)(separator - start);
+        if (length >= (int)sizeof(name)) length = sizeof(name) - 1;
+        memcpy(name, start, length);
+        name[length] = '\0';
+        
+        text_field = text_field_from_name(name);
+        if (text_field < 0) {
+            range_field = sort_field_from_name(name);
+            if (range_field != SORT_BY_YEAR && range_field != SORT_BY_TRACK && range_field != SORT_BY_DISC &&
+                range_field != SORT_BY_DURATION) {
+                parse_error(parser, "unknown field '%s'", name);
+                return -1;
+            }
+            if (contains) {
+                parse_error(parser, "'~' needs a text field, not '%s'", name);
+                return -1;
+            }
+        }
+        parser->p = separator + 1;
+    }
+    
+    int kind = range_field >= 0 ? FILTER_NODE_RANGE : (contains ? FILTER_NODE_CONTAINS : FILTER_NODE_TEXT);
+    int n = new_node(parser, kind);
+    if (n < 0) return -1;
+    FilterNode* node = &parser->query->nodes[n];
+    node->field = range_field >= 0 ? range_field : text_field;
+    
+    // Quotes keep spaces and operators in the value
+    const char* value = parser->p;
+    size_t length;
+    if (*value == '"') {
+        value++;
+        const char* end = strchr(value, '"');
+        if (!end) {
+            parse_error(parser, "missing closing quote%s", "");
+            return -1;
+        }
+        length = (size_t)(end - value);
+        parser->p = end + 1;
+    } else {
+        const char* end = value;
+        while (!ends_term(*end)) {
+            end++;
+        }
+        length = (size_t)(end - value);
+        parser->p = end;
+    }
+    
+    if (length >= MAX_FILTER_LENGTH) length = MAX_FILTER_LENGTH - 1;
+    memcpy(node->value, value, length);
+    node->value[length] = '\0';
+    if (length == 0) {
+        parse_error(parser, "missing value after '%s'", separator ? name : "");
+        return -1;
+    }
+    
+    if (node->kind == FILTER_NODE_RANGE) {
+        if (!parse_range(node)) {
+            parse_error(parser, "invalid number or range '%s'", node->value);
+            return -1;
+        }
+        if (node->low > node->high) {
+            parse_error(parser, "empty range '%s'", node->value);
+            return -1;
+        }
+    } else if (node->kind == FILTER_NODE_TEXT) {
+        text_tokenize(node->value, collect_word, node);
+        if (node->word_count == 0) {
+            parse_error(parser, "no words to look for in '%s'", node->value);
+            return -1;
+        }
+    }
+    return n;
+}
+
+static int parse_unary(Parser* parser) {
+    skip_spaces(parser);
+    
+    if (take_keyword(parser, "NOT")) {
+        int n = new_node(parser, FILTER_NODE_NOT);
+        int child = n < 0 ? -1 : parse_unary(parser);
+        if (child < 0 || !add_child(parser, n, child)) return -1;
+        return n;
+    }
+    
+    if (*parser->p == '(') {
+        parser->p++;
+        int n = parse_or(parser);
+        if (n < 0) return -1;
+        
+        skip_spaces(parser);
+        if (*parser->p != ')') {
+            parse_error(parser, "missing ')'%s", "");
+            return -1;
+        }
+        parser->p++;
+        return n;
+    }
+    
+    if (*parser->p == '\0' || *parser->p == ')' || take_keyword(parser, "AND") || take_keyword(parser, "OR")) {
+        parse_error(parser, "missing term%s", "");
+        return -1;
+    }
+    return parse_term(parser);
+}
+
+// Terms joined by AND, or simply written one after the other
+static int parse_and(Parser* parser) {
+    int first = parse_unary(parser);
+    if (first < 0) return -1;
+    
+    int n = -1;
+    while (TRUE) {
+        skip_spaces(parser);
+        const char* before = parser->p;
+        if (*parser->p == '\0' || *parser->p == ')' || take_keyword(parser, "OR")) {
+            parser->p = before;
+            break;
+        }
+        take_keyword(parser, "AND");
+        
+        if (n < 0) {
+            n = new_node(parser, FILTER_NODE_AND);
+            if (n < 0 || !add_child(parser, n, first)) return -1;
+        }
+        int next = parse_unary(parser);
+        if (next < 0 || !add_child(parser, n, next)) return -1;
+    }
+    return n >= 0 ? n : first;
+}
+
+static int parse_or(Parser* parser) {
+    int first = parse_and(parser);
+    if (first < 0) return -1;
+    
+    int n = -1;
+    while (TRUE) {
+        skip_spaces(parser);
+        if (!take_keyword(parser, "OR")) break;
+        
+        if (n < 0) {
+            n = new_node(parser, FILTER_NODE_OR);
+            if (n < 0 || !add_child(parser, n, first)) return -1;
+        }
+        int next = parse_and(parser);
+        if (next < 0 || !add_child(parser, n, next)) return -1;
+    }
+    return n >= 0 ? n : first;
+}
+
+FilterQuery* filter_query_parse(const char* text, char* error, size_t error_size) {
+    if (error && error_size > 0) error[0] = '\0';
+    if (!text) return NULL;
+    
+    FilterQuery* query = (FilterQuery*)MEM_CALLOC_TAGGED(1, sizeof(FilterQuery), MEM_CAT_FILTER);
+    if (!query) {
+        if (error && error_size > 0) snprintf(error, error_size, "out of memory");
+        return NULL;
+    }
+    
+    Parser parser = { text, query, error, error_size };
+    query->root = parse_or(&parser);
+    if (query->root >= 0) {
+        skip_spaces(&parser);
+        if (*parser.p != '\0') {
+            parse_error(&parser, "unexpected '%s'", parser.p);
+            query->root = -1;
+        }
+    }
+    
+    if (query->root < 0) {
+        MEM_FREE(query);
+        return NULL;
+    }
+    return query;
+}
+
+void filter_query_free(FilterQuery* query) {
+    MEM_FREE(query);
+}
+
+// Record matching
+
+typedef struct {
+    const FilterNode* node;
+    UINT32 matched;                  // Words found so far
+} WordCheck;
+
+// Same rules as the word index: a word matches the start of a token, or from
+// 3 letters any part of it
+static void check_token(const char* token, int length, void* context) {
+    WordCheck* check = (WordCheck*)context;
+    const FilterNode* node = check->node;
+    
+    for (int i = 0; i < node->word_count; i++) {
+        int word_length = node->word_length[i];
+        if ((check->matched & (1u << i)) || word_length > length) continue;
+        
+        if (memcmp(token, node->words[i], word_length) == 0 ||
+            (word_length >= 3 && strstr(token, node->words[i]) != NULL)) {
+            check->matched |= 1u << i;
+        }
+    }
+}
+
+static const char* text_field_value(const MP3File* file, int field) {
+    switch (field) {
+        case TEXT_FIELD_TITLE: return file->metadata.title;
+        case TEXT_FIELD_ARTIST: return file->metadata.artist;
+        case TEXT_FIELD_ALBUM: return file->metadata.album;
+        default: return file->metadata.genre;
+    }
+}
+
+static int range_field_value(const MP3File* file, int field) {
+    switch (field) {
+        case SORT_BY_YEAR: return file->metadata.year;
+        case SORT_BY_TRACK: return file->metadata.track_number;
+        case SORT_BY_DISC: return file->metadata.disc_number;
+        default: return file->metadata.duration;
+    }
+}
+
+static BOOL text_matches(const FilterNode* node, const MP3File* file) {
+    WordCheck check = { node, 0 };
+    UINT32 all = (1u << node->word_count) - 1;
+    
+    int first = node->field == TEXT_FIELD_ANY ? TEXT_FIELD_TITLE : node->field;
+    int last = node->field == TEXT_FIELD_ANY ? TEXT_FIELD_GENRE : node->field;
+    for (int field = first; field <= last && check.matched != all; field++) {
+        text_tokenize(text_field_value(file, field), check_token, &check);
+    }
+    return check.matched == all;
+}
+
+static BOOL contains_matches(const FilterNode* node, const MP3File* file) {
+    size_t length = strlen(node->value);
+    int first = node->field == TEXT_FIELD_ANY ? TEXT_FIELD_TITLE : node->field;
+    int last = node->field == TEXT_FIELD_ANY ? TEXT_FIELD_GENRE : node->field;
+    for (int field = first; field <= last; field++) {
+        const char* text = text_field_value(file, field);
+        if (str_find_nocase(text, strlen(text), node->value, length) != STR_NOT_FOUND) return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL node_matches(const FilterQuery* query, int n, const MP3File* file) {
+    const FilterNode* node = &query->nodes[n];
+    switch (node->kind) {
+        case FILTER_NODE_AND:
+            for (int i = 0; i < node->child_count; i++) {
+                if (!node_matches(query, node->children[i], file)) return FALSE;
+            }
+            return TRUE;
+        case FILTER_NODE_OR:
+            for (int i = 0; i < node->child_count; i++) {
+                if (node_matches(query, node->children[i], file)) return TRUE;
+            }
+            return FALSE;
+        case FILTER_NODE_NOT:
+            return !node_matches(query, node->children[0], file);
+        case FILTER_NODE_TEXT:
+            return text_matches(node, file);
+        case FILTER_NODE_CONTAINS:
+            return contains_matches(node, file);
+        default: {
+            int value = range_field_value(file, node->field);
+            return value >= node->low && value <= node->high;
+        }
+    }
+}
+
+BOOL filter_query_matches(const FilterQuery* query, const MP3File* file) {
+    return query && file && node_matches(query, query->root, file);
+}
+
+// Planning
+
+typedef struct {
+    FilterQuery* query;
+    MP3Library* library;
+    TextIndex* index;                // NULL if some records are missing from it
+    double tracks;
+    const MP3File* sample[FILTER_SAMPLE_SIZE];
+    int sample_count;
+} Planner;
+
+// The word index and its document numbers stand for the library only if every record is in it
+static TextIndex* covering_index(MP3Library* library) {
+    TextIndex* index = library->text;
+    if (!index || index->doc_count - index->deleted_count != (UINT32)library->total_files) return NULL;
+    return index;
+}
+
+// Records spread over the library, to estimate how many tracks a term keeps
+static void take_sample(Planner* planner) {
+    planner->sample_count = 0;
+    TextIndex* index = planner->index;
+    if (index && index->doc_count > 0) {
+        UINT32 step = index->doc_count / FILTER_SAMPLE_SIZE;
+        if (step == 0) step = 1;
+        for (UINT32 doc = step / 2; doc < index->doc_count && planner->sample_count < FILTER_SAMPLE_SIZE; doc += step) {
+            MP3File* file = index->docs[doc] != INVALID_TRACK_ID ? library_get_track(planner->library, index->docs[doc])
+                                                                 : NULL;
+            if (file) {
+                planner->sample[planner->sample_count++] = file;
+            }
+        }
+    } else {
+        for (MP3File* file = planner->library->all_files; file && planner->sample_count < FILTER_SAMPLE_SIZE;
+             file = file->next) {
+            planner->sample[planner->sample_count++] = file;
+        }
+    }
+}
+
+static double sampled_rows(Planner* planner, int n) {
+    if (planner->sample_count == 0) return 0;
+    
+    int hits = 0;
+    for (int i = 0; i < planner->sample_count; i++) {
+        if (node_matches(planner->query, n, planner->sample[i])) hits++;
+    }
+    // Half a hit when none of the sample matched: rare, but not impossible
+    double share = (hits > 0 ? hits : 0.5) / planner->sample_count;
+    return share * planner->tracks;
+}
+
+// Work to test a node on one record
+static double check_cost(const FilterQuery* query, int n) {
+    const FilterNode* node = &query->nodes[n];
+    switch (node->kind) {
+        case FILTER_NODE_TEXT:
+            return COST_TEXT_FIELD * (node->field == TEXT_FIELD_ANY ? 4 : 1);
+        case FILTER_NODE_CONTAINS:
+            return COST_CONTAINS_FIELD * (node->field == TEXT_FIELD_ANY ? 4 : 1);
+        case FILTER_NODE_RANGE:
+            return COST_RANGE;
+        default: {
+            double cost = 0;
+            for (int i = 0; i < node->child_count; i++) {
+                cost += check_cost(query, node->children[i]);
+            }
+            return cost;
+        }
+    }
+}
+
+// A registered view sorted first by the field, to walk a range of it
+static SortedView* range_view(Planner* planner, int field) {
+    for (SortedView* view = planner->library->views; view; view = view->next_view) {
+        if (view->valid && view->count == planner->library->total_files && view->spec.key_count > 0 &&
+            view->spec.keys[0].field == field) {
+            return view;
+        }
+    }
+    return NULL;
+}
+
+// Descendants of a tested node are tested with it
+static void mark_checked(FilterQuery* query, int n) {
+    FilterNode* node = &query->nodes[n];
+    for (int i = 0; i < node->child_count; i++) {
+        query->nodes[node->children[i]].access = FILTER_ACCESS_CHECK;
+        mark_checked(query, node->children[i]);
+    }
+}
+
+// Cost of an AND driven by its child number driver: the other terms follow, most
+// selective first, each intersected as a set or tested on the candidates left,
+// whichever costs less. With apply set the children are put in that order and
+// marked, and rows receives the estimated matches.
+static double and_cost(Planner* planner, int n, int driver, BOOL apply, double* rows) {
+    FilterQuery* query = planner->query;
+    FilterNode* node = &query->nodes[n];
+    double tracks = planner->tracks;
+    
+    int order[FILTER_QUERY_MAX_CHILDREN];
+    int count = 0;
+    order[count++] = node->children[driver];
+    for (int i = 0; i < node->child_count; i++) {
+        if (i == driver) continue;
+        
+        // Insertion sort keeps the written order on ties
+        int child = node->children[i];
+        int j = count;
+        while (j > 1 && query->nodes[order[j - 1]].rows > query->nodes[child].rows) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = child;
+        count++;
+    }
+    
+    FilterNode* first = &query->nodes[order[0]];
+    double candidates = first->rows;
+    double cost = first->cost;
+    BOOL fetched = FALSE;
+    for (int i = 1; i < count; i++) {
+        FilterNode* child = &query->nodes[order[i]];
+        double intersect = child->cost + tracks * COST_SET;
+        double test = candidates * (check_cost(query, order[i]) + (fetched ? 0 : COST_FETCH));
+        if (test < intersect) {
+            fetched = TRUE;
+            cost += test;
+            if (apply) {
+                child->access = FILTER_ACCESS_CHECK;
+                mark_checked(query, order[i]);
+            }
+        } else {
+            cost += intersect;
+        }
+        candidates *= tracks > 0 ? child->rows / tracks : 0;
+    }
+    
+    if (apply) {
+        memcpy(node->children, order, count * sizeof(int));
+        *rows = candidates;
+    }
+    return cost;
+}
+
+static BOOL plan_node(Planner* planner, int n) {
+    FilterQuery* query = planner->query;
+    FilterNode* node = &query->nodes[n];
+    double tracks = planner->tracks;
+    double scan = tracks * (COST_SCAN_STEP + check_cost(query, n));
+    
+    node->access = FILTER_ACCESS_SCAN;
+    node->view = NULL;
+    node->cost = scan;
+    node->actual = -1;
+    
+    if (!planner->index) {
+        node->rows = sampled_rows(planner, n);
+        mark_checked(query, n);
+        return TRUE;
+    }
+    
+    switch (node->kind) {
+        case FILTER_NODE_TEXT: {
+            size_t walk = 0;
+            int rows = text_index_estimate(planner->index, node->field, node->value, TEXT_MATCH_SUBSTRING, &walk);
+            if (rows < 0) return FALSE;
+            
+            node->rows = rows;
+            double cost = (double)walk + tracks * COST_SET;
+            if (cost < node->cost) {
+                node->access = FILTER_ACCESS_INDEX;
+                node->cost = cost;
+            }
+            return TRUE;
+        }
+        
+        case FILTER_NODE_CONTAINS: {
+            // The pools hold every document, removed ones included, back to back
+            node->rows = sampled_rows(planner, n);
+            size_t bytes = 0;
+            int first = node->field == TEXT_FIELD_ANY ? TEXT_FIELD_TITLE : node->field;
+            int last = node->field == TEXT_FIELD_ANY ? TEXT_FIELD_GENRE : node->field;
+            for (int field = first; field <= last; field++) {
+                bytes += text_index_pool(planner->index, field)->size;
+            }
+            double cost = bytes * COST_POOL_BYTE + node->rows * COST_POOL_MATCH + tracks * COST_SET;
+            if (cost < node->cost) {
+                node->access = FILTER_ACCESS_POOL;
+                node->cost = cost;
+            }
+            return TRUE;
+        }
+        
+        case FILTER_NODE_RANGE: {
+            node->rows = sampled_rows(planner, n);
+            SortedView* view = range_view(planner, node->field);
+            double levels = 1;
+            for (int count = planner->library->total_files; count > 1; count >>= 1) {
+                levels++;
+            }
+            double cost = (levels + node->rows) * COST_VIEW_STEP + tracks * COST_SET;
+            if (view && cost < node->cost) {
+                node->access = FILTER_ACCESS_VIEW;
+                node->view = view;
+                node->cost = cost;
+            }
+            return TRUE;
+        }
+        
+        case FILTER_NODE_AND: {
+            for (int i = 0; i < node->child_count; i++) {
+                if (!plan_node(planner, node->children[i])) return FALSE;
+            }
+            
+            // Every term is tried as the one giving the candidates
+            int driver = 0;
+            double best = and_cost(planner, n, 0, FALSE, NULL);
+            for (int i = 1; i < node->child_count; i++) {
+                double cost = and_cost(planner, n, i, FALSE, NULL);
+                if (cost < best) {
+                    best = cost;
+                    driver = i;
+                }
+            }
+            and_cost(planner, n, driver, TRUE, &node->rows);
+            
+            if (best < node->cost) {
+                node->access = FILTER_ACCESS_COMBINE;
+                node->cost = best;
+            } else {
+                mark_checked(query, n);
+            }
+            return TRUE;
+        }
+        
+        case FILTER_NODE_OR: {
+            double missed = 1;
+            double cost = 0;
+            for (int i = 0; i < node->child_count; i++) {
+                if (!plan_node(planner, node->children[i])) return FALSE;
+                
+                FilterNode* child = &query->nodes[node->children[i]];
+                missed *= tracks > 0 ? 1 - child->rows / tracks : 1;
+                cost += child->cost + tracks * COST_SET;
+            }
+            
+            node->rows = tracks * (1 - missed);
+            if (cost < node->cost) {
+                node->access = FILTER_ACCESS_COMBINE;
+                node->cost = cost;
+            } else {
+                mark_checked(query, n);
+            }
+            return TRUE;
+        }
+        
+        default: {
+            if (!plan_node(planner, node->children[0])) return FALSE;
+            
+            FilterNode* child = &query->nodes[node->children[0]];
+            node->rows = tracks - child->rows;
+            double cost = child->cost + tracks * COST_SET;
+            if (cost < node->cost) {
+                node->access = FILTER_ACCESS_COMBINE;
+                node->cost = cost;
+            } else {
+                mark_checked(query, n);
+            }
+            return TRUE;
+        }
+    }
+}
+
+BOOL filter_query_plan(FilterQuery* query, MP3Library* library) {
+    if (!query || !library) return FALSE;
+    
+    Planner* planner = (Planner*)MEM_ALLOC(sizeof(Planner));
+    if (!planner) return FALSE;
+    
+    planner->query = query;
+    planner->library = library;
+    library_lock(library);
+    planner->index = covering_index(library);
+    planner->tracks = library->total_files;
+    take_sample(planner);
+    
+    BOOL ok = plan_node(planner, query->root);
+    library_unlock(library);
+    query->indexed = planner->index != NULL;
+    query->cost = query->nodes[query->root].cost;
+    query->scan_cost = planner->tracks * (COST_SCAN_STEP + check_cost(query, query->root));
+    
+    MEM_FREE(planner);
+    return ok;
+}
+
+// Execution over bitmaps of index documents
+
+typedef struct {
+    FilterQuery* query;
+    MP3Library* library;
+    TextIndex* index;
+    int words;                       // UINT64 per bitmap
+    UINT64* live;                    // Documents still in the library, built for NOT when some are deleted
+    TrackView scratch;
+} Executor;
+
+static int count_bits(const UINT64* bits, int words) {
+    int count = 0;
+    for (int w = 0; w < words; w++) {
+        UINT64 word = bits[w];
+        while (word) {
+            word &= word - 1;
+            count++;
+        }
+    }
+    return count;
+}
+
+static UINT64* new_bitmap(Executor* executor) {
+    return (UINT64*)MEM_CALLOC_TAGGED(executor->words > 0 ? executor->words : 1, sizeof(UINT64), MEM_CAT_FILTER);
+}
+
+static void set_doc(UINT64* bits, UINT32 doc) {
+    bits[doc >> 6] |= (UINT64)1 << (doc & 63);
+}
+
+static BOOL walk_view(Executor* executor, const FilterNode* node, UINT64* bits) {
+    const SortedView* view = node->view;
+    BOOL descending = view->spec.keys[0].descending;
+    
+    // Skip the records before the range, then walk it
+    SortedViewNode* current = view->head;
+    for (int level = view->level - 1; level >= 0; level--) {
+        while (current->next[level]) {
+            int value = range_field_value(current->next[level]->file, node->field);
+            if (descending ? value <= node->high : value >= node->low) break;
+            current = current->next[level];
+        }
+    }
+    
+    for (current = current->next[0]; current; current = current->next[0]) {
+        int value = range_field_value(current->file, node->field);
+        if (descending ? value < node->low : value > node->high) break;
+        if (value >= node->low && value <= node->high && current->file->search_doc < executor->index->doc_count) {
+            set_doc(bits, current->file->search_doc);
+        }
+    }
+    return TRUE;
+}
+
+static BOOL search_index(Executor* executor, const FilterNode* node, UINT64* bits) {
+    // The folded words, so that the index looks up exactly what the checks test
+    char query[FILTER_QUERY_MAX_WORDS * TEXT_TOKEN_MAX];
+    size_t length = 0;
+    for (int i = 0; i < node->word_count; i++) {
+        memcpy(query + length, node->words[i], node->word_length[i]);
+        length += node->word_length[i];
+        query[length++] = ' ';
+    }
+    query[length > 0 ? length - 1 : 0] = '\0';
+    
+    int count = text_index_match(executor->index, node->field, query, TEXT_MATCH_SUBSTRING, &executor->scratch, NULL);
+    if (count < 0) return FALSE;
+    
+    for (int i = 0; i < count; i++) {
+        set_doc(bits, executor->index->result_docs[i]);
+    }
+    return TRUE;
+}
+
+typedef struct {
+    const TextIndex* index;
+    UINT64* bits;
+} PoolMatches;
+
+static void pool_match(UINT32 entry, void* context) {
+    PoolMatches* matches = (PoolMatches*)context;
+    if (matches->index->docs[entry] != INVALID_TRACK_ID) {
+        set_doc(matches->bits, entry);
+    }
+}
+
+static void scan_pools(Executor* executor, const FilterNode* node, UINT64* bits) {
+    PoolMatches matches = { executor->index, bits };
+    size_t length = strlen(node->value);
+    int first = node->field == TEXT_FIELD_ANY ? TEXT_FIELD_TITLE : node->field;
+    int last = node->field == TEXT_FIELD_ANY ? TEXT_FIELD_GENRE : node->field;
+    for (int field = first; field <= last; field++) {
+        string_pool_find(text_index_pool(executor->index, field), node->value, length, pool_match, &matches);
+    }
+}
+
+static void scan_library(Executor* executor, int n, UINT64* bits) {
+    for (MP3File* file = executor->library->all_files; file; file = file->next) {
+        if (file->search_doc < executor->index->doc_count && node_matches(executor->query, n, file)) {
+            set_doc(bits, file->search_doc);
+        }
+    }
+}
+
+static BOOL build_live(Executor* executor) {
+    if (executor->live || executor->index->deleted_count == 0) return TRUE;
+    
+    executor->live = new_bitmap(executor);
+    if (!executor->live) return FALSE;
+    
+    for (UINT32 doc = 0; doc < executor->index->doc_count; doc++) {
+        if (executor->index->docs[doc] != INVALID_TRACK_ID) {
+            set_doc(executor->live, doc);
+        }
+    }
+    return TRUE;
+}
+
+static UINT64* run_node(Executor* executor, int n);
+
+// Intersect the set children, then test the checked ones on each remaining document
+static BOOL run_and(Executor* executor, FilterNode* node, UINT64* bits) {
+    FilterQuery* query = executor->query;
+    int checked[FILTER_QUERY_MAX_CHILDREN];
+    int checked_count = 0;
+    
+    for (int i = 1; i < node->child_count; i++) {
+        FilterNode* child = &query->nodes[node->children[i]];
+        if (child->access == FILTER_ACCESS_CHECK) {
+            checked[checked_count++] = i;
+            child->actual = 0;
+            continue;
+        }
+        
+        UINT64* other = run_node(executor, node->children[i]);
+        if (!other) return FALSE;
+        for (int w = 0; w < executor->words; w++) {
+            bits[w] &= other[w];
+        }
+        MEM_FREE(other);
+    }
+    
+    for (int w = 0; checked_count > 0 && w < executor->words; w++) {
+        UINT64 word = bits[w];
+        for (int b = 0; word; b++, word >>= 1) {
+            if (!(word & 1)) continue;
+            
+            UINT32 doc = ((UINT32)w << 6) + b;
+            MP3File* file = library_get_track(executor->library, executor->index->docs[doc]);
+            BOOL keep = file != NULL;
+            for (int c = 0; keep && c < checked_count; c++) {
+                int child = node->children[checked[c]];
+                keep = node_matches(query, child, file);
+                if (keep) {
+                    query->nodes[child].actual++;
+                }
+            }
+            if (!keep) {
+                bits[w] &= ~((UINT64)1 << b);
+            }
+        }
+    }
+    return TRUE;
+}
+
+// Set of documents matching node n, NULL without memory
+static UINT64* run_node(Executor* executor, int n) {
+    FilterQuery* query = executor->query;
+    FilterNode* node = &query->nodes[n];
+    UINT64* bits = NULL;
+    BOOL ok = TRUE;
+    
+    if (node->access == FILTER_ACCESS_COMBINE && node->kind != FILTER_NODE_NOT) {
+        bits = run_node(executor, node->children[0]);
+        if (!bits) return NULL;
+        
+        if (node->kind == FILTER_NODE_AND) {
+            ok = run_and(executor, node, bits);
+        } else {
+            for (int i = 1; ok && i < node->child_count; i++) {
+                UINT64* other = run_node(executor, node->children[i]);
+                ok = other != NULL;
+                for (int w = 0; ok && w < executor->words; w++) {
+                    bits[w] |= other[w];
+                }
+                MEM_FREE(other);
+            }
+        }
+    } else if (node->access == FILTER_ACCESS_COMBINE) {
+        bits = run_node(executor, node->children[0]);
+        if (!bits) return NULL;
+        
+        ok = build_live(executor);
+        for (int w = 0; ok && w < executor->words; w++) {
+            bits[w] = ~bits[w] & (executor->live ? executor->live[w] : ~(UINT64)0);
+        }
+        // Documents past the last one
+        UINT32 tail = executor->index->doc_count & 63;
+        if (ok && tail && executor->words > 0) {
+            bits[executor->words - 1] &= ((UINT64)1 << tail) - 1;
+        }
+    } else {
+        bits = new_bitmap(executor);
+        if (!bits) return NULL;
+        
+        if (node->access == FILTER_ACCESS_INDEX) {
+            ok = search_index(executor, node, bits);
+        } else if (node->access == FILTER_ACCESS_VIEW) {
+            ok = walk_view(executor, node, bits);
+        } else if (node->access == FILTER_ACCESS_POOL) {
+            scan_pools(executor, node, bits);
+        } else {
+            scan_library(executor, n, bits);
+        }
+    }
+    
+    if (!ok) {
+        MEM_FREE(bits);
+        return NULL;
+    }
+    node->actual = count_bits(bits, executor->words);
+    return bits;
+}
+
+static void reset_actual(FilterQuery* query) {
+    for (int i = 0; i < query->node_count; i++) {
+        query->nodes[i].actual = -1;
+    }
+}
+
+// Body of filter_query_run, with the library lock held
+static int run_locked(FilterQuery* query, MP3Library* library, TrackView* result) {
+    track_view_clear(result);
+    if (!filter_query_plan(query, library)) return -1;
+    reset_actual(query);
+    
+    // Without a complete index every record is tested, in library order
+    TextIndex* index = covering_index(library);
+    if (!index) {
+        for (MP3File* file = library->all_files; file; file = file->next) {
+            if (node_matches(query, query->root, file) && !track_view_add(result, file->id)) return -1;
+        }
+        query->nodes[query->root].actual = result->count;
+        return result->count;
+    }
+    
+    Executor executor;
+    executor.query = query;
+    executor.library = library;
+    executor.index = index;
+    executor.words = (int)((index->doc_count + 63) / 64);
+    executor.live = NULL;
+    track_view_init(&executor.scratch);
+    
+    UINT64* bits = run_node(&executor, query->root);
+    int count = bits ? query->nodes[query->root].actual : -1;
+    if (count > 0 && !track_view_reserve(result, count)) {
+        count = -1;
+    }
+    
+    // Matches in document (insertion) order
+    for (int w = 0; count > 0 && w < executor.words; w++) {
+        UINT64 word = bits[w];
+        for (int b = 0; word; b++, word >>= 1) {
+            if (!(word & 1)) continue;
+            
+            TrackId id = index->docs[((UINT32)w << 6) + b];
+            if (id != INVALID_TRACK_ID) {
+                result->ids[result->count++] = id;
+            }
+        }
+    }
+    
+    MEM_FREE(bits);
+    MEM_FREE(executor.live);
+    track_view_free(&executor.scratch);
+    return count < 0 ? -1 : result->count;
+}
+
+int filter_query_run(FilterQuery* query, MP3Library* library, TrackView* result) {
+    if (!query || !library || !result) return -1;
+    
+    // The scan thread updates the index and the list: it waits until the query has run
+    library_lock(library);
+    int count = run_locked(query, library, result);
+    library_unlock(library);
+    return count;
+}
+
+// Narrowing
+
+static BOOL same_node(const FilterQuery* a, int na, const FilterQuery* b, int nb) {
+    const FilterNode* x = &a->nodes[na];
+    const FilterNode* y = &b->nodes[nb];
+    if (x->kind != y->kind || x->child_count != y->child_count) return FALSE;
+    
+    if (x->kind == FILTER_NODE_TEXT) {
+        if (x->field != y->field || x->word_count != y->word_count) return FALSE;
+        for (int i = 0; i < x->word_count; i++) {
+            if (strcmp(x->words[i], y->words[i]) != 0) return FALSE;
+        }
+        return TRUE;
+    }
+    if (x->kind == FILTER_NODE_RANGE) {
+        return x->field == y->field && x->low == y->low && x->high == y->high;
+    }
+    if (x->kind == FILTER_NODE_CONTAINS) {
+        return x->field == y->field && strcmp(x->value, y->value) == 0;
+    }
+    for (int i = 0; i < x->child_count; i++) {
+        if (!same_node(a, x->children[i], b, y->children[i])) return FALSE;
+    }
+    return TRUE;
+}
+
+// TRUE if every track matching term n of next matches term p of previous
+static BOOL term_implies(const FilterQuery* next, int n, const FilterQuery* previous, int p) {
+    const FilterNode* x = &next->nodes[n];
+    const FilterNode* y = &previous->nodes[p];
+    
+    if (x->kind == FILTER_NODE_RANGE && y->kind == FILTER_NODE_RANGE) {
+        return x->field == y->field && x->low >= y->low && x->high <= y->high;
+    }
+    if (x->kind == FILTER_NODE_TEXT && y->kind == FILTER_NODE_TEXT) {
+        if (y->field != TEXT_FIELD_ANY && y->field != x->field) return FALSE;
+        
+        // Each old word is kept, or (from 3 letters) contained in a new one
+        for (int i = 0; i < y->word_count; i++) {
+            BOOL implied = FALSE;
+            for (int j = 0; j < x->word_count && !implied; j++) {
+                implied = strcmp(x->words[j], y->words[i]) == 0 ||
+                          (y->word_length[i] >= 3 && strstr(x->words[j], y->words[i]) != NULL);
+            }
+            if (!implied) return FALSE;
+        }
+        return TRUE;
+    }
+    if (x->kind == FILTER_NODE_CONTAINS && y->kind == FILTER_NODE_CONTAINS) {
+        // The old text is part of the new one
+        if (y->field != TEXT_FIELD_ANY && y->field != x->field) return FALSE;
+        return str_find_nocase(x->value, strlen(x->value), y->value, strlen(y->value)) != STR_NOT_FOUND;
+    }
+    return same_node(next, n, previous, p);
+}
+
+static int conjuncts(const FilterQuery* query, const int** terms) {
+    const FilterNode* root = &query->nodes[query->root];
+    if (root->kind == FILTER_NODE_AND) {
+        *terms = root->children;
+        return root->child_count;
+    }
+    *terms = &query->root;
+    return 1;
+}
+
+BOOL filter_query_narrows(const FilterQuery* next, const FilterQuery* previous) {
+    if (!next || !previous) return FALSE;
+    
+    const int* next_terms;
+    const int* previous_terms;
+    int next_count = conjuncts(next, &next_terms);
+    int previous_count = conjuncts(previous, &previous_terms);
+    for (int p = 0; p < previous_count; p++) {
+        BOOL implied = FALSE;
+        for (int n = 0; n < next_count && !implied; n++) {
+            implied = term_implies(next, next_terms[n], previous, previous_terms[p]);
+        }
+        if (!implied) return FALSE;
+    }
+    return TRUE;
+}
+
+int filter_query_refine(const FilterQuery* query, MP3Library* library, TrackView* result) {
+    if (!query || !library || !result) return -1;
+    
+    library_lock(library);
+    int kept = 0;
+    for (int i = 0; i < result->count; i++) {
+        MP3File* file = library_get_track(library, result->ids[i]);
+        if (file && node_matches(query, query->root, file)) {
+            result->ids[kept++] = result->ids[i];
+        }
+    }
+    library_unlock(library);
+    result->count = kept;
+    return kept;
+}
+
+// Explain
+
+static const char* access_name(int access) {
+    switch (access) {
+        case FILTER_ACCESS_INDEX: return "index";
+        case FILTER_ACCESS_VIEW: return "view";
+        case FILTER_ACCESS_SCAN: return "scan";
+        case FILTER_ACCESS_COMBINE: return "combine";
+        case FILTER_ACCESS_POOL: return "pool";
+        default: return "check";
+    }
+}
+
+static void describe_node(const FilterQuery* query, int n, char* text, size_t size) {
+    const FilterNode* node = &query->nodes[n];
+    static const char* text_fields[TEXT_FIELD_COUNT] = { "title", "artist", "album", "genre", "any" };
+    
+    switch (node->kind) {
+        case FILTER_NODE_AND: snprintf(text, size, "AND"); break;
+        case FILTER_NODE_OR: snprintf(text, size, "OR"); break;
+        case FILTER_NODE_NOT: snprintf(text, size, "NOT"); break;
+        case FILTER_NODE_TEXT: snprintf(text, size, "%s:\"%s\"", text_fields[node->field], node->value); break;
+        case FILTER_NODE_CONTAINS: snprintf(text, size, "%s~\"%s\"", text_fields[node->field], node->value); break;
+        default: {
+            const char* name = sort_field_name(node->field);
+            if (node->low == node->high) {
+                snprintf(text, size, "%s:%d", name, node->low);
+            } else if (node->low == INT_MIN) {
+                snprintf(text, size, "%s:..%d", name, node->high);
+            } else if (node->high == INT_MAX) {
+                snprintf(text, size, "%s:%d..", name, node->low);
+            } else {
+                snprintf(text, size, "%s:%d..%d", name, node->low, node->high);
+            }
+        }
+    }
+}
+
+static size_t explain_node(const FilterQuery* query, int n, int depth, char* buffer, size_t size, size_t length) {
+    const FilterNode* node = &query->nodes[n];
+    char term[MAX_FILTER_LENGTH + 32];
+    describe_node(query, n, term, sizeof(term));
+    
+    char actual[32] = "";
+    if (node->actual >= 0) {
+        snprintf(actual, sizeof(actual), ", %d actual", node->actual);
+    }
+    
+    if (length < size) {
+        int written;
+        if (node->access == FILTER_ACCESS_CHECK) {
+            written = snprintf(buffer + length, size - length, "%*s%-8s %-32s ~%.0f rows%s\n", depth * 2, "",
+                               access_name(node->access), term, node->rows, actual);
+        } else {
+            written = snprintf(buffer + length, size - length, "%*s%-8s %-32s ~%.0f rows, cost %.0f%s\n", depth * 2,
+                               "", access_name(node->access), term, node->rows, node->cost, actual);
+        }
+        length += written > 0 ? (size_t)written : 0;
+    }
+    
+    for (int i = 0; i < node->child_count; i++) {
+        length = explain_node(query, node->children[i], depth + 1, buffer, size, length);
+    }
+    return length;
+}
+
+int filter_query_explain(const FilterQuery* query, char* buffer, size_t size) {
+    if (!query || !buffer || size == 0) return 0;
+    
+    buffer[0] = '\0';
+    size_t length = (size_t)snprintf(buffer, size, "Plan: cost %.0f (scanning every track: %.0f)%s\n", query->cost,
+                                     query->scan_cost, query->indexed ? "" : ", word index incomplete");
+    length = explain_node(query, query->root, 1, buffer, size, length);
+    return (int)(length < size ? length : size - 1);
+}
@@ -1,4 +1,8 @@
 #include "../include/gui.h"
+#include "../include/albumindex.h"
+#include "../include/sortspec.h"
+#include "../include/filterquery.h"
+#include "../include/memory.h"
 #include <stdio.h>
 #include <windowsx.h>
 #include <shlobj.h>  // Per la funzione di selezione cartella
@@ -172,6 +176,7 @@ void create_controls(HWND hWnd, GUIData* gui) {
     create_album_art_view(hWnd, gui);
     create_detail_view(hWnd, gui);
     create_tabs(hWnd, gui);
+    create_search_box(hWnd, gui);
     
     // Inizializza la modalità di visualizzazione
     gui->view_mode = VIEW_MODE_LIST;
@@ -460,10 +465,14 @@ void resize_controls(HWND hWnd, GUIData* gui) {
     MoveWindow(gui->hVolumeBar, rcClient.right - volumeWidth - 10, volumeY, 
                volumeWidth, volumeHeight, TRUE);
     
-    // Posiziona il controllo tab
+    // Posiziona il controllo tab, con la casella di ricerca alla sua destra
     int tabHeight = 25;
+    int searchWidth = gui->hSearchBox ? 200 : 0;
     if (gui->hTabs) {
-        MoveWindow(gui->hTabs, 0, toolHeight, rcClient.right, tabHeight, TRUE);
+        MoveWindow(gui->hTabs, 0, toolHeight, rcClient.right - searchWidth, tabHeight, TRUE);
+    }
+    if (gui->hSearchBox) {
+        MoveWindow(gui->hSearchBox, rcClient.right - searchWidth + 5, toolHeight + 2, searchWidth - 10, tabHeight - 4, TRUE);
     }
     
     // Calcola lo spazio disponibile per i controlli principali
@@ -532,6 +541,49 @@ void adjust_column_widths(HWND hListView, int totalWidth) {
     }
 }
 
+// Svuota l'elenco degli id associati agli elementi della ListView
+static void reset_view_ids(GUIData* gui) {
+    gui->view_count = 0;
+}
+
+// Associa un id al prossimo elemento della ListView e restituisce l'indice da usare come lParam
+static int push_view_id(GUIData* gui, TrackId id) {
+    if (gui->view_count >= gui->view_capacity) {
+        int new_capacity = gui->view_capacity ? gui->view_capacity * 2 : 256;
+        TrackId* new_ids = (TrackId*)MEM_REALLOC_TAGGED(gui->view_ids, new_capacity * sizeof(TrackId), MEM_CAT_GUI);
+        if (!new_ids) return -1;
+        
+        gui->view_ids = new_ids;
+        gui->view_capacity = new_capacity;
+    }
+    
+    gui->view_ids[gui->view_count] = id;
+    return gui->view_count++;
+}
+
+// Restituisce l'id della traccia associata a un elemento della ListView
+TrackId get_list_item_id(GUIData* gui, int item) {
+    if (!gui || item < 0) return INVALID_TRACK_ID;
+    
+    LVITEM lvItem;
+    ZeroMemory(&lvItem, sizeof(LVITEM));
+    lvItem.mask = LVIF_PARAM;
+    lvItem.iItem = item;
+    
+    if (!ListView_GetItem(gui->hListView, &lvItem)) return INVALID_TRACK_ID;
+    
+    int index = (int)lvItem.lParam;
+    if (index < 0 || index >= gui->view_count) return INVALID_TRACK_ID;
+    
+    return gui->view_ids[index];
+}
+
+// Restituisce il file associato a un elemento della ListView (NULL se rimosso dalla libreria)
+MP3File* get_list_item_file(GUIData* gui, int item) {
+    if (!gui) return NULL;
+    return library_get_track(gui->library, get_list_item_id(gui, item));
+}
+
 // Popola la ListView con i file MP3
 void populate_list_view(GUIData* gui) {
     if (!gui) return;
@@ -545,19 +597,35 @@ void populate_list_view(GUIData* gui) {
     // Altrimenti, usa il metodo standard per la visualizzazione a lista
     // Cancella tutti gli elementi nella ListView
     ListView_DeleteAllItems(gui->hListView);
+    reset_view_ids(gui);
     
-    // Ottieni la lista dei file MP3 da visualizzare
-    MP3File* list_to_show = gui->current_list ? gui->current_list : gui->library->all_files;
+    // Aggiungi gli elementi alla ListView: la lista filtrata viene risolta a pagine
+    // dagli id, la libreria si scorre direttamente
+    MP3File* page[TRACK_VIEW_PAGE_SIZE];
+    int page_count = 0;
+    int page_index = 0;
+    int next_id = 0;
+    MP3File* current = gui->using_filtered_list ? NULL : gui->library->all_files;
     
-    // Aggiungi gli elementi alla ListView
     LVITEM lvItem;
     ZeroMemory(&lvItem, sizeof(LVITEM));
     lvItem.mask = LVIF_TEXT | LVIF_PARAM;
     
     int itemIndex = 0;
-    MP3File* current = list_to_show;
     
-    while (current) {
+    // La scansione in background non deve modificare la lista mentre la scorriamo
+    library_lock(gui->library);
+    while (TRUE) {
+        if (gui->using_filtered_list) {
+            while (page_index == page_count && next_id < gui->filtered.count) {
+                page_count = track_view_page(gui->library, &gui->filtered, next_id, TRACK_VIEW_PAGE_SIZE, page);
+                page_index = 0;
+                next_id += TRACK_VIEW_PAGE_SIZE;
+            }
+            current = page_index < page_count ? page[page_index++] : NULL;
+        }
+        if (!current) break;
+        
         char buffer[32];
         
         // Colonna numero
@@ -565,7 +633,7 @@ void populate_list_view(GUIData* gui) {
         lvItem.iSubItem = COLUMN_NUMBER;
         sprintf(buffer, "%d", itemIndex + 1);
         lvItem.pszText = buffer;
-        lvItem.lParam = (LPARAM)current;  // Memorizza il puntatore al file MP3
+        lvItem.lParam = (LPARAM)push_view_id(gui, current->id);  // Indice dell'id della traccia
         ListView_InsertItem(gui->hListView, &lvItem);
         
         // Colonna titolo
@@ -601,20 +669,17 @@ void populate_list_view(GUIData* gui) {
         }
         
         itemIndex++;
-        current = current->next;
+        if (!gui->using_filtered_list) {
+            current = current->next;
+        }
     }
+    library_unlock(gui->library);
 }
 
 // Aggiorna la barra di stato
 void update_status_bar(GUIData* gui) {
     char statusText[256];
-    int total_files = 0;
-    MP3File* current = gui->current_list ? gui->current_list : gui->library->all_files;
-    
-    while (current) {
-        total_files++;
-        current = current->next;
-    }
+    int total_files = gui->using_filtered_list ? gui->filtered.count : gui->library->total_files;
     
     sprintf(statusText, "File MP3: %d", total_files);
     SetWindowText(gui->hStatusBar, statusText);
@@ -658,17 +723,21 @@ void handle_menu_action(HWND hWnd, WPARAM wParam, GUIData* gui) {
                         // Prima cancella tutti gli elementi dalla ListView
                         ListView_DeleteAllItems(gui->hListView);
                         
+                        // La ricerca in corso lavora sulla vecchia libreria: va fermata prima di liberarla
+                        search_session_free(gui->search);
+                        gui->search = NULL;
+                        SetWindowText(gui->hSearchBox, "");
+                        
                         // Rimuovi la lista filtrata se presente
-                        if (gui->using_filtered_list && gui->current_list) {
-                            gui->using_filtered_list = FALSE;
-                            gui->current_list = NULL;
-                        }
+                        gui->using_filtered_list = FALSE;
+                        track_view_clear(&gui->filtered);
                         
                         // Libera la memoria della vecchia libreria
                         free_mp3_library(gui->library);
                         
                         // Crea una nuova libreria con la cartella selezionata
                         gui->library = create_library(folder);
+                        set_player_library(gui->player, gui->library);
                         
                         // Esegui una scansione completa della cartella (con ricorsione)
                         int found = scan_directory(gui->library, folder, TRUE); // TRUE per abilitare la ricorsione
@@ -693,15 +762,15 @@ void handle_menu_action(HWND hWnd, WPARAM wParam, GUIData* gui) {
                 }
             }
             break;
-            
+        
         case ID_FILE_EXIT:
             DestroyWindow(hWnd);
             break;
-            
+        
         case ID_PLAY_SHOW_EQ:
             toggle_equalizer(gui);
             break;
-            
+        
         case ID_PLAY_START:
         case ID_PLAY_PAUSE:
         case ID_PLAY_STOP:
@@ -710,81 +779,45 @@ void handle_menu_action(HWND hWnd, WPARAM wParam, GUIData* gui) {
             // Gestisci i controlli di riproduzione utilizzando la funzione dedicata
             handle_playback_controls(hWnd, LOWORD(wParam), gui);
             break;
-            
+        
         // Gestione dell'ordinamento
         case ID_VIEW_SORT_TITLE:
-            gui->sort_type = SORT_BY_TITLE;
-            if (gui->using_filtered_list && gui->current_list) {
-                sort_mp3_files(gui->current_list, SORT_BY_TITLE);
-            } else {
-                sort_mp3_files(&gui->library->all_files, SORT_BY_TITLE);
-            }
-            populate_list_view(gui);
+            sort_current_view(gui, SORT_BY_TITLE);
             break;
-            
+        
         case ID_VIEW_SORT_ARTIST:
-            gui->sort_type = SORT_BY_ARTIST;
-            if (gui->using_filtered_list && gui->current_list) {
-                sort_mp3_files(gui->current_list, SORT_BY_ARTIST);
-            } else {
-                sort_mp3_files(&gui->library->all_files, SORT_BY_ARTIST);
-            }
-            populate_list_view(gui);
+            sort_current_view(gui, SORT_BY_ARTIST);
             break;
-            
+        
         case ID_VIEW_SORT_ALBUM:
-            gui->sort_type = SORT_BY_ALBUM;
-            if (gui->using_filtered_list && gui->current_list) {
-                sort_mp3_files(gui->current_list, SORT_BY_ALBUM);
-            } else {
-                sort_mp3_files(&gui->library->all_files, SORT_BY_ALBUM);
-            }
-            populate_list_view(gui);
+            sort_current_view(gui, SORT_BY_ALBUM);
             break;
-            
+        
         case ID_VIEW_SORT_YEAR:
-            gui->sort_type = SORT_BY_YEAR;
-            if (gui->using_filtered_list && gui->current_list) {
-                sort_mp3_files(gui->current_list, SORT_BY_YEAR);
-            } else {
-                sort_mp3_files(&gui->library->all_files, SORT_BY_YEAR);
-            }
-            populate_list_view(gui);
+            sort_current_view(gui, SORT_BY_YEAR);
             break;
-            
+        
         case ID_VIEW_SORT_GENRE:
-            gui->sort_type = SORT_BY_GENRE;
-            if (gui->using_filtered_list && gui->current_list) {
-                sort_mp3_files(gui->current_list, SORT_BY_GENRE);
-            } else {
-                sort_mp3_files(&gui->library->all_files, SORT_BY_GENRE);
-            }
-            populate_list_view(gui);
+            sort_current_view(gui, SORT_BY_GENRE);
             break;
-            
+        
         case ID_VIEW_SORT_TRACK:
-            gui->sort_type = SORT_BY_TRACK;
-            if (gui->using_filtered_list && gui->current_list) {
-                sort_mp3_files(gui->current_list, SORT_BY_TRACK);
-            } else {
-                sort_mp3_files(&gui->library->all_files, SORT_BY_TRACK);
-            }
-            populate_list_view(gui);
+            sort_current_view(gui, SORT_BY_TRACK);
             break;
-            
+        
         // Gestione delle modalità di visualizzazione
         case ID_VIEW_LIST_MODE:
             switch_view_mode(gui, VIEW_MODE_LIST);
             break;
-            
+        
         case ID_VIEW_GRID_MODE:
             switch_view_mode(gui, VIEW_MODE_GRID);
             break;
-            
+        
         case ID_VIEW_ALBUM_MODE:
             switch_view_mode(gui, VIEW_MODE_ALBUM);
             break;
-            
+        
         case ID_VIEW_SHOW_DETAILS:
             // Mostra/Nascondi la vista dei dettagli
             if (IsWindowVisible(gui->hDetailView)) {
@@ -798,6 +831,26 @@ void handle_menu_action(HWND hWnd, WPARAM wParam, GUIData* gui) {
     }
 }
 
+// Ordina la lista visualizzata (libreria o lista filtrata) e ricostruisce la ListView.
+// Le liste grandi vengono ordinate in parallelo con lo stesso risultato dell'ordinamento seriale.
+void sort_current_view(GUIData* gui, SortType sort_type) {
+    if (!gui || !gui->library) return;
+    
+    SortSpec spec;
+    sort_spec_init(&spec, SORT_DEFAULT_FLAGS);
+    sort_spec_add_key(&spec, sort_type, FALSE);
+    
+    gui->sort_type = sort_type;
+    if (gui->using_filtered_list) {
+        track_view_sort(gui->library, &gui->filtered, &spec, gui->sort_pool);
+    } else {
+        library_lock(gui->library);
+        sort_tracks_parallel(gui->library, &gui->library->all_files, &spec, gui->sort_pool);
+        library_unlock(gui->library);
+    }
+    populate_list_view(gui);
+}
+
 // Gestisce le notifiche della ListView
 void handle_list_view_notification(HWND hWnd, LPARAM lParam, GUIData* gui) {
     NMHDR* pnmh = (NMHDR*)lParam;
@@ -817,7 +870,34 @@ void handle_list_view_notification(HWND hWnd, LPARAM lParam, GUIData* gui) {
                 }
             }
             break;
-            
+        
+        case LVN_COLUMNCLICK:
+            {
+                // Click sull'intestazione: ordina per la colonna
+                NMLISTVIEW* pnmlv = (NMLISTVIEW*)lParam;
+                switch (pnmlv->iSubItem) {
+                    case COLUMN_TITLE:
+                        sort_current_view(gui, SORT_BY_TITLE);
+                        break;
+                    case COLUMN_ARTIST:
+                        sort_current_view(gui, SORT_BY_ARTIST);
+                        break;
+                    case COLUMN_ALBUM:
+                        sort_current_view(gui, SORT_BY_ALBUM);
+                        break;
+                    case COLUMN_YEAR:
+                        sort_current_view(gui, SORT_BY_YEAR);
+                        break;
+                    case COLUMN_GENRE:
+                        sort_current_view(gui, SORT_BY_GENRE);
+                        break;
+                    case COLUMN_TRACK:
+                        sort_current_view(gui, SORT_BY_TRACK);
+                        break;
+                }
+            }
+            break;
+        
         case NM_DBLCLK:
             {
                 NMITEMACTIVATE* pnmia = (NMITEMACTIVATE*)lParam;
@@ -825,13 +905,8 @@ void handle_list_view_notification(HWND hWnd, LPARAM lParam, GUIData* gui) {
                 // Se siamo in vista griglia, gestisci il doppio click su un album
                 if (gui->view_mode == VIEW_MODE_GRID && pnmia->iItem != -1) {
                     // Ottieni il file rappresentativo dell'album
-                    LVITEM lvItem;
-                    ZeroMemory(&lvItem, sizeof(LVITEM));
-                    lvItem.mask = LVIF_PARAM;
-                    lvItem.iItem = pnmia->iItem;
-                    
-                    if (ListView_GetItem(gui->hListView, &lvItem)) {
-                        MP3File* representative_file = (MP3File*)lvItem.lParam;
+                    MP3File* representative_file = get_list_item_file(gui, pnmia->iItem);
+                    if (representative_file) {
                         handle_album_selection(gui, representative_file);
                     }
                 } else {
@@ -847,65 +922,35 @@ void handle_list_view_notification(HWND hWnd, LPARAM lParam, GUIData* gui) {
 void play_selected_file(GUIData* gui) {
     if (!gui || !gui->player || gui->selected_item < 0) return;
     
-    // Otteniamo il puntatore al file MP3 dall'item selezionato nella ListView
-    LVITEM lvItem;
-    ZeroMemory(&lvItem, sizeof(LVITEM));
-    lvItem.mask = LVIF_PARAM;
-    lvItem.iItem = gui->selected_item;
+    // Otteniamo il file MP3 dall'item selezionato nella ListView
+    MP3File* selected_file = get_list_item_file(gui, gui->selected_item);
     
-    if (ListView_GetItem(gui->hListView, &lvItem)) {
-        MP3File* selected_file = (MP3File*)lvItem.lParam;
+    if (selected_file) {
+        // Puliamo la coda corrente
+        clear_queue(gui->player);
         
-        if (selected_file) {
-            // Puliamo la coda corrente
-            clear_queue(gui->player);
-            
-            // Aggiungiamo tutti i file visualizzati nella ListView alla coda
-            int file_count = ListView_GetItemCount(gui->hListView);
-            MP3File* file_to_play = NULL;
-            
-            for (int i = 0; i < file_count; i++) {
-                LVITEM item;
-                ZeroMemory(&item, sizeof(LVITEM));
-                item.mask = LVIF_PARAM;
-                item.iItem = i;
-                
-                if (ListView_GetItem(gui->hListView, &item)) {
-                    MP3File* file = (MP3File*)item.lParam;
-                    if (file) {
-                        add_to_queue(gui->player, file);
-                        
-                        // Se questo è il file selezionato, teniamo il riferimento
-                        if (i == gui->selected_item) {
-                            file_to_play = get_current_file(gui->player);
-                        }
-                    }
+        // Aggiungiamo tutti i file visualizzati nella ListView alla coda (solo gli id)
+        int file_count = ListView_GetItemCount(gui->hListView);
+        
+        for (int i = 0; i < file_count; i++) {
+            MP3File* file = get_list_item_file(gui, i);
+            if (file && add_to_queue(gui->player, file)) {
+                // Se questo è il file selezionato, diventa il brano corrente
+                if (i == gui->selected_item) {
+                    gui->player->queue->current = gui->player->queue->count - 1;
                 }
             }
-            
-            // Troviamo il file selezionato nella coda e lo rendiamo corrente
-            if (file_to_play) {
-                // Ora la coda è popolata e dobbiamo impostare il file corrente
-                MP3File* current = gui->player->queue->head;
-                while (current) {
-                    if (strcmp(current->filepath, selected_file->filepath) == 0) {
-                        gui->player->queue->current = current;
-                        break;
-                    }
-                    current = current->next;
-                }
+        }
+        
+        // Avviamo la riproduzione
+        if (play_current(gui->player)) {
+            // Se la riproduzione è partita, avviamo il timer per aggiornare la progress bar
+            if (gui->timer_id == 0) {
+                gui->timer_id = SetTimer(gui->hWnd, 1, 500, NULL); // Aggiorna ogni 500ms
             }
             
-            // Avviamo la riproduzione
-            if (play_current(gui->player)) {
-                // Se la riproduzione è partita, avviamo il timer per aggiornare la progress bar
-                if (gui->timer_id == 0) {
-                    gui->timer_id = SetTimer(gui->hWnd, 1, 500, NULL); // Aggiorna ogni 500ms
-                }
-                
-                // Aggiorniamo l'interfaccia
-                update_playback_ui(gui);
-            }
+            // Aggiorniamo l'interfaccia
+            update_playback_ui(gui);
         }
     }
 }
@@ -933,37 +978,29 @@ void update_playback_ui(GUIData* gui) {
             }
             SetWindowText(gui->hStatusBar, status);
             
-            // Trova la traccia in riproduzione nella ListView
+            // Trova la traccia in riproduzione nella ListView (confronto per id)
             int count = ListView_GetItemCount(gui->hListView);
             for (int i = 0; i < count; i++) {
-                LVITEM item;
-                ZeroMemory(&item, sizeof(LVITEM));
-                item.mask = LVIF_PARAM;
-                item.iItem = i;
-                
-                if (ListView_GetItem(gui->hListView, &item)) {
-                    MP3File* file = (MP3File*)item.lParam;
-                    if (file && strcmp(file->filepath, current->filepath) == 0) {
-                        // Se il brano attualmente evidenziato è diverso, aggiorna
-                        if (currently_highlighted_item != i) {
-                            // Rimuovi evidenziazione precedente se presente
-                            if (currently_highlighted_item != -1) {
-                                ListView_RedrawItems(gui->hListView, currently_highlighted_item, currently_highlighted_item);
-                            }
-                            
-                            // Memorizza la nuova traccia in riproduzione
-                            currently_highlighted_item = i;
-                            
-                            // Assicura che l'item sia visibile
-                            ListView_EnsureVisible(gui->hListView, i, FALSE);
+                if (get_list_item_id(gui, i) == current->id) {
+                    // Se il brano attualmente evidenziato è diverso, aggiorna
+                    if (currently_highlighted_item != i) {
+                        // Rimuovi evidenziazione precedente se presente
+                        if (currently_highlighted_item != -1) {
+                            ListView_RedrawItems(gui->hListView, currently_highlighted_item, currently_highlighted_item);
                         }
                         
-                        // Ridisegna l'elemento che sarà in grassetto
-                        ListView_RedrawItems(gui->hListView, i, i);
-                        UpdateWindow(gui->hListView);
+                        // Memorizza la nuova traccia in riproduzione
+                        currently_highlighted_item = i;
                         
-                        break;
+                        // Assicura che l'item sia visibile
+                        ListView_EnsureVisible(gui->hListView, i, FALSE);
                     }
+                    
+                    // Ridisegna l'elemento che sarà in grassetto
+                    ListView_RedrawItems(gui->hListView, i, i);
+                    UpdateWindow(gui->hListView);
+                    
+                    break;
                 }
             }
         } else {
@@ -1000,7 +1037,8 @@ void handle_playback_notification(HWND hWnd, WPARAM wParam, LPARAM lParam, GUIDa
             // Passiamo al brano successivo o fermiamo la riproduzione in base alla modalità
             if (get_playback_mode(gui->player) == PLAYBACK_MODE_NORMAL) {
                 // In modalità normale, se c'è un brano successivo, lo riproduciamo
-                if (gui->player->queue->current && gui->player->queue->current->next) {
+                if (gui->player->queue->current >= 0 && 
+                    gui->player->queue->current + 1 < gui->player->queue->count) {
                     next_track(gui->player);
                     update_playback_ui(gui);
                 } else {
@@ -1049,7 +1087,7 @@ void handle_playback_controls(HWND hWnd, int control_id, GUIData* gui) {
                 }
             }
             break;
-            
+        
         case ID_PLAY_PAUSE:
             // Se la riproduzione è in corso, la mettiamo in pausa
             if (get_playback_state(gui->player) == PLAYBACK_PLAYING) {
@@ -1068,7 +1106,7 @@ void handle_playback_controls(HWND hWnd, int control_id, GUIData* gui) {
                 }
             }
             break;
-            
+        
         case ID_PLAY_STOP:
             // Fermiamo la riproduzione
             if (stop_playback(gui->player)) {
@@ -1088,36 +1126,36 @@ void handle_playback_controls(HWND hWnd, int control_id, GUIData* gui) {
                 SetWindowText(gui->hStatusBar, "Riproduzione fermata");
             }
             break;
-            
+        
         case ID_PLAY_NEXT:
             // Passiamo al brano successivo
             if (next_track(gui->player)) {
                 update_playback_ui(gui);
             }
             break;
-            
+        
         case ID_PLAY_PREV:
             // Passiamo al brano precedente
             if (previous_track(gui->player)) {
                 update_playback_ui(gui);
             }
             break;
-            
+        
         case ID_PLAY_MODE_NORMAL:
             // Impostazione della modalità di riproduzione normale
             set_playback_mode(gui->player, PLAYBACK_MODE_NORMAL);
             break;
-            
+        
         case ID_PLAY_MODE_REPEAT_ONE:
             // Impostazione della modalità di riproduzione con ripetizione del brano corrente
             set_playback_mode(gui->player, PLAYBACK_MODE_REPEAT_ONE);
             break;
-            
+        
         case ID_PLAY_MODE_REPEAT_ALL:
             // Impostazione della modalità di riproduzione con ripetizione di tutti i brani
             set_playback_mode(gui->player, PLAYBACK_MODE_REPEAT_ALL);
             break;
-            
+        
         case ID_PLAY_MODE_SHUFFLE:
             // Impostazione della modalità di riproduzione casuale
             set_playback_mode(gui->player, PLAYBACK_MODE_SHUFFLE);
@@ -1224,23 +1262,33 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
             // Inizializza la GUIData
             g_gui_data.selected_item = -1;
             g_gui_data.sort_type = SORT_BY_TRACK; // Imposta l'ordinamento predefinito per traccia
+            g_gui_data.sort_pool = thread_pool_create(0); // Un thread per processore
             g_gui_data.using_filtered_list = FALSE;
-            g_gui_data.current_list = NULL;
+            track_view_init(&g_gui_data.filtered);
+            g_gui_data.search = NULL;
             g_gui_data.timer_id = 0;
             
             // Crea i controlli
             create_controls(hWnd, &g_gui_data);
             return 0;
-            
+        
         case WM_SIZE:
             // Ridimensiona i controlli
             resize_controls(hWnd, &g_gui_data);
             return 0;
-            
+        
         case WM_COMMAND:
             {
                 int id = LOWORD(wParam);
                 
+                // Ogni modifica del testo della casella di ricerca avvia una nuova ricerca
+                if (id == SEARCHBOX_ID) {
+                    if (HIWORD(wParam) == EN_CHANGE) {
+                        handle_search_input(&g_gui_data);
+                    }
+                    return 0;
+                }
+                
                 // Controlla se è un comando del menu o del toolbar
                 if (id >= ID_PLAY_START && id <= ID_PLAY_MODE_SHUFFLE) {
                     // Gestisce i controlli di riproduzione
@@ -1252,7 +1300,7 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
                     return 0;
                 }
             }
-            
+        
         case WM_DRAWITEM:
             // Gestisce il disegno personalizzato degli elementi della ListView
             if (wParam == LISTVIEW_ID) {
@@ -1260,7 +1308,7 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
                 return TRUE;
             }
             break;
-            
+        
         case WM_NOTIFY:
             // Gestisce le notifiche dei controlli
             if (((LPNMHDR)lParam)->idFrom == LISTVIEW_ID) {
@@ -1277,7 +1325,7 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
                 }
             }
             return 0;
-            
+        
         case WM_HSCROLL:
             // Gestisce lo scroll orizzontale per il controllo del volume
             if ((HWND)lParam == g_gui_data.hVolumeBar) {
@@ -1287,19 +1335,24 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
                 }
             }
             return 0;
-            
+        
         case WM_TIMER:
             // Aggiorna la barra di avanzamento
             if (wParam == g_gui_data.timer_id) {
                 update_progress_bar(&g_gui_data);
             }
             return 0;
-            
+        
         case WM_AUDIO_NOTIFY:
             // Gestisce le notifiche di riproduzione
             handle_playback_notification(hWnd, wParam, lParam, &g_gui_data);
             return 0;
-            
+        
+        case WM_SEARCH_RESULTS:
+            // Risultati della ricerca dal thread della sessione
+            handle_search_results(&g_gui_data, (SearchBatch*)lParam);
+            return 0;
+        
         case WM_CLOSE:
             // Ferma la riproduzione se è in corso
             if (g_gui_data.player && get_playback_state(g_gui_data.player) != PLAYBACK_STOPPED) {
@@ -1314,7 +1367,7 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
             
             DestroyWindow(hWnd);
             return 0;
-            
+        
         case WM_DESTROY:
             // Libera la memoria del player audio
             if (g_gui_data.player) {
@@ -1328,6 +1381,27 @@ LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
                 g_gui_data.hAlbumBitmap = NULL;
             }
             
+            // Ferma i thread dell'ordinamento
+            thread_pool_free(g_gui_data.sort_pool);
+            g_gui_data.sort_pool = NULL;
+            
+            // Ferma la ricerca e scarta i risultati non ancora ricevuti
+            search_session_free(g_gui_data.search);
+            g_gui_data.search = NULL;
+            {
+                MSG msg;
+                while (PeekMessage(&msg, hWnd, WM_SEARCH_RESULTS, WM_SEARCH_RESULTS, PM_REMOVE)) {
+                    MEM_FREE((void*)msg.lParam);
+                }
+            }
+            
+            // Libera gli id associati alla ListView
+            MEM_FREE(g_gui_data.view_ids);
+            g_gui_data.view_ids = NULL;
+            track_view_free(&g_gui_data.filtered);
+            g_gui_data.view_count = 0;
+            g_gui_data.view_capacity = 0;
+            
             PostQuitMessage(0);
             return 0;
     }
@@ -1364,6 +1438,7 @@ int start_gui(HINSTANCE hInstance, MP3Library* library) {
     
     // Salva il puntatore alla libreria
     g_gui_data.library = library;
+    set_player_library(g_gui_data.player, library);
     
     // Imposta le dimensioni iniziali dei controlli
     resize_controls(hWnd, &g_gui_data);
@@ -1500,7 +1575,7 @@ LRESULT CALLBACK EqDialogProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
                 return 0;
             }
             break;
-            
+        
         case WM_VSCROLL:
             // Gestisce gli slider dell'equalizzatore
             for (int i = 0; i < EQ_BANDS; i++) {
@@ -1517,7 +1592,7 @@ LRESULT CALLBACK EqDialogProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
                 }
             }
             return 0;
-            
+        
         case WM_CLOSE:
             ShowWindow(hWnd, SW_HIDE);
             return 0;
@@ -1724,6 +1799,9 @@ void update_album_art(GUIData* gui, MP3File* file) {
     // Libera il bitmap precedente se esiste
     free_album_art_bitmap(gui);
     
+    // La copertina potrebbe essere stata scaricata per rispettare il budget di memoria
+    library_load_album_art(gui->library, file);
+    
     // Crea il nuovo bitmap
     gui->hAlbumBitmap = create_album_art_bitmap(file);
     
@@ -1774,45 +1852,42 @@ void update_details_view(GUIData* gui) {
     if (!gui || !gui->hDetailView || gui->selected_item < 0) return;
     
     // Ottieni il file MP3 selezionato
-    LVITEM lvItem;
-    ZeroMemory(&lvItem, sizeof(LVITEM));
-    lvItem.mask = LVIF_PARAM;
-    lvItem.iItem = gui->selected_item;
-    
-    if (ListView_GetItem(gui->hListView, &lvItem)) {
-        MP3File* file = (MP3File*)lvItem.lParam;
-        
-        if (file) {
-            // Formatta il testo dei dettagli
-            char details[1024];
-            sprintf(details, 
-                "Titolo: %s\n"
-                "Artista: %s\n"
-                "Album: %s\n"
-                "Anno: %d\n"
-                "Genere: %s\n"
-                "Traccia: %d\n"
-                "Durata: %d:%02d\n"
-                "Formato Copertina: %s",
-                file->metadata.title[0] ? file->metadata.title : "Sconosciuto",
-                file->metadata.artist[0] ? file->metadata.artist : "Sconosciuto",
-                file->metadata.album[0] ? file->metadata.album : "Sconosciuto",
-                file->metadata.year > 0 ? file->metadata.year : 0,
-                file->metadata.genre[0] ? file->metadata.genre : "Sconosciuto",
-                file->metadata.track_number > 0 ? file->metadata.track_number : 0,
-                file->metadata.duration / 60, file->metadata.duration % 60,
-                file->metadata.album_art_format == ALBUM_ART_JPEG ? "JPEG" : 
-                  (file->metadata.album_art_format == ALBUM_ART_PNG ? "PNG" : 
-                   (file->metadata.album_art_format == ALBUM_ART_OTHER ? "Altro" : "Nessuno")),
-                file->filepath
-            );
-            
-            // Imposta il testo nel controllo
-            SetWindowText(gui->hDetailView, details);
-            
-            // Aggiorna l'album art
-            update_album_art(gui, file);
-        }
+    MP3File* file = get_list_item_file(gui, gui->selected_item);
+    
+    if (file) {
+        // Percorso completo (troncato per la visualizzazione)
+        char filepath[MAX_PATH_LENGTH];
+        mp3_file_path(file, filepath, sizeof(filepath));
+        
+        // Formatta il testo dei dettagli
+        char details[1024];
+        sprintf(details, 
+            "Titolo: %s\n"
+            "Artista: %s\n"
+            "Album: %s\n"
+            "Anno: %d\n"
+            "Genere: %s\n"
+            "Traccia: %d\n"
+            "Durata: %d:%02d\n"
+            "Formato Copertina: %s",
+            file->metadata.title[0] ? file->metadata.title : "Sconosciuto",
+            file->metadata.artist[0] ? file->metadata.artist : "Sconosciuto",
+            file->metadata.album[0] ? file->metadata.album : "Sconosciuto",
+            file->metadata.year > 0 ? file->metadata.year : 0,
+            file->metadata.genre[0] ? file->metadata.genre : "Sconosciuto",
+            file->metadata.track_number > 0 ? file->metadata.track_number : 0,
+            file->metadata.duration / 60, file->metadata.duration % 60,
+            file->metadata.album_art_format == ALBUM_ART_JPEG ? "JPEG" : 
+              (file->metadata.album_art_format == ALBUM_ART_PNG ? "PNG" : 
+               (file->metadata.album_art_format == ALBUM_ART_OTHER ? "Altro" : "Nessuno")),
+            filepath
+        );
+        
+        // Imposta il testo nel controllo
+        SetWindowText(gui->hDetailView, details);
+        
+        // Aggiorna l'album art
+        update_album_art(gui, file);
     }
 }
 
@@ -1846,6 +1921,138 @@ void create_tabs(HWND hWnd, GUIData* gui) {
     TabCtrl_InsertItem(gui->hTabs, 2, &tie);
 }
 
+// Crea la casella di ricerca: i risultati si aggiornano ad ogni tasto
+void create_search_box(HWND hWnd, GUIData* gui) {
+    gui->hSearchBox = CreateWindowEx(
+        WS_EX_CLIENTEDGE,
+        "EDIT",
+        "",
+        WS_CHILD | WS_VISIBLE | ES_AUTOHSCROLL,
+        0, 0, 0, 0, // Posizione e dimensioni (verranno aggiornate in resize_controls)
+        hWnd,
+        (HMENU)SEARCHBOX_ID,
+        GetModuleHandle(NULL),
+        NULL
+    );
+    
+    SendMessage(gui->hSearchBox, EM_LIMITTEXT, SEARCH_QUERY_MAX - 1, 0);
+    SendMessage(gui->hSearchBox, EM_SETCUEBANNER, FALSE, (LPARAM)L"Cerca...");
+}
+
+// Chiamata dal thread della sessione di ricerca: copia il blocco di risultati e lo
+// passa alla finestra, che lo riceve come WM_SEARCH_RESULTS sul proprio thread
+static void post_search_batch(void* context, LONG query_id, const TrackId* ids, const unsigned short* ranks,
+                              int first, int count, int total, BOOL last) {
+    (void)ranks;
+    (void)total;
+    GUIData* gui = (GUIData*)context;
+    
+    SearchBatch* batch = (SearchBatch*)MEM_ALLOC_TAGGED(sizeof(SearchBatch) + count * sizeof(TrackId), MEM_CAT_FILTER);
+    if (!batch) return;
+    
+    batch->query_id = query_id;
+    batch->first = first;
+    batch->count = count;
+    batch->last = last;
+    if (count > 0) {
+        memcpy(batch->ids, ids, count * sizeof(TrackId));
+    }
+    
+    if (!PostMessage(gui->hWnd, WM_SEARCH_RESULTS, 0, (LPARAM)batch)) {
+        MEM_FREE(batch);
+    }
+}
+
+// Applica un'interrogazione sui filtri (artist:queen AND year:1975..1980 ...) scritta
+// nella casella di ricerca. Mentre la si scrive è spesso incompleta: la lista resta
+// quella di prima e la barra di stato mostra cosa manca.
+static void apply_filter_query(GUIData* gui, const char* text) {
+    char error[FILTER_QUERY_ERROR_MAX];
+    FilterQuery* query = filter_query_parse(text, error, sizeof(error));
+    if (!query) {
+        char status[FILTER_QUERY_ERROR_MAX + 32];
+        snprintf(status, sizeof(status), "Filtro non valido: %s", error);
+        SetWindowText(gui->hStatusBar, status);
+        return;
+    }
+    
+    if (filter_query_run(query, gui->library, &gui->filtered) < 0) {
+        track_view_clear(&gui->filtered);
+        gui->using_filtered_list = FALSE;
+    } else {
+        gui->using_filtered_list = TRUE;
+    }
+    filter_query_free(query);
+    
+    populate_list_view(gui);
+    update_status_bar(gui);
+}
+
+// Avvia la ricerca del testo della casella (la ricerca precedente viene annullata)
+void handle_search_input(GUIData* gui) {
+    if (!gui || !gui->hSearchBox || !gui->library) return;
+    
+    char text[SEARCH_QUERY_MAX];
+    GetWindowText(gui->hSearchBox, text, sizeof(text));
+    
+    const char* start = text;
+    while (*start == ' ') {
+        start++;
+    }
+    
+    // Casella vuota: torna alla lista completa
+    if (*start == '\0') {
+        search_session_cancel(gui->search);
+        if (gui->using_filtered_list) {
+            gui->using_filtered_list = FALSE;
+            track_view_clear(&gui->filtered);
+            populate_list_view(gui);
+            update_status_bar(gui);
+        }
+        return;
+    }
+    
+    // Testo con "campo:valore" o "campo~testo": interrogazione sui filtri invece della ricerca per parole
+    if (strchr(start, ':') || strchr(start, '~')) {
+        search_session_cancel(gui->search);
+        apply_filter_query(gui, start);
+        return;
+    }
+    
+    if (!gui->search) {
+        gui->search = search_session_create(gui->library, TEXT_FIELD_ANY, TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY, TRUE,
+                                            post_search_batch, gui);
+        if (!gui->search) return;
+    }
+    search_session_update(gui->search, text);
+}
+
+// Mostra un blocco di risultati: i migliori compaiono subito, la lista completa
+// con l'ultimo blocco
+void handle_search_results(GUIData* gui, SearchBatch* batch) {
+    if (!batch) return;
+    
+    // Blocchi di una ricerca superata da un tasto successivo
+    if (!gui->search || batch->query_id != gui->search->current) {
+        MEM_FREE(batch);
+        return;
+    }
+    
+    if (batch->first == 0) {
+        track_view_clear(&gui->filtered);
+        gui->using_filtered_list = TRUE;
+    }
+    for (int i = 0; i < batch->count; i++) {
+        if (!track_view_add(&gui->filtered, batch->ids[i])) break;
+    }
+    
+    if (batch->first == 0 || batch->last) {
+        populate_list_view(gui);
+        update_status_bar(gui);
+    }
+    MEM_FREE(batch);
+}
+
 // Modifica il layout della finestra in base alla modalità di visualizzazione
 void switch_view_mode(GUIData* gui, int view_mode) {
     if (!gui) return;
@@ -1868,14 +2075,14 @@ void switch_view_mode(GUIData* gui, int view_mode) {
             // Riattiva l'owner draw
             SetWindowLong(gui->hListView, GWL_STYLE, 
                 GetWindowLong(gui->hListView, GWL_STYLE) | LVS_OWNERDRAWFIXED);
-                
+            
             // Mostra le intestazioni delle colonne
             ListView_SetExtendedListViewStyle(gui->hListView, 
                 ListView_GetExtendedListViewStyle(gui->hListView) | 
                 LVS_EX_FULLROWSELECT | LVS_EX_GRIDLINES | LVS_EX_HEADERDRAGDROP);
             
             break;
-            
+        
         case VIEW_MODE_GRID:
             {
                 // Visualizzazione a griglia con copertine
@@ -1895,7 +2102,7 @@ void switch_view_mode(GUIData* gui, int view_mode) {
                 prepare_grid_view_items(gui);
             }
             break;
-            
+        
         case VIEW_MODE_ALBUM:
             // Visualizzazione album (gruppo per album)
             MessageBox(gui->hWnd, "Visualizzazione per album non ancora implementata completamente", 
@@ -1914,22 +2121,13 @@ void switch_view_mode(GUIData* gui, int view_mode) {
     resize_controls(gui->hWnd, gui);
 }
 
-// Struttura per tenere traccia degli album unici
-typedef struct AlbumInfo {
-    char album[MAX_ALBUM_LENGTH];
-    char artist[MAX_ARTIST_LENGTH];
-    int year;
-    MP3File* representative_file; // Un file rappresentativo per questo album
-    int track_count;              // Numero di tracce nell'album
-    struct AlbumInfo* next;
-} AlbumInfo;
-
-// Prepara gli elementi per la visualizzazione a griglia
+// Prepara gli elementi per la visualizzazione a griglia leggendo l'indice degli album della libreria
 void prepare_grid_view_items(GUIData* gui) {
     if (!gui || !gui->hListView) return;
     
     // Cancella tutti gli elementi nella ListView
     ListView_DeleteAllItems(gui->hListView);
+    reset_view_ids(gui);
     
     // Lista di bitmap per gli elementi
     static HIMAGELIST g_hLargeImageList = NULL;
@@ -1947,61 +2145,49 @@ void prepare_grid_view_items(GUIData* gui) {
     // Imposta l'image list per la vista a icone
     ListView_SetImageList(gui->hListView, g_hLargeImageList, LVSIL_NORMAL);
     
-    // Ottieni la lista dei file MP3 da visualizzare
-    MP3File* list_to_show = gui->current_list ? gui->current_list : gui->library->all_files;
-    
-    // Crea una lista di album unici
-    AlbumInfo* album_list = NULL;
-    MP3File* current_file = list_to_show;
-    
-    while (current_file) {
-        // Controlla se l'album è già nella lista
-        BOOL album_found = FALSE;
-        AlbumInfo* current_album = album_list;
-        
-        while (current_album) {
-            // Confronta per nome album (case-insensitive)
-            if (stricmp(current_album->album, current_file->metadata.album) == 0) {
-                // Album trovato, incrementa il conteggio delle tracce
-                current_album->track_count++;
-                album_found = TRUE;
-                break;
-            }
-            current_album = current_album->next;
+    AlbumIndex* albums = gui->library->albums;
+    if (!albums) return;
+    
+    // L'indice degli album cambia con la scansione in background: lo leggiamo sotto lock
+    library_lock(gui->library);
+    
+    // Con una lista filtrata mostriamo solo gli album che hanno tracce visibili,
+    // contandole con una ricerca O(1) per traccia nell'indice
+    int* visible_counts = NULL;
+    if (gui->using_filtered_list) {
+        visible_counts = (int*)calloc(albums->album_slots > 0 ? albums->album_slots : 1, sizeof(int));
+        if (!visible_counts) {
+            library_unlock(gui->library);
+            return;
         }
         
-        // Se l'album non è nella lista, aggiungilo
-        if (!album_found) {
-            AlbumInfo* new_album = (AlbumInfo*)malloc(sizeof(AlbumInfo));
-            if (new_album) {
-                strncpy(new_album->album, current_file->metadata.album[0] ? 
-                         current_file->metadata.album : "Unknown Album", MAX_ALBUM_LENGTH - 1);
-                new_album->album[MAX_ALBUM_LENGTH - 1] = '\0';
-                
-                strncpy(new_album->artist, current_file->metadata.artist[0] ? 
-                         current_file->metadata.artist : "Unknown Artist", MAX_ARTIST_LENGTH - 1);
-                new_album->artist[MAX_ARTIST_LENGTH - 1] = '\0';
-                
-                new_album->year = current_file->metadata.year;
-                new_album->representative_file = current_file;
-                new_album->track_count = 1;
-                
-                // Aggiunge il nuovo album all'inizio della lista
-                new_album->next = album_list;
-                album_list = new_album;
+        for (int i = 0; i < gui->filtered.count; i++) {
+            MP3File* current = library_get_track(gui->library, gui->filtered.ids[i]);
+            if (!current) continue;
+            
+            int album_id = album_index_find_track_album(albums, current);
+            if (album_id >= 0) {
+                visible_counts[album_id]++;
             }
         }
-        
-        current_file = current_file->next;
     }
     
-    // Ora aggiungi un elemento alla ListView per ogni album unico
-    AlbumInfo* current_album = album_list;
+    // Aggiungi un elemento alla ListView per ogni album dell'indice
     int index = 0;
     
-    while (current_album) {
+    for (int album_id = 0; album_id < albums->album_slots; album_id++) {
+        AlbumEntry* album = album_index_get_album(albums, album_id);
+        if (!album) continue;
+        
+        int track_count = visible_counts ? visible_counts[album_id] : album->track_count;
+        if (track_count == 0) continue;
+        
+        // La prima traccia dell'album fa da file rappresentativo
+        MP3File* representative_file = library_get_track(gui->library, album->tracks[0]);
+        if (!representative_file) continue;
+        
         // Crea il bitmap dell'album art
-        HBITMAP hBitmap = create_album_art_bitmap(current_album->representative_file);
+        HBITMAP hBitmap = create_album_art_bitmap(representative_file);
         
         if (hBitmap) {
             // Aggiungi il bitmap all'image list
@@ -2018,63 +2204,53 @@ void prepare_grid_view_items(GUIData* gui) {
             // Formatta il testo con album, artista, anno e numero di tracce
             char text[512];
             sprintf(text, "%s\n%s\n%d\n%d tracce", 
-                    current_album->album, 
-                    current_album->artist,
-                    current_album->year > 0 ? current_album->year : 0,
-                    current_album->track_count);
+                    album->name[0] ? album->name : "Unknown Album", 
+                    album->artist[0] ? album->artist : "Unknown Artist",
+                    album->year > 0 ? album->year : 0,
+                    track_count);
             
             lvItem.pszText = text;
-            lvItem.lParam = (LPARAM)current_album->representative_file;  // Salva il puntatore al file rappresentativo
+            lvItem.lParam = (LPARAM)push_view_id(gui, representative_file->id);  // Id del file rappresentativo
             
             // Inserisci l'elemento
             ListView_InsertItem(gui->hListView, &lvItem);
+            index++;
             
             // Libera il bitmap originale (l'image list ne ha fatto una copia)
             DeleteObject(hBitmap);
         }
-        
-        // Vai al prossimo album
-        AlbumInfo* temp = current_album;
-        current_album = current_album->next;
-        free(temp);  // Libera la memoria dell'AlbumInfo corrente
-        
-        index++;
     }
+    library_unlock(gui->library);
+    
+    free(visible_counts);
 }
 
 // Quando un album è stato selezionato nella vista a griglia, seleziona tutte le tracce corrispondenti
 void handle_album_selection(GUIData* gui, MP3File* representative_file) {
     if (!gui || !representative_file) return;
     
-    // Ottieni il nome dell'album selezionato
-    const char* selected_album = representative_file->metadata.album;
-    
-    // Crea un filtro per l'album selezionato
-    MP3Filter filter;
-    filter.filter_type = FILTER_BY_ALBUM;
-    strncpy(filter.filter_text, selected_album, MAX_FILTER_LENGTH - 1);
-    filter.filter_text[MAX_FILTER_LENGTH - 1] = '\0';
-    
-    // Libera la lista filtrata precedente se esiste
-    if (gui->using_filtered_list && gui->current_list) {
-        MP3File* current = gui->current_list;
-        while (current) {
-            MP3File* next = current->next;
-            free(current);
-            current = next;
-        }
-        gui->current_list = NULL;
-    }
+    // Trova l'album nell'indice della libreria
+    AlbumEntry* album = album_index_get_album(gui->library->albums,
+                                              album_index_find_track_album(gui->library->albums, representative_file));
+    if (!album) return;
     
-    // Crea una nuova lista filtrata con le tracce dell'album
-    gui->current_list = filter_mp3_files(gui->library, &filter);
-    gui->using_filtered_list = TRUE;
+    const char* selected_album = album->name[0] ? album->name : "Unknown Album";
     
-    // Ora ordina la lista filtrata per numero di traccia
-    if (gui->current_list) {
-        sort_mp3_files(&gui->current_list, SORT_BY_TRACK);
+    // La lista dell'album sono gli id dell'indice (sostituisce la lista filtrata precedente,
+    // compresi i risultati ancora in arrivo dalla casella di ricerca)
+    search_session_cancel(gui->search);
+    track_view_clear(&gui->filtered);
+    for (int i = 0; i < album->track_count; i++) {
+        if (!track_view_add(&gui->filtered, album->tracks[i])) break;
     }
     
+    // Ora ordina la lista per numero di traccia
+    SortSpec spec;
+    sort_spec_init(&spec, SORT_BYTE_ORDER);
+    sort_spec_add_key(&spec, SORT_BY_TRACK, FALSE);
+    track_view_sort(gui->library, &gui->filtered, &spec, NULL);
+    gui->using_filtered_list = TRUE;
+    
     // Passa alla vista lista e mostra solo le tracce dell'album
     switch_view_mode(gui, VIEW_MODE_LIST);
     
@@ -2095,7 +2271,7 @@ void handle_album_selection(GUIData* gui, MP3File* representative_file) {
     char statusText[256];
     sprintf(statusText, "Album: %s - Artista: %s - %d tracce", 
             selected_album, 
-            representative_file->metadata.artist[0] ? representative_file->metadata.artist : "Unknown",
+            album->artist[0] ? album->artist : "Unknown",
             ListView_GetItemCount(gui->hListView));
     SetWindowText(gui->hStatusBar, statusText);
 }
\ No newline at end of file
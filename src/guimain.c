@@ -37,6 +37,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         return 1;
     }
     
+    // Scarica le copertine se la loro categoria supera il budget di memoria
+    library_set_art_eviction(library, TRUE);
+    
     // Update settings with the current library path
     strncpy(g_settings.library_path, library_path, MAX_PATH - 1);
     g_settings.library_path[MAX_PATH - 1] = '\0';
@@ -63,6 +66,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     settings_save(&g_settings, DEFAULT_SETTINGS_FILE);
     
     // Pulizia della memoria
+    library_set_art_eviction(library, FALSE);
     free_mp3_library(library);
     
     // Report any memory leaks
@@ -1,4 +1,8 @@
 #include "../include/mp3player.h"
+#include "../include/memory.h"
+#include "../include/sortspec.h"
+#include "../include/trackview.h"
+#include "../include/strscan.h"
 #include "../include/bass.h"
 
 // Dimensione dell'header ID3v2
@@ -128,13 +132,13 @@ static void extract_album_art(const unsigned char* frame_data, size_t frame_size
     if (image_data_size > 0) {
         // Libera memoria precedente se esistente
         if (metadata->album_art) {
-            free(metadata->album_art);
+            MEM_FREE(metadata->album_art);
             metadata->album_art = NULL;
             metadata->album_art_size = 0;
         }
         
         // Alloca memoria e copia i dati dell'immagine
-        metadata->album_art = (char*)malloc(image_data_size);
+        metadata->album_art = (char*)MEM_ALLOC_TAGGED(image_data_size, MEM_CAT_ART);
         if (metadata->album_art) {
             memcpy(metadata->album_art, frame_data + pos, image_data_size);
             metadata->album_art_size = image_data_size;
@@ -273,6 +277,12 @@ static int read_id3v2_tag(FILE* file, MP3Metadata* metadata) {
                 read_utf8_or_iso((char*)&frame_buffer[1], track_str, sizeof(track_str), frame_buffer[0]);
                 metadata->track_number = parse_track_number(track_str);
             }
+            else if (strcmp(frame_id, "TPA") == 0 && frame_size > 1) {
+                // Numero del disco, stesso formato "n/totale" della traccia
+                char disc_str[10] = {0};
+                read_utf8_or_iso((char*)&frame_buffer[1], disc_str, sizeof(disc_str), frame_buffer[0]);
+                metadata->disc_number = parse_track_number(disc_str);
+            }
             else if (strcmp(frame_id, "PIC") == 0 && frame_size > 4) {
                 // Esegui l'estrazione dell'immagine dell'album
                 extract_album_art(frame_buffer, frame_size, metadata);
@@ -303,6 +313,11 @@ static int read_id3v2_tag(FILE* file, MP3Metadata* metadata) {
                 read_utf8_or_iso((char*)&frame_buffer[1], track_str, sizeof(track_str), frame_buffer[0]);
                 metadata->track_number = parse_track_number(track_str);
             }
+            else if (strcmp(frame_id, "TPOS") == 0 && frame_size > 1) {
+                char disc_str[10] = {0};
+                read_utf8_or_iso((char*)&frame_buffer[1], disc_str, sizeof(disc_str), frame_buffer[0]);
+                metadata->disc_number = parse_track_number(disc_str);
+            }
             else if ((strcmp(frame_id, "APIC") == 0) && frame_size > 10) {
                 // Esegui l'estrazione dell'immagine dell'album
                 extract_album_art(frame_buffer, frame_size, metadata);
@@ -363,121 +378,203 @@ int read_mp3_metadata(const char* filepath, MP3Metadata* metadata) {
     return success;
 }
 
-// Funzione per ordinare i file MP3 in base a diversi criteri
-void sort_mp3_files(MP3File** file_list, int sort_type) {
-    if (!file_list || !(*file_list) || !(*file_list)->next) {
-        return; // Niente da ordinare
-    }
-    
-    // Implementa un semplice bubble sort per ora
-    int swapped;
-    MP3File* ptr1;
-    MP3File* lptr = NULL;
+// Funzioni di confronto per l'ordinamento (stesso criterio per ogni tipo)
+typedef int (*MP3FileCompare)(const MP3File* a, const MP3File* b);
+
+static int compare_by_title(const MP3File* a, const MP3File* b) {
+    return strcmp(a->metadata.title, b->metadata.title);
+}
+
+static int compare_by_artist(const MP3File* a, const MP3File* b) {
+    return strcmp(a->metadata.artist, b->metadata.artist);
+}
+
+static int compare_by_album(const MP3File* a, const MP3File* b) {
+    return strcmp(a->metadata.album, b->metadata.album);
+}
+
+static int compare_by_year(const MP3File* a, const MP3File* b) {
+    return a->metadata.year - b->metadata.year;
+}
+
+static int compare_by_genre(const MP3File* a, const MP3File* b) {
+    return strcmp(a->metadata.genre, b->metadata.genre);
+}
+
+static int compare_by_track(const MP3File* a, const MP3File* b) {
+    return a->metadata.track_number - b->metadata.track_number;
+}
+
+static int compare_by_disc(const MP3File* a, const MP3File* b) {
+    return a->metadata.disc_number - b->metadata.disc_number;
+}
+
+static int compare_by_duration(const MP3File* a, const MP3File* b) {
+    return a->metadata.duration - b->metadata.duration;
+}
+
+// Merge sort bottom-up sulla lista collegata: O(n log n), stabile, senza allocazioni.
+// Usato quando non c'è memoria per l'array delle chiavi.
+static void merge_sort_list(MP3File** file_list, MP3FileCompare compare) {
+    MP3File* list = *file_list;
+    int width = 1;
     
-    do {
-        swapped = 0;
-        ptr1 = *file_list;
+    while (1) {
+        MP3File* p = list;
+        MP3File* tail = NULL;
+        int merges = 0;
+        list = NULL;
         
-        while (ptr1->next != lptr) {
-            int compare_result = 0;
+        // Fonde a coppie le sequenze ordinate di lunghezza width
+        while (p) {
+            merges++;
             
-            // Seleziona il campo di ordinamento
-            switch (sort_type) {
-                case SORT_BY_TITLE:
-                    compare_result = strcmp(ptr1->metadata.title, ptr1->next->metadata.title);
-                    break;
-                case SORT_BY_ARTIST:
-                    compare_result = strcmp(ptr1->metadata.artist, ptr1->next->metadata.artist);
-                    break;
-                case SORT_BY_ALBUM:
-                    compare_result = strcmp(ptr1->metadata.album, ptr1->next->metadata.album);
-                    break;
-                case SORT_BY_YEAR:
-                    compare_result = ptr1->metadata.year - ptr1->next->metadata.year;
-                    break;
-                case SORT_BY_GENRE:
-                    compare_result = strcmp(ptr1->metadata.genre, ptr1->next->metadata.genre);
-                    break;
-                case SORT_BY_TRACK:
-                    compare_result = ptr1->metadata.track_number - ptr1->next->metadata.track_number;
-                    break;
-                default:
-                    compare_result = strcmp(ptr1->metadata.title, ptr1->next->metadata.title);
-                    break;
+            MP3File* q = p;
+            int p_size = 0;
+            while (p_size < width && q) {
+                p_size++;
+                q = q->next;
             }
+            int q_size = width;
             
-            // Scambia se necessario
-            if (compare_result > 0) {
-                // Scambia i metadati
-                MP3Metadata temp_metadata = ptr1->metadata;
-                ptr1->metadata = ptr1->next->metadata;
-                ptr1->next->metadata = temp_metadata;
+            while (p_size > 0 || (q_size > 0 && q)) {
+                MP3File* next;
                 
-                // Scambia i percorsi dei file
-                char temp_filepath[MAX_PATH_LENGTH];
-                strncpy(temp_filepath, ptr1->filepath, MAX_PATH_LENGTH);
-                strncpy(ptr1->filepath, ptr1->next->filepath, MAX_PATH_LENGTH);
-                strncpy(ptr1->next->filepath, temp_filepath, MAX_PATH_LENGTH);
+                // A parità di chiave vince la sequenza di sinistra (ordinamento stabile)
+                if (p_size > 0 && (q_size == 0 || !q || compare(p, q) <= 0)) {
+                    next = p;
+                    p = p->next;
+                    p_size--;
+                } else {
+                    next = q;
+                    q = q->next;
+                    q_size--;
+                }
                 
-                swapped = 1;
+                if (tail) {
+                    tail->next = next;
+                } else {
+                    list = next;
+                }
+                tail = next;
             }
             
-            ptr1 = ptr1->next;
+            p = q;
         }
-        lptr = ptr1;
-    } while (swapped);
+        
+        tail->next = NULL;
+        
+        // Una sola fusione: la lista è ordinata
+        if (merges <= 1) {
+            break;
+        }
+        width *= 2;
+    }
+    
+    *file_list = list;
+}
+
+// Funzione per ordinare i file MP3 in base a diversi criteri.
+// Ordinamento stabile in O(n log n): i nodi vengono ricollegati e mai copiati, quindi
+// ogni record resta allo stesso indirizzo con il proprio id, come si aspetta l'indice della libreria.
+void sort_mp3_files(MP3File** file_list, int sort_type) {
+    if (!file_list || !(*file_list) || !(*file_list)->next) {
+        return; // Niente da ordinare
+    }
+    
+    // Confronto byte per byte dei tag, come strcmp (vedi sortspec.c)
+    SortSpec spec;
+    sort_spec_init(&spec, SORT_BYTE_ORDER);
+    if (!sort_spec_add_key(&spec, sort_type, FALSE)) {
+        sort_spec_add_key(&spec, SORT_BY_TITLE, FALSE);
+    }
+    if (sort_tracks(NULL, file_list, &spec)) {
+        return;
+    }
+    
+    // Senza memoria per le chiavi si ordina direttamente la lista
+    MP3FileCompare compare;
+    switch (sort_type) {
+        case SORT_BY_ARTIST:
+            compare = compare_by_artist;
+            break;
+        case SORT_BY_ALBUM:
+            compare = compare_by_album;
+            break;
+        case SORT_BY_YEAR:
+            compare = compare_by_year;
+            break;
+        case SORT_BY_GENRE:
+            compare = compare_by_genre;
+            break;
+        case SORT_BY_TRACK:
+            compare = compare_by_track;
+            break;
+        case SORT_BY_DISC:
+            compare = compare_by_disc;
+            break;
+        case SORT_BY_DURATION:
+            compare = compare_by_duration;
+            break;
+        case SORT_BY_TITLE:
+        default:
+            compare = compare_by_title;
+            break;
+    }
+    
+    merge_sort_list(file_list, compare);
 }
 
-// Funzione per filtrare i file MP3 in base a un criterio
-MP3File* filter_mp3_files(MP3Library* library, MP3Filter* filter) {
-    if (!library || !filter || !library->all_files) {
-        return NULL;
+// Funzione per filtrare i file MP3 in base a un criterio.
+// Il testo è cercato come sottostringa senza distinguere maiuscole e minuscole (lettere ASCII).
+// Il risultato contiene solo gli id dei record (nessuna copia), nell'ordine della libreria.
+// Restituisce il numero di corrispondenze, -1 se manca la memoria.
+int filter_mp3_files(MP3Library* library, MP3Filter* filter, TrackView* result) {
+    if (!library || !filter || !result) {
+        return -1;
     }
     
-    MP3File* filtered_list = NULL;
+    track_view_clear(result);
+    int year = filter->filter_type == FILTER_BY_YEAR ? atoi(filter->filter_text) : 0;
+    size_t length = strlen(filter->filter_text);
     MP3File* current = library->all_files;
     
     while (current) {
         int match = 0;
+        const char* text = NULL;
         
         // Controlla se il file corrisponde al filtro
         switch (filter->filter_type) {
             case FILTER_BY_TITLE:
-                match = (strstr(current->metadata.title, filter->filter_text) != NULL);
+                text = current->metadata.title;
                 break;
             case FILTER_BY_ARTIST:
-                match = (strstr(current->metadata.artist, filter->filter_text) != NULL);
+                text = current->metadata.artist;
                 break;
             case FILTER_BY_ALBUM:
-                match = (strstr(current->metadata.album, filter->filter_text) != NULL);
+                text = current->metadata.album;
                 break;
             case FILTER_BY_GENRE:
-                match = (strstr(current->metadata.genre, filter->filter_text) != NULL);
+                text = current->metadata.genre;
                 break;
             case FILTER_BY_YEAR:
-                match = (current->metadata.year == atoi(filter->filter_text));
+                match = (current->metadata.year == year);
                 break;
             default:
                 match = 0;
                 break;
         }
+        if (text) {
+            match = (str_find_nocase(text, strlen(text), filter->filter_text, length) != STR_NOT_FOUND);
+        }
         
-        // Se corrisponde, aggiungi alla lista filtrata
-        if (match) {
-            MP3File* new_file = (MP3File*)malloc(sizeof(MP3File));
-            if (new_file) {
-                // Copia i dati
-                strncpy(new_file->filepath, current->filepath, MAX_PATH_LENGTH);
-                new_file->metadata = current->metadata;
-                
-                // Aggiungi all'inizio della lista filtrata
-                new_file->next = filtered_list;
-                filtered_list = new_file;
-            }
+        // Se corrisponde, aggiungi l'id al risultato
+        if (match && !track_view_add(result, current->id)) {
+            return -1;
         }
         
         current = current->next;
     }
     
-    return filtered_list;
+    return result->count;
 } 
\ No newline at end of file
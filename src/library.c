@@ -1,5 +1,618 @@
 #include "../include/mp3player.h"
 #include "../include/memory.h"
+#include "../include/albumindex.h"
+#include "../include/pathtrie.h"
+#include "../include/sortview.h"
+#include "../include/smartplaylist.h"
+#include "../include/textindex.h"
+
+// Capacità iniziale della tabella id -> record
+#define TRACK_TABLE_INITIAL_CAPACITY 1024
+
+// Marcatore per gli slot liberati (mantiene intatte le catene di probing)
+#define TRACK_SLOT_DELETED ((MP3File*)(ULONG_PTR)-1)
+
+// Capacità iniziale della coda di riproduzione
+#define QUEUE_INITIAL_CAPACITY 64
+
+// Rimescola i bit dell'id prima di ridurlo all'indice dello slot (finalizzatore splitmix64)
+static UINT64 mix_track_id(TrackId id) {
+    id ^= id >> 30;
+    id *= 0xBF58476D1CE4E5B9ULL;
+    id ^= id >> 27;
+    id *= 0x94D049BB133111EBULL;
+    id ^= id >> 31;
+    return id;
+}
+
+// Inizializza una tabella vuota con la capacità indicata (potenza di 2)
+static BOOL track_table_init(TrackTable* table, int capacity) {
+    table->slots = (MP3File**)MEM_CALLOC_TAGGED(capacity, sizeof(MP3File*), MEM_CAT_INDEX);
+    if (!table->slots) {
+        return FALSE;
+    }
+    
+    table->capacity = capacity;
+    table->count = 0;
+    table->tombstones = 0;
+    return TRUE;
+}
+
+// Restituisce l'indice dello slot che contiene l'id, oppure -1
+static int track_table_find_slot(const TrackTable* table, TrackId id) {
+    if (!table->slots) {
+        return -1;
+    }
+    
+    int mask = table->capacity - 1;
+    int index = (int)(mix_track_id(id) & mask);
+    
+    while (table->slots[index]) {
+        if (table->slots[index] != TRACK_SLOT_DELETED && table->slots[index]->id == id) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+    
+    return -1;
+}
+
+// Inserisce un record senza controllare il fattore di carico
+static void track_table_put(TrackTable* table, MP3File* file) {
+    int mask = table->capacity - 1;
+    int index = (int)(mix_track_id(file->id) & mask);
+    
+    while (table->slots[index] && table->slots[index] != TRACK_SLOT_DELETED) {
+        index = (index + 1) & mask;
+    }
+    
+    if (table->slots[index] == TRACK_SLOT_DELETED) {
+        table->tombstones--;
+    }
+    table->slots[index] = file;
+    table->count++;
+}
+
+// Ricostruisce la tabella (raddoppiandola se necessario) eliminando i marcatori
+static BOOL track_table_rehash(TrackTable* table) {
+    int new_capacity = table->capacity;
+    if ((table->count + 1) * 2 >= table->capacity) {
+        new_capacity *= 2;
+    }
+    
+    TrackTable resized;
+    if (!track_table_init(&resized, new_capacity)) {
+        return FALSE;
+    }
+    
+    for (int i = 0; i < table->capacity; i++) {
+        MP3File* file = table->slots[i];
+        if (file && file != TRACK_SLOT_DELETED) {
+            track_table_put(&resized, file);
+        }
+    }
+    
+    MEM_FREE(table->slots);
+    *table = resized;
+    return TRUE;
+}
+
+// Inserisce un record mantenendo il fattore di carico sotto il 75%
+static BOOL track_table_insert(TrackTable* table, MP3File* file) {
+    if ((table->count + table->tombstones + 1) * 4 >= table->capacity * 3) {
+        if (!track_table_rehash(table)) {
+            return FALSE;
+        }
+    }
+    
+    track_table_put(table, file);
+    return TRUE;
+}
+
+// Rimuove un id dalla tabella
+static void track_table_erase(TrackTable* table, TrackId id) {
+    int index = track_table_find_slot(table, id);
+    if (index < 0) {
+        return;
+    }
+    
+    table->slots[index] = TRACK_SLOT_DELETED;
+    table->count--;
+    table->tombstones++;
+}
+
+// Registra un record il cui id non è l'hash del percorso
+static BOOL add_collision(MP3Library* library, TrackId path_id, MP3File* file) {
+    if (library->collision_count == library->collision_capacity) {
+        int new_capacity = library->collision_capacity ? library->collision_capacity * 2 : 4;
+        TrackCollision* collisions = (TrackCollision*)MEM_REALLOC_TAGGED(library->collisions,
+                                                                          new_capacity * sizeof(TrackCollision),
+                                                                          MEM_CAT_INDEX);
+        if (!collisions) {
+            return FALSE;
+        }
+        library->collisions = collisions;
+        library->collision_capacity = new_capacity;
+    }
+    
+    library->collisions[library->collision_count].path_id = path_id;
+    library->collisions[library->collision_count].file = file;
+    library->collision_count++;
+    return TRUE;
+}
+
+// Toglie un record dalla tabella degli id (e dalle collisioni, se ne fa parte)
+static void unindex_track(MP3Library* library, MP3File* file) {
+    track_table_erase(&library->tracks, file->id);
+    
+    for (int i = 0; i < library->collision_count; i++) {
+        if (library->collisions[i].file == file) {
+            library->collisions[i] = library->collisions[--library->collision_count];
+            break;
+        }
+    }
+}
+
+// Calcola l'id stabile di una traccia a partire dal percorso (FNV-1a a 64 bit).
+// Il percorso viene confrontato senza distinguere maiuscole/minuscole, come fa Windows,
+// e '/' equivale a '\\' (il trie memorizza i percorsi sempre con '\\').
+TrackId make_track_id(const char* filepath) {
+    UINT64 hash = 14695981039346656037ULL;
+    
+    for (const unsigned char* p = (const unsigned char*)filepath; *p; p++) {
+        unsigned char c = *p;
+        if (c >= 'A' && c <= 'Z') {
+            c = (unsigned char)(c - 'A' + 'a');
+        } else if (c == '/') {
+            c = '\\';
+        }
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    
+    return hash != INVALID_TRACK_ID ? hash : 1;
+}
+
+// Restituisce il record associato a un id in O(1), NULL se la traccia non esiste più
+MP3File* library_get_track(MP3Library* library, TrackId id) {
+    if (!library || id == INVALID_TRACK_ID) {
+        return NULL;
+    }
+    
+    library_lock(library);
+    int index = track_table_find_slot(&library->tracks, id);
+    MP3File* file = index >= 0 ? library->tracks.slots[index] : NULL;
+    library_unlock(library);
+    return file;
+}
+
+// Cerca il file di nome filename, con l'id calcolato dal percorso, nella cartella dir già risolta
+static MP3File* find_in_dir(MP3Library* library, DirNode* dir, TrackId id, const char* filename) {
+    MP3File* file = library_get_track(library, id);
+    if (file && file->dir == dir && _stricmp(file->filename, filename) == 0) {
+        return file;
+    }
+    
+    // In caso di collisione tra percorsi diversi l'id assegnato è il successivo libero:
+    // quei record sono registrati per hash del percorso, così restano raggiungibili
+    // anche dopo la rimozione di chi occupava l'id
+    for (int i = 0; i < library->collision_count; i++) {
+        file = library->collisions[i].file;
+        if (library->collisions[i].path_id == id && file->dir == dir && _stricmp(file->filename, filename) == 0) {
+            return file;
+        }
+    }
+    
+    return NULL;
+}
+
+// Cerca una traccia per percorso senza scorrere la lista
+MP3File* library_find_by_path(MP3Library* library, const char* filepath) {
+    if (!library || !filepath) {
+        return NULL;
+    }
+    
+    // Se la directory non è nel trie il file non può essere in libreria
+    size_t dir_length;
+    const char* filename = path_split_name(filepath, &dir_length);
+    library_lock(library);
+    DirNode* dir = path_trie_find_dir(library->paths, filepath, dir_length);
+    MP3File* file = dir ? find_in_dir(library, dir, make_track_id(filepath), filename) : NULL;
+    library_unlock(library);
+    return file;
+}
+
+// Risolve molti percorsi in una volta (per esempio le voci di una playlist): i percorsi
+// consecutivi della stessa cartella, il caso comune, cercano la cartella una volta sola.
+// found[i] riceve il record di paths[i] o NULL. Restituisce il numero di percorsi trovati.
+int library_find_paths(MP3Library* library, const char* const* paths, int count, MP3File** found) {
+    if (!library || !paths || !found) {
+        return 0;
+    }
+    
+    const char* last_path = NULL;
+    size_t last_length = 0;
+    DirNode* last_dir = NULL;
+    int resolved = 0;
+    
+    library_lock(library);
+    for (int i = 0; i < count; i++) {
+        found[i] = NULL;
+        if (!paths[i]) {
+            continue;
+        }
+        
+        size_t dir_length;
+        const char* filename = path_split_name(paths[i], &dir_length);
+        if (!last_path || dir_length != last_length || _strnicmp(paths[i], last_path, dir_length) != 0) {
+            last_dir = path_trie_find_dir(library->paths, paths[i], dir_length);
+            last_path = paths[i];
+            last_length = dir_length;
+        }
+        
+        if (last_dir && (found[i] = find_in_dir(library, last_dir, make_track_id(paths[i]), filename)) != NULL) {
+            resolved++;
+        }
+    }
+    library_unlock(library);
+    
+    return resolved;
+}
+
+void library_lock(MP3Library* library) {
+    if (library) {
+        EnterCriticalSection(&library->lock);
+    }
+}
+
+void library_unlock(MP3Library* library) {
+    if (library) {
+        LeaveCriticalSection(&library->lock);
+    }
+}
+
+// Corpo di library_add_file, con il lock già preso
+static BOOL add_file_locked(MP3Library* library, MP3File* file, const char* filepath) {
+    if (library_find_by_path(library, filepath)) {
+        return FALSE;
+    }
+    
+    // Il record tiene solo il nome del file, la directory è un nodo condiviso del trie
+    size_t dir_length;
+    const char* filename = path_split_name(filepath, &dir_length);
+    file->filename = MEM_STRDUP_TAGGED(filename, MEM_CAT_LIBRARY);
+    if (!file->filename) {
+        return FALSE;
+    }
+    
+    TrackId path_id = make_track_id(filepath);
+    TrackId id = path_id;
+    while (library_get_track(library, id)) {
+        id = (id + 1 != INVALID_TRACK_ID) ? id + 1 : 1;
+    }
+    file->id = id;
+    
+    if (!track_table_insert(&library->tracks, file)) {
+        return FALSE;
+    }
+    if (id != path_id && !add_collision(library, path_id, file)) {
+        track_table_erase(&library->tracks, id);
+        return FALSE;
+    }
+    
+    // Aggiorna gli aggregati di album e artista
+    if (!album_index_add(library->albums, file)) {
+        unindex_track(library, file);
+        return FALSE;
+    }
+    
+    // Indicizza le parole dei tag per la ricerca
+    if (!text_index_add(library->text, file)) {
+        album_index_remove(library->albums, file);
+        unindex_track(library, file);
+        return FALSE;
+    }
+    
+    DirNode* dir = path_trie_get_dir(library->paths, filepath, dir_length);
+    if (!dir) {
+        text_index_remove(library->text, library, file);
+        album_index_remove(library->albums, file);
+        unindex_track(library, file);
+        return FALSE;
+    }
+    path_trie_attach(library->paths, dir, file);
+    
+    // Aggiungi il file alla lista
+    file->next = library->all_files;
+    library->all_files = file;
+    library->total_files++;
+    library->changes++;
+    
+    // Inserisci il record nelle viste ordinate e nelle playlist intelligenti che lo accettano
+    sorted_views_track_added(library, file);
+    smart_playlists_track_added(library, file);
+    
+    return TRUE;
+}
+
+// Aggiunge un record alla libreria assegnandogli l'id e il percorso.
+// Restituisce FALSE se il percorso è già presente: il chiamante resta proprietario del record.
+BOOL library_add_file(MP3Library* library, MP3File* file, const char* filepath) {
+    if (!library || !file || !filepath) {
+        return FALSE;
+    }
+    
+    library_lock(library);
+    BOOL added = add_file_locked(library, file, filepath);
+    library_unlock(library);
+    return added;
+}
+
+// Rimuove un record dalla libreria e lo libera.
+// prev è il nodo precedente nella lista, se noto (NULL fa cercare il predecessore).
+void library_remove_file(MP3Library* library, MP3File* file, MP3File* prev) {
+    if (!library || !file) {
+        return;
+    }
+    
+    library_lock(library);
+    if (library->all_files == file) {
+        library->all_files = file->next;
+    } else {
+        if (!prev || prev->next != file) {
+            prev = library->all_files;
+            while (prev && prev->next != file) {
+                prev = prev->next;
+            }
+            if (!prev) {
+                library_unlock(library);
+                return; // Il file non appartiene alla libreria
+            }
+        }
+        prev->next = file->next;
+    }
+    
+    sorted_views_track_removed(library, file);
+    smart_playlists_track_removed(library, file);
+    text_index_remove(library->text, library, file);
+    unindex_track(library, file);
+    album_index_remove(library->albums, file);
+    path_trie_detach(library->paths, file);
+    library->total_files--;
+    library->changes++;
+    library_unlock(library);
+    free_mp3_file(file);
+}
+
+// Rimuove e libera un gruppo di record con una sola passata sulla lista (O(n + count)).
+// Restituisce il numero di record rimossi; i duplicati nell'array vengono ignorati.
+int library_remove_files(MP3Library* library, MP3File** files, int count) {
+    if (!library || !files || count <= 0) {
+        return 0;
+    }
+    
+    // Togli i record dagli indici e segnali con l'id non valido
+    library_lock(library);
+    int removed = 0;
+    for (int i = 0; i < count; i++) {
+        MP3File* file = files[i];
+        if (!file || file->id == INVALID_TRACK_ID || library_get_track(library, file->id) != file) {
+            continue;
+        }
+        
+        sorted_views_track_removed(library, file);
+        smart_playlists_track_removed(library, file);
+        text_index_remove(library->text, library, file);
+        unindex_track(library, file);
+        album_index_remove(library->albums, file);
+        path_trie_detach(library->paths, file);
+        file->id = INVALID_TRACK_ID;
+        removed++;
+    }
+    
+    if (removed == 0) {
+        library_unlock(library);
+        return 0;
+    }
+    
+    // Scollega dalla lista tutti i record segnati
+    MP3File** link = &library->all_files;
+    while (*link) {
+        MP3File* file = *link;
+        if (file->id == INVALID_TRACK_ID) {
+            *link = file->next;
+            free_mp3_file(file);
+        } else {
+            link = &file->next;
+        }
+    }
+    
+    library->total_files -= removed;
+    library->changes++;
+    library_unlock(library);
+    return removed;
+}
+
+// Scrive il percorso completo di un record in buffer (troncato come snprintf).
+// Restituisce la lunghezza completa del percorso.
+size_t mp3_file_path(const MP3File* file, char* buffer, size_t size) {
+    return path_trie_format(file, buffer, size);
+}
+
+// Restituisce una copia allocata del percorso completo (da liberare con MEM_FREE)
+char* mp3_file_dup_path(const MP3File* file) {
+    size_t length = path_trie_format(file, NULL, 0);
+    char* path = (char*)MEM_ALLOC(length + 1);
+    if (path) {
+        path_trie_format(file, path, length + 1);
+    }
+    return path;
+}
+
+// Numero di tracce in una cartella e nelle sue sottocartelle, in O(profondità)
+int library_count_in_folder(MP3Library* library, const char* folder) {
+    if (!library || !folder) {
+        return 0;
+    }
+    
+    library_lock(library);
+    DirNode* dir = path_trie_find_dir(library->paths, folder, strlen(folder));
+    int count = dir ? dir->subtree_count : 0;
+    library_unlock(library);
+    return count;
+}
+
+// Contesto per raccogliere i record di una cartella
+typedef struct {
+    MP3File** files;
+    TrackId* ids;
+    int count;
+} FolderCollect;
+
+static void collect_folder_track(MP3File* file, void* context) {
+    FolderCollect* collect = (FolderCollect*)context;
+    if (collect->files) {
+        collect->files[collect->count] = file;
+    }
+    if (collect->ids) {
+        collect->ids[collect->count] = file->id;
+    }
+    collect->count++;
+}
+
+// Restituisce gli id delle tracce di una cartella e delle sottocartelle (array da liberare con MEM_FREE).
+// Visita solo il sottoalbero della cartella, non l'intera libreria.
+int library_get_folder_tracks(MP3Library* library, const char* folder, TrackId** ids) {
+    if (!ids) {
+        return 0;
+    }
+    *ids = NULL;
+    
+    if (!library || !folder) {
+        return 0;
+    }
+    
+    library_lock(library);
+    DirNode* dir = path_trie_find_dir(library->paths, folder, strlen(folder));
+    if (!dir || dir->subtree_count == 0) {
+        library_unlock(library);
+        return 0;
+    }
+    
+    FolderCollect collect = { NULL, NULL, 0 };
+    collect.ids = (TrackId*)MEM_ALLOC(dir->subtree_count * sizeof(TrackId));
+    if (collect.ids) {
+        path_trie_for_each(dir, collect_folder_track, &collect);
+    }
+    library_unlock(library);
+    
+    *ids = collect.ids;
+    return collect.count;
+}
+
+// Rimuove dalla libreria tutte le tracce di una cartella e delle sottocartelle
+int library_remove_folder(MP3Library* library, const char* folder) {
+    if (!library || !folder) {
+        return 0;
+    }
+    
+    // I record raccolti restano validi fino alla rimozione: il lock resta preso
+    library_lock(library);
+    DirNode* dir = path_trie_find_dir(library->paths, folder, strlen(folder));
+    if (!dir || dir->subtree_count == 0) {
+        library_unlock(library);
+        return 0;
+    }
+    
+    FolderCollect collect = { NULL, NULL, 0 };
+    collect.files = (MP3File**)MEM_ALLOC(dir->subtree_count * sizeof(MP3File*));
+    int removed = 0;
+    if (collect.files) {
+        path_trie_for_each(dir, collect_folder_track, &collect);
+        removed = library_remove_files(library, collect.files, collect.count);
+    }
+    library_unlock(library);
+    
+    MEM_FREE(collect.files);
+    return removed;
+}
+
+// Libera le copertine delle tracce finché non sono stati liberati almeno bytes byte.
+// Il formato resta impostato: library_load_album_art rilegge l'immagine dal file quando serve.
+size_t library_evict_album_art(MP3Library* library, size_t bytes) {
+    if (!library) {
+        return 0;
+    }
+    
+    // L'hook può scattare su qualunque thread, anche mentre la scansione modifica la lista
+    library_lock(library);
+    size_t released = 0;
+    for (MP3File* current = library->all_files; current && released < bytes; current = current->next) {
+        if (current->metadata.album_art) {
+            released += current->metadata.album_art_size;
+            MEM_FREE(current->metadata.album_art);
+            current->metadata.album_art = NULL;
+        }
+    }
+    library_unlock(library);
+    
+    return released;
+}
+
+// Ricarica dal file la copertina di una traccia se era stata scaricata
+BOOL library_load_album_art(MP3Library* library, MP3File* file) {
+    if (!library || !file) {
+        return FALSE;
+    }
+    
+    // Il file viene letto senza lock: l'hook di eviction può liberare le copertine intanto
+    library_lock(library);
+    BOOL loaded = file->metadata.album_art != NULL;
+    BOOL missing = file->metadata.album_art_format == ALBUM_ART_UNKNOWN; // Mai avuto una copertina
+    char* filepath = loaded || missing ? NULL : mp3_file_dup_path(file);
+    library_unlock(library);
+    if (loaded || missing || !filepath) {
+        return loaded;
+    }
+    
+    // Legge in una struttura temporanea: se l'allocazione fa scattare l'eviction
+    // l'immagine appena letta non è ancora collegata alla traccia e non viene liberata
+    MP3Metadata metadata;
+    read_mp3_metadata(filepath, &metadata);
+    MEM_FREE(filepath);
+    
+    if (!metadata.album_art) {
+        return FALSE;
+    }
+    
+    // Un altro thread può averla ricaricata nel frattempo: si tiene la sua
+    library_lock(library);
+    if (file->metadata.album_art) {
+        MEM_FREE(metadata.album_art);
+    } else {
+        file->metadata.album_art = metadata.album_art;
+        file->metadata.album_art_size = metadata.album_art_size;
+        file->metadata.album_art_format = metadata.album_art_format;
+        file->metadata.album_art_type = metadata.album_art_type;
+    }
+    library_unlock(library);
+    return TRUE;
+}
+
+// Hook di eviction della categoria delle copertine
+static size_t evict_album_art_hook(MemCategory category, size_t excess, void* context) {
+    (void)category;
+    return library_evict_album_art((MP3Library*)context, excess);
+}
+
+// Attiva o disattiva lo scaricamento delle copertine quando si supera il budget della categoria
+void library_set_art_eviction(MP3Library* library, BOOL enable) {
+    if (enable && library) {
+        mem_set_evict_hook(MEM_CAT_ART, evict_album_art_hook, library);
+    } else {
+        mem_set_evict_hook(MEM_CAT_ART, NULL, NULL);
+    }
+}
 
 // Funzione per creare una nuova libreria MP3
 MP3Library* create_library(const char* directory_path) {
@@ -7,7 +620,7 @@ MP3Library* create_library(const char* directory_path) {
         return NULL;
     }
     
-    MP3Library* library = (MP3Library*)MEM_ALLOC(sizeof(MP3Library));
+    MP3Library* library = (MP3Library*)MEM_ALLOC_TAGGED(sizeof(MP3Library), MEM_CAT_LIBRARY);
     if (!library) {
         return NULL;
     }
@@ -15,9 +628,49 @@ MP3Library* create_library(const char* directory_path) {
     // Inizializzazione della libreria
     library->all_files = NULL;
     library->total_files = 0;
+    library->views = NULL;
+    library->smart = NULL;
+    library->collisions = NULL;
+    library->collision_count = 0;
+    library->collision_capacity = 0;
+    library->changes = 0;
     strncpy(library->library_path, directory_path, MAX_PATH_LENGTH - 1);
     library->library_path[MAX_PATH_LENGTH - 1] = '\0'; // Assicura terminazione
     
+    // Inizializzazione dell'indice id -> record
+    if (!track_table_init(&library->tracks, TRACK_TABLE_INITIAL_CAPACITY)) {
+        MEM_FREE(library);
+        return NULL;
+    }
+    
+    // Inizializzazione dell'indice album/artisti
+    library->albums = album_index_create();
+    if (!library->albums) {
+        MEM_FREE(library->tracks.slots);
+        MEM_FREE(library);
+        return NULL;
+    }
+    
+    // Inizializzazione del trie delle directory
+    library->paths = path_trie_create();
+    if (!library->paths) {
+        album_index_free(library->albums);
+        MEM_FREE(library->tracks.slots);
+        MEM_FREE(library);
+        return NULL;
+    }
+    
+    // Inizializzazione dell'indice di ricerca
+    library->text = text_index_create();
+    if (!library->text) {
+        path_trie_free(library->paths);
+        album_index_free(library->albums);
+        MEM_FREE(library->tracks.slots);
+        MEM_FREE(library);
+        return NULL;
+    }
+    
+    InitializeCriticalSection(&library->lock);
     return library;
 }
 
@@ -29,14 +682,18 @@ int scan_directory(MP3Library* library, const char* directory_path, BOOL recursi
     
     WIN32_FIND_DATA findFileData;
     HANDLE hFind = INVALID_HANDLE_VALUE;
-    char search_path[MAX_PATH_LENGTH];
     int file_count = 0;
     
     // Costruisce il pattern di ricerca per tutti i file
-    _snprintf_s(search_path, MAX_PATH_LENGTH, MAX_PATH_LENGTH - 1, "%s\\*", directory_path);
+    // (i percorsi sono allocati: la libreria non ha più un limite di lunghezza)
+    char* search_path = path_join(directory_path, "*");
+    if (!search_path) {
+        return 0;
+    }
     
     // Trova il primo file
     hFind = FindFirstFile(search_path, &findFileData);
+    MEM_FREE(search_path);
     if (hFind == INVALID_HANDLE_VALUE) {
         return 0;
     }
@@ -49,8 +706,10 @@ int scan_directory(MP3Library* library, const char* directory_path, BOOL recursi
         }
         
         // Costruisci il percorso completo
-        char full_path[MAX_PATH_LENGTH];
-        _snprintf_s(full_path, MAX_PATH_LENGTH, MAX_PATH_LENGTH - 1, "%s\\%s", directory_path, findFileData.cFileName);
+        char* full_path = path_join(directory_path, findFileData.cFileName);
+        if (!full_path) {
+            continue;
+        }
         
         // Se è una directory e la scansione è ricorsiva
         if (findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
@@ -62,12 +721,16 @@ int scan_directory(MP3Library* library, const char* directory_path, BOOL recursi
         else {
             char* ext = strrchr(findFileData.cFileName, '.');
             if (ext && _stricmp(ext, ".mp3") == 0) {
+                // Se il file è già nella libreria manteniamo il record esistente (e il suo id)
+                if (library_find_by_path(library, full_path)) {
+                    file_count++;
+                    MEM_FREE(full_path);
+                    continue;
+                }
+                
                 // Crea un nuovo nodo per il file MP3
-                MP3File* new_file = (MP3File*)MEM_ALLOC(sizeof(MP3File));
+                MP3File* new_file = (MP3File*)MEM_CALLOC_TAGGED(1, sizeof(MP3File), MEM_CAT_LIBRARY);
                 if (new_file) {
-                    strncpy(new_file->filepath, full_path, MAX_PATH_LENGTH - 1);
-                    new_file->filepath[MAX_PATH_LENGTH - 1] = '\0';
-                    
                     // Leggi i metadati dal file MP3
                     if (!read_mp3_metadata(full_path, &new_file->metadata)) {
                         // Se la lettura dei metadati fallisce, usiamo il nome del file come titolo
@@ -76,16 +739,17 @@ int scan_directory(MP3Library* library, const char* directory_path, BOOL recursi
                         new_file->metadata.title[MAX_TITLE_LENGTH - 1] = '\0';
                     }
                     
-                    // Aggiungi il file alla lista
-                    new_file->next = library->all_files;
-                    library->all_files = new_file;
-                    
-                    // Incrementa i contatori
-                    library->total_files++;
-                    file_count++;
+                    // Aggiungi il file alla libreria (assegna anche l'id)
+                    if (library_add_file(library, new_file, full_path)) {
+                        file_count++;
+                    } else {
+                        free_mp3_file(new_file);
+                    }
                 }
             }
         }
+        
+        MEM_FREE(full_path);
     } while (FindNextFile(hFind, &findFileData) != 0);
     
     FindClose(hFind);
@@ -103,16 +767,61 @@ void free_mp3_file(MP3File* file) {
         MEM_FREE(file->metadata.album_art);
     }
     
+    collation_free_keys(file);
+    MEM_FREE(file->filename);
     MEM_FREE(file);
 }
 
+// Funzione per creare una coda di riproduzione vuota
+MP3Queue* create_queue() {
+    MP3Queue* queue = (MP3Queue*)MEM_ALLOC_TAGGED(sizeof(MP3Queue), MEM_CAT_QUEUE);
+    if (!queue) {
+        return NULL;
+    }
+    
+    memset(queue, 0, sizeof(MP3Queue));
+    queue->items = (TrackId*)MEM_ALLOC_TAGGED(QUEUE_INITIAL_CAPACITY * sizeof(TrackId), MEM_CAT_QUEUE);
+    if (!queue->items) {
+        MEM_FREE(queue);
+        return NULL;
+    }
+    
+    queue->capacity = QUEUE_INITIAL_CAPACITY;
+    queue->current = -1;
+    
+    return queue;
+}
+
+// Funzione per aggiungere un id in fondo alla coda
+BOOL queue_add_track(MP3Queue* queue, TrackId id) {
+    if (!queue || id == INVALID_TRACK_ID) {
+        return FALSE;
+    }
+    
+    // Ingrandisci l'array se necessario
+    if (queue->count >= queue->capacity) {
+        int new_capacity = queue->capacity * 2;
+        TrackId* new_items = (TrackId*)MEM_REALLOC(queue->items, new_capacity * sizeof(TrackId));
+        if (!new_items) {
+            return FALSE;
+        }
+        
+        queue->items = new_items;
+        queue->capacity = new_capacity;
+    }
+    
+    queue->items[queue->count++] = id;
+    return TRUE;
+}
+
 // Funzione per liberare la memoria di una coda di riproduzione
 void free_mp3_queue(MP3Queue* queue) {
     if (!queue) {
         return;
     }
     
-    // Non liberiamo i singoli MP3File qui perché sono referenziati dalla libreria
+    // La coda contiene solo id: i record appartengono alla libreria
+    MEM_FREE(queue->items);
     MEM_FREE(queue);
 }
 
@@ -122,6 +831,14 @@ void free_mp3_library(MP3Library* library) {
         return;
     }
     
+    // Libera le viste ordinate e le playlist intelligenti ancora registrate
+    while (library->views) {
+        sorted_view_free(library->views);
+    }
+    while (library->smart) {
+        smart_playlist_free(library->smart);
+    }
+    
     // Libera tutti i file MP3
     MP3File* current = library->all_files;
     while (current) {
@@ -130,5 +847,11 @@ void free_mp3_library(MP3Library* library) {
         current = next;
     }
     
+    MEM_FREE(library->tracks.slots);
+    MEM_FREE(library->collisions);
+    album_index_free(library->albums);
+    path_trie_free(library->paths);
+    text_index_free(library->text);
+    DeleteCriticalSection(&library->lock);
     MEM_FREE(library);
 } 
\ No newline at end of file
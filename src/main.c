@@ -1,11 +1,170 @@
 #include "../include/mp3player.h"
 #include "../include/memory.h"
+#include "../include/bench.h"
+#include "../include/duplicates.h"
+#include "../include/sortspec.h"
+#include "../include/sortview.h"
+#include "../include/trackview.h"
+#include "../include/textindex.h"
+#include "../include/searchsession.h"
+#include "../include/filterquery.h"
 #include <locale.h>
 #include <windows.h>
 
 // Dichiarazione della funzione di avvio dell'interfaccia grafica
 int start_gui_from_cli(MP3Library* library);
 
+// Istantanea degli id mostrati dall'ultimo "list": l'indice visualizzato viene
+// tradotto in id, che resta valido anche se la lista cambia nel frattempo
+typedef struct {
+    TrackId* ids;
+    int count;
+    BOOL valid;
+} ListSnapshot;
+
+// Forma classica "filter artist testo" (un campo seguito dal testo): la traduce
+// nell'interrogazione equivalente artist~"testo", una sottostringa come nel filtro
+// originale (year:"anno" per l'anno). FALSE se il testo è già un'interrogazione.
+static BOOL legacy_filter_query(const char* text, char* query, size_t size) {
+    static const char* fields[] = { "title", "artist", "album", "genre", "year" };
+    const char* space = strchr(text, ' ');
+    if (!space || strchr(text, ':') || strchr(text, '~')) {
+        return FALSE;
+    }
+    
+    for (int i = 0; i < 5; i++) {
+        size_t length = strlen(fields[i]);
+        if ((size_t)(space - text) != length || strncmp(text, fields[i], length) != 0) {
+            continue;
+        }
+        
+        // Le virgolette del testo chiuderebbero il valore: vengono tolte
+        size_t written = (size_t)snprintf(query, size, "%s%c\"", fields[i], i < 4 ? '~' : ':');
+        for (const char* p = space + 1; *p && written + 2 < size; p++) {
+            if (*p != '"') {
+                query[written++] = *p;
+            }
+        }
+        query[written++] = '"';
+        query[written] = '\0';
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Memorizza gli id della lista visualizzata nello stesso ordine del comando "list"
+static BOOL snapshot_list(ListSnapshot* snapshot, MP3File* list) {
+    int total_files = 0;
+    for (MP3File* current = list; current; current = current->next) {
+        total_files++;
+    }
+    
+    TrackId* ids = NULL;
+    if (total_files > 0) {
+        ids = (TrackId*)MEM_REALLOC_TAGGED(snapshot->ids, total_files * sizeof(TrackId), MEM_CAT_FILTER);
+        if (!ids) {
+            return FALSE;
+        }
+        snapshot->ids = ids;
+    }
+    
+    int i = 0;
+    for (MP3File* current = list; current; current = current->next) {
+        snapshot->ids[i++] = current->id;
+    }
+    
+    snapshot->count = total_files;
+    snapshot->valid = TRUE;
+    return TRUE;
+}
+
+// Memorizza gli id di una lista filtrata, saltando le tracce rimosse nel frattempo
+static BOOL snapshot_view(ListSnapshot* snapshot, MP3Library* library, const TrackView* view) {
+    if (view->count > 0) {
+        TrackId* ids = (TrackId*)MEM_REALLOC_TAGGED(snapshot->ids, view->count * sizeof(TrackId), MEM_CAT_FILTER);
+        if (!ids) {
+            return FALSE;
+        }
+        snapshot->ids = ids;
+    }
+    
+    // Risolve gli id a pagine, senza copiare i record
+    MP3File* page[TRACK_VIEW_PAGE_SIZE];
+    int count = 0;
+    for (int first = 0; first < view->count; first += TRACK_VIEW_PAGE_SIZE) {
+        int resolved = track_view_page(library, view, first, TRACK_VIEW_PAGE_SIZE, page);
+        for (int i = 0; i < resolved; i++) {
+            snapshot->ids[count++] = page[i]->id;
+        }
+    }
+    
+    snapshot->count = count;
+    snapshot->valid = TRUE;
+    return TRUE;
+}
+
+// Memorizza gli id della lista principale, nell'ordine della vista se ce n'è una.
+// La vista segue le scansioni, quindi basta ricollegare la lista (O(n), senza confronti).
+// Il lock tiene fuori il thread di scansione finché la lista è stata letta.
+static BOOL snapshot_library(ListSnapshot* snapshot, MP3Library* library, SortedView* view) {
+    library_lock(library);
+    if (view) {
+        if (!view->valid) {
+            sorted_view_rebuild(view, NULL);
+        }
+        sorted_view_relink(view);
+    }
+    BOOL snapshot_ok = snapshot_list(snapshot, library->all_files);
+    library_unlock(library);
+    return snapshot_ok;
+}
+
+// Mostra le informazioni dettagliate di un file
+static void print_file_info(MP3File* selected_file) {
+    printf("\nDetailed information:\n");
+    printf("Id: %016llx\n", (unsigned long long)selected_file->id);
+    printf("Title: %s\n", selected_file->metadata.title[0] ? selected_file->metadata.title : "Unknown");
+    printf("Artist: %s\n", selected_file->metadata.artist[0] ? selected_file->metadata.artist : "Unknown");
+    printf("Album: %s\n", selected_file->metadata.album[0] ? selected_file->metadata.album : "Unknown");
+    printf("Year: %d\n", selected_file->metadata.year);
+    printf("Genre: %s\n", selected_file->metadata.genre[0] ? selected_file->metadata.genre : "Unknown");
+    printf("Track: %d\n", selected_file->metadata.track_number);
+    char* filepath = mp3_file_dup_path(selected_file);
+    printf("Path: %s\n", filepath ? filepath : selected_file->filename);
+    MEM_FREE(filepath);
+    
+    if (selected_file->metadata.album_art_size > 0) {
+        // Corregge il formato di printf per size_t
+        printf("Album image: Present (%lu bytes", (unsigned long)selected_file->metadata.album_art_size);
+        
+        // Aggiungi informazioni sul tipo di immagine
+        const char* img_format = "Sconosciuto";
+        switch (selected_file->metadata.album_art_format) {
+            case ALBUM_ART_JPEG:
+                img_format = "JPEG";
+                break;
+            case ALBUM_ART_PNG:
+                img_format = "PNG";
+                break;
+            case ALBUM_ART_OTHER:
+                img_format = "Altro";
+                break;
+        }
+        
+        // Tipo di immagine (nel frame APIC)
+        const char* img_type = "Altro";
+        if (selected_file->metadata.album_art_type == 3) {
+            img_type = "Copertina";
+        } else if (selected_file->metadata.album_art_type == 4) {
+            img_type = "Retro copertina";
+        }
+        
+        printf(", %s, %s)\n", img_format, img_type);
+    } else {
+        printf("Album image: Not present\n");
+    }
+}
+
 int main(int argc, char* argv[]) {
     // Initialize memory tracking system
     mem_init();
@@ -39,6 +198,9 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
+    // Se la categoria delle copertine supera il budget (comando memcat) le immagini vengono scaricate
+    library_set_art_eviction(library, TRUE);
+    
     printf("Scanning directory: %s\n", library_path);
     
     // Scansione iniziale della directory
@@ -55,20 +217,42 @@ int main(int argc, char* argv[]) {
     printf("  monitor [interval] - Start continuous background scanning (interval in seconds, default: 60)\n");
     printf("  stop - Stop continuous scanning\n");
     printf("  list - Show all detected MP3 files\n");
-    printf("  info [number] - Show detailed information about an MP3 file\n");
-    printf("  sort [criterion] - Sort MP3 files (title, artist, album, year, genre, track)\n");
-    printf("  filter [type] [text] - Filter MP3 files (title, artist, album, genre, year)\n");
+    printf("  info [number|#id] - Show detailed information about an MP3 file\n");
+    printf("  sort [keys] [exact] - Sort MP3 files by a key list such as artist,album,disc,track\n");
+    printf("                        (title, artist, album, year, genre, track, disc, duration; -key = descending)\n");
+    printf("  filter [explain] [query] - Filter MP3 files, e.g. artist:queen AND year:1975..1980 AND NOT genre:live\n");
+    printf("                             (title, artist, album, genre, any; year, track, disc, duration ranges;\n");
+    printf("                             field~text finds text anywhere in a field, ignoring case)\n");
+    printf("  search [field] [words] - Find tracks matching all the words, also partially or with typos\n");
     printf("  reset - Reset display to complete list\n");
     printf("  gui - Start graphical interface\n");
     printf("  memstat - Show memory statistics\n");
+    printf("  memcat [category budget_kb] - Show memory by subsystem or set a category budget (0 = none)\n");
+    printf("  folder [path] - Count the tracks in a folder and its subfolders\n");
+    printf("  rmfolder [path] - Remove a folder and its subfolders from the library\n");
+    printf("  dupes [threads] - Find duplicate tracks by audio content (ignores ID3 tags)\n");
+    printf("  bench [name|list] [tracks] - Run benchmarks on a synthetic library\n");
     printf("  quit - Exit program\n");
     
     char input[MAX_PATH_LENGTH];
     char command[20];
     char param[MAX_PATH_LENGTH - 20];
     char param2[MAX_PATH_LENGTH - 20];
-    MP3File* filtered_list = NULL;
+    TrackView filtered; // id delle tracce dell'ultimo filtro (nessuna copia dei record)
     BOOL using_filtered_list = FALSE;
+    track_view_init(&filtered);
+    
+    // Ultimo filtro applicato: un filtro che lo restringe riesamina solo le sue tracce
+    FilterQuery* last_filter = NULL;
+    BOOL filter_reusable = FALSE;
+    UINT32 filter_changes = 0;
+    
+    // Sessione di ricerca: una ricerca che estende la precedente ne riusa i risultati
+    SearchSession* search = NULL;
+    ListSnapshot listed = { NULL, 0, FALSE };
+    
+    // Vista ordinata della libreria creata dall'ultimo "sort" sulla lista completa
+    SortedView* view = NULL;
     
     while (1) {
         printf("\n> ");
@@ -106,19 +290,12 @@ int main(int argc, char* argv[]) {
             printf("Scanning: %s\n", scan_path);
             int new_files = scan_directory(library, scan_path, TRUE);
             printf("Found %d MP3 files.\n", new_files);
+            listed.valid = FALSE;
             
             // Reset della lista filtrata
-            if (filtered_list) {
-                // Liberiamo solo la memoria dei nodi, non i file stessi
-                MP3File* current = filtered_list;
-                while (current) {
-                    MP3File* next = current->next;
-                    MEM_FREE(current);
-                    current = next;
-                }
-                filtered_list = NULL;
-                using_filtered_list = FALSE;
-            }
+            track_view_clear(&filtered);
+            using_filtered_list = FALSE;
+            filter_reusable = FALSE;
         } 
         else if (strcmp(command, "monitor") == 0) {
             if (continuous_scan_active) {
@@ -169,25 +346,28 @@ int main(int argc, char* argv[]) {
             }
         }
         else if (strcmp(command, "list") == 0) {
-            MP3File* list_to_show = using_filtered_list ? filtered_list : library->all_files;
-            int total_files = 0;
+            // Memorizza gli id da mostrare, usati anche dal comando "info"
+            BOOL snapshot_ok = using_filtered_list ? snapshot_view(&listed, library, &filtered)
+                                                   : snapshot_library(&listed, library, view);
+            if (!snapshot_ok) {
+                printf("Memory error.\n");
+                continue;
+            }
             
             printf("\nMP3 Files%s:\n", using_filtered_list ? " (filtered)" : "");
-            MP3File* current = list_to_show;
-            int index = 1;
-            
-            while (current) {
-                printf("%d. %s - %s\n", index++, 
+            for (int i = 0; i < listed.count; i++) {
+                MP3File* current = library_get_track(library, listed.ids[i]);
+                if (!current) continue;
+                
+                printf("%d. %s - %s\n", i + 1, 
                        current->metadata.artist[0] ? current->metadata.artist : "Artista sconosciuto", 
                        current->metadata.title[0] ? current->metadata.title : "Titolo sconosciuto");
-                current = current->next;
-                total_files++;
             }
             
-            if (total_files == 0) {
+            if (listed.count == 0) {
                 printf("No MP3 files found.\n");
             } else {
-                printf("Total: %d files.\n", total_files);
+                printf("Total: %d files.\n", listed.count);
             }
         }
         else if (strcmp(command, "info") == 0) {
@@ -196,197 +376,220 @@ int main(int argc, char* argv[]) {
                 continue;
             }
             
+            // "info #<id>" cerca direttamente per id
+            if (param[0] == '#') {
+                TrackId id = (TrackId)_strtoui64(param + 1, NULL, 16);
+                MP3File* selected_file = library_get_track(library, id);
+                if (!selected_file) {
+                    printf("No file with id %s in the library.\n", param + 1);
+                    continue;
+                }
+                print_file_info(selected_file);
+                continue;
+            }
+            
             int index = atoi(param);
             if (index <= 0) {
                 printf("Invalid number.\n");
                 continue;
             }
             
-            MP3File* list_to_show = using_filtered_list ? filtered_list : library->all_files;
-            
-            // Creiamo un array temporaneo di puntatori per mappare l'indice visualizzato al file reale
-            // Questo garantisce che l'indice corrisponda esattamente a quello visualizzato nel comando "list"
-            int total_files = 0;
-            MP3File* current = list_to_show;
-            while (current) {
-                total_files++;
-                current = current->next;
+            // L'indice si riferisce all'ultima lista mostrata; se non c'è, la fotografiamo ora
+            if (!listed.valid) {
+                BOOL snapshot_ok = using_filtered_list ? snapshot_view(&listed, library, &filtered)
+                                                       : snapshot_library(&listed, library, view);
+                if (!snapshot_ok) {
+                    printf("Memory error.\n");
+                    continue;
+                }
             }
             
-            if (total_files == 0) {
+            if (listed.count == 0) {
                 printf("No MP3 files found.\n");
                 continue;
             }
             
-            if (index > total_files) {
-                printf("Invalid number. There are only %d files.\n", total_files);
+            if (index > listed.count) {
+                printf("Invalid number. There are only %d files.\n", listed.count);
                 continue;
             }
             
-            // Alloca l'array di puntatori
-            MP3File** file_array = (MP3File**)malloc(total_files * sizeof(MP3File*));
-            if (!file_array) {
-                printf("Memory error.\n");
+            // Risolve l'id: il file potrebbe essere stato rimosso da una scansione in background
+            MP3File* selected_file = library_get_track(library, listed.ids[index - 1]);
+            if (!selected_file) {
+                printf("File %d is no longer in the library. Use \"list\" to refresh.\n", index);
                 continue;
             }
             
-            // Riempi l'array nello stesso ordine del comando list
-            current = list_to_show;
-            for (int i = 0; i < total_files; i++) {
-                file_array[i] = current;
-                current = current->next;
-            }
-            
-            // Accedi direttamente al file utilizzando l'indice dell'array (con indice base 1)
-            MP3File* selected_file = file_array[index - 1];
-            
-            // Visualizza le informazioni
-            printf("\nDetailed information:\n");
-            printf("Title: %s\n", selected_file->metadata.title[0] ? selected_file->metadata.title : "Unknown");
-            printf("Artist: %s\n", selected_file->metadata.artist[0] ? selected_file->metadata.artist : "Unknown");
-            printf("Album: %s\n", selected_file->metadata.album[0] ? selected_file->metadata.album : "Unknown");
-            printf("Year: %d\n", selected_file->metadata.year);
-            printf("Genre: %s\n", selected_file->metadata.genre[0] ? selected_file->metadata.genre : "Unknown");
-            printf("Track: %d\n", selected_file->metadata.track_number);
-            printf("Path: %s\n", selected_file->filepath);
-            
-            if (selected_file->metadata.album_art_size > 0) {
-                // Corregge il formato di printf per size_t
-                printf("Album image: Present (%lu bytes", (unsigned long)selected_file->metadata.album_art_size);
-                
-                // Aggiungi informazioni sul tipo di immagine
-                const char* img_format = "Sconosciuto";
-                switch (selected_file->metadata.album_art_format) {
-                    case ALBUM_ART_JPEG:
-                        img_format = "JPEG";
-                        break;
-                    case ALBUM_ART_PNG:
-                        img_format = "PNG";
-                        break;
-                    case ALBUM_ART_OTHER:
-                        img_format = "Altro";
-                        break;
-                }
-                
-                // Tipo di immagine (nel frame APIC)
-                const char* img_type = "Altro";
-                if (selected_file->metadata.album_art_type == 3) {
-                    img_type = "Copertina";
-                } else if (selected_file->metadata.album_art_type == 4) {
-                    img_type = "Retro copertina";
-                }
-                
-                printf(", %s, %s)\n", img_format, img_type);
-            } else {
-                printf("Album image: Not present\n");
-            }
-            
-            // Libera la memoria dell'array temporaneo
-            free(file_array);
+            print_file_info(selected_file);
         }
         else if (strcmp(command, "sort") == 0) {
             if (param[0] == '\0') {
-                printf("Specify sorting criterion (title, artist, album, year, genre, track).\n");
+                printf("Specify sorting keys, e.g. \"artist,album,disc,track\" (title, artist, album, year, genre, track, disc, duration; -key for descending).\n");
                 continue;
             }
             
-            int sort_type = SORT_BY_TITLE; // Default
-            
-            if (strcmp(param, "title") == 0) {
-                sort_type = SORT_BY_TITLE;
-            } else if (strcmp(param, "artist") == 0) {
-                sort_type = SORT_BY_ARTIST;
-            } else if (strcmp(param, "album") == 0) {
-                sort_type = SORT_BY_ALBUM;
-            } else if (strcmp(param, "year") == 0) {
-                sort_type = SORT_BY_YEAR;
-            } else if (strcmp(param, "genre") == 0) {
-                sort_type = SORT_BY_GENRE;
-            } else if (strcmp(param, "track") == 0) {
-                sort_type = SORT_BY_TRACK;
-            } else {
+            // Elenco di chiavi separate da virgola; "exact" confronta i tag byte per byte
+            SortSpec spec;
+            sort_spec_init(&spec, SORT_DEFAULT_FLAGS);
+            if (!sort_spec_parse(&spec, param)) {
                 printf("Invalid sorting criterion.\n");
                 continue;
             }
+            if (strcmp(param2, "exact") == 0) {
+                spec.flags = SORT_BYTE_ORDER;
+            } else if (param2[0] != '\0') {
+                printf("Unknown sort option '%s' (use \"exact\").\n", param2);
+                continue;
+            }
             
             printf("Sorting by %s...\n", param);
             
-            // Ordina la lista principale o la lista filtrata
-            MP3File** list_to_sort = using_filtered_list ? &filtered_list : &library->all_files;
-            sort_mp3_files(list_to_sort, sort_type);
+            // Ordina la lista filtrata, oppure crea una vista ordinata della libreria che
+            // le scansioni aggiornano senza riordinare
+            // (le liste grandi vengono ordinate a blocchi su tutti i processori)
+            ThreadPool* pool = library->total_files >= SORT_PARALLEL_THRESHOLD ? thread_pool_create(0) : NULL;
+            BOOL sorted;
+            if (using_filtered_list) {
+                sorted = track_view_sort(library, &filtered, &spec, pool);
+            } else {
+                sorted_view_free(view);
+                view = sorted_view_create(library, &spec, pool);
+                sorted = view != NULL;
+            }
+            thread_pool_free(pool);
+            if (!sorted) {
+                printf("Not enough memory to sort.\n");
+                continue;
+            }
+            listed.valid = FALSE;
             
             printf("Sorting completed.\n");
         }
         else if (strcmp(command, "filter") == 0) {
-            if (param[0] == '\0') {
-                printf("Specify filter type (title, artist, album, genre, year).\n");
+            // Interrogazione sul resto della riga, "explain" davanti mostra anche il piano scelto
+            const char* text = input + strlen(command);
+            while (*text == ' ') {
+                text++;
+            }
+            BOOL explain = strncmp(text, "explain ", 8) == 0;
+            if (explain) {
+                text += 8;
+                while (*text == ' ') {
+                    text++;
+                }
+            }
+            if (*text == '\0') {
+                printf("Specify a filter, e.g. artist:queen AND year:1975..1980 AND NOT genre:live\n");
                 continue;
             }
             
-            if (param2[0] == '\0') {
-                printf("Specify filter text.\n");
-                continue;
+            char legacy[MAX_PATH_LENGTH];
+            if (legacy_filter_query(text, legacy, sizeof(legacy))) {
+                text = legacy;
             }
             
-            MP3Filter filter;
-            strncpy(filter.filter_text, param2, MAX_FILTER_LENGTH - 1);
-            filter.filter_text[MAX_FILTER_LENGTH - 1] = '\0';
-            
-            if (strcmp(param, "title") == 0) {
-                filter.filter_type = FILTER_BY_TITLE;
-            } else if (strcmp(param, "artist") == 0) {
-                filter.filter_type = FILTER_BY_ARTIST;
-            } else if (strcmp(param, "album") == 0) {
-                filter.filter_type = FILTER_BY_ALBUM;
-            } else if (strcmp(param, "genre") == 0) {
-                filter.filter_type = FILTER_BY_GENRE;
-            } else if (strcmp(param, "year") == 0) {
-                filter.filter_type = FILTER_BY_YEAR;
-            } else {
-                printf("Invalid filter type.\n");
+            char error[FILTER_QUERY_ERROR_MAX];
+            FilterQuery* query = filter_query_parse(text, error, sizeof(error));
+            if (!query) {
+                printf("Invalid filter: %s.\n", error);
                 continue;
             }
             
-            printf("Filtering by %s = '%s'...\n", param, param2);
+            printf("Filtering by %s...\n", text);
+            
+            // Se il filtro restringe il precedente e la libreria non è cambiata basta
+            // riesaminare le tracce già trovate, altrimenti decide il pianificatore
+            BOOL refine = !explain && filter_reusable && using_filtered_list && library->changes == filter_changes &&
+                          filter_query_narrows(query, last_filter);
+            BenchTimer timer;
+            bench_timer_start(&timer);
+            int count = refine ? filter_query_refine(query, library, &filtered)
+                               : filter_query_run(query, library, &filtered);
+            double elapsed = bench_timer_elapsed_ms(&timer);
+            listed.valid = FALSE;
+            if (count < 0) {
+                printf("Memory error.\n");
+                filter_query_free(query);
+                track_view_clear(&filtered);
+                using_filtered_list = FALSE;
+                filter_reusable = FALSE;
+                continue;
+            }
             
-            // Libera la lista filtrata precedente
-            if (filtered_list) {
-                MP3File* current = filtered_list;
-                while (current) {
-                    MP3File* next = current->next;
-                    MEM_FREE(current);
-                    current = next;
-                }
-                filtered_list = NULL;
+            if (explain) {
+                char plan[4096];
+                filter_query_explain(query, plan, sizeof(plan));
+                printf("%sRan in %.2f ms.\n", plan, elapsed);
             }
             
-            // Applica il nuovo filtro
-            filtered_list = filter_mp3_files(library, &filter);
             using_filtered_list = TRUE;
+            filter_query_free(last_filter);
+            last_filter = query;
+            filter_reusable = TRUE;
+            filter_changes = library->changes;
             
-            // Conta i risultati
-            int count = 0;
-            MP3File* current = filtered_list;
-            while (current) {
-                count++;
-                current = current->next;
+            printf("Found %d matching files%s.\n", count, refine ? " (refined from the previous filter)" : "");
+        }
+        else if (strcmp(command, "search") == 0) {
+            // Campo opzionale seguito dalle parole da cercare (resto della riga)
+            const char* words = input + strlen(command);
+            while (*words == ' ') {
+                words++;
+            }
+            
+            int field = text_field_from_name(param);
+            if (field >= 0 && param2[0] != '\0') {
+                words = param2;
+            } else {
+                field = TEXT_FIELD_ANY;
+            }
+            if (*words == '\0') {
+                printf("Specify the words to search for.\n");
+                continue;
+            }
+            
+            // Indice invertito con trigrammi: parole esatte e parti di parola, errori di battitura
+            // se non c'è altro, risultati migliori per primi. Una ricerca che estende la
+            // precedente ("pink f" dopo "pink") riesamina solo i risultati già trovati.
+            if (search && search->field != field) {
+                search_session_free(search);
+                search = NULL;
+            }
+            if (!search) {
+                search = search_session_create(library, field, TEXT_MATCH_SUBSTRING | TEXT_MATCH_FUZZY, FALSE, NULL, NULL);
             }
             
-            printf("Found %d matching files.\n", count);
+            int refined = search ? search->refined : 0;
+            int count = -1;
+            if (search && search_session_update(search, words) != 0 &&
+                track_view_reserve(&filtered, search->results.tracks.count > 0 ? search->results.tracks.count : 1)) {
+                count = search->results.tracks.count;
+                if (count > 0) {
+                    memcpy(filtered.ids, search->results.tracks.ids, count * sizeof(TrackId));
+                }
+                filtered.count = count;
+            }
+            listed.valid = FALSE;
+            filter_reusable = FALSE;
+            if (count < 0) {
+                printf("Memory error.\n");
+                track_view_clear(&filtered);
+                using_filtered_list = FALSE;
+                continue;
+            }
+            using_filtered_list = TRUE;
+            
+            printf("Found %d matching files%s.\n", count,
+                   search->refined > refined ? " (refined from the previous search)" : "");
         }
         else if (strcmp(command, "reset") == 0) {
             // Ripristina la visualizzazione alla lista completa
-            if (filtered_list) {
-                MP3File* current = filtered_list;
-                while (current) {
-                    MP3File* next = current->next;
-                    MEM_FREE(current);
-                    current = next;
-                }
-                filtered_list = NULL;
-            }
+            track_view_clear(&filtered);
             using_filtered_list = FALSE;
+            filter_reusable = FALSE;
             printf("Filter removed. All files will be displayed.\n");
+            listed.valid = FALSE;
         }
         else if (strcmp(command, "gui") == 0) {
             printf("Starting graphical interface...\n");
@@ -406,20 +609,84 @@ int main(int argc, char* argv[]) {
             
             // Ripristina la modalità di visualizzazione
             using_filtered_list = FALSE;
-            if (filtered_list) {
-                MP3File* current = filtered_list;
-                while (current) {
-                    MP3File* next = current->next;
-                    MEM_FREE(current);
-                    current = next;
-                }
-                filtered_list = NULL;
+            filter_reusable = FALSE;
+            listed.valid = FALSE;
+            track_view_clear(&filtered);
+        }
+        else if (strcmp(command, "folder") == 0 || strcmp(command, "rmfolder") == 0) {
+            // Il percorso è il resto della riga (può contenere spazi)
+            const char* folder = input + strlen(command);
+            while (*folder == ' ') {
+                folder++;
+            }
+            if (*folder == '\0') {
+                printf("Specify a folder.\n");
+                continue;
+            }
+            
+            if (strcmp(command, "folder") == 0) {
+                printf("%d tracks in %s\n", library_count_in_folder(library, folder), folder);
+                continue;
+            }
+            
+            // La lista filtrata contiene solo id: le tracce rimosse vengono saltate
+            listed.valid = FALSE;
+            
+            int removed = library_remove_folder(library, folder);
+            printf("Removed %d tracks from the library.\n", removed);
+        }
+        else if (strcmp(command, "dupes") == 0) {
+            // Cerca le copie dello stesso brano confrontando il contenuto audio (senza tag ID3)
+            int thread_count = param[0] != '\0' ? atoi(param) : 0;
+            ThreadPool* pool = thread_pool_create(thread_count);
+            
+            printf("Searching for duplicates among %d files...\n", library->total_files);
+            DuplicateReport* report = find_duplicate_tracks(library, pool);
+            thread_pool_free(pool);
+            
+            if (!report) {
+                printf("Memory error.\n");
+                continue;
+            }
+            
+            print_duplicate_report(report, library);
+            free_duplicate_report(report);
+        }
+        else if (strcmp(command, "bench") == 0) {
+            // Esegue i benchmark su una libreria sintetica (non tocca quella caricata)
+            if (strcmp(param, "list") == 0) {
+                bench_list();
+                continue;
+            }
+            
+            int track_count = param2[0] != '\0' ? atoi(param2) : 0;
+            if (!run_benchmark(param, track_count)) {
+                printf("Unknown benchmark: %s\n", param);
+                bench_list();
             }
         }
         else if (strcmp(command, "memstat") == 0) {
             // Display memory statistics
             mem_report();
         }
+        else if (strcmp(command, "memcat") == 0) {
+            // Imposta il budget di una categoria, se richiesto, poi mostra la tabella
+            if (param[0] != '\0') {
+                MemCategory category = mem_find_category(param);
+                if (category == MEM_CATEGORY_COUNT || param2[0] == '\0') {
+                    printf("Usage: memcat [category budget_kb]\nCategories:");
+                    for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+                        printf(" %s", mem_category_name((MemCategory)i));
+                    }
+                    printf("\n");
+                    continue;
+                }
+                
+                mem_set_budget(category, (size_t)atoi(param2) * 1024);
+            }
+            
+            mem_report_categories();
+        }
         else if (strcmp(command, "quit") == 0) {
             // Ferma la scansione continua se attiva
             if (continuous_scan_active) {
@@ -427,16 +694,6 @@ int main(int argc, char* argv[]) {
                 stop_continuous_scan();
             }
             
-            // Libera la lista filtrata
-            if (filtered_list) {
-                MP3File* current = filtered_list;
-                while (current) {
-                    MP3File* next = current->next;
-                    MEM_FREE(current);
-                    current = next;
-                }
-            }
-            
             break;
         }
         else {
@@ -445,6 +702,12 @@ int main(int argc, char* argv[]) {
     }
     
     // Pulizia della memoria
+    MEM_FREE(listed.ids);
+    track_view_free(&filtered);
+    filter_query_free(last_filter);
+    search_session_free(search);
+    sorted_view_free(view);
+    library_set_art_eviction(library, FALSE);
     free_mp3_library(library);
     
     // Final memory report to check for leaks
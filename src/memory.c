@@ -9,6 +9,7 @@ typedef struct MemoryRecord {
     size_t size;
     const char* file;
     int line;
+    MemCategory category;
     struct MemoryRecord* next;
 } MemoryRecord;
 
@@ -18,6 +19,16 @@ static MemoryStats g_memory_stats = {0};
 static CRITICAL_SECTION g_memory_lock;
 static BOOL g_memory_initialized = FALSE;
 
+// Category names, in MemCategory order
+static const char* g_category_names[MEM_CATEGORY_COUNT] = {
+    "general", "library", "index", "art", "playlist", "queue", "filter", "gui"
+};
+
+// Eviction hooks for categories with a budget
+static MemEvictHook g_evict_hooks[MEM_CATEGORY_COUNT];
+static void* g_evict_contexts[MEM_CATEGORY_COUNT];
+static BOOL g_evicting[MEM_CATEGORY_COUNT];
+
 // Initialize memory tracking system
 void mem_init(void) {
     if (!g_memory_initialized) {
@@ -61,9 +72,41 @@ void mem_shutdown(void) {
     printf("Memory tracking system shut down\n");
 }
 
+// Run the eviction hook of a category over its budget (called with the lock held).
+// Returns the hook to call once the lock is released, or NULL.
+static MemEvictHook check_budget(MemCategory category, size_t* excess, void** context) {
+    MemoryCategoryStats* stats = &g_memory_stats.categories[category];
+    
+    if (stats->budget == 0 || stats->allocated <= stats->budget ||
+        !g_evict_hooks[category] || g_evicting[category]) {
+        return NULL;
+    }
+    
+    // The hook frees memory of its own category, so it must not re-enter itself
+    g_evicting[category] = TRUE;
+    stats->evictions++;
+    *excess = stats->allocated - stats->budget;
+    *context = g_evict_contexts[category];
+    return g_evict_hooks[category];
+}
+
+// Call an eviction hook outside the lock
+static void run_evict_hook(MemEvictHook hook, MemCategory category, size_t excess, void* context) {
+    hook(category, excess, context);
+    
+    EnterCriticalSection(&g_memory_lock);
+    g_evicting[category] = FALSE;
+    LeaveCriticalSection(&g_memory_lock);
+}
+
 // Add a memory allocation record
-static void add_memory_record(void* address, size_t size, const char* file, int line) {
+static void add_memory_record(void* address, size_t size, MemCategory category, const char* file, int line) {
     if (!g_memory_initialized) mem_init();
+    if (category < 0 || category >= MEM_CATEGORY_COUNT) category = MEM_CAT_GENERAL;
+    
+    MemEvictHook hook = NULL;
+    size_t excess = 0;
+    void* context = NULL;
     
     EnterCriticalSection(&g_memory_lock);
     
@@ -74,6 +117,7 @@ static void add_memory_record(void* address, size_t size, const char* file, int
         record->size = size;
         record->file = file;
         record->line = line;
+        record->category = category;
         record->next = g_memory_records;
         g_memory_records = record;
         
@@ -85,13 +129,26 @@ static void add_memory_record(void* address, size_t size, const char* file, int
         if (g_memory_stats.total_allocated > g_memory_stats.peak_allocated) {
             g_memory_stats.peak_allocated = g_memory_stats.total_allocated;
         }
+        
+        MemoryCategoryStats* stats = &g_memory_stats.categories[category];
+        stats->allocated += size;
+        stats->alloc_count++;
+        if (stats->allocated > stats->peak) {
+            stats->peak = stats->allocated;
+        }
+        
+        hook = check_budget(category, &excess, &context);
     }
     
     LeaveCriticalSection(&g_memory_lock);
+    
+    if (hook) {
+        run_evict_hook(hook, category, excess, context);
+    }
 }
 
-// Remove a memory allocation record
-static size_t remove_memory_record(void* address) {
+// Remove a memory allocation record, returning its size and category
+static size_t remove_memory_record(void* address, MemCategory* category) {
     if (!g_memory_initialized) return 0;
     
     size_t size = 0;
@@ -107,11 +164,14 @@ static size_t remove_memory_record(void* address) {
             // Remove it from the list
             *pp = current->next;
             size = current->size;
+            if (category) *category = current->category;
             
             // Update statistics
             g_memory_stats.total_allocated -= size;
             g_memory_stats.alloc_count--;
             g_memory_stats.total_frees++;
+            g_memory_stats.categories[current->category].allocated -= size;
+            g_memory_stats.categories[current->category].alloc_count--;
             
             free(current);
             break;
@@ -126,46 +186,63 @@ static size_t remove_memory_record(void* address) {
 }
 
 // Memory allocation tracking
-void* mem_alloc(size_t size, const char* file, int line) {
+void* mem_alloc_tagged(size_t size, MemCategory category, const char* file, int line) {
     void* ptr = malloc(size);
     
     if (ptr) {
-        add_memory_record(ptr, size, file, line);
+        add_memory_record(ptr, size, category, file, line);
     }
     
     return ptr;
 }
 
-void* mem_calloc(size_t num, size_t size, const char* file, int line) {
+void* mem_calloc_tagged(size_t num, size_t size, MemCategory category, const char* file, int line) {
     void* ptr = calloc(num, size);
     
     if (ptr) {
-        add_memory_record(ptr, num * size, file, line);
+        add_memory_record(ptr, num * size, category, file, line);
     }
     
     return ptr;
 }
 
-void* mem_realloc(void* ptr, size_t size, const char* file, int line) {
+void* mem_alloc(size_t size, const char* file, int line) {
+    return mem_alloc_tagged(size, MEM_CAT_GENERAL, file, line);
+}
+
+void* mem_calloc(size_t num, size_t size, const char* file, int line) {
+    return mem_calloc_tagged(num, size, MEM_CAT_GENERAL, file, line);
+}
+
+void* mem_realloc_tagged(void* ptr, size_t size, MemCategory category, const char* file, int line) {
+    size_t old_size = 0;
+    
     if (ptr) {
-        // Remove the old record
-        remove_memory_record(ptr);
+        // Remove the old record, the new block keeps its category
+        old_size = remove_memory_record(ptr, &category);
     }
     
     void* new_ptr = realloc(ptr, size);
     
     if (new_ptr) {
-        add_memory_record(new_ptr, size, file, line);
+        add_memory_record(new_ptr, size, category, file, line);
+    } else if (ptr && old_size > 0) {
+        // The old block is still valid
+        add_memory_record(ptr, old_size, category, file, line);
     }
     
     return new_ptr;
 }
 
+void* mem_realloc(void* ptr, size_t size, const char* file, int line) {
+    return mem_realloc_tagged(ptr, size, MEM_CAT_GENERAL, file, line);
+}
+
 void mem_free(void* ptr, const char* file, int line) {
     if (!ptr) return;
     
     // Remove the record
-    size_t size = remove_memory_record(ptr);
+    size_t size = remove_memory_record(ptr, NULL);
     
     if (size == 0) {
         // This might be a double-free or freeing unallocated memory
@@ -175,11 +252,11 @@ void mem_free(void* ptr, const char* file, int line) {
     free(ptr);
 }
 
-char* mem_strdup(const char* str, const char* file, int line) {
+char* mem_strdup_tagged(const char* str, MemCategory category, const char* file, int line) {
     if (!str) return NULL;
     
     size_t size = strlen(str) + 1;
-    char* new_str = (char*)mem_alloc(size, file, line);
+    char* new_str = (char*)mem_alloc_tagged(size, category, file, line);
     
     if (new_str) {
         memcpy(new_str, str, size);
@@ -188,6 +265,10 @@ char* mem_strdup(const char* str, const char* file, int line) {
     return new_str;
 }
 
+char* mem_strdup(const char* str, const char* file, int line) {
+    return mem_strdup_tagged(str, MEM_CAT_GENERAL, file, line);
+}
+
 // Generate memory usage report
 void mem_report(void) {
     if (!g_memory_initialized) return;
@@ -201,6 +282,13 @@ void mem_report(void) {
     printf("  Total allocations:   %u\n", g_memory_stats.total_allocs);
     printf("  Total frees:         %u\n", g_memory_stats.total_frees);
     
+    for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+        if (g_memory_stats.categories[i].peak > 0) {
+            printf("  %-20s %zu bytes (peak %zu)\n", g_category_names[i],
+                   g_memory_stats.categories[i].allocated, g_memory_stats.categories[i].peak);
+        }
+    }
+    
     // Uncomment to print detailed allocation records
     /*
     if (g_memory_stats.alloc_count > 0) {
@@ -228,4 +316,72 @@ MemoryStats mem_get_stats(void) {
     }
     
     return stats;
-} 
\ No newline at end of file
+}
+
+// Get the name of a category
+const char* mem_category_name(MemCategory category) {
+    if (category < 0 || category >= MEM_CATEGORY_COUNT) return "unknown";
+    return g_category_names[category];
+}
+
+// Find a category by name, returns MEM_CATEGORY_COUNT if unknown
+MemCategory mem_find_category(const char* name) {
+    if (!name) return MEM_CATEGORY_COUNT;
+    
+    for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+        if (_stricmp(name, g_category_names[i]) == 0) {
+            return (MemCategory)i;
+        }
+    }
+    
+    return MEM_CATEGORY_COUNT;
+}
+
+// Print a per category table with budgets
+void mem_report_categories(void) {
+    MemoryStats stats = mem_get_stats();
+    
+    printf("%-10s %12s %12s %10s %12s %9s\n", "Category", "Current", "Peak", "Blocks", "Budget", "Evictions");
+    for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+        MemoryCategoryStats* category = &stats.categories[i];
+        char budget[32] = "-";
+        if (category->budget > 0) {
+            sprintf(budget, "%zu", category->budget);
+        }
+        printf("%-10s %12zu %12zu %10u %12s %9u\n", g_category_names[i], category->allocated,
+               category->peak, category->alloc_count, budget, category->evictions);
+    }
+    printf("%-10s %12zu %12zu %10u\n", "total", stats.total_allocated, stats.peak_allocated, stats.alloc_count);
+}
+
+// Set a soft budget for a category (0 removes it). Going over the budget never
+// makes an allocation fail, it only runs the category's eviction hook.
+void mem_set_budget(MemCategory category, size_t budget) {
+    if (category < 0 || category >= MEM_CATEGORY_COUNT) return;
+    if (!g_memory_initialized) mem_init();
+    
+    MemEvictHook hook = NULL;
+    size_t excess = 0;
+    void* context = NULL;
+    
+    EnterCriticalSection(&g_memory_lock);
+    g_memory_stats.categories[category].budget = budget;
+    hook = check_budget(category, &excess, &context);
+    LeaveCriticalSection(&g_memory_lock);
+    
+    // A lower budget applies right away
+    if (hook) {
+        run_evict_hook(hook, category, excess, context);
+    }
+}
+
+// Install the hook called when a category goes over its budget (NULL removes it)
+void mem_set_evict_hook(MemCategory category, MemEvictHook hook, void* context) {
+    if (category < 0 || category >= MEM_CATEGORY_COUNT) return;
+    if (!g_memory_initialized) mem_init();
+    
+    EnterCriticalSection(&g_memory_lock);
+    g_evict_hooks[category] = hook;
+    g_evict_contexts[category] = context;
+    LeaveCriticalSection(&g_memory_lock);
+}
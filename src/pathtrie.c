@@ -0,0 +1,381 @@
+#include "../include/pathtrie.h"
+#include "../include/memory.h"
+
+#define INITIAL_TRIE_CAPACITY 1024
+#define DIR_SLOT_DELETED ((DirNode*)(ULONG_PTR)-1)
+
+static BOOL is_separator(char c) {
+    return c == '\\' || c == '/';
+}
+
+// Hash of a (parent, name) pair, ignoring ASCII case in the name
+static UINT64 child_hash(const DirNode* parent, const char* name, size_t length) {
+    UINT64 hash = 14695981039346656037ULL ^ ((UINT64)(ULONG_PTR)parent * 0x9E3779B97F4A7C15ULL);
+    
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c = (unsigned char)(c - 'A' + 'a');
+        }
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Get the next component of path[0, length), FALSE when there are no more
+static BOOL next_component(const char* path, size_t length, size_t* pos, size_t* start, size_t* component_length) {
+    if (*pos >= length) return FALSE;
+    
+    size_t i = *pos;
+    while (i < length && !is_separator(path[i])) {
+        i++;
+    }
+    
+    *start = *pos;
+    *component_length = i - *pos;
+    *pos = i + 1;
+    return TRUE;
+}
+
+// Insert a node into the table without checking the load factor
+static void table_put(PathTrie* trie, DirNode* node) {
+    int mask = trie->capacity - 1;
+    int slot = (int)(child_hash(node->parent, node->name, node->name_length) & mask);
+    
+    while (trie->slots[slot] && trie->slots[slot] != DIR_SLOT_DELETED) {
+        slot = (slot + 1) & mask;
+    }
+    
+    if (trie->slots[slot] == DIR_SLOT_DELETED) {
+        trie->tombstones--;
+    }
+    trie->slots[slot] = node;
+    trie->count++;
+}
+
+// Make room for one more node, growing the table or dropping tombstones
+static BOOL table_reserve(PathTrie* trie) {
+    if ((trie->count + trie->tombstones + 1) * 4 < trie->capacity * 3) {
+        return TRUE;
+    }
+    
+    int old_capacity = trie->capacity;
+    DirNode** old_slots = trie->slots;
+    int new_capacity = old_capacity;
+    if ((trie->count + 1) * 2 >= old_capacity) {
+        new_capacity *= 2;
+    }
+    
+    DirNode** new_slots = (DirNode**)MEM_CALLOC_TAGGED(new_capacity, sizeof(DirNode*), MEM_CAT_LIBRARY);
+    if (!new_slots) return FALSE;
+    
+    trie->slots = new_slots;
+    trie->capacity = new_capacity;
+    trie->count = 0;
+    trie->tombstones = 0;
+    
+    for (int i = 0; i < old_capacity; i++) {
+        if (old_slots[i] && old_slots[i] != DIR_SLOT_DELETED) {
+            table_put(trie, old_slots[i]);
+        }
+    }
+    
+    MEM_FREE(old_slots);
+    return TRUE;
+}
+
+// Find the child of parent with the given name
+static DirNode* find_child(PathTrie* trie, DirNode* parent, const char* name, size_t length) {
+    int mask = trie->capacity - 1;
+    int slot = (int)(child_hash(parent, name, length) & mask);
+    
+    while (trie->slots[slot]) {
+        DirNode* node = trie->slots[slot];
+        if (node != DIR_SLOT_DELETED && node->parent == parent && node->name_length == length &&
+            _strnicmp(node->name, name, length) == 0) {
+            return node;
+        }
+        slot = (slot + 1) & mask;
+    }
+    
+    return NULL;
+}
+
+// Create a child directory
+static DirNode* add_child(PathTrie* trie, DirNode* parent, const char* name, size_t length) {
+    if (!table_reserve(trie)) return NULL;
+    
+    DirNode* node = (DirNode*)MEM_CALLOC_TAGGED(1, sizeof(DirNode), MEM_CAT_LIBRARY);
+    if (!node) return NULL;
+    
+    node->name = (char*)MEM_ALLOC_TAGGED(length + 1, MEM_CAT_LIBRARY);
+    if (!node->name) {
+        MEM_FREE(node);
+        return NULL;
+    }
+    memcpy(node->name, name, length);
+    node->name[length] = '\0';
+    node->name_length = length;
+    node->path_length = parent == &trie->root ? length : parent->path_length + 1 + length;
+    node->parent = parent;
+    node->next_sibling = parent->children;
+    parent->children = node;
+    
+    table_put(trie, node);
+    trie->node_count++;
+    trie->name_bytes += length + 1;
+    return node;
+}
+
+// Remove an empty directory from its parent and the table
+static void remove_node(PathTrie* trie, DirNode* node) {
+    DirNode** link = &node->parent->children;
+    while (*link && *link != node) {
+        link = &(*link)->next_sibling;
+    }
+    if (*link) {
+        *link = node->next_sibling;
+    }
+    
+    int mask = trie->capacity - 1;
+    int slot = (int)(child_hash(node->parent, node->name, node->name_length) & mask);
+    while (trie->slots[slot]) {
+        if (trie->slots[slot] == node) {
+            trie->slots[slot] = DIR_SLOT_DELETED;
+            trie->count--;
+            trie->tombstones++;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    
+    trie->node_count--;
+    trie->name_bytes -= node->name_length + 1;
+    MEM_FREE(node->name);
+    MEM_FREE(node);
+}
+
+// Create an empty trie
+PathTrie* path_trie_create(void) {
+    PathTrie* trie = (PathTrie*)MEM_CALLOC_TAGGED(1, sizeof(PathTrie), MEM_CAT_LIBRARY);
+    if (!trie) return NULL;
+    
+    trie->slots = (DirNode**)MEM_CALLOC_TAGGED(INITIAL_TRIE_CAPACITY, sizeof(DirNode*), MEM_CAT_LIBRARY);
+    if (!trie->slots) {
+        MEM_FREE(trie);
+        return NULL;
+    }
+    trie->capacity = INITIAL_TRIE_CAPACITY;
+    
+    return trie;
+}
+
+// Free the trie and all its nodes (tracks are not freed)
+void path_trie_free(PathTrie* trie) {
+    if (!trie) return;
+    
+    // Every node except the root is in the table
+    for (int i = 0; i < trie->capacity; i++) {
+        DirNode* node = trie->slots[i];
+        if (node && node != DIR_SLOT_DELETED) {
+            MEM_FREE(node->name);
+            MEM_FREE(node);
+        }
+    }
+    
+    MEM_FREE(trie->slots);
+    MEM_FREE(trie);
+}
+
+// Walk the components of a directory path, optionally creating missing nodes
+static DirNode* lookup_dir(PathTrie* trie, const char* path, size_t length, BOOL create) {
+    if (!trie || !path) return NULL;
+    
+    DirNode* node = &trie->root;
+    size_t pos = 0, start, component_length;
+    
+    while (next_component(path, length, &pos, &start, &component_length)) {
+        DirNode* child = find_child(trie, node, path + start, component_length);
+        if (!child) {
+            if (!create) return NULL;
+            child = add_child(trie, node, path + start, component_length);
+            if (!child) return NULL;
+        }
+        node = child;
+    }
+    
+    return node;
+}
+
+// Find the directory for the first length characters of path (NULL if unknown)
+DirNode* path_trie_find_dir(PathTrie* trie, const char* path, size_t length) {
+    return lookup_dir(trie, path, length, FALSE);
+}
+
+// Same as path_trie_find_dir, creating missing nodes
+DirNode* path_trie_get_dir(PathTrie* trie, const char* path, size_t length) {
+    return lookup_dir(trie, path, length, TRUE);
+}
+
+// Link a track into a directory (file->filename must already be set)
+void path_trie_attach(PathTrie* trie, DirNode* dir, MP3File* file) {
+    if (!trie || !dir || !file) return;
+    
+    file->dir = dir;
+    file->dir_prev = NULL;
+    file->dir_next = dir->files;
+    if (dir->files) {
+        dir->files->dir_prev = file;
+    }
+    dir->files = file;
+    dir->file_count++;
+    
+    for (DirNode* node = dir; node; node = node->parent) {
+        node->subtree_count++;
+    }
+    
+    trie->name_bytes += strlen(file->filename) + 1;
+}
+
+// Unlink a track from its directory, pruning directories left empty
+void path_trie_detach(PathTrie* trie, MP3File* file) {
+    if (!trie || !file || !file->dir) return;
+    
+    DirNode* dir = file->dir;
+    
+    if (file->dir_prev) {
+        file->dir_prev->dir_next = file->dir_next;
+    } else {
+        dir->files = file->dir_next;
+    }
+    if (file->dir_next) {
+        file->dir_next->dir_prev = file->dir_prev;
+    }
+    file->dir = NULL;
+    file->dir_prev = NULL;
+    file->dir_next = NULL;
+    dir->file_count--;
+    
+    for (DirNode* node = dir; node; node = node->parent) {
+        node->subtree_count--;
+    }
+    
+    trie->name_bytes -= strlen(file->filename) + 1;
+    
+    // Drop directories that no longer hold anything
+    while (dir != &trie->root && dir->file_count == 0 && !dir->children) {
+        DirNode* parent = dir->parent;
+        remove_node(trie, dir);
+        dir = parent;
+    }
+}
+
+// Write the full path of a directory into buffer (truncated like snprintf)
+size_t path_trie_format_dir(const DirNode* dir, char* buffer, size_t size) {
+    size_t length = dir ? dir->path_length : 0;
+    if (!buffer || size == 0) return length;
+    
+    // Fill from the end: each node knows where its name starts
+    for (const DirNode* node = dir; node && node->name; node = node->parent) {
+        size_t start = node->path_length - node->name_length;
+        for (size_t i = 0; i < node->name_length && start + i < size - 1; i++) {
+            buffer[start + i] = node->name[i];
+        }
+        if (start > 0 && start - 1 < size - 1) {
+            buffer[start - 1] = '\\';
+        }
+    }
+    
+    buffer[length < size - 1 ? length : size - 1] = '\0';
+    return length;
+}
+
+// Write the full path of a track into buffer (truncated like snprintf)
+size_t path_trie_format(const MP3File* file, char* buffer, size_t size) {
+    if (!file || !file->filename) {
+        if (buffer && size > 0) buffer[0] = '\0';
+        return 0;
+    }
+    
+    const DirNode* dir = file->dir;
+    size_t prefix = (dir && dir->name) ? dir->path_length + 1 : 0;
+    size_t name_length = strlen(file->filename);
+    if (!buffer || size == 0) return prefix + name_length;
+    
+    if (prefix > 0) {
+        path_trie_format_dir(dir, buffer, size);
+        if (prefix - 1 < size - 1) {
+            buffer[prefix - 1] = '\\';
+        }
+    }
+    
+    for (size_t i = 0; i < name_length && prefix + i < size - 1; i++) {
+        buffer[prefix + i] = file->filename[i];
+    }
+    
+    size_t length = prefix + name_length;
+    buffer[length < size - 1 ? length : size - 1] = '\0';
+    return length;
+}
+
+// Next directory in a depth-first walk of the subtree rooted at top (NULL at the end)
+DirNode* path_trie_next_dir(DirNode* top, DirNode* dir, BOOL skip_children) {
+    if (!dir) return NULL;
+    
+    if (!skip_children && dir->children) {
+        return dir->children;
+    }
+    
+    while (dir && dir != top) {
+        if (dir->next_sibling) {
+            return dir->next_sibling;
+        }
+        dir = dir->parent;
+    }
+    
+    return NULL;
+}
+
+// Call fn for every track in a directory and its subdirectories (fn must not modify the trie)
+void path_trie_for_each(DirNode* dir, void (*fn)(MP3File* file, void* context), void* context) {
+    if (!dir || !fn) return;
+    
+    for (DirNode* node = dir; node; node = path_trie_next_dir(dir, node, FALSE)) {
+        for (MP3File* file = node->files; file; file = file->dir_next) {
+            fn(file, context);
+        }
+    }
+}
+
+// Split a path into its leaf name and the length of the directory part
+const char* path_split_name(const char* path, size_t* dir_length) {
+    const char* name = path;
+    
+    for (const char* p = path; *p; p++) {
+        if (is_separator(*p)) {
+            name = p + 1;
+        }
+    }
+    
+    if (dir_length) {
+        *dir_length = (size_t)(name - path);
+    }
+    return name;
+}
+
+// Allocate "dir\name"
+char* path_join(const char* dir, const char* name) {
+    size_t dir_length = strlen(dir);
+    size_t name_length = strlen(name);
+    
+    char* path = (char*)MEM_ALLOC(dir_length + 1 + name_length + 1);
+    if (!path) return NULL;
+    
+    memcpy(path, dir, dir_length);
+    path[dir_length] = '\\';
+    memcpy(path + dir_length + 1, name, name_length + 1);
+    return path;
+}
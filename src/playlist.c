@@ -1,23 +1,46 @@
 #include "../include/playlist.h"
 #include "../include/memory.h"
+#include "../include/threadpool.h"
+#include <ctype.h>
+#include <limits.h>
+#include <io.h>
 
 #define INITIAL_PLAYLIST_CAPACITY 16
 #define INITIAL_MANAGER_CAPACITY 8
+#define INITIAL_MANAGER_SLOTS 16     // Slots of the name and id indexes (a power of 2)
+#define PLAYLIST_STEM_SUFFIX_BYTES 24 // Longest " ~<id>-<n>" added to a file name on a collision
+#define PLAYLIST_STEM_MIN_BYTES 8    // Shortest room left for a name in a file name
 #define PLAYLIST_FILE_EXTENSION ".m3plist"
+#define PLAYLIST_HEADER_BYTES 4096  // Read by playlist_index, enough for any header it writes
+#define PLAYLIST_BINARY_MAGIC "M3PB"
+#define PLAYLIST_BINARY_MAGIC_BYTES 4
+#define PLAYLIST_BINARY_VERSION 1
+#define PLAYLIST_VARINT_BYTES 10    // Longest encoding of a 64-bit value
+#define PLAYLIST_TEMP_EXTENSION ".tmp"
+#define PLAYLIST_LOG_EXTENSION ".log"
+#define PLAYLIST_LOG_MIN_TRACKS 4096 // Smaller playlists are always rewritten whole
+#define PLAYLIST_LOG_MAX_CHANGES 1024 // Edits in a change log before the file is rewritten
 
 // Create a new playlist manager
 PlaylistManager* playlist_manager_create(void) {
-    PlaylistManager* manager = (PlaylistManager*)MEM_ALLOC(sizeof(PlaylistManager));
+    PlaylistManager* manager = (PlaylistManager*)MEM_ALLOC_TAGGED(sizeof(PlaylistManager), MEM_CAT_PLAYLIST);
     if (!manager) return NULL;
     
-    manager->playlists = (Playlist**)MEM_ALLOC(INITIAL_MANAGER_CAPACITY * sizeof(Playlist*));
-    if (!manager->playlists) {
+    manager->playlists = (Playlist**)MEM_ALLOC_TAGGED(INITIAL_MANAGER_CAPACITY * sizeof(Playlist*), MEM_CAT_PLAYLIST);
+    manager->name_slots = (int*)MEM_CALLOC_TAGGED(INITIAL_MANAGER_SLOTS, sizeof(int), MEM_CAT_PLAYLIST);
+    manager->id_slots = (int*)MEM_CALLOC_TAGGED(INITIAL_MANAGER_SLOTS, sizeof(int), MEM_CAT_PLAYLIST);
+    if (!manager->playlists || !manager->name_slots || !manager->id_slots) {
+        MEM_FREE(manager->playlists);
+        MEM_FREE(manager->name_slots);
+        MEM_FREE(manager->id_slots);
         MEM_FREE(manager);
         return NULL;
     }
     
     manager->count = 0;
     manager->capacity = INITIAL_MANAGER_CAPACITY;
+    manager->slot_capacity = INITIAL_MANAGER_SLOTS;
+    manager->next_id = 1;
     
     return manager;
 }
@@ -31,50 +54,127 @@ void playlist_manager_free(PlaylistManager* manager) {
         playlist_free(manager->playlists[i]);
     }
     
-    // Free the array and the manager
+    // Free the array, the indexes and the manager
     MEM_FREE(manager->playlists);
+    MEM_FREE(manager->name_slots);
+    MEM_FREE(manager->id_slots);
     MEM_FREE(manager);
 }
 
 // Create a new empty playlist
 Playlist* playlist_create(const char* name, const char* description) {
-    Playlist* playlist = (Playlist*)MEM_ALLOC(sizeof(Playlist));
+    Playlist* playlist = (Playlist*)MEM_ALLOC_TAGGED(sizeof(Playlist), MEM_CAT_PLAYLIST);
     if (!playlist) return NULL;
     
     // Initialize fields
+    playlist->id = INVALID_PLAYLIST_ID;
     strncpy(playlist->name, name ? name : "New Playlist", sizeof(playlist->name) - 1);
     playlist->name[sizeof(playlist->name) - 1] = '\0';
     
     strncpy(playlist->description, description ? description : "", sizeof(playlist->description) - 1);
     playlist->description[sizeof(playlist->description) - 1] = '\0';
     
-    playlist->tracks = (MP3File**)MEM_ALLOC(INITIAL_PLAYLIST_CAPACITY * sizeof(MP3File*));
-    if (!playlist->tracks) {
-        MEM_FREE(playlist);
-        return NULL;
-    }
-    
+    track_seq_init(&playlist->tracks);
     playlist->track_count = 0;
-    playlist->capacity = INITIAL_PLAYLIST_CAPACITY;
+    
+    playlist->missing_ids = NULL;
+    playlist->missing_capacity = 0;
+    string_pool_init(&playlist->missing_paths);
+    
+    playlist->source = NULL;
+    playlist->library = NULL;
+    
+    // Never saved: written whole the first time
+    playlist->file = NULL;
+    playlist->revision = 0;
+    playlist->dirty = TRUE;
+    playlist->changes = NULL;
+    playlist->change_count = -1;
+    playlist->change_capacity = 0;
+    playlist->logged = 0;
+    
+    playlist->history = NULL;
+    playlist->history_count = 0;
+    playlist->history_position = 0;
+    playlist->history_capacity = 0;
+    playlist->history_bytes = 0;
     
     return playlist;
 }
 
-// Ensure the playlist has enough capacity for a new track
-static BOOL ensure_playlist_capacity(Playlist* playlist) {
-    if (playlist->track_count >= playlist->capacity) {
-        int new_capacity = playlist->capacity * 2;
-        MP3File** new_tracks = (MP3File**)MEM_REALLOC(playlist->tracks, new_capacity * sizeof(MP3File*));
+// Remember the path of a track missing from the library
+static BOOL add_missing(Playlist* playlist, TrackId id, const char* path) {
+    int count = (int)playlist->missing_paths.count;
+    if (count == playlist->missing_capacity) {
+        int new_capacity = count > 0 ? count * 2 : INITIAL_PLAYLIST_CAPACITY;
+        TrackId* new_ids = (TrackId*)MEM_REALLOC(playlist->missing_ids, new_capacity * sizeof(TrackId));
         
-        if (!new_tracks) return FALSE;
+        if (!new_ids) return FALSE;
         
-        playlist->tracks = new_tracks;
-        playlist->capacity = new_capacity;
+        playlist->missing_ids = new_ids;
+        playlist->missing_capacity = new_capacity;
     }
     
+    if (!string_pool_append(&playlist->missing_paths, path)) return FALSE;
+    
+    playlist->missing_ids[count] = id;
+    return TRUE;
+}
+
+// Keep a placeholder for a path missing from the library; id is the one to list
+static BOOL add_placeholder(Playlist* playlist, const char* path, TrackId* id) {
+    *id = make_track_id(path);
+    return add_missing(playlist, *id, path);
+}
+
+// Append ids to the tracks
+static BOOL append_tracks(Playlist* playlist, const TrackId* ids, int count) {
+    if (!track_seq_append(&playlist->tracks, ids, count)) return FALSE;
+    
+    playlist->track_count += count;
     return TRUE;
 }
 
+// Append the entries at paths, resolved through the library in one batch; the ones
+// missing from it are kept as placeholders
+static BOOL append_paths(Playlist* playlist, const char* const* paths, int count, MP3Library* library) {
+    if (count <= 0) return TRUE;
+    
+    MP3File** found = (MP3File**)MEM_ALLOC_TAGGED(count * sizeof(MP3File*), MEM_CAT_PLAYLIST);
+    TrackId* ids = (TrackId*)MEM_ALLOC_TAGGED(count * sizeof(TrackId), MEM_CAT_PLAYLIST);
+    BOOL ok = found && ids;
+    
+    // The records are only read for their ids, before a scan can free them
+    library_lock(library);
+    if (ok) {
+        library_find_paths(library, paths, count, found);
+        for (int i = 0; i < count; i++) {
+            ids[i] = found[i] ? found[i]->id : INVALID_TRACK_ID;
+        }
+    }
+    library_unlock(library);
+    for (int i = 0; ok && i < count; i++) {
+        if (!found[i]) {
+            ok = add_placeholder(playlist, paths[i], &ids[i]);
+        }
+    }
+    ok = ok && append_tracks(playlist, ids, count);
+    
+    MEM_FREE(found);
+    MEM_FREE(ids);
+    return ok;
+}
+
+// Placeholder whose path is kept for a track id (NULL if the track is not one)
+static const char* missing_path_of(Playlist* playlist, TrackId id) {
+    for (UINT32 i = 0; i < playlist->missing_paths.count; i++) {
+        if (playlist->missing_ids[i] == id) {
+            return playlist->missing_paths.text + playlist->missing_paths.offsets[i];
+        }
+    }
+    return NULL;
+}
+
 // Ensure the manager has enough capacity for a new playlist
 static BOOL ensure_manager_capacity(PlaylistManager* manager) {
     if (manager->count >= manager->capacity) {
@@ -90,194 +190,1241 @@ static BOOL ensure_manager_capacity(PlaylistManager* manager) {
     return TRUE;
 }
 
+// Load the tracks of an indexed playlist before they are used
+static BOOL ensure_loaded(Playlist* playlist) {
+    return !playlist->source || playlist_materialize(playlist);
+}
+
+// Note an edit for the change log. Past what the log takes, or without a file to log
+// against, the edits are dropped and the next save rewrites the file.
+static void record_change(Playlist* playlist, int kind, int index, int to, int count, TrackId id) {
+    playlist->dirty = TRUE;
+    if (playlist->change_count < 0) return;
+    
+    if (playlist->logged + playlist->change_count >= PLAYLIST_LOG_MAX_CHANGES) {
+        playlist->change_count = -1;
+        return;
+    }
+    
+    if (playlist->change_count == playlist->change_capacity) {
+        int new_capacity = playlist->change_capacity > 0 ? playlist->change_capacity * 2 : INITIAL_PLAYLIST_CAPACITY;
+        PlaylistChange* new_changes = (PlaylistChange*)MEM_REALLOC_TAGGED(playlist->changes,
+                                                                          new_capacity * sizeof(PlaylistChange),
+                                                                          MEM_CAT_PLAYLIST);
+        if (!new_changes) {
+            playlist->change_count = -1;
+            return;
+        }
+        
+        playlist->changes = new_changes;
+        playlist->change_capacity = new_capacity;
+    }
+    
+    PlaylistChange* change = &playlist->changes[playlist->change_count++];
+    change->kind = kind;
+    change->index = index;
+    change->to = to;
+    change->count = count;
+    change->id = id;
+}
+
+// Memory an edit holds
+static size_t edit_bytes(const PlaylistEdit* edit) {
+    size_t bytes = sizeof(PlaylistEdit);
+    if (edit->ids) {
+        bytes += (size_t)edit->count * sizeof(TrackId);
+    }
+    if (edit->kind == PLAYLIST_EDIT_CLEAR) {
+        bytes += (size_t)edit->cleared.count * sizeof(TrackId) +
+                 (size_t)edit->cleared_missing_capacity * sizeof(TrackId) + edit->cleared_missing_paths.capacity +
+                 edit->cleared_missing_paths.entry_capacity * sizeof(UINT32);
+    }
+    return bytes;
+}
+
+static void free_edit(PlaylistEdit* edit) {
+    MEM_FREE(edit->ids);
+    track_seq_free(&edit->cleared);
+    MEM_FREE(edit->cleared_missing_ids);
+    string_pool_free(&edit->cleared_missing_paths);
+}
+
+// Forget the oldest edit kept
+static void drop_oldest_edit(Playlist* playlist) {
+    playlist->history_bytes -= edit_bytes(&playlist->history[0]);
+    free_edit(&playlist->history[0]);
+    playlist->history_count--;
+    playlist->history_position--;
+    memmove(playlist->history, playlist->history + 1, playlist->history_count * sizeof(PlaylistEdit));
+}
+
+// Forget the edits that could be redone
+static void drop_undone_edits(Playlist* playlist) {
+    while (playlist->history_count > playlist->history_position) {
+        PlaylistEdit* edit = &playlist->history[--playlist->history_count];
+        playlist->history_bytes -= edit_bytes(edit);
+        free_edit(edit);
+    }
+}
+
+// Make room for the record of an edit about to be made, so that keeping it cannot fail
+// once the edit is done
+static BOOL reserve_edit(Playlist* playlist) {
+    drop_undone_edits(playlist);
+    if (playlist->history_count == PLAYLIST_UNDO_MAX_EDITS) {
+        drop_oldest_edit(playlist);
+    }
+    
+    if (playlist->history_count == playlist->history_capacity) {
+        int new_capacity = playlist->history_capacity > 0 ? playlist->history_capacity * 2 : INITIAL_PLAYLIST_CAPACITY;
+        PlaylistEdit* new_history = (PlaylistEdit*)MEM_REALLOC_TAGGED(playlist->history,
+                                                                      new_capacity * sizeof(PlaylistEdit),
+                                                                      MEM_CAT_PLAYLIST);
+        if (!new_history) return FALSE;
+        
+        playlist->history = new_history;
+        playlist->history_capacity = new_capacity;
+    }
+    return TRUE;
+}
+
+// Keep the record of an edit just made (after reserve_edit). ids, if any, now belong
+// to the history.
+static PlaylistEdit* push_edit(Playlist* playlist, int kind, int index, int to, int count, TrackId id, TrackId* ids) {
+    PlaylistEdit* edit = &playlist->history[playlist->history_count++];
+    edit->kind = kind;
+    edit->index = index;
+    edit->to = to;
+    edit->count = count;
+    edit->id = id;
+    edit->ids = ids;
+    track_seq_init(&edit->cleared);
+    edit->cleared_missing_ids = NULL;
+    edit->cleared_missing_capacity = 0;
+    string_pool_init(&edit->cleared_missing_paths);
+    playlist->history_position = playlist->history_count;
+    return edit;
+}
+
+// Account for the memory of the newest edit, forgetting the oldest ones past the bound
+static void account_edit(Playlist* playlist) {
+    playlist->history_bytes += edit_bytes(&playlist->history[playlist->history_count - 1]);
+    while (playlist->history_bytes > PLAYLIST_UNDO_MAX_BYTES && playlist->history_count > 1) {
+        drop_oldest_edit(playlist);
+    }
+}
+
+// Forget every edit kept
+void playlist_clear_history(Playlist* playlist) {
+    if (!playlist) return;
+    
+    playlist->history_position = 0;
+    drop_undone_edits(playlist);
+    playlist->history_bytes = 0;
+}
+
+// Insert ids so that the first one ends up at index, noting them for the change log
+static BOOL insert_ids(Playlist* playlist, int index, const TrackId* ids, int count) {
+    if (!track_seq_insert(&playlist->tracks, index, ids, count)) return FALSE;
+    
+    for (int i = 0; i < count; i++) {
+        record_change(playlist, PLAYLIST_CHANGE_ADD, index + i, 0, 1, ids[i]);
+    }
+    playlist->track_count += count;
+    return TRUE;
+}
+
+// Remove count tracks from first on, noting them for the change log
+static void remove_ids(Playlist* playlist, int first, int count) {
+    for (int i = 0; i < count; i++) {
+        record_change(playlist, PLAYLIST_CHANGE_REMOVE, first, 0, 1, INVALID_TRACK_ID);
+    }
+    track_seq_remove(&playlist->tracks, first, count);
+    playlist->track_count -= count;
+}
+
+// Move count tracks from first on to to, noting it for the change log
+static BOOL move_ids(Playlist* playlist, int first, int count, int to) {
+    if (!track_seq_move(&playlist->tracks, first, count, to)) return FALSE;
+    
+    record_change(playlist, PLAYLIST_CHANGE_MOVE, first, to, count, INVALID_TRACK_ID);
+    return TRUE;
+}
+
+// Exchange the tracks and placeholders of the playlist with the ones a clear holds: the
+// whole clear, its undo and its redo, without copying a track
+static void swap_cleared(Playlist* playlist, PlaylistEdit* edit) {
+    TrackSequence tracks = playlist->tracks;
+    playlist->tracks = edit->cleared;
+    edit->cleared = tracks;
+    
+    TrackId* missing_ids = playlist->missing_ids;
+    playlist->missing_ids = edit->cleared_missing_ids;
+    edit->cleared_missing_ids = missing_ids;
+    
+    StringPool missing_paths = playlist->missing_paths;
+    playlist->missing_paths = edit->cleared_missing_paths;
+    edit->cleared_missing_paths = missing_paths;
+    
+    int missing_capacity = playlist->missing_capacity;
+    playlist->missing_capacity = edit->cleared_missing_capacity;
+    edit->cleared_missing_capacity = missing_capacity;
+    
+    int count = playlist->track_count;
+    playlist->track_count = edit->count;
+    edit->count = count;
+    
+    // Cheaper to write the file whole than to log every track
+    playlist->dirty = TRUE;
+    playlist->change_count = -1;
+}
+
+// Apply an edit again, or take it back
+static BOOL apply_edit(Playlist* playlist, PlaylistEdit* edit, BOOL undo) {
+    const TrackId* ids = edit->count == 1 ? &edit->id : edit->ids;
+    
+    switch (edit->kind) {
+    case PLAYLIST_CHANGE_ADD:
+        if (!undo) return insert_ids(playlist, edit->index, ids, edit->count);
+        remove_ids(playlist, edit->index, edit->count);
+        return TRUE;
+    
+    case PLAYLIST_CHANGE_REMOVE:
+        if (undo) return insert_ids(playlist, edit->index, ids, edit->count);
+        remove_ids(playlist, edit->index, edit->count);
+        return TRUE;
+    
+    case PLAYLIST_CHANGE_MOVE:
+        if (undo) return move_ids(playlist, edit->to, edit->count, edit->index);
+        return move_ids(playlist, edit->index, edit->count, edit->to);
+    
+    case PLAYLIST_EDIT_CLEAR:
+        // What each side holds changes size
+        playlist->history_bytes -= edit_bytes(edit);
+        swap_cleared(playlist, edit);
+        playlist->history_bytes += edit_bytes(edit);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Take back the last edit applied
+BOOL playlist_undo(Playlist* playlist) {
+    if (!playlist || playlist->history_position == 0) return FALSE;
+    
+    if (!apply_edit(playlist, &playlist->history[playlist->history_position - 1], TRUE)) return FALSE;
+    
+    playlist->history_position--;
+    return TRUE;
+}
+
+// Apply again the last edit undone
+BOOL playlist_redo(Playlist* playlist) {
+    if (!playlist || playlist->history_position == playlist->history_count) return FALSE;
+    
+    if (!apply_edit(playlist, &playlist->history[playlist->history_position], FALSE)) return FALSE;
+    
+    playlist->history_position++;
+    return TRUE;
+}
+
 // Add a track to a playlist
 BOOL playlist_add_track(Playlist* playlist, MP3File* track) {
-    if (!playlist || !track) return FALSE;
+    if (!playlist || !ensure_loaded(playlist)) return FALSE;
+    return playlist_insert_track(playlist, playlist->track_count, track);
+}
+
+// Insert a track at a position
+BOOL playlist_insert_track(Playlist* playlist, int index, MP3File* track) {
+    if (!playlist || !track || !ensure_loaded(playlist) || index < 0 || index > playlist->track_count) return FALSE;
+    
+    // Just store the id
+    if (!reserve_edit(playlist) || !insert_ids(playlist, index, &track->id, 1)) return FALSE;
+    
+    push_edit(playlist, PLAYLIST_CHANGE_ADD, index, 0, 1, track->id, NULL);
+    account_edit(playlist);
+    return TRUE;
+}
+
+// Insert track ids at a position
+BOOL playlist_insert_ids(Playlist* playlist, int index, const TrackId* ids, int count) {
+    if (!playlist || !ids || count < 0 || !ensure_loaded(playlist) || index < 0 || index > playlist->track_count) {
+        return FALSE;
+    }
+    if (count == 0) return TRUE;
+    
+    // The history keeps its own copy of the ids
+    TrackId* kept = NULL;
+    if (count > 1) {
+        kept = (TrackId*)MEM_ALLOC_TAGGED(count * sizeof(TrackId), MEM_CAT_PLAYLIST);
+        if (!kept) return FALSE;
+        memcpy(kept, ids, count * sizeof(TrackId));
+    }
+    if (!reserve_edit(playlist) || !insert_ids(playlist, index, ids, count)) {
+        MEM_FREE(kept);
+        return FALSE;
+    }
+    
+    push_edit(playlist, PLAYLIST_CHANGE_ADD, index, 0, count, ids[0], kept);
+    account_edit(playlist);
+    return TRUE;
+}
+
+// Append entries by path
+BOOL playlist_add_paths(Playlist* playlist, const char* const* paths, int count, MP3Library* library) {
+    if (!playlist || !paths || !library || count < 0 || !ensure_loaded(playlist)) return FALSE;
+    if (count == 0) return TRUE;
     
-    // Make sure we have enough capacity
-    if (!ensure_playlist_capacity(playlist)) return FALSE;
+    int first = playlist->track_count;
+    if (!reserve_edit(playlist) || !append_paths(playlist, paths, count, library)) return FALSE;
     
-    // Add the track to the playlist (just store the pointer)
-    playlist->tracks[playlist->track_count++] = track;
+    for (int i = first; i < playlist->track_count; i++) {
+        record_change(playlist, PLAYLIST_CHANGE_ADD, i, 0, 1, track_seq_get(&playlist->tracks, i));
+    }
     
+    // The ids resolved are what a redo adds again
+    TrackId* ids = (TrackId*)MEM_ALLOC_TAGGED(count * sizeof(TrackId), MEM_CAT_PLAYLIST);
+    if (!ids) {
+        // The tracks are in: only the history, which no longer matches them, is lost
+        playlist_clear_history(playlist);
+        return TRUE;
+    }
+    track_seq_copy(&playlist->tracks, first, count, ids);
+    push_edit(playlist, PLAYLIST_CHANGE_ADD, first, 0, count, ids[0], ids);
+    account_edit(playlist);
     return TRUE;
 }
 
 // Remove a track from a playlist
 BOOL playlist_remove_track(Playlist* playlist, int index) {
-    if (!playlist || index < 0 || index >= playlist->track_count) return FALSE;
+    return playlist_remove_tracks(playlist, index, 1);
+}
+
+// Remove a range of tracks
+BOOL playlist_remove_tracks(Playlist* playlist, int first, int count) {
+    if (!playlist || !ensure_loaded(playlist) || count <= 0 || first < 0 || first + count > playlist->track_count) {
+        return FALSE;
+    }
     
-    // Shift all tracks after the removed one
-    for (int i = index; i < playlist->track_count - 1; i++) {
-        playlist->tracks[i] = playlist->tracks[i + 1];
+    // Keep the ids removed, to put them back
+    TrackId id = track_seq_get(&playlist->tracks, first);
+    TrackId* ids = NULL;
+    if (count > 1) {
+        ids = (TrackId*)MEM_ALLOC_TAGGED(count * sizeof(TrackId), MEM_CAT_PLAYLIST);
+        if (!ids) return FALSE;
+        track_seq_copy(&playlist->tracks, first, count, ids);
+    }
+    if (!reserve_edit(playlist)) {
+        MEM_FREE(ids);
+        return FALSE;
     }
     
-    playlist->track_count--;
+    remove_ids(playlist, first, count);
+    push_edit(playlist, PLAYLIST_CHANGE_REMOVE, first, 0, count, id, ids);
+    account_edit(playlist);
     return TRUE;
 }
 
 // Move a track within a playlist (change order)
 BOOL playlist_move_track(Playlist* playlist, int from_index, int to_index) {
-    if (!playlist || from_index < 0 || from_index >= playlist->track_count || 
-        to_index < 0 || to_index >= playlist->track_count) {
+    return playlist_move_tracks(playlist, from_index, 1, to_index);
+}
+
+// Move a range of tracks within a playlist
+BOOL playlist_move_tracks(Playlist* playlist, int first, int count, int to_index) {
+    if (!playlist || !ensure_loaded(playlist) || count <= 0 || first < 0 || first + count > playlist->track_count ||
+        to_index < 0 || to_index + count > playlist->track_count) {
         return FALSE;
     }
     
-    if (from_index == to_index) return TRUE; // Nothing to do
-    
-    // Save the track being moved
-    MP3File* track = playlist->tracks[from_index];
-    
-    // Move tracks up or down as needed
-    if (from_index < to_index) {
-        // Move tracks up
-        for (int i = from_index; i < to_index; i++) {
-            playlist->tracks[i] = playlist->tracks[i + 1];
-        }
-    } else {
-        // Move tracks down
-        for (int i = from_index; i > to_index; i--) {
-            playlist->tracks[i] = playlist->tracks[i - 1];
-        }
-    }
+    if (first == to_index) return TRUE; // Nothing to do
     
-    // Insert the track at its new position
-    playlist->tracks[to_index] = track;
+    if (!reserve_edit(playlist) || !move_ids(playlist, first, count, to_index)) return FALSE;
     
+    push_edit(playlist, PLAYLIST_CHANGE_MOVE, first, to_index, count, INVALID_TRACK_ID, NULL);
+    account_edit(playlist);
     return TRUE;
 }
 
+// Get the id of the track at the specified index
+TrackId playlist_get_track_id(Playlist* playlist, int index) {
+    if (!playlist || !ensure_loaded(playlist) || index < 0 || index >= playlist->track_count) return INVALID_TRACK_ID;
+    return track_seq_get(&playlist->tracks, index);
+}
+
 // Get the track at the specified index
-MP3File* playlist_get_track(Playlist* playlist, int index) {
-    if (!playlist || index < 0 || index >= playlist->track_count) return NULL;
-    return playlist->tracks[index];
+MP3File* playlist_get_track(Playlist* playlist, MP3Library* library, int index) {
+    return library_get_track(library, playlist_get_track_id(playlist, index));
+}
+
+// Path of a placeholder entry
+const char* playlist_missing_path(Playlist* playlist, TrackId id) {
+    if (!playlist || id == INVALID_TRACK_ID || !ensure_loaded(playlist)) return NULL;
+    return missing_path_of(playlist, id);
+}
+
+// Keep the path of a placeholder
+BOOL playlist_add_placeholder(Playlist* playlist, const char* path) {
+    if (!playlist || !path || !ensure_loaded(playlist)) return FALSE;
+    
+    TrackId id = make_track_id(path);
+    return missing_path_of(playlist, id) != NULL || add_missing(playlist, id, path);
 }
 
 // Clear all tracks from a playlist
 void playlist_clear(Playlist* playlist) {
     if (!playlist) return;
+    
+    // An indexed playlist that cannot be read is already empty
+    ensure_loaded(playlist);
+    
+    if (reserve_edit(playlist)) {
+        // The tracks go into the history as they are, nothing is copied
+        PlaylistEdit* edit = push_edit(playlist, PLAYLIST_EDIT_CLEAR, 0, 0, 0, INVALID_TRACK_ID, NULL);
+        swap_cleared(playlist, edit);
+        account_edit(playlist);
+        return;
+    }
+    
+    playlist_clear_history(playlist);
+    track_seq_free(&playlist->tracks);
     playlist->track_count = 0;
+    string_pool_truncate(&playlist->missing_paths, 0);
+    
+    // Cheaper to write the empty file than to log every removal
+    playlist->dirty = TRUE;
+    playlist->change_count = -1;
 }
 
 // Free a playlist and its resources
 void playlist_free(Playlist* playlist) {
     if (!playlist) return;
     
-    // Free the tracks array (not the tracks themselves, as those belong to the library)
-    MEM_FREE(playlist->tracks);
+    // Free the track ids (not the tracks themselves, as those belong to the library)
+    track_seq_free(&playlist->tracks);
+    MEM_FREE(playlist->missing_ids);
+    string_pool_free(&playlist->missing_paths);
+    MEM_FREE(playlist->source);
+    MEM_FREE(playlist->file);
+    MEM_FREE(playlist->changes);
+    playlist_clear_history(playlist);
+    MEM_FREE(playlist->history);
     MEM_FREE(playlist);
 }
 
-// Find a track in the library by its filepath
-static MP3File* find_track_by_filepath(MP3Library* library, const char* filepath) {
-    if (!library || !filepath) return NULL;
-    
-    MP3File* current = library->all_files;
-    while (current) {
-        if (strcmp(current->filepath, filepath) == 0) {
-            return current;
+// Remember the file the playlist now matches, with nothing left to save
+static void set_saved(Playlist* playlist, const char* filename, DWORD revision, int logged) {
+    if (!playlist->file || strcmp(playlist->file, filename) != 0) {
+        MEM_FREE(playlist->file);
+        playlist->file = (char*)MEM_ALLOC_TAGGED(strlen(filename) + 1, MEM_CAT_PLAYLIST);
+        if (playlist->file) {
+            strcpy(playlist->file, filename);
         }
-        current = current->next;
     }
     
-    return NULL;
+    playlist->revision = revision;
+    playlist->logged = logged;
+    playlist->dirty = FALSE;
+    playlist->change_count = playlist->file ? 0 : -1;
 }
 
-// Save a playlist to file
-BOOL playlist_save(Playlist* playlist, const char* filename) {
-    if (!playlist || !filename) return FALSE;
-    
-    FILE* file = fopen(filename, "w");
-    if (!file) return FALSE;
-    
+// Name of a file beside filename (FALSE if it does not fit in MAX_PATH)
+static BOOL sibling_name(const char* filename, const char* extension, char* name) {
+    int length = snprintf(name, MAX_PATH, "%s%s", filename, extension);
+    return length > 0 && length < MAX_PATH;
+}
+
+// Flush a file to the disk and close it. FALSE if writing it failed anywhere.
+static BOOL close_durable(FILE* file, BOOL ok) {
+    ok = ok && fflush(file) == 0 && FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(file)));
+    return fclose(file) == 0 && ok;
+}
+
+// Put a fully written temporary file in place of filename, or drop it on failure.
+// Until the rename the old file is intact; the rename replaces it in one step.
+static BOOL replace_with_temp(FILE* file, const char* temp, const char* filename, BOOL ok) {
+    ok = close_durable(file, ok) && MoveFileEx(temp, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    if (!ok) DeleteFile(temp);
+    return ok;
+}
+
+// The change log of the file a save replaced no longer applies
+static void delete_log(const char* filename) {
+    char log_name[MAX_PATH];
+    if (sibling_name(filename, PLAYLIST_LOG_EXTENSION, log_name)) {
+        DeleteFile(log_name);
+    }
+}
+
+// Write the whole playlist as text
+static BOOL write_text(Playlist* playlist, FILE* file, MP3Library* library, DWORD revision) {
     // Write the playlist name and description
     fprintf(file, "[Playlist]\n");
     fprintf(file, "Name=%s\n", playlist->name);
     fprintf(file, "Description=%s\n", playlist->description);
-    fprintf(file, "TrackCount=%d\n\n", playlist->track_count);
+    fprintf(file, "TrackCount=%d\n", playlist->track_count);
+    fprintf(file, "Revision=%lu\n\n", (unsigned long)revision);
     
-    // Write each track's filepath
+    // Write each track's filepath (placeholders keep the path they were loaded with)
     fprintf(file, "[Tracks]\n");
-    for (int i = 0; i < playlist->track_count; i++) {
-        MP3File* track = playlist->tracks[i];
-        if (track) {
-            fprintf(file, "%d=%s\n", i, track->filepath);
+    int length = 0;
+    for (int i = 0; i < playlist->track_count; i += length) {
+        const TrackId* run = track_seq_run(&playlist->tracks, i, &length);
+        if (!run) break;
+        
+        for (int k = 0; k < length; k++) {
+            library_lock(library);
+            MP3File* track = library_get_track(library, run[k]);
+            char* filepath = track ? mp3_file_dup_path(track) : NULL;
+            library_unlock(library);
+            if (filepath) {
+                fprintf(file, "%d=%s\n", i + k, filepath);
+                MEM_FREE(filepath);
+            } else if (!track) {
+                const char* missing = missing_path_of(playlist, run[k]);
+                if (missing) {
+                    fprintf(file, "%d=%s\n", i + k, missing);
+                }
+            }
         }
     }
     
-    fclose(file);
+    return !ferror(file);
+}
+
+// Rewrite the whole text file under a new revision
+static BOOL save_whole(Playlist* playlist, const char* filename, MP3Library* library) {
+    // A new playlist starts from the clock, so that an old log left beside the file it
+    // replaces cannot match it
+    DWORD revision = playlist->revision != 0 ? playlist->revision + 1 : GetTickCount();
+    if (revision == 0) revision = 1;
+    
+    char temp[MAX_PATH];
+    FILE* file = sibling_name(filename, PLAYLIST_TEMP_EXTENSION, temp) ? fopen(temp, "w") : NULL;
+    if (!file || !replace_with_temp(file, temp, filename, write_text(playlist, file, library, revision))) {
+        return FALSE;
+    }
+    
+    delete_log(filename);
+    set_saved(playlist, filename, revision, 0);
     return TRUE;
 }
 
-// Load a playlist from file
-Playlist* playlist_load(const char* filename, MP3Library* library) {
-    if (!filename || !library) return NULL;
+// Change log: "@revision" of the file it extends, then one batch per save: a line per
+// edit ("+index=path" inserted, "-index" removed, ">from to count" moved, the count left
+// out for one track) and "#track count" once the batch is complete. A batch cut by a
+// crash has no "#" line and is ignored.
+static BOOL append_changes(Playlist* playlist, const char* filename, MP3Library* library) {
+    char log_name[MAX_PATH];
+    if (!sibling_name(filename, PLAYLIST_LOG_EXTENSION, log_name)) return FALSE;
     
-    FILE* file = fopen(filename, "r");
-    if (!file) return NULL;
+    // With nothing logged since the file was written, any log there is a stale one
+    FILE* log = fopen(log_name, playlist->logged > 0 ? "ab" : "wb");
+    if (!log) return FALSE;
+    
+    BOOL ok = playlist->logged > 0 || fprintf(log, "@%lu\n", (unsigned long)playlist->revision) > 0;
+    for (int i = 0; ok && i < playlist->change_count; i++) {
+        const PlaylistChange* change = &playlist->changes[i];
+        if (change->kind == PLAYLIST_CHANGE_ADD) {
+            library_lock(library);
+            MP3File* track = library_get_track(library, change->id);
+            char* filepath = track ? mp3_file_dup_path(track) : NULL;
+            library_unlock(library);
+            const char* path = track ? filepath : missing_path_of(playlist, change->id);
+            ok = path && fprintf(log, "+%d=%s\n", change->index, path) > 0;
+            MEM_FREE(filepath);
+        } else if (change->kind == PLAYLIST_CHANGE_REMOVE) {
+            ok = fprintf(log, "-%d\n", change->index) > 0;
+        } else if (change->count == 1) {
+            ok = fprintf(log, ">%d %d\n", change->index, change->to) > 0;
+        } else {
+            ok = fprintf(log, ">%d %d %d\n", change->index, change->to, change->count) > 0;
+        }
+    }
+    ok = ok && fprintf(log, "#%d\n", playlist->track_count) > 0;
+    
+    if (!close_durable(log, ok)) return FALSE;
+    
+    playlist->logged += playlist->change_count;
+    playlist->change_count = 0;
+    playlist->dirty = FALSE;
+    return TRUE;
+}
+
+// Save a playlist to file
+BOOL playlist_save(Playlist* playlist, const char* filename, MP3Library* library) {
+    if (!playlist || !filename || !library) return FALSE;
+    
+    // Edits to a large playlist go to the log of the file they were made against
+    if (playlist->change_count > 0 && playlist->revision != 0 && playlist->track_count >= PLAYLIST_LOG_MIN_TRACKS &&
+        playlist->file && strcmp(playlist->file, filename) == 0) {
+        if (append_changes(playlist, filename, library)) return TRUE;
+        
+        // The cut batch is ignored until the rewrite replaces the log
+        playlist->change_count = -1;
+    }
+    
+    return ensure_loaded(playlist) && save_whole(playlist, filename, library);
+}
+
+// Binary playlist file:
+//   "M3PB", version byte, name and description each zero terminated
+//   track count (varint), then every track id as 8 bytes, little endian
+//   fallback count (varint), then for each track saved as a placeholder its distance
+//   from the previous one's position (varint) and its path, zero terminated
+// Track ids are hashes spread over all 64 bits, which a varint would stretch to 9 or 10
+// bytes, so they are stored whole; the counts and positions are small and take varints.
+// Loading needs no path lookup: the ids are the ones the library gives the files.
+
+static size_t put_varint(unsigned char* out, UINT64 value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+// Decode a varint at the cursor; FALSE if it is cut by end or too long
+static BOOL get_varint(const unsigned char** cursor, const unsigned char* end, UINT64* value) {
+    UINT64 result = 0;
+    for (int shift = 0; shift < 64 && *cursor < end; shift += 7) {
+        unsigned char byte = *(*cursor)++;
+        result |= (UINT64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static BOOL write_varint(FILE* file, UINT64 value) {
+    unsigned char bytes[PLAYLIST_VARINT_BYTES];
+    size_t length = put_varint(bytes, value);
+    return fwrite(bytes, 1, length, file) == length;
+}
+
+// Placeholders sorted by id, to find the path of any track quickly
+typedef struct {
+    TrackId id;
+    UINT32 entry;              // In missing_paths
+} MissingEntry;
+
+static int compare_missing(const void* a, const void* b) {
+    TrackId x = ((const MissingEntry*)a)->id;
+    TrackId y = ((const MissingEntry*)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+// Path kept for a track saved as a placeholder (NULL if it needs none)
+static const char* fallback_path(Playlist* playlist, const MissingEntry* sorted, TrackId id, MP3Library* library) {
+    MissingEntry key = { id, 0 };
+    const MissingEntry* found = (const MissingEntry*)bsearch(&key, sorted, playlist->missing_paths.count,
+                                                             sizeof(MissingEntry), compare_missing);
+    if (!found || library_get_track(library, id)) return NULL;
+    return playlist->missing_paths.text + playlist->missing_paths.offsets[found->entry];
+}
+
+// Save a playlist in the binary format
+BOOL playlist_save_binary(Playlist* playlist, const char* filename, MP3Library* library) {
+    if (!playlist || !filename || !library || !ensure_loaded(playlist)) return FALSE;
+    
+    // Header and ids go out in one write
+    size_t name_length = strlen(playlist->name) + 1;
+    size_t description_length = strlen(playlist->description) + 1;
+    size_t size = PLAYLIST_BINARY_MAGIC_BYTES + 1 + name_length + description_length + PLAYLIST_VARINT_BYTES +
+                  (size_t)playlist->track_count * sizeof(UINT64);
+    unsigned char* buffer = (unsigned char*)MEM_ALLOC_TAGGED(size, MEM_CAT_PLAYLIST);
+    if (!buffer) return FALSE;
+    
+    unsigned char* out = buffer;
+    memcpy(out, PLAYLIST_BINARY_MAGIC, PLAYLIST_BINARY_MAGIC_BYTES);
+    out += PLAYLIST_BINARY_MAGIC_BYTES;
+    *out++ = PLAYLIST_BINARY_VERSION;
+    memcpy(out, playlist->name, name_length);
+    out += name_length;
+    memcpy(out, playlist->description, description_length);
+    out += description_length;
+    out += put_varint(out, (UINT64)playlist->track_count);
+    int length = 0;
+    for (int i = 0; i < playlist->track_count; i += length) {
+        const TrackId* run = track_seq_run(&playlist->tracks, i, &length);
+        if (!run) break;
+        
+        for (int k = 0; k < length; k++) {
+            UINT64 id = run[k];
+            for (int b = 0; b < 8; b++) {
+                *out++ = (unsigned char)(id >> (8 * b));
+            }
+        }
+    }
+    
+    // Only placeholders can need their path: without any, no track is looked up
+    UINT32 missing = playlist->missing_paths.count;
+    MissingEntry* sorted = NULL;
+    if (missing > 0) {
+        sorted = (MissingEntry*)MEM_ALLOC_TAGGED(missing * sizeof(MissingEntry), MEM_CAT_PLAYLIST);
+        if (!sorted) {
+            MEM_FREE(buffer);
+            return FALSE;
+        }
+        for (UINT32 i = 0; i < missing; i++) {
+            sorted[i].id = playlist->missing_ids[i];
+            sorted[i].entry = i;
+        }
+        qsort(sorted, missing, sizeof(MissingEntry), compare_missing);
+    }
     
-    char buffer[MAX_PATH];
-    char name[100] = "Unnamed Playlist";
-    char description[256] = "";
-    int track_count = 0;
+    int fallback_count = 0;
+    for (int i = 0; sorted && i < playlist->track_count; i += length) {
+        const TrackId* run = track_seq_run(&playlist->tracks, i, &length);
+        if (!run) break;
+        
+        for (int k = 0; k < length; k++) {
+            fallback_count += fallback_path(playlist, sorted, run[k], library) != NULL;
+        }
+    }
     
-    // Read the playlist header
-    while (fgets(buffer, sizeof(buffer), file)) {
-        buffer[strcspn(buffer, "\r\n")] = 0; // Remove newline
+    char temp[MAX_PATH];
+    FILE* file = sibling_name(filename, PLAYLIST_TEMP_EXTENSION, temp) ? fopen(temp, "wb") : NULL;
+    BOOL ok = file && fwrite(buffer, 1, (size_t)(out - buffer), file) == (size_t)(out - buffer) &&
+              write_varint(file, (UINT64)fallback_count);
+    int previous = 0;
+    for (int i = 0; ok && fallback_count > 0 && i < playlist->track_count; i += length) {
+        const TrackId* run = track_seq_run(&playlist->tracks, i, &length);
+        if (!run) break;
         
-        if (strncmp(buffer, "[Tracks]", 8) == 0) {
+        for (int k = 0; ok && k < length; k++) {
+            const char* path = fallback_path(playlist, sorted, run[k], library);
+            if (path) {
+                size_t path_length = strlen(path) + 1;
+                ok = write_varint(file, (UINT64)(i + k - previous)) && fwrite(path, 1, path_length, file) == path_length;
+                previous = i + k;
+            }
+        }
+    }
+    
+    ok = file && replace_with_temp(file, temp, filename, ok);
+    MEM_FREE(sorted);
+    MEM_FREE(buffer);
+    
+    // A binary file has no revision, so no log ever extends it
+    if (ok) {
+        delete_log(filename);
+        set_saved(playlist, filename, 0, 0);
+    }
+    return ok;
+}
+
+// Read a whole file into a zero terminated buffer
+static char* read_whole_file(const char* filename, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+    
+    char* text = NULL;
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        length = ftell(file);
+        rewind(file);
+    }
+    if (length >= 0) {
+        text = (char*)MEM_ALLOC_TAGGED((size_t)length + 1, MEM_CAT_PLAYLIST);
+    }
+    if (text) {
+        *size = fread(text, 1, (size_t)length, file);
+        text[*size] = '\0';
+    }
+    
+    fclose(file);
+    return text;
+}
+
+// Next line of the buffer, terminated in place without its line break (NULL at the end)
+static char* next_line(char** cursor, char* end) {
+    char* line = *cursor;
+    if (line >= end) return NULL;
+    
+    char* newline = (char*)memchr(line, '\n', (size_t)(end - line));
+    char* line_end = newline ? newline : end;
+    *cursor = newline ? newline + 1 : end;
+    
+    if (line_end > line && line_end[-1] == '\r') line_end--;
+    *line_end = '\0';
+    return line;
+}
+
+// Playlist header: the lines before [Tracks], or the binary header, left at the cursor
+typedef struct {
+    const char* name;
+    const char* description;
+    int track_count;           // -1 if the file does not say
+    DWORD revision;            // 0 if the file does not say
+    BOOL complete;             // The [Tracks] line was found, or the binary header ends in the buffer
+    BOOL binary;               // Written by playlist_save_binary
+} PlaylistHeader;
+
+static BOOL is_binary_playlist(const char* text, size_t size) {
+    return size > PLAYLIST_BINARY_MAGIC_BYTES && memcmp(text, PLAYLIST_BINARY_MAGIC, PLAYLIST_BINARY_MAGIC_BYTES) == 0;
+}
+
+static void parse_binary_header(char** cursor, char* end, PlaylistHeader* header) {
+    header->binary = TRUE;
+    char* p = *cursor + PLAYLIST_BINARY_MAGIC_BYTES;
+    if (*(unsigned char*)p++ != PLAYLIST_BINARY_VERSION) return;
+    
+    char* name_end = (char*)memchr(p, '\0', (size_t)(end - p));
+    char* description_end = name_end ? (char*)memchr(name_end + 1, '\0', (size_t)(end - name_end - 1)) : NULL;
+    if (!description_end) return;
+    
+    const unsigned char* count_at = (const unsigned char*)description_end + 1;
+    UINT64 count;
+    if (!get_varint(&count_at, (const unsigned char*)end, &count) || count > INT_MAX) return;
+    
+    header->name = p;
+    header->description = name_end + 1;
+    header->track_count = (int)count;
+    header->complete = TRUE;
+    *cursor = (char*)count_at;
+}
+
+static void parse_header(char** cursor, char* end, PlaylistHeader* header) {
+    header->name = "Unnamed Playlist";
+    header->description = "";
+    header->track_count = -1;
+    header->revision = 0;
+    header->complete = FALSE;
+    header->binary = FALSE;
+    
+    if (is_binary_playlist(*cursor, (size_t)(end - *cursor))) {
+        parse_binary_header(cursor, end, header);
+        return;
+    }
+    
+    char* line;
+    while ((line = next_line(cursor, end)) != NULL) {
+        if (strncmp(line, "[Tracks]", 8) == 0) {
+            header->complete = TRUE;
             break; // Start of tracks section
         }
         
-        if (strncmp(buffer, "Name=", 5) == 0) {
-            strncpy(name, buffer + 5, sizeof(name) - 1);
-            name[sizeof(name) - 1] = '\0';
-        } else if (strncmp(buffer, "Description=", 12) == 0) {
-            strncpy(description, buffer + 12, sizeof(description) - 1);
-            description[sizeof(description) - 1] = '\0';
-        } else if (strncmp(buffer, "TrackCount=", 11) == 0) {
-            track_count = atoi(buffer + 11);
+        if (strncmp(line, "Name=", 5) == 0) {
+            header->name = line + 5;
+        } else if (strncmp(line, "Description=", 12) == 0) {
+            header->description = line + 12;
+        } else if (strncmp(line, "TrackCount=", 11) == 0) {
+            header->track_count = atoi(line + 11);
+        } else if (strncmp(line, "Revision=", 9) == 0) {
+            header->revision = strtoul(line + 9, NULL, 10);
         }
     }
+}
+
+// Append the track ids and fallback paths of a binary file from the cursor on
+static BOOL load_binary_tracks(Playlist* playlist, const PlaylistHeader* header, char* cursor, char* end) {
+    if (!header->complete) return FALSE;
     
-    // Create the playlist
-    Playlist* playlist = playlist_create(name, description);
-    if (!playlist) {
-        fclose(file);
-        return NULL;
+    int count = header->track_count;
+    const unsigned char* in = (const unsigned char*)cursor;
+    const unsigned char* limit = (const unsigned char*)end;
+    if ((size_t)(limit - in) / sizeof(UINT64) < (size_t)count) return FALSE;
+    
+    TrackId* ids = (TrackId*)MEM_ALLOC_TAGGED((count > 0 ? count : 1) * sizeof(TrackId), MEM_CAT_PLAYLIST);
+    if (!ids) return FALSE;
+    
+    for (int i = 0; i < count; i++, in += sizeof(UINT64)) {
+        UINT64 id = 0;
+        for (int b = 0; b < 8; b++) {
+            id |= (UINT64)in[b] << (8 * b);
+        }
+        ids[i] = id;
     }
     
-    // Read each track
-    while (fgets(buffer, sizeof(buffer), file)) {
-        buffer[strcspn(buffer, "\r\n")] = 0; // Remove newline
+    // The paths are zero terminated in the buffer and are copied as they are
+    UINT32 missing = playlist->missing_paths.count;
+    UINT64 fallback_count;
+    BOOL ok = get_varint(&in, limit, &fallback_count);
+    UINT64 position = 0;
+    for (UINT64 f = 0; ok && f < fallback_count; f++) {
+        UINT64 distance;
+        ok = get_varint(&in, limit, &distance);
+        position += distance;
         
-        // Find the '=' separator
-        char* separator = strchr(buffer, '=');
-        if (!separator) continue;
+        const unsigned char* path_end = ok ? (const unsigned char*)memchr(in, '\0', (size_t)(limit - in)) : NULL;
+        ok = path_end && position < (UINT64)count && add_missing(playlist, ids[position], (const char*)in);
+        if (ok) in = path_end + 1;
+    }
+    
+    // A damaged file adds nothing
+    ok = ok && append_tracks(playlist, ids, count);
+    if (!ok) {
+        string_pool_truncate(&playlist->missing_paths, missing);
+    }
+    MEM_FREE(ids);
+    return ok;
+}
+
+// Append the tracks listed from the cursor on
+static BOOL load_tracks(Playlist* playlist, const PlaylistHeader* header, char* cursor, char* end,
+                        MP3Library* library) {
+    if (header->binary) return load_binary_tracks(playlist, header, cursor, end);
+    
+    // One entry per remaining line at most: count them to allocate once
+    int line_count = 1;
+    for (const char* p = cursor; (p = (const char*)memchr(p, '\n', (size_t)(end - p))) != NULL; p++) {
+        line_count++;
+    }
+    
+    const char** paths = (const char**)MEM_ALLOC_TAGGED(line_count * sizeof(const char*), MEM_CAT_PLAYLIST);
+    BOOL ok = paths != NULL;
+    
+    // The paths point into the buffer: no copy per line
+    int count = 0;
+    char* line;
+    while (ok && (line = next_line(&cursor, end)) != NULL) {
+        char* separator = strchr(line, '=');
+        if (separator && separator[1] != '\0') {
+            paths[count++] = separator + 1;
+        }
+    }
+    
+    // Resolve every path in one batch, keeping the missing ones as placeholders
+    ok = ok && append_paths(playlist, paths, count, library);
+    
+    MEM_FREE(paths);
+    return ok;
+}
+
+// Apply one edit line of a change log. FALSE if it does not fit the playlist.
+static BOOL apply_logged(Playlist* playlist, char* line, MP3Library* library) {
+    int from = -1;
+    int to = -1;
+    int count = 1;
+    if (line[0] == '+') {
+        // "+index=path" inserts, "+path" appends
+        char* path = line + 1;
+        from = playlist->track_count;
+        if (isdigit((unsigned char)*path)) {
+            char* digits_end;
+            long index = strtol(path, &digits_end, 10);
+            if (*digits_end == '=') {
+                from = (int)index;
+                path = digits_end + 1;
+            }
+        }
+        if (*path == '\0' || from < 0 || from > playlist->track_count) return FALSE;
         
-        // Get the filepath
-        char* filepath = separator + 1;
+        library_lock(library);
+        MP3File* track = library_find_by_path(library, path);
+        TrackId id = track ? track->id : INVALID_TRACK_ID;
+        library_unlock(library);
+        if (!track && !add_placeholder(playlist, path, &id)) return FALSE;
+        if (!track_seq_insert(&playlist->tracks, from, &id, 1)) return FALSE;
         
-        // Find the track in the library
-        MP3File* track = find_track_by_filepath(library, filepath);
-        if (track) {
-            playlist_add_track(playlist, track);
+        playlist->track_count++;
+        return TRUE;
+    }
+    
+    if (line[0] == '-' && sscanf(line + 1, "%d", &from) == 1 && from >= 0 && from < playlist->track_count) {
+        track_seq_remove(&playlist->tracks, from, 1);
+        playlist->track_count--;
+        return TRUE;
+    }
+    if (line[0] == '>' && sscanf(line + 1, "%d %d %d", &from, &to, &count) >= 2) {
+        return count > 0 && from >= 0 && from + count <= playlist->track_count && to >= 0 &&
+               to + count <= playlist->track_count && track_seq_move(&playlist->tracks, from, count, to);
+    }
+    return FALSE;
+}
+
+// Apply the complete batches of the change log beside a file written at revision.
+// Returns the number of edits applied, -1 if the log does not fit the playlist.
+static int replay_log(Playlist* playlist, const char* filename, DWORD revision, MP3Library* library) {
+    char log_name[MAX_PATH];
+    size_t size = 0;
+    char* text = sibling_name(filename, PLAYLIST_LOG_EXTENSION, log_name) ? read_whole_file(log_name, &size) : NULL;
+    if (!text) return 0;
+    
+    char* cursor = text;
+    char* end = text + size;
+    char* line = next_line(&cursor, end);
+    
+    // A log kept from an older revision of the file is stale
+    if (!line || line[0] != '@' || strtoul(line + 1, NULL, 10) != revision) {
+        MEM_FREE(text);
+        return 0;
+    }
+    
+    // Only batches a save completed count: stop after the last "#" line that ends
+    // with its line break
+    char* limit = end;
+    while (limit > cursor && limit[-1] != '\n') {
+        limit--;
+    }
+    while (limit > cursor) {
+        char* start = limit - 1;
+        while (start > cursor && start[-1] != '\n') {
+            start--;
+        }
+        if (*start == '#') break;
+        limit = start;
+    }
+    
+    int applied = 0;
+    while (applied >= 0 && (line = next_line(&cursor, limit)) != NULL) {
+        if (line[0] == '#') {
+            if (atoi(line + 1) != playlist->track_count) applied = -1;
+        } else {
+            applied = apply_logged(playlist, line, library) ? applied + 1 : -1;
+        }
+    }
+    
+    MEM_FREE(text);
+    return applied;
+}
+
+// Apply the change log of the file the tracks came from, which the playlist now matches
+static void attach_file(Playlist* playlist, const char* filename, DWORD revision, MP3Library* library) {
+    int logged = revision != 0 ? replay_log(playlist, filename, revision, library) : 0;
+    set_saved(playlist, filename, revision, logged > 0 ? logged : 0);
+    
+    // The next save replaces a damaged log
+    if (logged < 0) {
+        playlist->dirty = TRUE;
+        playlist->change_count = -1;
+    }
+}
+
+// Load a playlist from file
+Playlist* playlist_load(const char* filename, MP3Library* library) {
+    if (!filename || !library) return NULL;
+    
+    size_t size = 0;
+    char* text = read_whole_file(filename, &size);
+    if (!text) return NULL;
+    
+    char* cursor = text;
+    char* end = text + size;
+    PlaylistHeader header;
+    parse_header(&cursor, end, &header);
+    
+    // Create the playlist
+    Playlist* playlist = playlist_create(header.name, header.description);
+    if (playlist && !load_tracks(playlist, &header, cursor, end, library)) {
+        playlist_free(playlist);
+        playlist = NULL;
+    }
+    if (playlist) {
+        attach_file(playlist, filename, header.revision, library);
+    }
+    
+    MEM_FREE(text);
+    return playlist;
+}
+
+// Read the tracks of a playlist indexed by playlist_index
+BOOL playlist_materialize(Playlist* playlist) {
+    if (!playlist) return FALSE;
+    if (!playlist->source) return TRUE;
+    
+    // Whatever happens the playlist is loaded from now on, empty if the file is unreadable
+    char* source = playlist->source;
+    playlist->source = NULL;
+    playlist->track_count = 0;
+    
+    size_t size = 0;
+    char* text = read_whole_file(source, &size);
+    BOOL ok = text != NULL;
+    if (ok) {
+        char* cursor = text;
+        PlaylistHeader header;
+        parse_header(&cursor, text + size, &header);
+        ok = load_tracks(playlist, &header, cursor, text + size, playlist->library);
+        if (ok) {
+            attach_file(playlist, source, header.revision, playlist->library);
         }
     }
     
+    MEM_FREE(text);
+    MEM_FREE(source);
+    return ok;
+}
+
+// Read only the header of a playlist file; the tracks wait for playlist_materialize.
+// Files whose header does not give the track count, or that have a change log, are
+// loaded at once.
+Playlist* playlist_index(const char* filename, MP3Library* library) {
+    if (!filename || !library) return NULL;
+    
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+    
+    char text[PLAYLIST_HEADER_BYTES + 1];
+    size_t size = fread(text, 1, PLAYLIST_HEADER_BYTES, file);
     fclose(file);
+    text[size] = '\0';
+    
+    // A full buffer may end in the middle of a line: keep the complete ones
+    char* end = text + size;
+    if (size == PLAYLIST_HEADER_BYTES && !is_binary_playlist(text, size)) {
+        while (end > text && end[-1] != '\n') {
+            end--;
+        }
+    }
+    
+    char* cursor = text;
+    PlaylistHeader header;
+    parse_header(&cursor, end, &header);
+    char log_name[MAX_PATH];
+    if (!header.complete || header.track_count < 0 || !sibling_name(filename, PLAYLIST_LOG_EXTENSION, log_name) ||
+        GetFileAttributes(log_name) != INVALID_FILE_ATTRIBUTES) {
+        return playlist_load(filename, library);
+    }
+    
+    Playlist* playlist = playlist_create(header.name, header.description);
+    if (!playlist) return NULL;
+    
+    playlist->source = (char*)MEM_ALLOC_TAGGED(strlen(filename) + 1, MEM_CAT_PLAYLIST);
+    if (!playlist->source) {
+        playlist_free(playlist);
+        return NULL;
+    }
+    strcpy(playlist->source, filename);
+    playlist->library = library;
+    playlist->track_count = header.track_count;
+    set_saved(playlist, filename, header.revision, 0);
     return playlist;
 }
 
+// Scramble the bits of a hash before reducing it to a slot (splitmix64 finalizer)
+static UINT64 mix_hash(UINT64 hash) {
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+// FNV-1a over the name, case kept as find_by_name compares it
+static UINT64 hash_name(const char* name) {
+    UINT64 hash = 0xCBF29CE484222325ULL;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        hash = (hash ^ *p) * 0x100000001B3ULL;
+    }
+    return mix_hash(hash);
+}
+
+static UINT64 name_hash_at(const PlaylistManager* manager, int position) {
+    return hash_name(manager->playlists[position]->name);
+}
+
+static UINT64 id_hash_at(const PlaylistManager* manager, int position) {
+    return mix_hash(manager->playlists[position]->id);
+}
+
+// Slot holding the playlist named name, or the free slot where it would go
+static int find_name_slot(const PlaylistManager* manager, const char* name) {
+    int mask = manager->slot_capacity - 1;
+    int slot = (int)(hash_name(name) & mask);
+    while (manager->name_slots[slot] && strcmp(manager->playlists[manager->name_slots[slot] - 1]->name, name) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Slot holding the playlist with id, or the free slot where it would go
+static int find_id_slot(const PlaylistManager* manager, PlaylistId id) {
+    int mask = manager->slot_capacity - 1;
+    int slot = (int)(mix_hash(id) & mask);
+    while (manager->id_slots[slot] && manager->playlists[manager->id_slots[slot] - 1]->id != id) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Free a slot of an index by shifting back the entries after it that may take its
+// place, so that no probe chain is cut
+static void free_slot(const PlaylistManager* manager, int* slots, int slot,
+                      UINT64 (*hash_at)(const PlaylistManager*, int)) {
+    int mask = manager->slot_capacity - 1;
+    int hole = slot;
+    for (int next = (hole + 1) & mask; slots[next]; next = (next + 1) & mask) {
+        int home = (int)(hash_at(manager, slots[next] - 1) & mask);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+    }
+    slots[hole] = 0;
+}
+
+// Index every playlist again in tables of capacity slots
+static BOOL rebuild_manager_slots(PlaylistManager* manager, int capacity) {
+    int* name_slots = (int*)MEM_CALLOC_TAGGED(capacity, sizeof(int), MEM_CAT_PLAYLIST);
+    int* id_slots = (int*)MEM_CALLOC_TAGGED(capacity, sizeof(int), MEM_CAT_PLAYLIST);
+    if (!name_slots || !id_slots) {
+        MEM_FREE(name_slots);
+        MEM_FREE(id_slots);
+        return FALSE;
+    }
+    
+    MEM_FREE(manager->name_slots);
+    MEM_FREE(manager->id_slots);
+    manager->name_slots = name_slots;
+    manager->id_slots = id_slots;
+    manager->slot_capacity = capacity;
+    for (int i = 0; i < manager->count; i++) {
+        manager->name_slots[find_name_slot(manager, manager->playlists[i]->name)] = i + 1;
+        manager->id_slots[find_id_slot(manager, manager->playlists[i]->id)] = i + 1;
+    }
+    return TRUE;
+}
+
+// Set the name of a playlist: the header changes, so the file is written whole
+static void set_name(Playlist* playlist, const char* name) {
+    strncpy(playlist->name, name, sizeof(playlist->name) - 1);
+    playlist->name[sizeof(playlist->name) - 1] = '\0';
+    playlist->dirty = TRUE;
+    playlist->change_count = -1;
+}
+
+// Give a playlist a name no other playlist of the manager has, numbering it if needed
+static void make_name_unique(PlaylistManager* manager, Playlist* playlist) {
+    if (!manager->name_slots[find_name_slot(manager, playlist->name)]) return;
+    
+    char base[sizeof(playlist->name)];
+    char name[sizeof(playlist->name)];
+    strcpy(base, playlist->name);
+    for (int number = 2;; number++) {
+        char suffix[16];
+        int suffix_length = snprintf(suffix, sizeof(suffix), " (%d)", number);
+        snprintf(name, sizeof(name), "%.*s%s", (int)(sizeof(name) - 1 - suffix_length), base, suffix);
+        if (!manager->name_slots[find_name_slot(manager, name)]) break;
+    }
+    set_name(playlist, name);
+}
+
 // Add a playlist to the manager
 BOOL playlist_manager_add(PlaylistManager* manager, Playlist* playlist) {
     if (!manager || !playlist) return FALSE;
     
-    // Make sure we have enough capacity
+    // Make sure we have enough capacity, the indexes at most half full
     if (!ensure_manager_capacity(manager)) return FALSE;
+    if ((manager->count + 1) * 2 > manager->slot_capacity &&
+        !rebuild_manager_slots(manager, manager->slot_capacity * 2)) {
+        return FALSE;
+    }
+    
+    make_name_unique(manager, playlist);
+    playlist->id = manager->next_id++;
     
     // Add the playlist
-    manager->playlists[manager->count++] = playlist;
+    int position = manager->count++;
+    manager->playlists[position] = playlist;
+    manager->name_slots[find_name_slot(manager, playlist->name)] = position + 1;
+    manager->id_slots[find_id_slot(manager, playlist->id)] = position + 1;
     
     return TRUE;
 }
@@ -286,15 +1433,22 @@ BOOL playlist_manager_add(PlaylistManager* manager, Playlist* playlist) {
 BOOL playlist_manager_remove(PlaylistManager* manager, int index) {
     if (!manager || index < 0 || index >= manager->count) return FALSE;
     
-    // Free the playlist
-    playlist_free(manager->playlists[index]);
+    Playlist* playlist = manager->playlists[index];
+    free_slot(manager, manager->name_slots, find_name_slot(manager, playlist->name), name_hash_at);
+    free_slot(manager, manager->id_slots, find_id_slot(manager, playlist->id), id_hash_at);
     
-    // Shift all playlists after the removed one
-    for (int i = index; i < manager->count - 1; i++) {
-        manager->playlists[i] = manager->playlists[i + 1];
+    // The last playlist fills the hole
+    int last = manager->count - 1;
+    if (index != last) {
+        Playlist* moved = manager->playlists[last];
+        manager->playlists[index] = moved;
+        manager->name_slots[find_name_slot(manager, moved->name)] = index + 1;
+        manager->id_slots[find_id_slot(manager, moved->id)] = index + 1;
     }
-    
     manager->count--;
+    
+    // Free the playlist
+    playlist_free(playlist);
     return TRUE;
 }
 
@@ -308,50 +1462,231 @@ Playlist* playlist_manager_get(PlaylistManager* manager, int index) {
 Playlist* playlist_manager_find_by_name(PlaylistManager* manager, const char* name) {
     if (!manager || !name) return NULL;
     
-    for (int i = 0; i < manager->count; i++) {
-        if (strcmp(manager->playlists[i]->name, name) == 0) {
-            return manager->playlists[i];
-        }
+    int position = manager->name_slots[find_name_slot(manager, name)];
+    return position ? manager->playlists[position - 1] : NULL;
+}
+
+// Get a playlist by id
+Playlist* playlist_manager_find_by_id(PlaylistManager* manager, PlaylistId id) {
+    int index = playlist_manager_index_of(manager, id);
+    return index >= 0 ? manager->playlists[index] : NULL;
+}
+
+// Position of a playlist
+int playlist_manager_index_of(PlaylistManager* manager, PlaylistId id) {
+    if (!manager || id == INVALID_PLAYLIST_ID) return -1;
+    return manager->id_slots[find_id_slot(manager, id)] - 1;
+}
+
+// Rename a playlist
+BOOL playlist_manager_rename(PlaylistManager* manager, Playlist* playlist, const char* name) {
+    if (!manager || !playlist || !name || playlist_manager_find_by_id(manager, playlist->id) != playlist) return FALSE;
+    
+    // Compare the name as it will be stored
+    char stored[sizeof(playlist->name)];
+    strncpy(stored, name, sizeof(stored) - 1);
+    stored[sizeof(stored) - 1] = '\0';
+    if (strcmp(stored, playlist->name) == 0) return TRUE;
+    if (manager->name_slots[find_name_slot(manager, stored)]) return FALSE;
+    
+    int position = playlist_manager_index_of(manager, playlist->id);
+    free_slot(manager, manager->name_slots, find_name_slot(manager, playlist->name), name_hash_at);
+    set_name(playlist, stored);
+    manager->name_slots[find_name_slot(manager, playlist->name)] = position + 1;
+    return TRUE;
+}
+
+// Stems of the files claimed by one save_all, compared as Windows compares file names
+typedef struct {
+    char (*stems)[MAX_PATH];   // Stem claimed for each playlist
+    int* slots;                // Open addressing: playlist position + 1, 0 free
+    int mask;
+} StemSet;
+
+static UINT64 hash_stem(const char* stem) {
+    UINT64 hash = 0xCBF29CE484222325ULL;
+    for (const unsigned char* p = (const unsigned char*)stem; *p; p++) {
+        hash = (hash ^ (unsigned char)tolower(*p)) * 0x100000001B3ULL;
+    }
+    return mix_hash(hash);
+}
+
+// Slot holding the stem, or the free slot where it would go
+static int find_stem_slot(const StemSet* set, const char* stem) {
+    int slot = (int)(hash_stem(stem) & set->mask);
+    while (set->slots[slot] && _stricmp(set->stems[set->slots[slot] - 1], stem) != 0) {
+        slot = (slot + 1) & set->mask;
     }
+    return slot;
+}
+
+// Claim stem for the playlist at position: FALSE if another playlist has it
+static BOOL claim_stem(StemSet* set, int position, const char* stem) {
+    int slot = find_stem_slot(set, stem);
+    if (set->slots[slot]) return FALSE;
     
-    return NULL;
+    strcpy(set->stems[position], stem);
+    set->slots[slot] = position + 1;
+    return TRUE;
+}
+
+// Names Windows keeps for devices, whatever the extension after them
+static BOOL is_device_name(const char* stem) {
+    static const char* devices[] = { "CON", "PRN", "AUX", "NUL" };
+    size_t length = strcspn(stem, ".");
+    for (int i = 0; i < (int)(sizeof(devices) / sizeof(devices[0])); i++) {
+        if (length == 3 && _strnicmp(stem, devices[i], 3) == 0) return TRUE;
+    }
+    return length == 4 && (_strnicmp(stem, "COM", 3) == 0 || _strnicmp(stem, "LPT", 3) == 0) &&
+           stem[3] >= '1' && stem[3] <= '9';
+}
+
+// File name stem for a playlist name, at most room bytes: characters Windows refuses
+// become '_', trailing dots and spaces (which Windows drops) go, and a device name gets
+// a '_' in front
+static void name_stem(const char* name, size_t room, char* stem) {
+    size_t length = 0;
+    for (const unsigned char* p = (const unsigned char*)name; *p && length < room; p++) {
+        stem[length++] = *p < 32 || strchr("\\/:*?\"<>|", *p) ? '_' : (char)*p;
+    }
+    while (length > 0 && (stem[length - 1] == '.' || stem[length - 1] == ' ')) {
+        length--;
+    }
+    stem[length] = '\0';
+    
+    if (length == 0 || is_device_name(stem)) {
+        if (length == room) length--;
+        memmove(stem + 1, stem, length);
+        stem[0] = '_';
+        stem[length + 1] = '\0';
+    }
+}
+
+// Stem of a file in directory with the playlist extension (NULL if it is elsewhere).
+// Copied to stem.
+static const char* stem_in_directory(const char* filename, const char* directory, char* stem) {
+    size_t directory_length = strlen(directory);
+    if (!filename || _strnicmp(filename, directory, directory_length) != 0 || filename[directory_length] != '\\') {
+        return NULL;
+    }
+    
+    const char* name = filename + directory_length + 1;
+    size_t length = strlen(name);
+    size_t extension_length = strlen(PLAYLIST_FILE_EXTENSION);
+    if (strchr(name, '\\') || length <= extension_length || length - extension_length >= MAX_PATH ||
+        _stricmp(name + length - extension_length, PLAYLIST_FILE_EXTENSION) != 0) {
+        return NULL;
+    }
+    
+    memcpy(stem, name, length - extension_length);
+    stem[length - extension_length] = '\0';
+    return stem;
 }
 
 // Save all playlists to files
-BOOL playlist_manager_save_all(PlaylistManager* manager, const char* directory) {
-    if (!manager || !directory) return FALSE;
+BOOL playlist_manager_save_all(PlaylistManager* manager, const char* directory, MP3Library* library) {
+    if (!manager || !directory || !library) return FALSE;
     
     // Create the directory if it doesn't exist
     CreateDirectory(directory, NULL);
     
+    // Room for a stem once the directory, the extension, the id suffix and the longest
+    // sibling extension (.tmp, .log) are in MAX_PATH
+    size_t fixed = strlen(directory) + 1 + strlen(PLAYLIST_FILE_EXTENSION) + PLAYLIST_STEM_SUFFIX_BYTES +
+                   strlen(PLAYLIST_TEMP_EXTENSION) + 1;
+    if (fixed + PLAYLIST_STEM_MIN_BYTES > MAX_PATH) return FALSE;
+    size_t room = MAX_PATH - fixed;
+    
+    StemSet set;
+    set.mask = INITIAL_MANAGER_SLOTS - 1;
+    while (set.mask + 1 < manager->count * 2) {
+        set.mask = set.mask * 2 + 1;
+    }
+    set.stems = (char(*)[MAX_PATH])MEM_ALLOC_TAGGED((manager->count > 0 ? manager->count : 1) * sizeof(*set.stems),
+                                                    MEM_CAT_PLAYLIST);
+    set.slots = (int*)MEM_CALLOC_TAGGED(set.mask + 1, sizeof(int), MEM_CAT_PLAYLIST);
+    BOOL* kept = (BOOL*)MEM_CALLOC_TAGGED(manager->count > 0 ? manager->count : 1, sizeof(BOOL), MEM_CAT_PLAYLIST);
+    if (!set.stems || !set.slots || !kept) {
+        MEM_FREE(set.stems);
+        MEM_FREE(set.slots);
+        MEM_FREE(kept);
+        return FALSE;
+    }
+    
+    // A playlist keeps its file while the file still goes with its name, so that a
+    // suffixed file name does not move when the other playlist goes away
+    char stem[MAX_PATH];
+    char current[MAX_PATH];
+    for (int i = 0; i < manager->count; i++) {
+        Playlist* playlist = manager->playlists[i];
+        name_stem(playlist->name, room, stem);
+        size_t length = strlen(stem);
+        if (stem_in_directory(playlist->file, directory, current) && _strnicmp(current, stem, length) == 0 &&
+            (current[length] == '\0' || strncmp(current + length, " ~", 2) == 0)) {
+            kept[i] = claim_stem(&set, i, current);
+        }
+    }
+    
+    // The others take their name, and the id on a collision
+    for (int i = 0; i < manager->count; i++) {
+        if (kept[i]) continue;
+        
+        Playlist* playlist = manager->playlists[i];
+        name_stem(playlist->name, room, stem);
+        size_t length = strlen(stem);
+        for (int attempt = 0; !claim_stem(&set, i, stem); attempt++) {
+            if (attempt == 0) {
+                snprintf(stem + length, MAX_PATH - length, " ~%08lX", (unsigned long)playlist->id);
+            } else {
+                snprintf(stem + length, MAX_PATH - length, " ~%08lX-%d", (unsigned long)playlist->id, attempt);
+            }
+        }
+    }
+    
+    // Read the playlists that move before any file is written over: one may still have
+    // its tracks in the file another one is about to take
     BOOL success = TRUE;
+    for (int i = 0; i < manager->count; i++) {
+        if (!kept[i] && !playlist_materialize(manager->playlists[i])) {
+            success = FALSE;
+        }
+    }
     
     // Save each playlist
     for (int i = 0; i < manager->count; i++) {
         Playlist* playlist = manager->playlists[i];
         
-        // Create a filename from the playlist name
         char filename[MAX_PATH];
-        sprintf(filename, "%s\\%s%s", directory, playlist->name, PLAYLIST_FILE_EXTENSION);
+        snprintf(filename, sizeof(filename), "%s\\%s%s", directory, set.stems[i], PLAYLIST_FILE_EXTENSION);
         
-        // Replace invalid filename characters
-        for (char* p = filename + strlen(directory) + 1; *p; p++) {
-            if (*p == '\\' || *p == '/' || *p == ':' || *p == '*' || 
-                *p == '?' || *p == '"' || *p == '<' || *p == '>' || *p == '|') {
-                *p = '_';
-            }
+        // Unchanged since loaded from or saved to this very file (an indexed playlist
+        // is not even read)
+        if (!playlist->dirty && playlist->file && strcmp(playlist->file, filename) == 0) continue;
+        
+        // The file it had, to delete once it has moved (unless another playlist took it)
+        char old_file[MAX_PATH];
+        BOOL moved = !kept[i] && stem_in_directory(playlist->file, directory, current) &&
+                     !set.slots[find_stem_slot(&set, current)];
+        if (moved) {
+            strcpy(old_file, playlist->file);
         }
         
         // Save the playlist
-        if (!playlist_save(playlist, filename)) {
+        if (!playlist_save(playlist, filename, library)) {
             success = FALSE;
+        } else if (moved) {
+            DeleteFile(old_file);
+            delete_log(old_file);
         }
     }
     
+    MEM_FREE(set.stems);
+    MEM_FREE(set.slots);
+    MEM_FREE(kept);
     return success;
 }
 
-// Load all playlists from files in a directory
+// Load all playlists from files in a directory (headers only, see playlist_index)
 BOOL playlist_manager_load_all(PlaylistManager* manager, const char* directory, MP3Library* library) {
     if (!manager || !directory || !library) return FALSE;
     
@@ -368,8 +1703,12 @@ BOOL playlist_manager_load_all(PlaylistManager* manager, const char* directory,
         }
     }
     
-    // Construct the search pattern for playlist files
-    sprintf(search_path, "%s\\*%s", directory, PLAYLIST_FILE_EXTENSION);
+    // Construct the search pattern for playlist files (none can be found in a directory
+    // whose name leaves no room for it)
+    int pattern_length = snprintf(search_path, sizeof(search_path), "%s\\*%s", directory, PLAYLIST_FILE_EXTENSION);
+    if (pattern_length < 0 || pattern_length >= (int)sizeof(search_path)) {
+        return FALSE;
+    }
     
     // Find the first file
     hFind = FindFirstFile(search_path, &findFileData);
@@ -385,18 +1724,56 @@ BOOL playlist_manager_load_all(PlaylistManager* manager, const char* directory,
             continue;
         }
         
-        // Construct the full path
+        // Construct the full path, skipping a file whose path does not fit in MAX_PATH
         char filepath[MAX_PATH];
-        sprintf(filepath, "%s\\%s", directory, findFileData.cFileName);
+        int path_length = snprintf(filepath, sizeof(filepath), "%s\\%s", directory, findFileData.cFileName);
+        if (path_length < 0 || path_length >= (int)sizeof(filepath)) {
+            continue;
+        }
         
-        // Load the playlist
-        Playlist* playlist = playlist_load(filepath, library);
-        if (playlist) {
-            playlist_manager_add(manager, playlist);
+        // Index the playlist: its tracks are read on first use
+        Playlist* playlist = playlist_index(filepath, library);
+        if (playlist && !playlist_manager_add(manager, playlist)) {
+            playlist_free(playlist);
         }
         
     } while (FindNextFile(hFind, &findFileData) != 0);
     
     FindClose(hFind);
     return success;
-} 
\ No newline at end of file
+} 
+
+typedef struct {
+    Playlist** pending;
+    volatile LONG failed;
+} MaterializeJob;
+
+static void materialize_task(void* context, int index) {
+    MaterializeJob* job = (MaterializeJob*)context;
+    if (!playlist_materialize(job->pending[index])) {
+        InterlockedIncrement(&job->failed);
+    }
+}
+
+// Read the tracks of every playlist still waiting for them
+BOOL playlist_manager_materialize_all(PlaylistManager* manager, ThreadPool* pool) {
+    if (!manager) return FALSE;
+    
+    Playlist** pending = (Playlist**)MEM_ALLOC_TAGGED((manager->count > 0 ? manager->count : 1) * sizeof(Playlist*),
+                                                      MEM_CAT_PLAYLIST);
+    if (!pending) return FALSE;
+    
+    int count = 0;
+    for (int i = 0; i < manager->count; i++) {
+        if (manager->playlists[i]->source) {
+            pending[count++] = manager->playlists[i];
+        }
+    }
+    
+    // Each task reads its own file and only looks tracks up in the library
+    MaterializeJob job = { pending, 0 };
+    thread_pool_run(pool, count, materialize_task, &job);
+    
+    MEM_FREE(pending);
+    return job.failed == 0;
+}
@@ -0,0 +1,814 @@
+#include "../include/playlistdiff.h"
+#include "../include/memory.h"
+#include <limits.h>
+
+#define PLAYLIST_DIFF_MAGIC "M3PD"
+#define PLAYLIST_DIFF_MAGIC_BYTES 4
+#define PLAYLIST_DIFF_VERSION 1
+#define PLAYLIST_DIFF_VARINT_BYTES 10 // Longest encoding of a 64-bit value
+
+// A track id met in a stretch of the playlists, while looking for anchors
+typedef struct {
+    TrackId id;
+    int count_a;                     // Times in the old version (0: free slot)
+    int count_b;                     // Times in the new one
+    int index_a;                     // Where, when once
+    int index_b;
+} DiffSlot;
+
+typedef struct {
+    const TrackId* a;                // Old version
+    const TrackId* b;                // New version
+    PlaylistDiff* diff;              // Script being written
+    BOOL ok;                         // FALSE once out of memory
+} Differ;
+
+// Scramble the bits of an id before reducing it to a slot (splitmix64 finalizer)
+static UINT64 mix_id(UINT64 id) {
+    id ^= id >> 30;
+    id *= 0xBF58476D1CE4E5B9ULL;
+    id ^= id >> 27;
+    id *= 0x94D049BB133111EBULL;
+    id ^= id >> 31;
+    return id;
+}
+
+// Hash of the ids in order, to tell versions apart
+static UINT64 hash_tracks(const TrackId* ids, int count) {
+    UINT64 hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < count; i++) {
+        hash = (hash ^ mix_id(ids[i])) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// The ids of a playlist in one array (NULL without memory or if it cannot be loaded)
+static TrackId* copy_tracks(Playlist* playlist) {
+    if (!playlist_materialize(playlist)) return NULL;
+    
+    TrackId* ids = (TrackId*)MEM_ALLOC_TAGGED((playlist->track_count > 0 ? playlist->track_count : 1) * sizeof(TrackId),
+                                             MEM_CAT_PLAYLIST);
+    if (ids) {
+        track_seq_copy(&playlist->tracks, 0, playlist->track_count, ids);
+    }
+    return ids;
+}
+
+static PlaylistDiff* create_diff(void) {
+    PlaylistDiff* diff = (PlaylistDiff*)MEM_CALLOC_TAGGED(1, sizeof(PlaylistDiff), MEM_CAT_PLAYLIST);
+    if (diff) {
+        string_pool_init(&diff->missing_paths);
+    }
+    return diff;
+}
+
+void playlist_diff_free(PlaylistDiff* diff) {
+    if (!diff) return;
+    
+    MEM_FREE(diff->hunks);
+    MEM_FREE(diff->ids);
+    string_pool_free(&diff->missing_paths);
+    MEM_FREE(diff);
+}
+
+// Room for count more inserted ids and one more hunk
+static BOOL reserve_diff(PlaylistDiff* diff, int count) {
+    if (diff->id_count + count > diff->id_capacity) {
+        int new_capacity = diff->id_capacity > 0 ? diff->id_capacity * 2 : 64;
+        while (new_capacity < diff->id_count + count) {
+            new_capacity *= 2;
+        }
+        TrackId* new_ids = (TrackId*)MEM_REALLOC_TAGGED(diff->ids, new_capacity * sizeof(TrackId), MEM_CAT_PLAYLIST);
+        if (!new_ids) return FALSE;
+        
+        diff->ids = new_ids;
+        diff->id_capacity = new_capacity;
+    }
+    
+    if (diff->hunk_count == diff->hunk_capacity) {
+        int new_capacity = diff->hunk_capacity > 0 ? diff->hunk_capacity * 2 : 16;
+        PlaylistDiffHunk* new_hunks = (PlaylistDiffHunk*)MEM_REALLOC_TAGGED(diff->hunks,
+                                                                            new_capacity * sizeof(PlaylistDiffHunk),
+                                                                            MEM_CAT_PLAYLIST);
+        if (!new_hunks) return FALSE;
+        
+        diff->hunks = new_hunks;
+        diff->hunk_capacity = new_capacity;
+    }
+    return TRUE;
+}
+
+// Note that a_count old tracks from a_index on give way to b_count new ones from
+// b_index on. Changes come in order; one touching the previous hunk extends it (nothing
+// was matched in between on either side).
+static void emit_change(Differ* differ, int a_index, int a_count, int b_index, int b_count) {
+    PlaylistDiff* diff = differ->diff;
+    if (!differ->ok || (a_count == 0 && b_count == 0)) return;
+    if (!reserve_diff(diff, b_count)) {
+        differ->ok = FALSE;
+        return;
+    }
+    
+    if (b_count > 0) {
+        memcpy(diff->ids + diff->id_count, differ->b + b_index, b_count * sizeof(TrackId));
+    }
+    
+    PlaylistDiffHunk* last = diff->hunk_count > 0 ? &diff->hunks[diff->hunk_count - 1] : NULL;
+    if (last && last->base_index + last->base_count == a_index) {
+        last->base_count += a_count;
+        last->insert_count += b_count;
+    } else {
+        PlaylistDiffHunk* hunk = &diff->hunks[diff->hunk_count++];
+        hunk->base_index = a_index;
+        hunk->base_count = a_count;
+        hunk->insert_first = diff->id_count;
+        hunk->insert_count = b_count;
+    }
+    diff->id_count += b_count;
+}
+
+// Slot holding id, or the free slot where it would go
+static int find_diff_slot(const DiffSlot* slots, int mask, TrackId id) {
+    int slot = (int)(mix_id(id) & mask);
+    while (slots[slot].count_a && slots[slot].id != id) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Anchors of a stretch: the tracks found exactly once in each version, longest run of
+// them in the same order on both sides (patience sorting). Fills anchors with pairs of
+// positions, old then new, and shared with whether any id is on both sides. Returns
+// their number, -1 without memory.
+static int find_anchors(const Differ* differ, int a_lo, int a_hi, int b_lo, int b_hi, int** anchors, BOOL* shared) {
+    *anchors = NULL;
+    *shared = FALSE;
+    
+    int capacity = 16;
+    while (capacity < (a_hi - a_lo) * 2) {
+        capacity *= 2;
+    }
+    int mask = capacity - 1;
+    DiffSlot* slots = (DiffSlot*)MEM_CALLOC_TAGGED(capacity, sizeof(DiffSlot), MEM_CAT_PLAYLIST);
+    if (!slots) return -1;
+    
+    for (int i = a_lo; i < a_hi; i++) {
+        DiffSlot* slot = &slots[find_diff_slot(slots, mask, differ->a[i])];
+        slot->id = differ->a[i];
+        slot->count_a++;
+        slot->index_a = i;
+    }
+    
+    // Only ids of the old version matter on the new side
+    for (int j = b_lo; j < b_hi; j++) {
+        DiffSlot* slot = &slots[find_diff_slot(slots, mask, differ->b[j])];
+        if (slot->count_a) {
+            slot->count_b++;
+            slot->index_b = j;
+            *shared = TRUE;
+        }
+    }
+    
+    // Unique pairs in old order, then the longest increasing run of their new positions
+    int pair_count = 0;
+    int* pairs = (int*)MEM_ALLOC_TAGGED((a_hi - a_lo) * 2 * sizeof(int), MEM_CAT_PLAYLIST);
+    int* tails = (int*)MEM_ALLOC_TAGGED((a_hi - a_lo) * sizeof(int), MEM_CAT_PLAYLIST);
+    int* previous = (int*)MEM_ALLOC_TAGGED((a_hi - a_lo) * sizeof(int), MEM_CAT_PLAYLIST);
+    int count = -1;
+    if (pairs && tails && previous) {
+        for (int i = a_lo; i < a_hi; i++) {
+            const DiffSlot* slot = &slots[find_diff_slot(slots, mask, differ->a[i])];
+            if (slot->count_a == 1 && slot->count_b == 1) {
+                pairs[pair_count * 2] = i;
+                pairs[pair_count * 2 + 1] = slot->index_b;
+                pair_count++;
+            }
+        }
+        
+        // tails[k]: pair ending the best run of length k + 1 found so far
+        int piles = 0;
+        for (int p = 0; p < pair_count; p++) {
+            int b = pairs[p * 2 + 1];
+            int low = 0;
+            int high = piles;
+            while (low < high) {
+                int middle = (low + high) / 2;
+                if (pairs[tails[middle] * 2 + 1] < b) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            previous[p] = low > 0 ? tails[low - 1] : -1;
+            tails[low] = p;
+            if (low == piles) piles++;
+        }
+        
+        count = 0;
+        if (piles > 0) {
+            *anchors = (int*)MEM_ALLOC_TAGGED(piles * 2 * sizeof(int), MEM_CAT_PLAYLIST);
+            if (*anchors) {
+                for (int p = tails[piles - 1], k = piles - 1; p >= 0; p = previous[p], k--) {
+                    (*anchors)[k * 2] = pairs[p * 2];
+                    (*anchors)[k * 2 + 1] = pairs[p * 2 + 1];
+                }
+                count = piles;
+            } else {
+                count = -1;
+            }
+        }
+    }
+    
+    MEM_FREE(pairs);
+    MEM_FREE(tails);
+    MEM_FREE(previous);
+    MEM_FREE(slots);
+    return count;
+}
+
+// Match a stretch track by track (Myers' O(ND) greedy algorithm), or replace it whole
+// once the edit distance passes PLAYLIST_DIFF_MAX_COST
+static void diff_myers(Differ* differ, int a_lo, int a_hi, int b_lo, int b_hi) {
+    const TrackId* a = differ->a + a_lo;
+    const TrackId* b = differ->b + b_lo;
+    int n = a_hi - a_lo;
+    int m = b_hi - b_lo;
+    int max_cost = n + m < PLAYLIST_DIFF_MAX_COST ? n + m : PLAYLIST_DIFF_MAX_COST;
+    
+    // Row d holds the furthest x on each diagonal k = x - y, -d to d, at offset d * d
+    int* rows = (int*)MEM_ALLOC_TAGGED((size_t)(max_cost + 1) * (max_cost + 1) * sizeof(int), MEM_CAT_PLAYLIST);
+    if (!rows) {
+        differ->ok = FALSE;
+        return;
+    }
+    
+    int cost = -1;
+    for (int d = 0; d <= max_cost && cost < 0; d++) {
+        int* row = rows + d * d + d;
+        const int* above = rows + (d - 1) * (d - 1) + (d - 1);
+        for (int k = -d; k <= d; k += 2) {
+            int x;
+            if (d == 0) {
+                x = 0;
+            } else if (k == -d || (k != d && above[k - 1] < above[k + 1])) {
+                x = above[k + 1];            // Down: a new track inserted
+            } else {
+                x = above[k - 1] + 1;        // Right: an old track removed
+            }
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            row[k] = x;
+            if (x >= n && y >= m) {
+                cost = d;
+                break;
+            }
+        }
+    }
+    
+    if (cost < 0) {
+        emit_change(differ, a_lo, n, b_lo, m);
+        MEM_FREE(rows);
+        return;
+    }
+    
+    // Walk back from the end, noting the edits last to first: position in the old
+    // version, in the new one, and whether it is an insertion
+    int* steps = (int*)MEM_ALLOC_TAGGED((cost > 0 ? cost : 1) * 3 * sizeof(int), MEM_CAT_PLAYLIST);
+    if (!steps) {
+        differ->ok = FALSE;
+        MEM_FREE(rows);
+        return;
+    }
+    int x = n;
+    int y = m;
+    for (int d = cost; d > 0; d--) {
+        const int* above = rows + (d - 1) * (d - 1) + (d - 1);
+        int k = x - y;
+        BOOL down = k == -d || (k != d && above[k - 1] < above[k + 1]);
+        int previous_k = down ? k + 1 : k - 1;
+        int previous_x = above[previous_k];
+        int previous_y = previous_x - previous_k;
+        int* step = steps + (d - 1) * 3;
+        step[0] = previous_x;
+        step[1] = previous_y;
+        step[2] = down;
+        x = previous_x;
+        y = previous_y;
+    }
+    
+    for (int s = 0; s < cost; s++) {
+        const int* step = steps + s * 3;
+        if (step[2]) {
+            emit_change(differ, a_lo + step[0], 0, b_lo + step[1], 1);
+        } else {
+            emit_change(differ, a_lo + step[0], 1, b_lo + step[1], 0);
+        }
+    }
+    
+    MEM_FREE(steps);
+    MEM_FREE(rows);
+}
+
+// Script for one stretch of both versions, emitted in order
+static void diff_range(Differ* differ, int a_lo, int a_hi, int b_lo, int b_hi, int depth) {
+    if (!differ->ok) return;
+    
+    // Common ends cost nothing
+    while (a_lo < a_hi && b_lo < b_hi && differ->a[a_lo] == differ->b[b_lo]) {
+        a_lo++;
+        b_lo++;
+    }
+    while (a_lo < a_hi && b_lo < b_hi && differ->a[a_hi - 1] == differ->b[b_hi - 1]) {
+        a_hi--;
+        b_hi--;
+    }
+    if (a_lo == a_hi || b_lo == b_hi) {
+        emit_change(differ, a_lo, a_hi - a_lo, b_lo, b_hi - b_lo);
+        return;
+    }
+    
+    if (depth < PLAYLIST_DIFF_MAX_DEPTH) {
+        int* anchors;
+        BOOL shared;
+        int count = find_anchors(differ, a_lo, a_hi, b_lo, b_hi, &anchors, &shared);
+        if (count < 0) {
+            differ->ok = FALSE;
+            return;
+        }
+        
+        // Nothing in common: replaced whole
+        if (!shared) {
+            emit_change(differ, a_lo, a_hi - a_lo, b_lo, b_hi - b_lo);
+            return;
+        }
+        
+        // The stretches between anchors, each on its own
+        if (count > 0) {
+            for (int k = 0; k < count; k++) {
+                diff_range(differ, a_lo, anchors[k * 2], b_lo, anchors[k * 2 + 1], depth + 1);
+                a_lo = anchors[k * 2] + 1;
+                b_lo = anchors[k * 2 + 1] + 1;
+            }
+            diff_range(differ, a_lo, a_hi, b_lo, b_hi, depth + 1);
+            MEM_FREE(anchors);
+            return;
+        }
+    }
+    
+    diff_myers(differ, a_lo, a_hi, b_lo, b_hi);
+}
+
+// Script between two arrays of ids
+static PlaylistDiff* diff_tracks(const TrackId* a, int a_count, const TrackId* b, int b_count) {
+    Differ differ;
+    differ.a = a;
+    differ.b = b;
+    differ.diff = create_diff();
+    differ.ok = differ.diff != NULL;
+    if (!differ.ok) return NULL;
+    
+    differ.diff->base_length = a_count;
+    differ.diff->result_length = b_count;
+    differ.diff->base_hash = hash_tracks(a, a_count);
+    differ.diff->result_hash = hash_tracks(b, b_count);
+    diff_range(&differ, 0, a_count, 0, b_count, 0);
+    
+    if (!differ.ok) {
+        playlist_diff_free(differ.diff);
+        return NULL;
+    }
+    return differ.diff;
+}
+
+// Placeholder ids sorted with their entry, to find their path quickly
+typedef struct {
+    TrackId id;
+    UINT32 entry;
+} DiffMissing;
+
+static int compare_diff_missing(const void* a, const void* b) {
+    TrackId x = ((const DiffMissing*)a)->id;
+    TrackId y = ((const DiffMissing*)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+// Keep in the script the path of every inserted id that is a placeholder of source
+static BOOL add_missing_paths(PlaylistDiff* diff, const Playlist* source) {
+    UINT32 count = source->missing_paths.count;
+    if (count == 0) return TRUE;
+    
+    DiffMissing* sorted = (DiffMissing*)MEM_ALLOC_TAGGED(count * sizeof(DiffMissing), MEM_CAT_PLAYLIST);
+    if (!sorted) return FALSE;
+    
+    for (UINT32 i = 0; i < count; i++) {
+        sorted[i].id = source->missing_ids[i];
+        sorted[i].entry = i;
+    }
+    qsort(sorted, count, sizeof(DiffMissing), compare_diff_missing);
+    
+    BOOL ok = TRUE;
+    for (int i = 0; ok && i < diff->id_count; i++) {
+        DiffMissing key;
+        key.id = diff->ids[i];
+        const DiffMissing* found = (const DiffMissing*)bsearch(&key, sorted, count, sizeof(DiffMissing),
+                                                               compare_diff_missing);
+        if (found) {
+            ok = string_pool_append(&diff->missing_paths,
+                                    source->missing_paths.text + source->missing_paths.offsets[found->entry]);
+        }
+    }
+    
+    MEM_FREE(sorted);
+    return ok;
+}
+
+PlaylistDiff* playlist_diff(Playlist* from, Playlist* to) {
+    if (!from || !to) return NULL;
+    
+    TrackId* a = copy_tracks(from);
+    TrackId* b = copy_tracks(to);
+    PlaylistDiff* diff = a && b ? diff_tracks(a, from->track_count, b, to->track_count) : NULL;
+    if (diff && !add_missing_paths(diff, to)) {
+        playlist_diff_free(diff);
+        diff = NULL;
+    }
+    
+    MEM_FREE(a);
+    MEM_FREE(b);
+    return diff;
+}
+
+BOOL playlist_diff_apply(const PlaylistDiff* diff, Playlist* playlist) {
+    if (!diff || !playlist || !playlist_materialize(playlist) || playlist->track_count != diff->base_length) {
+        return FALSE;
+    }
+    
+    // Only the version the script was made from
+    UINT64 hash = 0xCBF29CE484222325ULL;
+    int length = 0;
+    for (int i = 0; i < playlist->track_count; i += length) {
+        const TrackId* run = track_seq_run(&playlist->tracks, i, &length);
+        for (int k = 0; k < length; k++) {
+            hash = (hash ^ mix_id(run[k])) * 0x100000001B3ULL;
+        }
+    }
+    if (hash != diff->base_hash) return FALSE;
+    
+    for (UINT32 i = 0; i < diff->missing_paths.count; i++) {
+        if (!playlist_add_placeholder(playlist, diff->missing_paths.text + diff->missing_paths.offsets[i])) {
+            return FALSE;
+        }
+    }
+    
+    // From the last hunk back, so that the positions of the ones before still hold
+    for (int h = diff->hunk_count - 1; h >= 0; h--) {
+        const PlaylistDiffHunk* hunk = &diff->hunks[h];
+        if (hunk->base_count > 0 && !playlist_remove_tracks(playlist, hunk->base_index, hunk->base_count)) {
+            return FALSE;
+        }
+        if (hunk->insert_count > 0 &&
+            !playlist_insert_ids(playlist, hunk->base_index, diff->ids + hunk->insert_first, hunk->insert_count)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Copy count ids, none at all when count is 0 (either array may then be NULL: a side
+// with no insertions, an empty base). Returns count.
+static int copy_ids(TrackId* to, const TrackId* from, int count) {
+    if (count > 0) {
+        memcpy(to, from, count * sizeof(TrackId));
+    }
+    return count;
+}
+
+// Append to out what one side made of base[start, end), from its hunk first on (the
+// hunks inside the stretch). Returns the number of ids appended.
+static int side_version(const PlaylistDiff* diff, int first, int last, const TrackId* base, int start, int end,
+                        TrackId* out) {
+    int length = 0;
+    int cursor = start;
+    for (int h = first; h < last; h++) {
+        const PlaylistDiffHunk* hunk = &diff->hunks[h];
+        length += copy_ids(out + length, base + cursor, hunk->base_index - cursor);
+        length += copy_ids(out + length, diff->ids + hunk->insert_first, hunk->insert_count);
+        cursor = hunk->base_index + hunk->base_count;
+    }
+    return length + copy_ids(out + length, base + cursor, end - cursor);
+}
+
+static int compare_track_ids(const void* a, const void* b) {
+    TrackId x = *(const TrackId*)a;
+    TrackId y = *(const TrackId*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Hunk h of a side falls in the stretch from start to end of the other changes: it
+// starts inside, or where the stretch starts
+static BOOL in_stretch(const PlaylistDiff* diff, int h, int start, int end) {
+    return h < diff->hunk_count && (diff->hunks[h].base_index < end || diff->hunks[h].base_index == start);
+}
+
+// Resolve a stretch both sides changed differently: ours, then what theirs added there
+// (ids neither in ours' version nor in the base stretch). Returns the ids appended to
+// out, -1 without memory.
+static int union_version(const TrackId* ours, int ours_length, const TrackId* theirs, int theirs_length,
+                         const TrackId* base, int base_length, TrackId* out) {
+    int known_length = ours_length + base_length;
+    TrackId* known = (TrackId*)MEM_ALLOC_TAGGED((known_length > 0 ? known_length : 1) * sizeof(TrackId),
+                                                MEM_CAT_PLAYLIST);
+    if (!known) return -1;
+    
+    copy_ids(known, ours, ours_length);
+    copy_ids(known + ours_length, base, base_length);
+    qsort(known, known_length, sizeof(TrackId), compare_track_ids);
+    
+    int length = copy_ids(out, ours, ours_length);
+    for (int i = 0; i < theirs_length; i++) {
+        if (!bsearch(&theirs[i], known, known_length, sizeof(TrackId), compare_track_ids)) {
+            out[length++] = theirs[i];
+        }
+    }
+    
+    MEM_FREE(known);
+    return length;
+}
+
+// Merge the changes of two scripts from the same base into one array of ids. Returns
+// its length, -1 without memory.
+static int merge_tracks(const TrackId* base, int base_count, const PlaylistDiff* ours, const PlaylistDiff* theirs,
+                        TrackId* out, int* conflicts) {
+    TrackId* ours_version = NULL;
+    TrackId* theirs_version = NULL;
+    int version_capacity = 0;
+    int length = 0;
+    int cursor = 0;
+    int i = 0;
+    int j = 0;
+    
+    while (i < ours->hunk_count || j < theirs->hunk_count) {
+        int start = INT_MAX;
+        if (i < ours->hunk_count) start = ours->hunks[i].base_index;
+        if (j < theirs->hunk_count && theirs->hunks[j].base_index < start) start = theirs->hunks[j].base_index;
+        
+        length += copy_ids(out + length, base + cursor, start - cursor);
+        
+        // The hunks of both sides that overlap, however they chain
+        int end = start;
+        int i_end = i;
+        int j_end = j;
+        for (BOOL grew = TRUE; grew;) {
+            grew = FALSE;
+            if (in_stretch(ours, i_end, start, end)) {
+                const PlaylistDiffHunk* hunk = &ours->hunks[i_end++];
+                if (hunk->base_index + hunk->base_count > end) end = hunk->base_index + hunk->base_count;
+                grew = TRUE;
+            }
+            if (in_stretch(theirs, j_end, start, end)) {
+                const PlaylistDiffHunk* hunk = &theirs->hunks[j_end++];
+                if (hunk->base_index + hunk->base_count > end) end = hunk->base_index + hunk->base_count;
+                grew = TRUE;
+            }
+        }
+        
+        if (j_end == j) {
+            length += side_version(ours, i, i_end, base, start, end, out + length);
+        } else if (i_end == i) {
+            length += side_version(theirs, j, j_end, base, start, end, out + length);
+        } else {
+            // Both sides changed the stretch: the same way, or not
+            int needed = end - start;
+            for (int h = i; h < i_end; h++) needed += ours->hunks[h].insert_count;
+            for (int h = j; h < j_end; h++) needed += theirs->hunks[h].insert_count;
+            if (needed > version_capacity) {
+                MEM_FREE(ours_version);
+                MEM_FREE(theirs_version);
+                version_capacity = needed;
+                ours_version = (TrackId*)MEM_ALLOC_TAGGED(needed * sizeof(TrackId), MEM_CAT_PLAYLIST);
+                theirs_version = (TrackId*)MEM_ALLOC_TAGGED(needed * sizeof(TrackId), MEM_CAT_PLAYLIST);
+                if (!ours_version || !theirs_version) {
+                    length = -1;
+                    break;
+                }
+            }
+            
+            int ours_length = side_version(ours, i, i_end, base, start, end, ours_version);
+            int theirs_length = side_version(theirs, j, j_end, base, start, end, theirs_version);
+            if (ours_length == theirs_length &&
+                memcmp(ours_version, theirs_version, ours_length * sizeof(TrackId)) == 0) {
+                length += copy_ids(out + length, ours_version, ours_length);
+            } else {
+                int added = union_version(ours_version, ours_length, theirs_version, theirs_length, base + start,
+                                          end - start, out + length);
+                if (added < 0) {
+                    length = -1;
+                    break;
+                }
+                length += added;
+                (*conflicts)++;
+            }
+        }
+        
+        cursor = end;
+        i = i_end;
+        j = j_end;
+    }
+    
+    if (length >= 0) {
+        length += copy_ids(out + length, base + cursor, base_count - cursor);
+    }
+    
+    MEM_FREE(ours_version);
+    MEM_FREE(theirs_version);
+    return length;
+}
+
+PlaylistDiff* playlist_merge(Playlist* base, Playlist* ours, Playlist* theirs, int* conflicts) {
+    if (!base || !ours || !theirs) return NULL;
+    
+    int conflict_count = 0;
+    TrackId* base_ids = copy_tracks(base);
+    TrackId* ours_ids = copy_tracks(ours);
+    TrackId* theirs_ids = copy_tracks(theirs);
+    PlaylistDiff* ours_diff = NULL;
+    PlaylistDiff* theirs_diff = NULL;
+    TrackId* merged = NULL;
+    PlaylistDiff* result = NULL;
+    
+    if (base_ids && ours_ids && theirs_ids) {
+        ours_diff = diff_tracks(base_ids, base->track_count, ours_ids, ours->track_count);
+        theirs_diff = diff_tracks(base_ids, base->track_count, theirs_ids, theirs->track_count);
+    }
+    
+    // The merge holds the base and at most everything either side inserted
+    if (ours_diff && theirs_diff) {
+        int capacity = base->track_count + ours_diff->id_count + theirs_diff->id_count;
+        merged = (TrackId*)MEM_ALLOC_TAGGED((capacity > 0 ? capacity : 1) * sizeof(TrackId), MEM_CAT_PLAYLIST);
+    }
+    int merged_count = merged ? merge_tracks(base_ids, base->track_count, ours_diff, theirs_diff, merged,
+                                             &conflict_count) : -1;
+    
+    // What ours needs to become the merge; the new placeholders can only come from theirs
+    if (merged_count >= 0) {
+        result = diff_tracks(ours_ids, ours->track_count, merged, merged_count);
+        if (result && !add_missing_paths(result, theirs)) {
+            playlist_diff_free(result);
+            result = NULL;
+        }
+    }
+    if (conflicts) {
+        *conflicts = conflict_count;
+    }
+    
+    MEM_FREE(base_ids);
+    MEM_FREE(ours_ids);
+    MEM_FREE(theirs_ids);
+    MEM_FREE(merged);
+    playlist_diff_free(ours_diff);
+    playlist_diff_free(theirs_diff);
+    return result;
+}
+
+// Varints as the binary playlist format writes them: 7 bits a byte, low bits first
+static size_t put_diff_varint(unsigned char* out, UINT64 value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+static BOOL get_diff_varint(const unsigned char** cursor, const unsigned char* end, UINT64* value) {
+    UINT64 result = 0;
+    for (int shift = 0; shift < 64 && *cursor < end; shift += 7) {
+        unsigned char byte = *(*cursor)++;
+        result |= (UINT64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+size_t playlist_diff_encode(const PlaylistDiff* diff, unsigned char** out) {
+    *out = NULL;
+    if (!diff) return 0;
+    
+    // Magic and version, 7 header varints, 3 per hunk, the ids, then the paths
+    size_t capacity = PLAYLIST_DIFF_MAGIC_BYTES + 1 + (7 + (size_t)diff->hunk_count * 3) * PLAYLIST_DIFF_VARINT_BYTES +
+                      (size_t)diff->id_count * sizeof(UINT64) + diff->missing_paths.size;
+    unsigned char* bytes = (unsigned char*)MEM_ALLOC_TAGGED(capacity, MEM_CAT_PLAYLIST);
+    if (!bytes) return 0;
+    
+    unsigned char* p = bytes;
+    memcpy(p, PLAYLIST_DIFF_MAGIC, PLAYLIST_DIFF_MAGIC_BYTES);
+    p += PLAYLIST_DIFF_MAGIC_BYTES;
+    *p++ = PLAYLIST_DIFF_VERSION;
+    p += put_diff_varint(p, (UINT64)diff->base_length);
+    p += put_diff_varint(p, (UINT64)diff->result_length);
+    p += put_diff_varint(p, diff->base_hash);
+    p += put_diff_varint(p, diff->result_hash);
+    p += put_diff_varint(p, (UINT64)diff->hunk_count);
+    p += put_diff_varint(p, (UINT64)diff->id_count);
+    p += put_diff_varint(p, (UINT64)diff->missing_paths.count);
+    
+    int previous_end = 0;
+    for (int h = 0; h < diff->hunk_count; h++) {
+        const PlaylistDiffHunk* hunk = &diff->hunks[h];
+        p += put_diff_varint(p, (UINT64)(hunk->base_index - previous_end));
+        p += put_diff_varint(p, (UINT64)hunk->base_count);
+        p += put_diff_varint(p, (UINT64)hunk->insert_count);
+        previous_end = hunk->base_index + hunk->base_count;
+    }
+    
+    // Ids are hashes: every byte counts, so they are written whole
+    for (int i = 0; i < diff->id_count; i++) {
+        for (int b = 0; b < 8; b++) {
+            *p++ = (unsigned char)(diff->ids[i] >> (8 * b));
+        }
+    }
+    if (diff->missing_paths.size > 0) {
+        memcpy(p, diff->missing_paths.text, diff->missing_paths.size);
+        p += diff->missing_paths.size;
+    }
+    
+    *out = bytes;
+    return (size_t)(p - bytes);
+}
+
+PlaylistDiff* playlist_diff_decode(const unsigned char* bytes, size_t size) {
+    if (!bytes || size < PLAYLIST_DIFF_MAGIC_BYTES + 1 || memcmp(bytes, PLAYLIST_DIFF_MAGIC, PLAYLIST_DIFF_MAGIC_BYTES) != 0 ||
+        bytes[PLAYLIST_DIFF_MAGIC_BYTES] != PLAYLIST_DIFF_VERSION) {
+        return NULL;
+    }
+    
+    const unsigned char* p = bytes + PLAYLIST_DIFF_MAGIC_BYTES + 1;
+    const unsigned char* end = bytes + size;
+    UINT64 base_length, result_length, base_hash, result_hash, hunk_count, id_count, path_count;
+    if (!get_diff_varint(&p, end, &base_length) || !get_diff_varint(&p, end, &result_length) ||
+        !get_diff_varint(&p, end, &base_hash) || !get_diff_varint(&p, end, &result_hash) ||
+        !get_diff_varint(&p, end, &hunk_count) || !get_diff_varint(&p, end, &id_count) ||
+        !get_diff_varint(&p, end, &path_count) || base_length > INT_MAX || result_length > INT_MAX ||
+        hunk_count > (UINT64)(end - p) || id_count > (UINT64)(end - p) / sizeof(UINT64)) {
+        return NULL;
+    }
+    
+    PlaylistDiff* diff = create_diff();
+    if (!diff) return NULL;
+    diff->base_length = (int)base_length;
+    diff->result_length = (int)result_length;
+    diff->base_hash = base_hash;
+    diff->result_hash = result_hash;
+    
+    // Every hunk must lie in the base, after the previous one, and its ids in the script
+    BOOL ok = TRUE;
+    UINT64 previous_end = 0;
+    UINT64 inserted = 0;
+    for (UINT64 h = 0; ok && h < hunk_count; h++) {
+        UINT64 gap, base_count, insert_count;
+        ok = get_diff_varint(&p, end, &gap) && get_diff_varint(&p, end, &base_count) &&
+             get_diff_varint(&p, end, &insert_count) && gap <= base_length && base_count <= base_length &&
+             insert_count <= id_count && previous_end + gap + base_count <= base_length &&
+             inserted + insert_count <= id_count && reserve_diff(diff, 0);
+        if (ok) {
+            PlaylistDiffHunk* hunk = &diff->hunks[diff->hunk_count++];
+            hunk->base_index = (int)(previous_end + gap);
+            hunk->base_count = (int)base_count;
+            hunk->insert_first = (int)inserted;
+            hunk->insert_count = (int)insert_count;
+            previous_end += gap + base_count;
+            inserted += insert_count;
+        }
+    }
+    ok = ok && inserted == id_count && (UINT64)(end - p) >= id_count * sizeof(UINT64) &&
+         reserve_diff(diff, (int)id_count);
+    
+    for (UINT64 i = 0; ok && i < id_count; i++) {
+        UINT64 id = 0;
+        for (int b = 0; b < 8; b++) {
+            id |= (UINT64)p[b] << (8 * b);
+        }
+        diff->ids[diff->id_count++] = (TrackId)id;
+        p += sizeof(UINT64);
+    }
+    
+    // The paths, each ending in a NUL
+    for (UINT64 i = 0; ok && i < path_count; i++) {
+        const unsigned char* path_end = (const unsigned char*)memchr(p, '\0', (size_t)(end - p));
+        ok = path_end && string_pool_append(&diff->missing_paths, (const char*)p);
+        p = path_end ? path_end + 1 : end;
+    }
+    
+    if (!ok || p != end) {
+        playlist_diff_free(diff);
+        return NULL;
+    }
+    return diff;
+}
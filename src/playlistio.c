@@ -0,0 +1,686 @@
+#include "../include/playlistio.h"
+#include "../include/memory.h"
+#include "../include/strscan.h"
+#include <ctype.h>
+
+#define UTF8_BOM "\xEF\xBB\xBF"
+
+// Longest tag read from an XSPF file (only its name is used)
+#define XSPF_TAG_MAX 128
+
+// Sequential reader over fixed blocks of a file
+typedef struct {
+    FILE* file;
+    size_t position;
+    size_t end;
+    char data[PLAYLIST_IO_BUFFER];
+} BlockReader;
+
+// State of one import
+typedef struct {
+    Playlist* playlist;
+    MP3Library* library;
+    BlockReader reader;
+    char base[PLAYLIST_IO_LINE_MAX];   // Directory of the playlist file, relative entries start from it
+    BOOL utf8;                         // Text is UTF-8 rather than in the system code page
+    BOOL ok;
+    
+    // Entries waiting for the next batched lookup
+    StringPool batch;
+    const char* paths[PLAYLIST_IO_BATCH];
+    
+    char line[PLAYLIST_IO_LINE_MAX];
+    char path[PLAYLIST_IO_LINE_MAX];
+    char converted[PLAYLIST_IO_LINE_MAX];
+} Importer;
+
+// Placeholder path of a track id, for lookups by binary search
+typedef struct {
+    TrackId id;
+    const char* path;
+} ExportMissing;
+
+// State of one export
+typedef struct {
+    FILE* file;
+    int format;
+    char base[PLAYLIST_IO_LINE_MAX];   // Directory of the playlist file: entries below it are written relative
+    size_t base_length;
+    ExportMissing* missing;            // Placeholders sorted by id
+    int missing_count;
+    
+    char path[PLAYLIST_IO_LINE_MAX];
+    char line[PLAYLIST_IO_LINE_MAX];
+    char converted[PLAYLIST_IO_LINE_MAX];
+} Exporter;
+
+int playlist_format_from_name(const char* filename) {
+    const char* dot = filename ? strrchr(filename, '.') : NULL;
+    if (!dot || strchr(dot, '\\') || strchr(dot, '/')) return PLAYLIST_FORMAT_UNKNOWN;
+    
+    if (_stricmp(dot, ".m3u") == 0) return PLAYLIST_FORMAT_M3U;
+    if (_stricmp(dot, ".m3u8") == 0) return PLAYLIST_FORMAT_M3U8;
+    if (_stricmp(dot, ".pls") == 0) return PLAYLIST_FORMAT_PLS;
+    if (_stricmp(dot, ".xspf") == 0) return PLAYLIST_FORMAT_XSPF;
+    return PLAYLIST_FORMAT_UNKNOWN;
+}
+
+// Read up to the next delimiter (consumed, not stored) into out, or skip it when out is
+// NULL. Text past size - 1 bytes is dropped and sets cut. FALSE once the file is over.
+static BOOL read_until(BlockReader* reader, char delimiter, char* out, size_t size, BOOL* cut) {
+    size_t length = 0;
+    BOOL any = FALSE;
+    *cut = FALSE;
+    for (;;) {
+        if (reader->position == reader->end) {
+            reader->end = fread(reader->data, 1, sizeof(reader->data), reader->file);
+            reader->position = 0;
+            if (reader->end == 0) break;
+        }
+        any = TRUE;
+        
+        const char* start = reader->data + reader->position;
+        size_t available = reader->end - reader->position;
+        const char* found = (const char*)memchr(start, delimiter, available);
+        size_t take = found ? (size_t)(found - start) : available;
+        if (out) {
+            size_t room = size - 1 - length;
+            size_t copied = take < room ? take : room;
+            memcpy(out + length, start, copied);
+            length += copied;
+            *cut = *cut || copied < take;
+        }
+        reader->position += take + (found ? 1 : 0);
+        if (found) break;
+    }
+    if (out) out[length] = '\0';
+    return any;
+}
+
+static BOOL is_ascii(const char* text) {
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p >= 0x80) return FALSE;
+    }
+    return TRUE;
+}
+
+// Convert text between code pages through UTF-16. FALSE if it does not fit in size.
+static BOOL convert_text(const char* text, UINT from, UINT to, char* out, int size) {
+    WCHAR wide[PLAYLIST_IO_LINE_MAX];
+    int length = MultiByteToWideChar(from, 0, text, -1, wide, PLAYLIST_IO_LINE_MAX);
+    return length > 0 && WideCharToMultiByte(to, 0, wide, -1, out, size, NULL, NULL) > 0;
+}
+
+// Remove leading and trailing blanks (and the CR of CRLF lines)
+static char* trim(char* text) {
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char)text[length - 1])) {
+        text[--length] = '\0';
+    }
+    return text;
+}
+
+// Directory of a file as a full path, with its final separator
+static size_t directory_of(const char* filename, char* base, size_t size) {
+    char full[PLAYLIST_IO_LINE_MAX];
+    DWORD length = GetFullPathName(filename, sizeof(full), full, NULL);
+    const char* source = length > 0 && length < sizeof(full) ? full : filename;
+    
+    size_t keep = 0;
+    for (size_t i = 0; source[i]; i++) {
+        if (source[i] == '\\' || source[i] == '/') keep = i + 1;
+    }
+    if (keep >= size) keep = 0;
+    
+    memcpy(base, source, keep);
+    base[keep] = '\0';
+    for (size_t i = 0; i < keep; i++) {
+        if (base[i] == '/') base[i] = '\\';
+    }
+    return keep;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decode the %XX escapes of a URI in place
+static void percent_decode(char* text) {
+    char* out = text;
+    for (const char* in = text; *in; in++) {
+        int high = in[0] == '%' ? hex_value(in[1]) : -1;
+        int low = high >= 0 ? hex_value(in[2]) : -1;
+        if (low >= 0) {
+            *out++ = (char)(high * 16 + low);
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+// Decode the entities of XML text in place
+static void xml_unescape(char* text) {
+    static const struct { const char* name; char value; } entities[] = {
+        { "amp;", '&' }, { "lt;", '<' }, { "gt;", '>' }, { "quot;", '"' }, { "apos;", '\'' }
+    };
+    char* out = text;
+    for (const char* in = text; *in; in++) {
+        if (*in != '&') {
+            *out++ = *in;
+            continue;
+        }
+        
+        BOOL decoded = FALSE;
+        for (int e = 0; e < (int)(sizeof(entities) / sizeof(entities[0])) && !decoded; e++) {
+            size_t length = strlen(entities[e].name);
+            if (strncmp(in + 1, entities[e].name, length) == 0) {
+                *out++ = entities[e].value;
+                in += length;
+                decoded = TRUE;
+            }
+        }
+        
+        // Numeric references, written as UTF-8
+        if (!decoded && in[1] == '#') {
+            char* end;
+            unsigned long code = in[2] == 'x' ? strtoul(in + 3, &end, 16) : strtoul(in + 2, &end, 10);
+            if (*end == ';' && code > 0 && code < 0x10000) {
+                if (code < 0x80) {
+                    *out++ = (char)code;
+                } else if (code < 0x800) {
+                    *out++ = (char)(0xC0 | (code >> 6));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                } else {
+                    *out++ = (char)(0xE0 | (code >> 12));
+                    *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                }
+                in = end;
+                decoded = TRUE;
+            }
+        }
+        if (!decoded) {
+            *out++ = '&';
+        }
+    }
+    *out = '\0';
+}
+
+// Length of the part of a path that ".." never goes above: "C:\", "\\server\share\" or "\"
+static size_t root_length(const char* path) {
+    if (isalpha((unsigned char)path[0]) && path[1] == ':') return path[2] == '\\' ? 3 : 2;
+    if (path[0] == '\\' && path[1] == '\\') {
+        const char* p = path + 2;
+        for (int separators = 0; *p && separators < 2; p++) {
+            if (*p == '\\') separators++;
+        }
+        return (size_t)(p - path);
+    }
+    return path[0] == '\\' ? 1 : 0;
+}
+
+// Drop the empty, "." and ".." segments of a path in place
+static void remove_dot_segments(char* path) {
+    char* root = path + root_length(path);
+    char* out = root;
+    const char* in = root;
+    while (*in) {
+        const char* end = strchr(in, '\\');
+        size_t length = end ? (size_t)(end - in) : strlen(in);
+        if (length == 2 && in[0] == '.' && in[1] == '.') {
+            // Back to the end of the previous segment
+            while (out > root && out[-1] != '\\') {
+                out--;
+            }
+            if (out > root) out--;
+        } else if (length > 0 && !(length == 1 && in[0] == '.')) {
+            // The output never passes the input: at least one separator was read since
+            if (out > root) *out++ = '\\';
+            memmove(out, in, length);
+            out += length;
+        }
+        in += length + (end ? 1 : 0);
+    }
+    *out = '\0';
+}
+
+// URL of another scheme than file ("http://..."), kept as written
+static BOOL is_url(const char* text) {
+    const char* p = text;
+    while (isalpha((unsigned char)*p)) {
+        p++;
+    }
+    return p - text > 1 && strncmp(p, "://", 3) == 0;
+}
+
+// Full path of an entry in importer->path: file URIs decoded (uri: any entry is a URI, as
+// in XSPF), separators made '\', relative paths joined to the playlist directory and the
+// "." and ".." segments removed
+static const char* resolve_entry(Importer* importer, char* entry, BOOL uri) {
+    if (_strnicmp(entry, "file:", 5) == 0) {
+        entry += 5;
+        uri = TRUE;
+        if (entry[0] == '/' && entry[1] == '/') {
+            // file:///C:/... and file://localhost/C:/... are local, file://server/share a UNC path
+            if (entry[2] == '/') {
+                entry += 3;
+            } else if (_strnicmp(entry + 2, "localhost/", 10) == 0) {
+                entry += 12;
+            } else {
+                entry[0] = entry[1] = '\\';
+            }
+        }
+    } else if (is_url(entry)) {
+        return entry;
+    }
+    if (uri) {
+        percent_decode(entry);
+    }
+    for (char* p = entry; *p; p++) {
+        if (*p == '/') *p = '\\';
+    }
+    
+    char* path = importer->path;
+    size_t size = sizeof(importer->path);
+    if ((isalpha((unsigned char)entry[0]) && entry[1] == ':') || (entry[0] == '\\' && entry[1] == '\\')) {
+        snprintf(path, size, "%s", entry);
+    } else if (entry[0] == '\\') {
+        // Root of the playlist's drive
+        snprintf(path, size, "%.*s%s", (int)(importer->base[1] == ':' ? 2 : 0), importer->base, entry);
+    } else {
+        snprintf(path, size, "%s%s", importer->base, entry);
+    }
+    remove_dot_segments(path);
+    return path;
+}
+
+// Look up the waiting entries in one batch and append them
+static void flush_batch(Importer* importer) {
+    StringPool* batch = &importer->batch;
+    for (UINT32 i = 0; i < batch->count; i++) {
+        importer->paths[i] = batch->text + batch->offsets[i];
+    }
+    if (batch->count > 0 &&
+        !playlist_add_paths(importer->playlist, importer->paths, (int)batch->count, importer->library)) {
+        importer->ok = FALSE;
+    }
+    string_pool_truncate(batch, 0);
+}
+
+static void add_entry(Importer* importer, char* entry, BOOL uri) {
+    const char* path = resolve_entry(importer, entry, uri);
+    if (importer->utf8 && !is_ascii(path)) {
+        // Paths the system code page cannot hold are not in the library either: skip them
+        if (!convert_text(path, CP_UTF8, CP_ACP, importer->converted, sizeof(importer->converted))) return;
+        path = importer->converted;
+    }
+    
+    if (!string_pool_append(&importer->batch, path)) {
+        importer->ok = FALSE;
+    } else if (importer->batch.count == PLAYLIST_IO_BATCH) {
+        flush_batch(importer);
+    }
+}
+
+static void set_name(Importer* importer, const char* name) {
+    if (importer->utf8 && !is_ascii(name) &&
+        convert_text(name, CP_UTF8, CP_ACP, importer->converted, sizeof(importer->converted))) {
+        name = importer->converted;
+    }
+    Playlist* playlist = importer->playlist;
+    strncpy(playlist->name, name, sizeof(playlist->name) - 1);
+    playlist->name[sizeof(playlist->name) - 1] = '\0';
+}
+
+// Next line, without the BOM of the first one (which makes the text UTF-8)
+static char* read_line(Importer* importer, BOOL* cut) {
+    BOOL first = importer->reader.position == 0 && importer->reader.end == 0;
+    if (!read_until(&importer->reader, '\n', importer->line, sizeof(importer->line), cut)) return NULL;
+    
+    char* line = importer->line;
+    if (first && strncmp(line, UTF8_BOM, 3) == 0) {
+        line += 3;
+        importer->utf8 = TRUE;
+    }
+    return trim(line);
+}
+
+// M3U: a path or URI per line; comments start with '#'. The #EXTINF line before an entry
+// holds its duration and title, which the library has too; #PLAYLIST names the playlist.
+static void import_m3u(Importer* importer) {
+    BOOL cut;
+    char* line;
+    while (importer->ok && (line = read_line(importer, &cut)) != NULL) {
+        if (cut || *line == '\0') continue;
+        
+        if (*line == '#') {
+            if (_strnicmp(line, "#PLAYLIST:", 10) == 0) {
+                set_name(importer, trim(line + 10));
+            }
+            continue;
+        }
+        add_entry(importer, line, FALSE);
+    }
+}
+
+// PLS: FileN=path keys, taken in file order (players write them numbered in order)
+static void import_pls(Importer* importer) {
+    BOOL cut;
+    char* line;
+    while (importer->ok && (line = read_line(importer, &cut)) != NULL) {
+        if (cut || _strnicmp(line, "File", 4) != 0 || !isdigit((unsigned char)line[4])) continue;
+        
+        char* value = strchr(line, '=');
+        if (value && value[1] != '\0') {
+            add_entry(importer, trim(value + 1), FALSE);
+        }
+    }
+}
+
+// XSPF: the text of every <location> in the <trackList>, and the <title> before it as
+// the playlist name. Tags are skipped one at a time, so any layout is read in one pass.
+static void import_xspf(Importer* importer) {
+    BlockReader* reader = &importer->reader;
+    char tag[XSPF_TAG_MAX];
+    BOOL in_tracks = FALSE;
+    BOOL at_tag = FALSE;
+    BOOL cut;
+    while (importer->ok) {
+        // Reading an element's text stops on the '<' of the next tag
+        if (!at_tag && !read_until(reader, '<', NULL, 0, &cut)) break;
+        if (!read_until(reader, '>', tag, sizeof(tag), &cut)) break;
+        at_tag = FALSE;
+        
+        size_t length = strcspn(tag, " \t\r\n/");
+        BOOL location = in_tracks && length == 8 && strncmp(tag, "location", 8) == 0;
+        BOOL title = !in_tracks && length == 5 && strncmp(tag, "title", 5) == 0;
+        if (length == 9 && strncmp(tag, "trackList", 9) == 0) {
+            in_tracks = TRUE;
+        }
+        if (!location && !title) continue;
+        if (tag[strlen(tag) - 1] == '/') continue; // Empty element
+        
+        if (!read_until(reader, '<', importer->line, sizeof(importer->line), &cut)) break;
+        at_tag = TRUE;
+        if (cut) continue;
+        
+        xml_unescape(importer->line);
+        char* text = trim(importer->line);
+        if (*text == '\0') continue;
+        
+        if (location) {
+            add_entry(importer, text, TRUE);
+        } else {
+            set_name(importer, text);
+        }
+    }
+}
+
+// File name without directory and extension, as the default playlist name
+static void name_of(const char* filename, char* name, size_t size) {
+    const char* start = filename;
+    for (const char* p = filename; *p; p++) {
+        if (*p == '\\' || *p == '/') start = p + 1;
+    }
+    const char* dot = strrchr(start, '.');
+    size_t length = dot ? (size_t)(dot - start) : strlen(start);
+    if (length >= size) length = size - 1;
+    
+    memcpy(name, start, length);
+    name[length] = '\0';
+}
+
+Playlist* playlist_import(const char* filename, int format, MP3Library* library) {
+    if (!filename || !library) return NULL;
+    
+    if (format == PLAYLIST_FORMAT_UNKNOWN) {
+        format = playlist_format_from_name(filename);
+    }
+    if (format == PLAYLIST_FORMAT_UNKNOWN) return NULL;
+    
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+    
+    char name[sizeof(((Playlist*)0)->name)];
+    name_of(filename, name, sizeof(name));
+    Importer* importer = (Importer*)MEM_ALLOC_TAGGED(sizeof(Importer), MEM_CAT_PLAYLIST);
+    Playlist* playlist = importer ? playlist_create(name, "") : NULL;
+    if (!playlist) {
+        MEM_FREE(importer);
+        fclose(file);
+        return NULL;
+    }
+    
+    importer->playlist = playlist;
+    importer->library = library;
+    importer->reader.file = file;
+    importer->reader.position = 0;
+    importer->reader.end = 0;
+    directory_of(filename, importer->base, sizeof(importer->base));
+    importer->utf8 = format == PLAYLIST_FORMAT_M3U8 || format == PLAYLIST_FORMAT_XSPF;
+    importer->ok = TRUE;
+    string_pool_init(&importer->batch);
+    
+    if (format == PLAYLIST_FORMAT_PLS) {
+        import_pls(importer);
+    } else if (format == PLAYLIST_FORMAT_XSPF) {
+        import_xspf(importer);
+    } else {
+        import_m3u(importer);
+    }
+    flush_batch(importer);
+    
+    BOOL ok = importer->ok && !ferror(file);
+    fclose(file);
+    string_pool_free(&importer->batch);
+    MEM_FREE(importer);
+    
+    if (!ok) {
+        playlist_free(playlist);
+        return NULL;
+    }
+    return playlist;
+}
+
+static int compare_export_missing(const void* a, const void* b) {
+    TrackId x = ((const ExportMissing*)a)->id;
+    TrackId y = ((const ExportMissing*)b)->id;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Placeholder path of an id, NULL if it is not one
+static const char* exported_missing(const Exporter* exporter, TrackId id) {
+    ExportMissing key = { id, NULL };
+    const ExportMissing* found = exporter->missing_count > 0
+        ? (const ExportMissing*)bsearch(&key, exporter->missing, exporter->missing_count, sizeof(ExportMissing),
+                                        compare_export_missing)
+        : NULL;
+    return found ? found->path : NULL;
+}
+
+// Text in the encoding of the file: UTF-8 for M3U8 and XSPF
+static const char* encoded(Exporter* exporter, const char* text) {
+    BOOL utf8 = exporter->format == PLAYLIST_FORMAT_M3U8 || exporter->format == PLAYLIST_FORMAT_XSPF;
+    if (utf8 && !is_ascii(text) &&
+        convert_text(text, CP_ACP, CP_UTF8, exporter->converted, sizeof(exporter->converted))) {
+        return exporter->converted;
+    }
+    return text;
+}
+
+// Path as written in M3U and PLS files: relative below the playlist directory
+static const char* relative_path(const Exporter* exporter, const char* path) {
+    if (exporter->base_length > 0 && _strnicmp(path, exporter->base, exporter->base_length) == 0) {
+        return path + exporter->base_length;
+    }
+    return path;
+}
+
+static BOOL write_xml_text(Exporter* exporter, const char* text) {
+    BOOL ok = TRUE;
+    for (const char* p = encoded(exporter, text); ok && *p; p++) {
+        switch (*p) {
+        case '&': ok = fputs("&amp;", exporter->file) >= 0; break;
+        case '<': ok = fputs("&lt;", exporter->file) >= 0; break;
+        case '>': ok = fputs("&gt;", exporter->file) >= 0; break;
+        case '"': ok = fputs("&quot;", exporter->file) >= 0; break;
+        default: ok = fputc(*p, exporter->file) != EOF; break;
+        }
+    }
+    return ok;
+}
+
+// Element of XML text, skipped when empty
+static BOOL write_xml_element(Exporter* exporter, const char* name, const char* text) {
+    if (*text == '\0') return TRUE;
+    
+    return fprintf(exporter->file, "      <%s>", name) > 0 && write_xml_text(exporter, text) &&
+           fprintf(exporter->file, "</%s>\n", name) > 0;
+}
+
+// File URI of a path: "C:\a b.mp3" is "file:///C:/a%20b.mp3", "\\server\x" "file://server/x"
+static BOOL write_uri(Exporter* exporter, const char* path) {
+    if (is_url(path)) return write_xml_text(exporter, path);
+    
+    const char* p = encoded(exporter, path);
+    BOOL ok = fputs(p[0] == '\\' && p[1] == '\\' ? "file:" : "file:///", exporter->file) >= 0;
+    for (; ok && *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '\\') {
+            ok = fputc('/', exporter->file) != EOF;
+        } else if (isalnum(c) || strchr("-._~/:", c)) {
+            ok = fputc(c, exporter->file) != EOF;
+        } else {
+            ok = fprintf(exporter->file, "%%%02X", c) > 0;
+        }
+    }
+    return ok;
+}
+
+// Write one entry; number counts the entries written, from 1
+static BOOL write_entry(Exporter* exporter, int number, const char* path, const MP3File* track) {
+    FILE* file = exporter->file;
+    const MP3Metadata* metadata = track ? &track->metadata : NULL;
+    if (exporter->format == PLAYLIST_FORMAT_XSPF) {
+        BOOL ok = fputs("    <track>\n      <location>", file) >= 0 && write_uri(exporter, path) &&
+                  fputs("</location>\n", file) >= 0;
+        if (ok && metadata) {
+            ok = write_xml_element(exporter, "title", metadata->title) &&
+                 write_xml_element(exporter, "creator", metadata->artist) &&
+                 write_xml_element(exporter, "album", metadata->album) &&
+                 (metadata->duration <= 0 ||
+                  fprintf(file, "      <duration>%d</duration>\n", metadata->duration * 1000) > 0);
+        }
+        return ok && fputs("    </track>\n", file) >= 0;
+    }
+    
+    // The title line of M3U and PLS: "Artist - Title"
+    if (metadata && metadata->artist[0]) {
+        snprintf(exporter->line, sizeof(exporter->line), "%s - %s", metadata->artist, metadata->title);
+    } else if (metadata) {
+        snprintf(exporter->line, sizeof(exporter->line), "%s", metadata->title);
+    }
+    int duration = metadata && metadata->duration > 0 ? metadata->duration : -1;
+    const char* relative = relative_path(exporter, path);
+    if (exporter->format == PLAYLIST_FORMAT_PLS) {
+        return fprintf(file, "File%d=%s\n", number, relative) > 0 &&
+               (!metadata || fprintf(file, "Title%d=%s\n", number, exporter->line) > 0) &&
+               fprintf(file, "Length%d=%d\n", number, duration) > 0;
+    }
+    
+    if (metadata && fprintf(file, "#EXTINF:%d,%s\n", duration, encoded(exporter, exporter->line)) <= 0) return FALSE;
+    return fprintf(file, "%s\n", encoded(exporter, relative)) > 0;
+}
+
+// Placeholders sorted by id, so that each entry finds its path in O(log n)
+static BOOL sort_missing(Exporter* exporter, Playlist* playlist) {
+    int count = (int)playlist->missing_paths.count;
+    exporter->missing_count = 0;
+    exporter->missing = NULL;
+    if (count == 0) return TRUE;
+    
+    exporter->missing = (ExportMissing*)MEM_ALLOC_TAGGED(count * sizeof(ExportMissing), MEM_CAT_PLAYLIST);
+    if (!exporter->missing) return FALSE;
+    
+    for (int i = 0; i < count; i++) {
+        exporter->missing[i].id = playlist->missing_ids[i];
+        exporter->missing[i].path = playlist->missing_paths.text + playlist->missing_paths.offsets[i];
+    }
+    qsort(exporter->missing, count, sizeof(ExportMissing), compare_export_missing);
+    exporter->missing_count = count;
+    return TRUE;
+}
+
+BOOL playlist_export(Playlist* playlist, const char* filename, int format, MP3Library* library) {
+    if (!playlist || !filename || !library || !playlist_materialize(playlist)) return FALSE;
+    
+    if (format == PLAYLIST_FORMAT_UNKNOWN) {
+        format = playlist_format_from_name(filename);
+    }
+    if (format == PLAYLIST_FORMAT_UNKNOWN) return FALSE;
+    
+    Exporter* exporter = (Exporter*)MEM_ALLOC_TAGGED(sizeof(Exporter), MEM_CAT_PLAYLIST);
+    FILE* file = exporter ? fopen(filename, "wb") : NULL;
+    if (!file || !sort_missing(exporter, playlist)) {
+        if (file) fclose(file);
+        MEM_FREE(exporter);
+        return FALSE;
+    }
+    setvbuf(file, NULL, _IOFBF, PLAYLIST_IO_BUFFER);
+    
+    exporter->file = file;
+    exporter->format = format;
+    exporter->base_length = directory_of(filename, exporter->base, sizeof(exporter->base));
+    
+    BOOL ok;
+    if (format == PLAYLIST_FORMAT_XSPF) {
+        ok = fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                   "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n  <title>", file) >= 0 &&
+             write_xml_text(exporter, playlist->name) && fputs("</title>\n  <trackList>\n", file) >= 0;
+    } else if (format == PLAYLIST_FORMAT_PLS) {
+        ok = fputs("[playlist]\n", file) >= 0;
+    } else {
+        ok = fprintf(file, "#EXTM3U\n#PLAYLIST:%s\n", encoded(exporter, playlist->name)) > 0;
+    }
+    
+    // Entries a leaf of the track sequence at a time
+    int written = 0;
+    int length = 0;
+    for (int i = 0; ok && i < playlist->track_count; i += length) {
+        const TrackId* run = track_seq_run(&playlist->tracks, i, &length);
+        if (!run) break;
+        
+        for (int k = 0; ok && k < length; k++) {
+            MP3File* track = library_get_track(library, run[k]);
+            const char* path = NULL;
+            if (track) {
+                size_t path_length = mp3_file_path(track, exporter->path, sizeof(exporter->path));
+                path = path_length < sizeof(exporter->path) ? exporter->path : NULL;
+            } else {
+                path = exported_missing(exporter, run[k]);
+            }
+            if (path) {
+                ok = write_entry(exporter, ++written, path, track);
+            }
+        }
+    }
+    
+    if (ok && format == PLAYLIST_FORMAT_XSPF) {
+        ok = fputs("  </trackList>\n</playlist>\n", file) >= 0;
+    } else if (ok && format == PLAYLIST_FORMAT_PLS) {
+        ok = fprintf(file, "NumberOfEntries=%d\nVersion=2\n", written) > 0;
+    }
+    
+    ok = fclose(file) == 0 && ok;
+    MEM_FREE(exporter->missing);
+    MEM_FREE(exporter);
+    return ok;
+}
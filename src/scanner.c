@@ -1,4 +1,6 @@
 #include "../include/mp3player.h"
+#include "../include/pathtrie.h"
+#include "../include/memory.h"
 
 // Thread globali e variabili di controllo
 static HANDLE g_scan_thread = NULL;
@@ -8,27 +10,14 @@ static int g_scan_interval = 0;  // Intervallo in secondi
 // Struttura per passare i parametri al thread
 typedef struct {
     MP3Library* library;
-    char directory_path[MAX_PATH_LENGTH];
+    char* directory_path;
     BOOL recursive;
 } ScanThreadParams;
 
-// Funzione che confronta due file MP3 per determinare se sono lo stesso file
-static BOOL is_same_file(const char* filepath1, const char* filepath2) {
-    return (strcmp(filepath1, filepath2) == 0);
-}
-
 // Funzione per verificare se un file è già presente nella libreria
 static BOOL file_exists_in_library(MP3Library* library, const char* filepath) {
-    MP3File* current = library->all_files;
-    
-    while (current) {
-        if (is_same_file(current->filepath, filepath)) {
-            return TRUE;
-        }
-        current = current->next;
-    }
-    
-    return FALSE;
+    // Lookup per id (O(1)) invece della scansione lineare della lista
+    return library_find_by_path(library, filepath) != NULL;
 }
 
 // Funzione per verificare se un file esiste sul filesystem
@@ -38,153 +27,201 @@ static BOOL file_exists_on_disk(const char* filepath) {
             !(attributes & FILE_ATTRIBUTE_DIRECTORY));
 }
 
-// Funzione per rimuovere un file dalla libreria
-static void remove_file_from_library(MP3Library* library, const char* filepath) {
-    if (!library || !filepath) {
-        return;
+// Funzione per verificare se una directory esiste sul filesystem
+static BOOL directory_exists_on_disk(const char* path) {
+    DWORD attributes = GetFileAttributes(path);
+    return (attributes != INVALID_FILE_ATTRIBUTES && 
+            (attributes & FILE_ATTRIBUTE_DIRECTORY));
+}
+
+// Ingrandisce il buffer dei percorsi se non contiene length caratteri più il terminatore
+static BOOL reserve_path_buffer(char** buffer, size_t* size, size_t length) {
+    if (length < *size) {
+        return TRUE;
     }
     
-    // Caso speciale: primo elemento della lista
-    if (library->all_files && is_same_file(library->all_files->filepath, filepath)) {
-        MP3File* temp = library->all_files;
-        library->all_files = library->all_files->next;
-        free_mp3_file(temp);
-        library->total_files--;
-        return;
+    size_t new_size = length + 1 > 2 * *size ? length + 1 : 2 * *size;
+    char* new_buffer = (char*)realloc(*buffer, new_size);
+    if (!new_buffer) {
+        return FALSE;
     }
     
-    // Scansione della lista per trovare il file
-    MP3File* current = library->all_files;
-    while (current && current->next) {
-        if (is_same_file(current->next->filepath, filepath)) {
-            MP3File* temp = current->next;
-            current->next = current->next->next;
-            free_mp3_file(temp);
-            library->total_files--;
-            return;
-        }
-        current = current->next;
-    }
+    *buffer = new_buffer;
+    *size = new_size;
+    return TRUE;
 }
 
-// Funzione eseguita dal thread di scansione
-static DWORD WINAPI scan_thread_func(LPVOID lpParam) {
-    ScanThreadParams* params = (ScanThreadParams*)lpParam;
+// Elenco dei record da rimuovere
+typedef struct {
+    MP3File** files;
+    int count;
+} MissingFiles;
+
+static void collect_missing_file(MP3File* file, void* context) {
+    MissingFiles* missing = (MissingFiles*)context;
+    missing->files[missing->count++] = file;
+}
+
+// Funzione per rimuovere dalla libreria i file che non esistono più sul disco.
+// Visita il trie delle directory: se una cartella che conteneva file è sparita
+// si scarta l'intero sottoalbero senza controllare i singoli file.
+// Il lock resta preso per tutta la visita: il conteggio che dimensiona l'elenco, il
+// trie e i record raccolti non cambiano finché non sono stati rimossi.
+static int remove_missing_files(MP3Library* library) {
+    if (!library) {
+        return 0;
+    }
     
-    while (g_continue_scanning) {
-        // Prima verifica se i file esistenti sono ancora presenti sul disco
-        MP3File* current = params->library->all_files;
-        MP3File* prev = NULL;
-        int removed_files = 0;
+    library_lock(library);
+    if (library->total_files == 0) {
+        library_unlock(library);
+        return 0;
+    }
+    
+    // Ogni record viene raccolto al massimo una volta
+    MissingFiles missing;
+    missing.files = (MP3File**)malloc(library->total_files * sizeof(MP3File*));
+    missing.count = 0;
+    if (!missing.files) {
+        library_unlock(library);
+        return 0;
+    }
+    
+    char* path = NULL;
+    size_t path_size = 0;
+    DirNode* top = &library->paths->root;
+    DirNode* dir = top;
+    
+    while (dir) {
+        BOOL skip_children = FALSE;
         
-        while (current) {
-            MP3File* next = current->next;
+        // Le directory intermedie senza file (unità, server UNC) non vengono controllate
+        if (dir->file_count > 0 &&
+            reserve_path_buffer(&path, &path_size, path_trie_format_dir(dir, NULL, 0))) {
+            path_trie_format_dir(dir, path, path_size);
             
-            // Verifica se il file esiste ancora sul disco
-            if (!file_exists_on_disk(current->filepath)) {
-                // Il file è stato rimosso dal disco
-                if (prev) {
-                    // Non è il primo elemento
-                    prev->next = next;
-                    free_mp3_file(current);
-                } else {
-                    // È il primo elemento
-                    params->library->all_files = next;
-                    free_mp3_file(current);
-                }
-                
-                params->library->total_files--;
-                removed_files++;
+            if (!directory_exists_on_disk(path)) {
+                path_trie_for_each(dir, collect_missing_file, &missing);
+                skip_children = TRUE;
             } else {
-                // Il file esiste ancora, aggiorniamo prev
-                prev = current;
+                for (MP3File* file = dir->files; file; file = file->dir_next) {
+                    if (!reserve_path_buffer(&path, &path_size, mp3_file_path(file, NULL, 0))) {
+                        continue;
+                    }
+                    mp3_file_path(file, path, path_size);
+                    
+                    if (!file_exists_on_disk(path)) {
+                        missing.files[missing.count++] = file;
+                    }
+                }
             }
-            
-            current = next;
         }
         
-        // Poi cerca nuovi file
-        // Scansione della directory
-        WIN32_FIND_DATA findFileData;
-        HANDLE hFind = INVALID_HANDLE_VALUE;
-        char search_path[MAX_PATH_LENGTH];
-        int new_files = 0;
+        dir = path_trie_next_dir(top, dir, skip_children);
+    }
+    
+    // Il file è stato rimosso dal disco: lo togliamo anche dagli indici,
+    // così i riferimenti per id non restano appesi a un record liberato
+    int removed = library_remove_files(library, missing.files, missing.count);
+    library_unlock(library);
+    
+    free(path);
+    free(missing.files);
+    return removed;
+}
+
+// Cerca i nuovi file MP3 in una directory (e nelle sottodirectory se recursive)
+// e li aggiunge alla libreria. I percorsi sono allocati con path_join come in
+// scan_directory, così quelli lunghi non vengono troncati in tracce fantasma.
+static int scan_new_files(MP3Library* library, const char* directory_path, BOOL recursive) {
+    WIN32_FIND_DATA findFileData;
+    HANDLE hFind = INVALID_HANDLE_VALUE;
+    int new_files = 0;
+    
+    // Costruisce il pattern di ricerca per tutti i file
+    char* search_path = path_join(directory_path, "*");
+    if (!search_path) {
+        return 0;
+    }
+    
+    // Trova il primo file
+    hFind = FindFirstFile(search_path, &findFileData);
+    MEM_FREE(search_path);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    
+    do {
+        // Ignora "." e ".."
+        if (strcmp(findFileData.cFileName, ".") == 0 || 
+            strcmp(findFileData.cFileName, "..") == 0) {
+            continue;
+        }
         
-        // Costruisce il pattern di ricerca per tutti i file
-        _snprintf_s(search_path, MAX_PATH_LENGTH, MAX_PATH_LENGTH - 1, "%s\\*", params->directory_path);
+        // Costruisci il percorso completo
+        char* full_path = path_join(directory_path, findFileData.cFileName);
+        if (!full_path) {
+            continue;
+        }
         
-        // Trova il primo file
-        hFind = FindFirstFile(search_path, &findFileData);
-        if (hFind != INVALID_HANDLE_VALUE) {
-            do {
-                // Ignora "." e ".."
-                if (strcmp(findFileData.cFileName, ".") == 0 || 
-                    strcmp(findFileData.cFileName, "..") == 0) {
-                    continue;
-                }
-                
-                // Costruisci il percorso completo
-                char full_path[MAX_PATH_LENGTH];
-                _snprintf_s(full_path, MAX_PATH_LENGTH, MAX_PATH_LENGTH - 1, "%s\\%s", 
-                          params->directory_path, findFileData.cFileName);
-                
-                // Se è una directory e la scansione è ricorsiva
-                if (findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-                    if (params->recursive) {
-                        // Crea parametri per la sottodirectory
-                        ScanThreadParams subdir_params;
-                        subdir_params.library = params->library;
-                        strncpy(subdir_params.directory_path, full_path, MAX_PATH_LENGTH - 1);
-                        subdir_params.directory_path[MAX_PATH_LENGTH - 1] = '\0';
-                        subdir_params.recursive = TRUE;
+        // Se è una directory e la scansione è ricorsiva
+        if (findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (recursive) {
+                new_files += scan_new_files(library, full_path, recursive);
+            }
+        }
+        // Se è un file con estensione .mp3
+        else {
+            char* ext = strrchr(findFileData.cFileName, '.');
+            if (ext && _stricmp(ext, ".mp3") == 0) {
+                // Controlla se il file è già nella libreria
+                if (!file_exists_in_library(library, full_path)) {
+                    // Crea un nuovo nodo per il file MP3
+                    MP3File* new_file = (MP3File*)MEM_CALLOC_TAGGED(1, sizeof(MP3File), MEM_CAT_LIBRARY);
+                    if (new_file) {
+                        // Leggi i metadati dal file MP3
+                        if (!read_mp3_metadata(full_path, &new_file->metadata)) {
+                            // Se la lettura dei metadati fallisce, usiamo il nome del file come titolo
+                            memset(&new_file->metadata, 0, sizeof(MP3Metadata));
+                            strncpy(new_file->metadata.title, findFileData.cFileName, MAX_TITLE_LENGTH - 1);
+                            new_file->metadata.title[MAX_TITLE_LENGTH - 1] = '\0';
+                        }
                         
-                        // Chiamata ricorsiva (in questo thread)
-                        scan_thread_func(&subdir_params);
-                    }
-                }
-                // Se è un file con estensione .mp3
-                else {
-                    char* ext = strrchr(findFileData.cFileName, '.');
-                    if (ext && _stricmp(ext, ".mp3") == 0) {
-                        // Controlla se il file è già nella libreria
-                        if (!file_exists_in_library(params->library, full_path)) {
-                            // Crea un nuovo nodo per il file MP3
-                            MP3File* new_file = (MP3File*)malloc(sizeof(MP3File));
-                            if (new_file) {
-                                strncpy(new_file->filepath, full_path, MAX_PATH_LENGTH - 1);
-                                new_file->filepath[MAX_PATH_LENGTH - 1] = '\0';
-                                
-                                // Leggi i metadati dal file MP3
-                                if (!read_mp3_metadata(full_path, &new_file->metadata)) {
-                                    // Se la lettura dei metadati fallisce, usiamo il nome del file come titolo
-                                    memset(&new_file->metadata, 0, sizeof(MP3Metadata));
-                                    strncpy(new_file->metadata.title, findFileData.cFileName, MAX_TITLE_LENGTH - 1);
-                                    new_file->metadata.title[MAX_TITLE_LENGTH - 1] = '\0';
-                                }
-                                
-                                // Aggiungi il file alla lista in modo thread-safe
-                                // Qui andrebbe usato un semaforo o mutex per la sincronizzazione
-                                // Ma per semplicità, aggiungiamo il file direttamente
-                                new_file->next = params->library->all_files;
-                                params->library->all_files = new_file;
-                                
-                                // Incrementa i contatori
-                                params->library->total_files++;
-                                new_files++;
-                            }
+                        // library_add_file prende il lock della libreria
+                        if (library_add_file(library, new_file, full_path)) {
+                            new_files++;
+                        } else {
+                            free_mp3_file(new_file);
                         }
                     }
                 }
-            } while (FindNextFile(hFind, &findFileData) != 0);
-            
-            FindClose(hFind);
+            }
         }
         
+        MEM_FREE(full_path);
+    } while (FindNextFile(hFind, &findFileData) != 0);
+    
+    FindClose(hFind);
+    return new_files;
+}
+
+// Funzione eseguita dal thread di scansione
+static DWORD WINAPI scan_thread_func(LPVOID lpParam) {
+    ScanThreadParams* params = (ScanThreadParams*)lpParam;
+    
+    while (g_continue_scanning) {
+        // Prima verifica se i file esistenti sono ancora presenti sul disco
+        remove_missing_files(params->library);
+        
+        // Poi cerca nuovi file
+        scan_new_files(params->library, params->directory_path, params->recursive);
+        
         // Attendi per l'intervallo di scansione
         Sleep(g_scan_interval * 1000);
     }
     
     // Libera i parametri
+    MEM_FREE(params->directory_path);
     free(params);
     return 0;
 }
@@ -210,11 +247,14 @@ void start_continuous_scan(MP3Library* library, int interval_seconds, const char
     
     // Usa la directory specificata o il percorso della libreria se non specificata
     if (directory_path && directory_path[0] != '\0') {
-        strncpy(params->directory_path, directory_path, MAX_PATH_LENGTH - 1);
+        params->directory_path = MEM_STRDUP(directory_path);
     } else {
-        strncpy(params->directory_path, library->library_path, MAX_PATH_LENGTH - 1);
+        params->directory_path = MEM_STRDUP(library->library_path);
+    }
+    if (!params->directory_path) {
+        free(params);
+        return;
     }
-    params->directory_path[MAX_PATH_LENGTH - 1] = '\0';
     params->recursive = TRUE;
     
     // Crea il thread
@@ -228,6 +268,7 @@ void start_continuous_scan(MP3Library* library, int interval_seconds, const char
     );
     
     if (g_scan_thread == NULL) {
+        MEM_FREE(params->directory_path);
         free(params);
     }
 }
@@ -0,0 +1,309 @@
+#include "../include/searchsession.h"
+#include "../include/memory.h"
+
+static void collect_word(const char* token, int length, void* context) {
+    SearchWords* words = (SearchWords*)context;
+    if (words->count == TEXT_QUERY_MAX_TOKENS) return;
+    
+    for (int i = 0; i < words->count; i++) {
+        if (words->length[i] == length && memcmp(words->text[i], token, length) == 0) return;
+    }
+    memcpy(words->text[words->count], token, length + 1);
+    words->length[words->count++] = length;
+}
+
+// TRUE if every track matching next also matches previous, so that the results of
+// previous can be refined: each old word must appear in the new query, or (from 3
+// letters, where inner parts match too) be contained in one of its words
+static BOOL words_imply(const SearchWords* next, const SearchWords* previous) {
+    for (int i = 0; i < previous->count; i++) {
+        BOOL implied = FALSE;
+        for (int j = 0; j < next->count && !implied; j++) {
+            if (next->length[j] == previous->length[i]) {
+                implied = memcmp(next->text[j], previous->text[i], previous->length[i]) == 0;
+            } else if (previous->length[i] >= 3 && next->length[j] > previous->length[i]) {
+                implied = strstr(next->text[j], previous->text[i]) != NULL;
+            }
+        }
+        if (!implied) return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL is_stale(SearchSession* session, LONG id) {
+    return session->current != id;
+}
+
+// Count a query stopped by a newer one (the caller also counts the ones it replaces)
+static void count_cancelled(SearchSession* session) {
+    EnterCriticalSection(&session->lock);
+    session->cancelled++;
+    LeaveCriticalSection(&session->lock);
+}
+
+static void results_init(SearchResults* results) {
+    track_view_init(&results->tracks);
+    results->ranks = NULL;
+    results->docs = NULL;
+    results->capacity = 0;
+}
+
+static void results_free(SearchResults* results) {
+    track_view_free(&results->tracks);
+    MEM_FREE(results->ranks);
+    MEM_FREE(results->docs);
+    results_init(results);
+}
+
+// Keep the ranks and documents of the last index query in spare (the index owns its arrays)
+static BOOL keep_ranks(SearchSession* session, int count) {
+    if (count < 0) return FALSE;
+    
+    SearchResults* spare = &session->spare;
+    if (count > spare->capacity) {
+        unsigned short* ranks = (unsigned short*)MEM_REALLOC_TAGGED(spare->ranks, (size_t)count * sizeof(unsigned short),
+                                                                    MEM_CAT_FILTER);
+        if (!ranks) return FALSE;
+        spare->ranks = ranks;
+        
+        UINT32* docs = (UINT32*)MEM_REALLOC_TAGGED(spare->docs, (size_t)count * sizeof(UINT32), MEM_CAT_FILTER);
+        if (!docs) return FALSE;
+        spare->docs = docs;
+        spare->capacity = count;
+    }
+    
+    if (count > 0) {
+        TextIndex* index = session->library->text;
+        memcpy(spare->ranks, index->ranks, (size_t)count * sizeof(unsigned short));
+        memcpy(spare->docs, index->result_docs, (size_t)count * sizeof(UINT32));
+    }
+    return TRUE;
+}
+
+// Narrow the previous results into spare
+static BOOL refine_results(SearchSession* session, const char* query) {
+    SearchResults* previous = &session->results;
+    int count = text_index_match_within(session->library->text, session->field, query, TEXT_MATCH_SUBSTRING,
+                                        previous->docs, previous->tracks.count, &session->spare.tracks, NULL);
+    return keep_ranks(session, count);
+}
+
+// Ask the whole index into spare
+static BOOL index_results(SearchSession* session, const char* query, DWORD options) {
+    int count = text_index_match(session->library->text, session->field, query, options, &session->spare.tracks, NULL);
+    return keep_ranks(session, count);
+}
+
+// Hand the results to the callback in rank order, stopping if a newer query started
+static void deliver_results(SearchSession* session, LONG id) {
+    if (!session->callback) return;
+    
+    SearchResults* results = &session->results;
+    int total = results->tracks.count;
+    int first = 0;
+    do {
+        if (is_stale(session, id)) return;
+        
+        int size = first == 0 ? SEARCH_FIRST_BATCH : SEARCH_BATCH_SIZE;
+        int count = total - first < size ? total - first : size;
+        const TrackId* ids = results->tracks.ids ? results->tracks.ids + first : NULL;
+        const unsigned short* ranks = results->ranks ? results->ranks + first : NULL;
+        session->callback(session->context, id, ids, ranks, first, count, total, first + count == total);
+        first += count;
+    } while (first < total);
+}
+
+static void swap_results(SearchSession* session) {
+    SearchResults results = session->results;
+    session->results = session->spare;
+    session->spare = results;
+}
+
+// Run one query (on the worker, or on the caller without one)
+static void run_query(SearchSession* session, LONG id, const char* query) {
+    if (is_stale(session, id)) {
+        count_cancelled(session);
+        return;
+    }
+    
+    SearchWords words;
+    words.count = 0;
+    text_tokenize(query, collect_word, &words);
+    
+    // The scan thread updates the index as it adds and removes tracks: it waits while
+    // the postings are read and copied out
+    library_lock(session->library);
+    UINT32 changes = session->library->changes;
+    BOOL ok = TRUE;
+    BOOL fuzzy = FALSE;
+    if (words.count == 0) {
+        track_view_clear(&session->spare.tracks);
+    } else if (session->reusable && session->library_changes == changes &&
+               session->results.tracks.count <= session->library->total_files / SEARCH_REFINE_SHARE &&
+               words_imply(&words, &session->words)) {
+        ok = refine_results(session, query);
+        if (ok) {
+            session->refined++;
+        }
+    } else {
+        ok = index_results(session, query, TEXT_MATCH_SUBSTRING);
+        if (ok) {
+            session->indexed++;
+        }
+    }
+    
+    // Typos are only worth trying when nothing matches as typed
+    if (ok && words.count > 0 && session->spare.tracks.count == 0 && (session->options & TEXT_MATCH_FUZZY) &&
+        !is_stale(session, id)) {
+        ok = index_results(session, query, session->options | TEXT_MATCH_SUBSTRING);
+        fuzzy = TRUE;
+    }
+    library_unlock(session->library);
+    
+    if (!ok) {
+        // Out of memory: the previous results stay as they were
+        return;
+    }
+    
+    // Complete results are kept for the next query even if this one is already stale
+    swap_results(session);
+    snprintf(session->query, SEARCH_QUERY_MAX, "%s", query);
+    session->words = words;
+    session->reusable = words.count > 0 && !fuzzy;
+    session->library_changes = changes;
+    session->completed = id;
+    
+    if (is_stale(session, id)) {
+        count_cancelled(session);
+        return;
+    }
+    deliver_results(session, id);
+}
+
+static void forget_results(SearchSession* session) {
+    session->reusable = FALSE;
+    track_view_clear(&session->results.tracks);
+}
+
+// Worker task: run the newest query handed over in pending until none is left, so
+// that the caller never waits for a running query to stop
+static void run_pending(void* context, int index) {
+    (void)index;
+    SearchSession* session = (SearchSession*)context;
+    char query[SEARCH_QUERY_MAX];
+    
+    for (;;) {
+        EnterCriticalSection(&session->lock);
+        if (session->forget) {
+            forget_results(session);
+            session->forget = FALSE;
+        }
+        if (session->taken_id == session->pending_id) {
+            session->running = FALSE;
+            LeaveCriticalSection(&session->lock);
+            return;
+        }
+        LONG id = session->pending_id;
+        memcpy(query, session->pending, SEARCH_QUERY_MAX);
+        session->taken_id = id;
+        LeaveCriticalSection(&session->lock);
+        
+        run_query(session, id, query);
+    }
+}
+
+SearchSession* search_session_create(MP3Library* library, int field, DWORD options, BOOL background,
+                                     SearchResultsCallback callback, void* context) {
+    if (!library || !library->text || field < 0 || field >= TEXT_FIELD_COUNT) return NULL;
+    
+    SearchSession* session = (SearchSession*)MEM_CALLOC_TAGGED(1, sizeof(SearchSession), MEM_CAT_FILTER);
+    if (!session) return NULL;
+    
+    session->library = library;
+    session->field = field;
+    session->options = options;
+    session->callback = callback;
+    session->context = context;
+    results_init(&session->results);
+    results_init(&session->spare);
+    
+    if (background) {
+        session->worker = thread_pool_create(1);
+        if (!session->worker) {
+            MEM_FREE(session);
+            return NULL;
+        }
+    }
+    InitializeCriticalSection(&session->lock);
+    return session;
+}
+
+void search_session_free(SearchSession* session) {
+    if (!session) return;
+    
+    search_session_cancel(session);
+    search_session_wait(session);
+    thread_pool_free(session->worker);
+    DeleteCriticalSection(&session->lock);
+    results_free(&session->results);
+    results_free(&session->spare);
+    MEM_FREE(session);
+}
+
+LONG search_session_update(SearchSession* session, const char* query) {
+    if (!session || !query) return 0;
+    
+    // The running query sees the new id and stops at its next check
+    LONG id = InterlockedIncrement(&session->current);
+    if (!session->worker) {
+        run_query(session, id, query);
+        return session->completed == id ? id : 0;
+    }
+    
+    // Hand the query over: a worker still running takes it when its query stops,
+    // otherwise a new one is started (the previous job has finished or is returning)
+    EnterCriticalSection(&session->lock);
+    if (session->running && session->taken_id != session->pending_id) {
+        session->cancelled++;            // Replaced before the worker got to it
+    }
+    session->pending_id = id;
+    snprintf(session->pending, SEARCH_QUERY_MAX, "%s", query);
+    BOOL start = !session->running;
+    session->running = TRUE;
+    LeaveCriticalSection(&session->lock);
+    
+    if (start) {
+        thread_pool_wait(session->job);
+        session->job = thread_pool_submit(session->worker, 1, run_pending, session);
+        if (!session->job) {
+            EnterCriticalSection(&session->lock);
+            session->running = FALSE;
+            session->taken_id = id;
+            LeaveCriticalSection(&session->lock);
+            return 0;
+        }
+    }
+    return id;
+}
+
+void search_session_cancel(SearchSession* session) {
+    if (!session) return;
+    
+    InterlockedIncrement(&session->current);
+    
+    // The results belong to the worker while it runs: it forgets them before stopping
+    EnterCriticalSection(&session->lock);
+    if (session->running) {
+        session->forget = TRUE;
+    } else {
+        forget_results(session);
+    }
+    LeaveCriticalSection(&session->lock);
+}
+
+void search_session_wait(SearchSession* session) {
+    if (!session) return;
+    
+    thread_pool_wait(session->job);
+    session->job = NULL;
+}
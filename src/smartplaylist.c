@@ -0,0 +1,189 @@
+#include "../include/smartplaylist.h"
+#include "../include/memory.h"
+
+// Scramble the id bits before reducing them to a slot (splitmix64 finalizer)
+static UINT64 mix_track_id(TrackId id) {
+    id ^= id >> 30;
+    id *= 0xBF58476D1CE4E5B9ULL;
+    id ^= id >> 27;
+    id *= 0x94D049BB133111EBULL;
+    id ^= id >> 31;
+    return id;
+}
+
+// Slot holding id, or the free slot where it would go
+static int find_slot(const SmartPlaylist* playlist, TrackId id) {
+    int mask = playlist->slot_capacity - 1;
+    int slot = (int)(mix_track_id(id) & mask);
+    while (playlist->slots[slot] && playlist->members.ids[playlist->slots[slot] - 1] != id) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Index every member again in a table of capacity slots
+static BOOL rebuild_slots(SmartPlaylist* playlist, int capacity) {
+    int* slots = (int*)MEM_CALLOC_TAGGED(capacity, sizeof(int), MEM_CAT_PLAYLIST);
+    if (!slots) return FALSE;
+    
+    MEM_FREE(playlist->slots);
+    playlist->slots = slots;
+    playlist->slot_capacity = capacity;
+    for (int i = 0; i < playlist->members.count; i++) {
+        playlist->slots[find_slot(playlist, playlist->members.ids[i])] = i + 1;
+    }
+    return TRUE;
+}
+
+static BOOL add_member(SmartPlaylist* playlist, TrackId id) {
+    if (playlist->slots[find_slot(playlist, id)]) return TRUE;
+    
+    // Keep the table at most half full, so that probe chains stay short
+    if ((playlist->members.count + 1) * 2 > playlist->slot_capacity &&
+        !rebuild_slots(playlist, playlist->slot_capacity * 2)) {
+        return FALSE;
+    }
+    if (!track_view_add(&playlist->members, id)) return FALSE;
+    
+    playlist->slots[find_slot(playlist, id)] = playlist->members.count;
+    playlist->changes++;
+    return TRUE;
+}
+
+static void remove_member(SmartPlaylist* playlist, TrackId id) {
+    int slot = find_slot(playlist, id);
+    if (!playlist->slots[slot]) return;
+    
+    int position = playlist->slots[slot] - 1;
+    
+    // Free the slot by shifting back the entries after it that may take its place, so
+    // that no probe chain is cut
+    int* slots = playlist->slots;
+    int mask = playlist->slot_capacity - 1;
+    int hole = slot;
+    for (int next = (hole + 1) & mask; slots[next]; next = (next + 1) & mask) {
+        int home = (int)(mix_track_id(playlist->members.ids[slots[next] - 1]) & mask);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+    }
+    slots[hole] = 0;
+    
+    // The last member fills the hole in the list
+    int last = playlist->members.count - 1;
+    if (position != last) {
+        TrackId moved = playlist->members.ids[last];
+        playlist->members.ids[position] = moved;
+        slots[find_slot(playlist, moved)] = position + 1;
+    }
+    playlist->members.count--;
+    playlist->changes++;
+}
+
+// Run the query and index its result; the caller holds the library lock
+static BOOL refresh_locked(SmartPlaylist* playlist) {
+    playlist->valid = FALSE;
+    if (filter_query_run(playlist->query, playlist->library, &playlist->members) < 0) return FALSE;
+    
+    int capacity = SMART_PLAYLIST_INITIAL_SLOTS;
+    while (capacity < playlist->members.count * 2) {
+        capacity *= 2;
+    }
+    if (!rebuild_slots(playlist, capacity)) return FALSE;
+    
+    playlist->changes++;
+    playlist->valid = TRUE;
+    return TRUE;
+}
+
+BOOL smart_playlist_refresh(SmartPlaylist* playlist) {
+    if (!playlist) return FALSE;
+    
+    // The scan thread's hooks update members too: hold the lock from the query to the slots
+    library_lock(playlist->library);
+    BOOL refreshed = refresh_locked(playlist);
+    library_unlock(playlist->library);
+    return refreshed;
+}
+
+SmartPlaylist* smart_playlist_create(MP3Library* library, const char* name, const char* query, char* error,
+                                     size_t error_size) {
+    if (!library || !query) return NULL;
+    
+    FilterQuery* parsed = filter_query_parse(query, error, error_size);
+    if (!parsed) return NULL;
+    
+    SmartPlaylist* playlist = (SmartPlaylist*)MEM_CALLOC_TAGGED(1, sizeof(SmartPlaylist), MEM_CAT_PLAYLIST);
+    char* text = MEM_STRDUP_TAGGED(query, MEM_CAT_PLAYLIST);
+    if (!playlist || !text) {
+        filter_query_free(parsed);
+        MEM_FREE(playlist);
+        MEM_FREE(text);
+        return NULL;
+    }
+    
+    playlist->library = library;
+    strncpy(playlist->name, name ? name : "New Smart Playlist", sizeof(playlist->name) - 1);
+    playlist->name[sizeof(playlist->name) - 1] = '\0';
+    playlist->query_text = text;
+    playlist->query = parsed;
+    track_view_init(&playlist->members);
+    
+    // Registered under the same lock as the first run, so no record added in between is missed
+    library_lock(library);
+    if (!refresh_locked(playlist)) {
+        library_unlock(library);
+        filter_query_free(parsed);
+        track_view_free(&playlist->members);
+        MEM_FREE(playlist->slots);
+        MEM_FREE(text);
+        MEM_FREE(playlist);
+        return NULL;
+    }
+    
+    playlist->next_smart = library->smart;
+    library->smart = playlist;
+    library_unlock(library);
+    return playlist;
+}
+
+void smart_playlist_free(SmartPlaylist* playlist) {
+    if (!playlist) return;
+    
+    library_lock(playlist->library);
+    SmartPlaylist** link = &playlist->library->smart;
+    while (*link && *link != playlist) {
+        link = &(*link)->next_smart;
+    }
+    if (*link) {
+        *link = playlist->next_smart;
+    }
+    library_unlock(playlist->library);
+    
+    filter_query_free(playlist->query);
+    track_view_free(&playlist->members);
+    MEM_FREE(playlist->slots);
+    MEM_FREE(playlist->query_text);
+    MEM_FREE(playlist);
+}
+
+BOOL smart_playlist_contains(const SmartPlaylist* playlist, TrackId id) {
+    return playlist && playlist->slots && playlist->slots[find_slot(playlist, id)] != 0;
+}
+
+void smart_playlists_track_added(MP3Library* library, MP3File* file) {
+    for (SmartPlaylist* playlist = library->smart; playlist; playlist = playlist->next_smart) {
+        if (playlist->valid && filter_query_matches(playlist->query, file) && !add_member(playlist, file->id)) {
+            playlist->valid = FALSE;
+        }
+    }
+}
+
+void smart_playlists_track_removed(MP3Library* library, MP3File* file) {
+    for (SmartPlaylist* playlist = library->smart; playlist; playlist = playlist->next_smart) {
+        if (playlist->valid) {
+            remove_member(playlist, file->id);
+        }
+    }
+}
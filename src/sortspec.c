@@ -0,0 +1,769 @@
+#include "../include/sortspec.h"
+#include "../include/memory.h"
+
+#define COLLATION_FIELD_COUNT 4
+#define COLLATION_KEY_SIZE 1024     // Room for the sort key of one field
+#define COLLATION_FLAG_MASK (SORT_FOLD_CASE | SORT_FOLD_ACCENTS | SORT_IGNORE_ARTICLES)
+
+#define SORT_PREFIX_LENGTH 15       // Key bytes in SortEntry.prefix, the last byte flags longer keys
+#define SORT_INSERTION_RUN 32
+#define SORT_MIN_CHUNK 16384        // Smallest chunk worth a thread of its own
+#define SORT_SAMPLES_PER_CHUNK 16   // Samples taken from each chunk to pick the merge splitters
+
+// Names accepted by sort_spec_parse, indexed by SORT_BY_* constant
+static const char* sort_field_names[] = {
+    "title", "artist", "album", "year", "genre", "track", "disc", "duration"
+};
+
+#define SORT_FIELD_COUNT ((int)(sizeof(sort_field_names) / sizeof(sort_field_names[0])))
+
+// Leading articles skipped by SORT_IGNORE_ARTICLES (English and Italian)
+static const char* sort_articles[] = {
+    "the ", "a ", "an ", "il ", "lo ", "la ", "gli ", "le ", "l'"
+};
+
+#define SORT_ARTICLE_COUNT (sizeof(sort_articles) / sizeof(sort_articles[0]))
+
+// Sort array element: the reduced key answers most comparisons without
+// touching the rest of the composite key
+typedef struct {
+    UINT64 prefix[2];                // First 15 bytes of the composite key, big endian, then 1 if it goes on
+    MP3File* file;
+    const unsigned char* tail;       // Rest of the key (unsigned short length + bytes) if the flag is set
+} SortEntry;
+
+// Bytes of the composite keys that do not fit in the prefix
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+} KeyArena;
+
+// State shared by the tasks of one sort. With a single chunk everything runs inline.
+typedef struct {
+    MP3Library* library;
+    const SortSpec* spec;
+    SortEntry* entries;
+    SortEntry* buffer;
+    int count;
+    int chunk_count;
+    int chunk_start[SORT_MAX_CHUNKS + 1];
+    KeyArena arenas[SORT_MAX_CHUNKS];   // One per chunk so keys are built without locking
+    BOOL failed[SORT_MAX_CHUNKS];
+    SortEntry* sorted[SORT_MAX_CHUNKS]; // Where each sorted chunk ended up
+    int* bounds;                        // Merge split points, (chunk_count + 1) rows of chunk_count
+} SortJob;
+
+void sort_spec_init(SortSpec* spec, DWORD flags) {
+    memset(spec, 0, sizeof(SortSpec));
+    spec->flags = flags;
+}
+
+BOOL sort_spec_add_key(SortSpec* spec, int field, BOOL descending) {
+    if (spec->key_count >= SORT_SPEC_MAX_KEYS || field < 0 || field >= SORT_FIELD_COUNT) {
+        return FALSE;
+    }
+    
+    spec->keys[spec->key_count].field = field;
+    spec->keys[spec->key_count].descending = descending;
+    spec->key_count++;
+    return TRUE;
+}
+
+int sort_field_from_name(const char* name) {
+    for (int i = 0; i < SORT_FIELD_COUNT; i++) {
+        if (_stricmp(name, sort_field_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* sort_field_name(int field) {
+    return field >= 0 && field < SORT_FIELD_COUNT ? sort_field_names[field] : NULL;
+}
+
+BOOL sort_spec_parse(SortSpec* spec, const char* text) {
+    spec->key_count = 0;
+    
+    const char* p = text;
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        if (!*p) break;
+        
+        BOOL descending = FALSE;
+        if (*p == '-' || *p == '+') {
+            descending = *p == '-';
+            p++;
+        }
+        
+        char name[16];
+        size_t length = 0;
+        while (*p && *p != ',' && *p != ' ') {
+            if (length < sizeof(name) - 1) {
+                name[length++] = *p;
+            }
+            p++;
+        }
+        name[length] = '\0';
+        
+        if (!sort_spec_add_key(spec, sort_field_from_name(name), descending)) {
+            return FALSE;
+        }
+    }
+    
+    return spec->key_count > 0;
+}
+
+static BOOL is_numeric_field(int field) {
+    return field == SORT_BY_YEAR || field == SORT_BY_TRACK || field == SORT_BY_DISC || field == SORT_BY_DURATION;
+}
+
+static int field_number(const MP3File* file, int field) {
+    switch (field) {
+        case SORT_BY_YEAR:
+            return file->metadata.year;
+        case SORT_BY_TRACK:
+            return file->metadata.track_number;
+        case SORT_BY_DISC:
+            return file->metadata.disc_number;
+        default:
+            return file->metadata.duration;
+    }
+}
+
+// Index of a string field in CollationKeys
+static int collation_index(int field) {
+    switch (field) {
+        case SORT_BY_ARTIST:
+            return 1;
+        case SORT_BY_ALBUM:
+            return 2;
+        case SORT_BY_GENRE:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static const char* field_text(const MP3File* file, int index) {
+    switch (index) {
+        case 1:
+            return file->metadata.artist;
+        case 2:
+            return file->metadata.album;
+        case 3:
+            return file->metadata.genre;
+        default:
+            return file->metadata.title;
+    }
+}
+
+// Skip a leading article, unless nothing would be left
+static const char* skip_article(const char* text) {
+    while (*text == ' ') text++;
+    
+    for (size_t i = 0; i < SORT_ARTICLE_COUNT; i++) {
+        size_t length = strlen(sort_articles[i]);
+        if (_strnicmp(text, sort_articles[i], length) == 0 && text[length] != '\0') {
+            return text + length;
+        }
+    }
+    return text;
+}
+
+// Write the sort key of one string into out (always zero terminated), returns its size
+static size_t build_field_key(const char* text, DWORD flags, unsigned char* out, size_t size) {
+    // Tags are stored either as UTF-8 or as raw ISO-8859-1 bytes
+    WCHAR wide[MAX_TITLE_LENGTH + 1];
+    int wide_length = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, text, -1, wide, MAX_TITLE_LENGTH + 1);
+    if (wide_length == 0) {
+        wide_length = MultiByteToWideChar(CP_ACP, 0, text, -1, wide, MAX_TITLE_LENGTH + 1);
+    }
+    
+    if (wide_length > 0) {
+        DWORD map_flags = LCMAP_SORTKEY;
+        if (flags & SORT_FOLD_CASE) map_flags |= NORM_IGNORECASE;
+        if (flags & SORT_FOLD_ACCENTS) map_flags |= NORM_IGNORENONSPACE;
+        
+        // With LCMAP_SORTKEY the destination is a byte buffer and the result a byte count
+        int bytes = LCMapStringW(LOCALE_USER_DEFAULT, map_flags, wide, -1, (LPWSTR)out, (int)size);
+        if (bytes > 0) {
+            return (size_t)bytes;
+        }
+    }
+    
+    // Fallback: the bytes themselves, ASCII folded if requested
+    size_t length = 0;
+    while (text[length] && length < size - 1) {
+        unsigned char c = (unsigned char)text[length];
+        if ((flags & SORT_FOLD_CASE) && c >= 'A' && c <= 'Z') {
+            c = (unsigned char)(c - 'A' + 'a');
+        }
+        out[length++] = c;
+    }
+    out[length++] = '\0';
+    return length;
+}
+
+// Build the collation keys of a track
+static CollationKeys* build_keys(const MP3File* file, DWORD flags) {
+    unsigned char buffer[COLLATION_FIELD_COUNT * COLLATION_KEY_SIZE];
+    unsigned short offsets[COLLATION_FIELD_COUNT];
+    size_t length = 0;
+    
+    for (int i = 0; i < COLLATION_FIELD_COUNT; i++) {
+        const char* text = field_text(file, i);
+        if ((flags & SORT_IGNORE_ARTICLES) && i != 3) {
+            text = skip_article(text);
+        }
+        
+        offsets[i] = (unsigned short)length;
+        length += build_field_key(text, flags, buffer + length, COLLATION_KEY_SIZE);
+    }
+    
+    CollationKeys* keys = (CollationKeys*)MEM_ALLOC_TAGGED(sizeof(CollationKeys) + length, MEM_CAT_INDEX);
+    if (!keys) return NULL;
+    
+    keys->flags = flags;
+    memcpy(keys->offsets, offsets, sizeof(offsets));
+    memcpy(keys->data, buffer, length);
+    return keys;
+}
+
+// Keys of a record already built with these flags, NULL if none
+static CollationKeys* find_keys(const MP3File* file, DWORD flags) {
+    for (CollationKeys* keys = file->collation; keys; keys = keys->next) {
+        if (keys->flags == flags) {
+            return keys;
+        }
+    }
+    return NULL;
+}
+
+const CollationKeys* collation_get_keys(MP3File* file, DWORD flags) {
+    flags &= COLLATION_FLAG_MASK;
+    CollationKeys* keys = find_keys(file, flags);
+    if (keys) {
+        return keys;
+    }
+    
+    // Other flag sets keep their keys: views sorted with different flags each find theirs
+    keys = build_keys(file, flags);
+    if (!keys) return NULL;
+    
+    keys->next = file->collation;
+    file->collation = keys;
+    return keys;
+}
+
+void collation_free_keys(MP3File* file) {
+    while (file->collation) {
+        CollationKeys* next = file->collation->next;
+        MEM_FREE(file->collation);
+        file->collation = next;
+    }
+}
+
+int collation_prepare(MP3Library* library, DWORD flags) {
+    if (!library || (flags & SORT_BYTE_ORDER)) return 0;
+    
+    flags &= COLLATION_FLAG_MASK;
+    int built = 0;
+    for (MP3File* file = library->all_files; file; file = file->next) {
+        if (find_keys(file, flags)) continue;
+        if (!collation_get_keys(file, flags)) break;
+        built++;
+    }
+    return built;
+}
+
+// Bytes of a string key: the collation key, or the tag itself in byte order mode
+static const unsigned char* key_string(const MP3File* file, const CollationKeys* keys, int field) {
+    int index = collation_index(field);
+    if (keys) {
+        return keys->data + keys->offsets[index];
+    }
+    return (const unsigned char*)field_text(file, index);
+}
+
+int sort_compare_tracks(MP3File* a, MP3File* b, const SortSpec* spec) {
+    const CollationKeys* x = NULL;
+    const CollationKeys* y = NULL;
+    if (!(spec->flags & SORT_BYTE_ORDER)) {
+        x = collation_get_keys(a, spec->flags);
+        y = collation_get_keys(b, spec->flags);
+        if (!x || !y) {
+            // Without memory for the keys fall back to the tag bytes
+            x = NULL;
+            y = NULL;
+        }
+    }
+    
+    for (int k = 0; k < spec->key_count; k++) {
+        const SortKey* key = &spec->keys[k];
+        int result;
+        
+        if (is_numeric_field(key->field)) {
+            int u = field_number(a, key->field);
+            int v = field_number(b, key->field);
+            result = u < v ? -1 : (u > v ? 1 : 0);
+        } else {
+            result = strcmp((const char*)key_string(a, x, key->field), (const char*)key_string(b, y, key->field));
+            result = result < 0 ? -1 : (result > 0 ? 1 : 0);
+        }
+        
+        if (result != 0) {
+            return key->descending ? -result : result;
+        }
+    }
+    
+    return 0;
+}
+
+// Composite key: all the keys of the spec back to back. Strings keep their terminator and
+// numbers are 4 bytes big endian, so every key is self delimiting and comparing composite
+// keys with memcmp gives the same order as comparing the keys one by one.
+// Descending keys are inverted. Returns the length written to out.
+static size_t build_composite(const MP3File* file, const CollationKeys* keys, const SortSpec* spec, unsigned char* out) {
+    size_t length = 0;
+    
+    for (int k = 0; k < spec->key_count; k++) {
+        const SortKey* key = &spec->keys[k];
+        unsigned char number[4];
+        const unsigned char* data;
+        size_t size;
+        
+        if (is_numeric_field(key->field)) {
+            UINT32 value = (UINT32)((INT64)field_number(file, key->field) + 0x80000000LL);
+            number[0] = (unsigned char)(value >> 24);
+            number[1] = (unsigned char)(value >> 16);
+            number[2] = (unsigned char)(value >> 8);
+            number[3] = (unsigned char)value;
+            data = number;
+            size = 4;
+        } else {
+            data = key_string(file, keys, key->field);
+            size = strlen((const char*)data) + 1;
+        }
+        
+        for (size_t i = 0; i < size; i++) {
+            out[length++] = key->descending ? (unsigned char)~data[i] : data[i];
+        }
+    }
+    
+    return length;
+}
+
+// Store a composite key in an entry: the first bytes go in the prefix, the rest in the arena.
+// The arena may still move, so tail holds an offset until fix_tails runs.
+static BOOL set_entry_key(SortEntry* entry, const unsigned char* key, size_t length, KeyArena* arena) {
+    unsigned char bytes[SORT_PREFIX_LENGTH + 1] = {0};
+    size_t head = length < SORT_PREFIX_LENGTH ? length : SORT_PREFIX_LENGTH;
+    memcpy(bytes, key, head);
+    
+    entry->tail = NULL;
+    if (length > SORT_PREFIX_LENGTH) {
+        unsigned short tail_length = (unsigned short)(length - SORT_PREFIX_LENGTH);
+        if (arena->size + sizeof(tail_length) + tail_length > arena->capacity) {
+            size_t new_capacity = arena->capacity ? arena->capacity * 2 : 64 * 1024;
+            while (new_capacity < arena->size + sizeof(tail_length) + tail_length) {
+                new_capacity *= 2;
+            }
+            unsigned char* grown = (unsigned char*)MEM_REALLOC(arena->data, new_capacity);
+            if (!grown) return FALSE;
+            arena->data = grown;
+            arena->capacity = new_capacity;
+        }
+        
+        entry->tail = (const unsigned char*)(ULONG_PTR)arena->size;
+        memcpy(arena->data + arena->size, &tail_length, sizeof(tail_length));
+        memcpy(arena->data + arena->size + sizeof(tail_length), key + SORT_PREFIX_LENGTH, tail_length);
+        arena->size += sizeof(tail_length) + tail_length;
+        bytes[SORT_PREFIX_LENGTH] = 1;
+    }
+    
+    entry->prefix[0] = 0;
+    entry->prefix[1] = 0;
+    for (int i = 0; i <= SORT_PREFIX_LENGTH; i++) {
+        entry->prefix[i / 8] |= (UINT64)bytes[i] << (8 * (7 - i % 8));
+    }
+    return TRUE;
+}
+
+// Turn the tail offsets of a chunk into pointers once its arena is complete
+static void fix_tails(SortEntry* entries, int count, const KeyArena* arena) {
+    for (int i = 0; i < count; i++) {
+        if (entries[i].prefix[1] & 0xFF) {
+            entries[i].tail = arena->data + (ULONG_PTR)entries[i].tail;
+        }
+    }
+}
+
+// Full comparison: the prefixes, then the rest of the composite keys
+static int compare_entries(const SortEntry* a, const SortEntry* b) {
+    if (a->prefix[0] != b->prefix[0]) {
+        return a->prefix[0] < b->prefix[0] ? -1 : 1;
+    }
+    if (a->prefix[1] != b->prefix[1]) {
+        return a->prefix[1] < b->prefix[1] ? -1 : 1;
+    }
+    
+    // Both composite keys fit in the prefix: they are equal
+    if ((a->prefix[1] & 0xFF) == 0) {
+        return 0;
+    }
+    
+    unsigned short x_length, y_length;
+    memcpy(&x_length, a->tail, sizeof(x_length));
+    memcpy(&y_length, b->tail, sizeof(y_length));
+    
+    int result = memcmp(a->tail + sizeof(x_length), b->tail + sizeof(y_length),
+                        x_length < y_length ? x_length : y_length);
+    if (result != 0) {
+        return result < 0 ? -1 : 1;
+    }
+    return x_length < y_length ? -1 : (x_length > y_length ? 1 : 0);
+}
+
+// Stable merge sort of the entries: insertion sorted runs, then merges alternating
+// between the two buffers. Returns the buffer holding the result.
+static SortEntry* merge_sort_entries(SortEntry* entries, SortEntry* buffer, int count) {
+    SortEntry* source = entries;
+    SortEntry* target = buffer;
+    
+    for (int start = 0; start < count; start += SORT_INSERTION_RUN) {
+        int end = start + SORT_INSERTION_RUN < count ? start + SORT_INSERTION_RUN : count;
+        for (int i = start + 1; i < end; i++) {
+            SortEntry entry = source[i];
+            int j = i - 1;
+            while (j >= start && compare_entries(&source[j], &entry) > 0) {
+                source[j + 1] = source[j];
+                j--;
+            }
+            source[j + 1] = entry;
+        }
+    }
+    
+    for (int width = SORT_INSERTION_RUN; width < count; width *= 2) {
+        for (int left = 0; left < count; left += 2 * width) {
+            int middle = left + width < count ? left + width : count;
+            int right = left + 2 * width < count ? left + 2 * width : count;
+            int i = left, j = middle, k = left;
+            
+            // On equal keys the left run wins
+            while (i < middle && j < right) {
+                if (compare_entries(&source[j], &source[i]) < 0) {
+                    target[k++] = source[j++];
+                } else {
+                    target[k++] = source[i++];
+                }
+            }
+            while (i < middle) {
+                target[k++] = source[i++];
+            }
+            while (j < right) {
+                target[k++] = source[j++];
+            }
+        }
+        
+        SortEntry* swap = source;
+        source = target;
+        target = swap;
+    }
+    
+    return source;
+}
+
+// Task: build the composite keys of one chunk
+static void build_chunk_keys(void* context, int chunk) {
+    SortJob* job = (SortJob*)context;
+    const SortSpec* spec = job->spec;
+    BOOL collate = !(spec->flags & SORT_BYTE_ORDER);
+    DWORD flags = spec->flags & COLLATION_FLAG_MASK;
+    KeyArena* arena = &job->arenas[chunk];
+    unsigned char composite[SORT_SPEC_MAX_KEYS * COLLATION_KEY_SIZE];
+    int start = job->chunk_start[chunk];
+    int end = job->chunk_start[chunk + 1];
+    
+    for (int i = start; i < end; i++) {
+        SortEntry* entry = &job->entries[i];
+        
+        // Keys are cached on the library record; tracks no longer in the library
+        // get keys that only live for this sort
+        const CollationKeys* keys = NULL;
+        CollationKeys* temporary = NULL;
+        if (collate) {
+            MP3File* owner = job->library ? library_get_track(job->library, entry->file->id) : NULL;
+            if (owner) {
+                keys = collation_get_keys(owner, flags);
+            } else {
+                keys = temporary = build_keys(entry->file, flags);
+            }
+            if (!keys) {
+                job->failed[chunk] = TRUE;
+                return;
+            }
+        }
+        
+        size_t length = build_composite(entry->file, keys, spec, composite);
+        MEM_FREE(temporary);
+        
+        if (!set_entry_key(entry, composite, length, arena)) {
+            job->failed[chunk] = TRUE;
+            return;
+        }
+    }
+    
+    fix_tails(job->entries + start, end - start, arena);
+}
+
+// Task: sort one chunk
+static void sort_chunk(void* context, int chunk) {
+    SortJob* job = (SortJob*)context;
+    int start = job->chunk_start[chunk];
+    int count = job->chunk_start[chunk + 1] - start;
+    
+    job->sorted[chunk] = merge_sort_entries(job->entries + start, job->buffer + start, count);
+}
+
+// Element of the sorted chunks identified by its chunk and position. (key, chunk, position)
+// is the order of the serial stable sort: chunks are consecutive slices of the input.
+typedef struct {
+    const SortEntry* entry;
+    int chunk;
+    int index;
+} SortSplitter;
+
+static int compare_ranked(const SortEntry* entry, int chunk, int index, const SortSplitter* splitter) {
+    int result = compare_entries(entry, splitter->entry);
+    if (result != 0) return result;
+    if (chunk != splitter->chunk) return chunk < splitter->chunk ? -1 : 1;
+    return index < splitter->index ? -1 : (index > splitter->index ? 1 : 0);
+}
+
+// Split the merge into chunk_count independent ranges: sample every chunk, pick evenly
+// spaced splitters and find where each splitter falls in every chunk
+static void split_merge(SortJob* job, SortSplitter* samples) {
+    int chunks = job->chunk_count;
+    int sample_count = 0;
+    
+    for (int c = 0; c < chunks; c++) {
+        int length = job->chunk_start[c + 1] - job->chunk_start[c];
+        for (int s = 0; s < SORT_SAMPLES_PER_CHUNK; s++) {
+            int index = (int)((INT64)(2 * s + 1) * length / (2 * SORT_SAMPLES_PER_CHUNK));
+            samples[sample_count].entry = &job->sorted[c][index];
+            samples[sample_count].chunk = c;
+            samples[sample_count].index = index;
+            sample_count++;
+        }
+    }
+    
+    for (int i = 1; i < sample_count; i++) {
+        SortSplitter sample = samples[i];
+        int j = i - 1;
+        while (j >= 0 && compare_ranked(samples[j].entry, samples[j].chunk, samples[j].index, &sample) > 0) {
+            samples[j + 1] = samples[j];
+            j--;
+        }
+        samples[j + 1] = sample;
+    }
+    
+    for (int c = 0; c < chunks; c++) {
+        job->bounds[c] = 0;
+        job->bounds[chunks * chunks + c] = job->chunk_start[c + 1] - job->chunk_start[c];
+    }
+    
+    for (int p = 1; p < chunks; p++) {
+        const SortSplitter* splitter = &samples[p * sample_count / chunks];
+        
+        // Elements of each chunk that come before the splitter
+        for (int c = 0; c < chunks; c++) {
+            int low = 0;
+            int high = job->chunk_start[c + 1] - job->chunk_start[c];
+            while (low < high) {
+                int middle = low + (high - low) / 2;
+                if (compare_ranked(&job->sorted[c][middle], c, middle, splitter) < 0) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            job->bounds[p * chunks + c] = low;
+        }
+    }
+}
+
+// Task: k-way merge of one range of the sorted chunks into the output array
+static void merge_range(void* context, int range) {
+    SortJob* job = (SortJob*)context;
+    int chunks = job->chunk_count;
+    const int* from = &job->bounds[range * chunks];
+    const int* to = &job->bounds[(range + 1) * chunks];
+    int heads[SORT_MAX_CHUNKS];
+    
+    // The range starts after everything the previous ranges take from every chunk
+    int out = 0;
+    for (int c = 0; c < chunks; c++) {
+        heads[c] = from[c];
+        out += from[c];
+    }
+    
+    SortEntry* output = job->sorted[0] == job->entries ? job->buffer : job->entries;
+    while (1) {
+        // On equal keys the earliest chunk wins, as in the serial sort
+        int best = -1;
+        for (int c = 0; c < chunks; c++) {
+            if (heads[c] < to[c] &&
+                (best < 0 || compare_entries(&job->sorted[c][heads[c]], &job->sorted[best][heads[best]]) < 0)) {
+                best = c;
+            }
+        }
+        if (best < 0) break;
+        
+        output[out++] = job->sorted[best][heads[best]++];
+    }
+}
+
+// Sort job.entries (files already filled in) and return the sorted array, or NULL without memory.
+// The result points into job.entries or job.buffer; release the job with free_sort_job.
+static SortEntry* run_sort_job(SortJob* job, ThreadPool* pool) {
+    // Consecutive chunks of similar size, one per thread
+    job->chunk_count = 1;
+    if (pool && job->count >= SORT_PARALLEL_THRESHOLD) {
+        job->chunk_count = pool->thread_count;
+        if (job->chunk_count > job->count / SORT_MIN_CHUNK) job->chunk_count = job->count / SORT_MIN_CHUNK;
+        if (job->chunk_count > SORT_MAX_CHUNKS) job->chunk_count = SORT_MAX_CHUNKS;
+        if (job->chunk_count < 1) job->chunk_count = 1;
+    }
+    for (int c = 0; c <= job->chunk_count; c++) {
+        job->chunk_start[c] = (int)((INT64)job->count * c / job->chunk_count);
+    }
+    
+    ThreadPool* workers = job->chunk_count > 1 ? pool : NULL;
+    SortSplitter* samples = NULL;
+    SortEntry* sorted = NULL;
+    BOOL ok = TRUE;
+    
+    thread_pool_run(workers, job->chunk_count, build_chunk_keys, job);
+    for (int c = 0; c < job->chunk_count; c++) {
+        ok = ok && !job->failed[c];
+    }
+    
+    if (ok) {
+        job->buffer = (SortEntry*)MEM_ALLOC((size_t)job->count * sizeof(SortEntry));
+        ok = job->buffer != NULL;
+    }
+    if (ok && job->chunk_count > 1) {
+        job->bounds = (int*)MEM_ALLOC((size_t)(job->chunk_count + 1) * job->chunk_count * sizeof(int));
+        samples = (SortSplitter*)MEM_ALLOC((size_t)job->chunk_count * SORT_SAMPLES_PER_CHUNK * sizeof(SortSplitter));
+        ok = job->bounds && samples;
+    }
+    
+    if (ok) {
+        thread_pool_run(workers, job->chunk_count, sort_chunk, job);
+        sorted = job->sorted[0];
+        
+        if (job->chunk_count > 1) {
+            // The merge reads the chunks where they are and writes to the other array,
+            // so every chunk must end up in the same one
+            for (int c = 1; c < job->chunk_count; c++) {
+                int start = job->chunk_start[c];
+                BOOL in_entries = job->sorted[c] == job->entries + start;
+                if (in_entries != (job->sorted[0] == job->entries)) {
+                    SortEntry* target = in_entries ? job->buffer + start : job->entries + start;
+                    memcpy(target, job->sorted[c], (size_t)(job->chunk_start[c + 1] - start) * sizeof(SortEntry));
+                    job->sorted[c] = target;
+                }
+            }
+            
+            split_merge(job, samples);
+            thread_pool_run(workers, job->chunk_count, merge_range, job);
+            sorted = job->sorted[0] == job->entries ? job->buffer : job->entries;
+        }
+    }
+    
+    MEM_FREE(samples);
+    return sorted;
+}
+
+static void free_sort_job(SortJob* job) {
+    for (int c = 0; c < job->chunk_count; c++) {
+        MEM_FREE(job->arenas[c].data);
+    }
+    MEM_FREE(job->bounds);
+    MEM_FREE(job->entries);
+    MEM_FREE(job->buffer);
+}
+
+BOOL sort_tracks_parallel(MP3Library* library, MP3File** file_list, const SortSpec* spec, ThreadPool* pool) {
+    if (!file_list || !spec || spec->key_count == 0) return FALSE;
+    if (!*file_list || !(*file_list)->next) return TRUE;
+    
+    SortJob job;
+    memset(&job, 0, sizeof(SortJob));
+    job.library = library;
+    job.spec = spec;
+    
+    // One pass over the list: the array grows while the nodes are read
+    int capacity = 1024;
+    job.entries = (SortEntry*)MEM_ALLOC(capacity * sizeof(SortEntry));
+    if (!job.entries) return FALSE;
+    
+    for (MP3File* current = *file_list; current; current = current->next) {
+        if (job.count == capacity) {
+            SortEntry* grown = (SortEntry*)MEM_REALLOC(job.entries, 2 * (size_t)capacity * sizeof(SortEntry));
+            if (!grown) {
+                MEM_FREE(job.entries);
+                return FALSE;
+            }
+            job.entries = grown;
+            capacity *= 2;
+        }
+        job.entries[job.count++].file = current;
+    }
+    
+    SortEntry* sorted = run_sort_job(&job, pool);
+    if (sorted) {
+        // Relink the nodes in the new order
+        for (int i = 0; i < job.count - 1; i++) {
+            sorted[i].file->next = sorted[i + 1].file;
+        }
+        sorted[job.count - 1].file->next = NULL;
+        *file_list = sorted[0].file;
+    }
+    
+    free_sort_job(&job);
+    return sorted != NULL;
+}
+
+BOOL sort_track_array(MP3Library* library, MP3File** tracks, int count, const SortSpec* spec, ThreadPool* pool) {
+    if (!tracks || !spec || spec->key_count == 0) return FALSE;
+    if (count < 2) return TRUE;
+    
+    SortJob job;
+    memset(&job, 0, sizeof(SortJob));
+    job.library = library;
+    job.spec = spec;
+    job.entries = (SortEntry*)MEM_ALLOC((size_t)count * sizeof(SortEntry));
+    if (!job.entries) return FALSE;
+    
+    for (int i = 0; i < count; i++) {
+        job.entries[i].file = tracks[i];
+    }
+    job.count = count;
+    
+    SortEntry* sorted = run_sort_job(&job, pool);
+    if (sorted) {
+        for (int i = 0; i < count; i++) {
+            tracks[i] = sorted[i].file;
+        }
+    }
+    
+    free_sort_job(&job);
+    return sorted != NULL;
+}
+
+BOOL sort_tracks(MP3Library* library, MP3File** file_list, const SortSpec* spec) {
+    return sort_tracks_parallel(library, file_list, spec, NULL);
+}
@@ -0,0 +1,293 @@
+#include "../include/sortview.h"
+#include "../include/memory.h"
+
+// Probability 1/4 of promoting a node to the next level
+#define SORTED_VIEW_LEVEL_BITS 2
+
+static SortedViewNode* alloc_node(MP3File* file, int level) {
+    SortedViewNode* node = (SortedViewNode*)MEM_ALLOC_TAGGED(sizeof(SortedViewNode) + level * sizeof(SortedViewNode*),
+                                                             MEM_CAT_INDEX);
+    if (!node) return NULL;
+    
+    node->file = file;
+    node->level = level;
+    for (int i = 0; i < level; i++) {
+        node->next[i] = NULL;
+    }
+    return node;
+}
+
+static int random_level(SortedView* view) {
+    // xorshift32
+    UINT32 x = view->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    view->random_state = x;
+    
+    int level = 1;
+    while (level < SORTED_VIEW_MAX_LEVEL && (x & ((1u << SORTED_VIEW_LEVEL_BITS) - 1)) == 0) {
+        level++;
+        x >>= SORTED_VIEW_LEVEL_BITS;
+    }
+    return level;
+}
+
+// View order: the spec, then the track id so that every record has a single position
+static int compare_records(SortedView* view, MP3File* a, MP3File* b) {
+    int result = sort_compare_tracks(a, b, &view->spec);
+    if (result != 0) return result;
+    return a->id < b->id ? -1 : (a->id > b->id ? 1 : 0);
+}
+
+static int compare_by_id(const void* a, const void* b) {
+    TrackId x = (*(MP3File* const*)a)->id;
+    TrackId y = (*(MP3File* const*)b)->id;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Free every node, leaving an empty view
+static void clear_nodes(SortedView* view) {
+    SortedViewNode* node = view->head->next[0];
+    while (node) {
+        SortedViewNode* next = node->next[0];
+        MEM_FREE(node);
+        node = next;
+    }
+    
+    for (int i = 0; i < SORTED_VIEW_MAX_LEVEL; i++) {
+        view->head->next[i] = NULL;
+    }
+    view->level = 1;
+    view->count = 0;
+}
+
+// Body of sorted_view_rebuild, with the library lock held
+static BOOL rebuild_locked(SortedView* view, ThreadPool* pool) {
+    MP3Library* library = view->library;
+    clear_nodes(view);
+    view->valid = FALSE;
+    
+    if (!sort_tracks_parallel(library, &library->all_files, &view->spec, pool)) {
+        return FALSE;
+    }
+    
+    // Runs of equal keys are put in id order, then the nodes are appended in order
+    MP3File** run = (MP3File**)MEM_ALLOC((size_t)(library->total_files > 0 ? library->total_files : 1) * sizeof(MP3File*));
+    if (!run) return FALSE;
+    
+    SortedViewNode* last[SORTED_VIEW_MAX_LEVEL];
+    for (int i = 0; i < SORTED_VIEW_MAX_LEVEL; i++) {
+        last[i] = view->head;
+    }
+    
+    BOOL ok = TRUE;
+    MP3File* current = library->all_files;
+    while (ok && current) {
+        int run_length = 0;
+        run[run_length++] = current;
+        MP3File* next = current->next;
+        while (next && sort_compare_tracks(current, next, &view->spec) == 0) {
+            run[run_length++] = next;
+            next = next->next;
+        }
+        if (run_length > 1) {
+            qsort(run, run_length, sizeof(MP3File*), compare_by_id);
+        }
+        
+        for (int i = 0; i < run_length; i++) {
+            int level = random_level(view);
+            SortedViewNode* node = alloc_node(run[i], level);
+            if (!node) {
+                ok = FALSE;
+                break;
+            }
+            for (int l = 0; l < level; l++) {
+                last[l]->next[l] = node;
+                last[l] = node;
+            }
+            if (level > view->level) {
+                view->level = level;
+            }
+            view->count++;
+        }
+        
+        current = next;
+    }
+    
+    MEM_FREE(run);
+    if (!ok) {
+        clear_nodes(view);
+        return FALSE;
+    }
+    
+    // Keep the library list in the same order as the view
+    sorted_view_relink(view);
+    view->valid = TRUE;
+    return TRUE;
+}
+
+BOOL sorted_view_rebuild(SortedView* view, ThreadPool* pool) {
+    if (!view) return FALSE;
+    
+    // The list is sorted in place and the view read from it: no scan may change either
+    library_lock(view->library);
+    BOOL ok = rebuild_locked(view, pool);
+    library_unlock(view->library);
+    return ok;
+}
+
+SortedView* sorted_view_create(MP3Library* library, const SortSpec* spec, ThreadPool* pool) {
+    if (!library || !spec || spec->key_count == 0) return NULL;
+    
+    SortedView* view = (SortedView*)MEM_CALLOC_TAGGED(1, sizeof(SortedView), MEM_CAT_INDEX);
+    if (!view) return NULL;
+    
+    view->head = (SortedViewNode*)MEM_CALLOC_TAGGED(1, sizeof(SortedViewNode) + SORTED_VIEW_MAX_LEVEL * sizeof(SortedViewNode*),
+                                                    MEM_CAT_INDEX);
+    if (!view->head) {
+        MEM_FREE(view);
+        return NULL;
+    }
+    
+    view->library = library;
+    view->spec = *spec;
+    view->head->level = SORTED_VIEW_MAX_LEVEL;
+    view->level = 1;
+    view->random_state = 0x9E3779B9u;
+    
+    // Registered in the same lock as the build, so that no record added in between is missed
+    library_lock(library);
+    if (!rebuild_locked(view, pool)) {
+        library_unlock(library);
+        MEM_FREE(view->head);
+        MEM_FREE(view);
+        return NULL;
+    }
+    
+    view->next_view = library->views;
+    library->views = view;
+    library_unlock(library);
+    return view;
+}
+
+void sorted_view_free(SortedView* view) {
+    if (!view) return;
+    
+    library_lock(view->library);
+    SortedView** link = &view->library->views;
+    while (*link && *link != view) {
+        link = &(*link)->next_view;
+    }
+    if (*link) {
+        *link = view->next_view;
+    }
+    library_unlock(view->library);
+    
+    clear_nodes(view);
+    MEM_FREE(view->head);
+    MEM_FREE(view);
+}
+
+// Find the last node before file on every level
+static void find_predecessors(SortedView* view, MP3File* file, SortedViewNode** update) {
+    SortedViewNode* node = view->head;
+    for (int i = view->level - 1; i >= 0; i--) {
+        while (node->next[i] && compare_records(view, node->next[i]->file, file) < 0) {
+            node = node->next[i];
+        }
+        update[i] = node;
+    }
+}
+
+BOOL sorted_view_insert(SortedView* view, MP3File* file) {
+    if (!view || !file || !view->valid) return FALSE;
+    
+    SortedViewNode* update[SORTED_VIEW_MAX_LEVEL];
+    find_predecessors(view, file, update);
+    
+    // Already in the view
+    if (update[0]->next[0] && update[0]->next[0]->file == file) {
+        return TRUE;
+    }
+    
+    int level = random_level(view);
+    SortedViewNode* node = alloc_node(file, level);
+    if (!node) {
+        view->valid = FALSE;
+        return FALSE;
+    }
+    
+    for (int i = view->level; i < level; i++) {
+        update[i] = view->head;
+    }
+    if (level > view->level) {
+        view->level = level;
+    }
+    
+    for (int i = 0; i < level; i++) {
+        node->next[i] = update[i]->next[i];
+        update[i]->next[i] = node;
+    }
+    view->count++;
+    return TRUE;
+}
+
+BOOL sorted_view_remove(SortedView* view, MP3File* file) {
+    if (!view || !file || !view->valid) return FALSE;
+    
+    SortedViewNode* update[SORTED_VIEW_MAX_LEVEL];
+    find_predecessors(view, file, update);
+    
+    SortedViewNode* node = update[0]->next[0];
+    if (!node || node->file != file) {
+        return FALSE;
+    }
+    
+    for (int i = 0; i < node->level; i++) {
+        update[i]->next[i] = node->next[i];
+    }
+    while (view->level > 1 && !view->head->next[view->level - 1]) {
+        view->level--;
+    }
+    
+    MEM_FREE(node);
+    view->count--;
+    return TRUE;
+}
+
+void sorted_views_track_added(MP3Library* library, MP3File* file) {
+    for (SortedView* view = library->views; view; view = view->next_view) {
+        sorted_view_insert(view, file);
+    }
+}
+
+void sorted_views_track_removed(MP3Library* library, MP3File* file) {
+    for (SortedView* view = library->views; view; view = view->next_view) {
+        // A record missing from a valid view means the view no longer matches the library
+        if (view->valid && !sorted_view_remove(view, file)) {
+            view->valid = FALSE;
+        }
+    }
+}
+
+SortedViewNode* sorted_view_first(const SortedView* view) {
+    return view ? view->head->next[0] : NULL;
+}
+
+void sorted_view_relink(SortedView* view) {
+    if (!view) return;
+    
+    // Every next pointer is rewritten: not while a scan adds or removes records
+    MP3Library* library = view->library;
+    library_lock(library);
+    if (view->count == library->total_files) {
+        MP3File** link = &library->all_files;
+        for (SortedViewNode* node = view->head->next[0]; node; node = node->next[0]) {
+            *link = node->file;
+            link = &node->file->next;
+        }
+        *link = NULL;
+    }
+    library_unlock(library);
+}
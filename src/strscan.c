@@ -0,0 +1,317 @@
+#include "../include/strscan.h"
+#include "../include/memory.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define STRSCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC only emits vector instructions in functions built for them; MSVC always does
+#if defined(__GNUC__)
+#define STRSCAN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define STRSCAN_TARGET(isa)
+#endif
+
+typedef size_t (*FindKernel)(const char* text, size_t length, const char* needle, size_t needle_length);
+
+static const char* level_names[STR_SCAN_LEVELS] = { "scalar", "sse2", "avx2" };
+
+static unsigned char fold_ascii(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c | 0x20) : c;
+}
+
+static BOOL is_ascii_letter(unsigned char c) {
+    c = fold_ascii(c);
+    return c >= 'a' && c <= 'z';
+}
+
+static BOOL equal_nocase(const char* a, const char* b, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (fold_ascii((unsigned char)a[i]) != fold_ascii((unsigned char)b[i])) return FALSE;
+    }
+    return TRUE;
+}
+
+static int lowest_bit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static size_t find_scalar(const char* text, size_t length, const char* needle, size_t needle_length) {
+    unsigned char first = fold_ascii((unsigned char)needle[0]);
+    for (size_t i = 0; i + needle_length <= length; i++) {
+        if (fold_ascii((unsigned char)text[i]) == first && equal_nocase(text + i + 1, needle + 1, needle_length - 1)) {
+            return i;
+        }
+    }
+    return STR_NOT_FOUND;
+}
+
+#ifdef STRSCAN_X86
+
+// Each block compares the first and the last byte of the needle at every position
+// at once; only positions where both agree are checked byte by byte. Setting bit 5
+// folds exactly the two cases of a letter together, so it is applied only when the
+// needle byte is a letter.
+
+STRSCAN_TARGET("sse2")
+static size_t find_sse2(const char* text, size_t length, const char* needle, size_t needle_length) {
+    unsigned char first = fold_ascii((unsigned char)needle[0]);
+    unsigned char last = fold_ascii((unsigned char)needle[needle_length - 1]);
+    const __m128i first_fold = _mm_set1_epi8(is_ascii_letter(first) ? 0x20 : 0);
+    const __m128i last_fold = _mm_set1_epi8(is_ascii_letter(last) ? 0x20 : 0);
+    const __m128i first_byte = _mm_set1_epi8((char)first);
+    const __m128i last_byte = _mm_set1_epi8((char)last);
+    
+    size_t i = 0;
+    for (; i + needle_length - 1 + 16 <= length; i += 16) {
+        __m128i start = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i)), first_fold);
+        __m128i end = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i + needle_length - 1)), last_fold);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(start, first_byte), _mm_cmpeq_epi8(end, last_byte)));
+        while (mask) {
+            int bit = lowest_bit(mask);
+            if (needle_length <= 2 || equal_nocase(text + i + bit + 1, needle + 1, needle_length - 2)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    
+    size_t found = find_scalar(text + i, length - i, needle, needle_length);
+    return found == STR_NOT_FOUND ? found : i + found;
+}
+
+STRSCAN_TARGET("avx2")
+static size_t find_avx2(const char* text, size_t length, const char* needle, size_t needle_length) {
+    // Short texts (most single fields) never fill a block: leave before touching the
+    // 256-bit registers, whose state switch costs more than the whole search
+    if (needle_length - 1 + 32 > length) return find_sse2(text, length, needle, needle_length);
+    
+    unsigned char first = fold_ascii((unsigned char)needle[0]);
+    unsigned char last = fold_ascii((unsigned char)needle[needle_length - 1]);
+    const __m256i first_fold = _mm256_set1_epi8(is_ascii_letter(first) ? 0x20 : 0);
+    const __m256i last_fold = _mm256_set1_epi8(is_ascii_letter(last) ? 0x20 : 0);
+    const __m256i first_byte = _mm256_set1_epi8((char)first);
+    const __m256i last_byte = _mm256_set1_epi8((char)last);
+    
+    size_t i = 0;
+    for (; i + needle_length - 1 + 32 <= length; i += 32) {
+        __m256i start = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i)), first_fold);
+        __m256i end = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i + needle_length - 1)), last_fold);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(start, first_byte), _mm256_cmpeq_epi8(end, last_byte)));
+        while (mask) {
+            int bit = lowest_bit(mask);
+            if (needle_length <= 2 || equal_nocase(text + i + bit + 1, needle + 1, needle_length - 2)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    
+    // The remaining tail is shorter than two blocks
+    size_t found = find_sse2(text + i, length - i, needle, needle_length);
+    return found == STR_NOT_FOUND ? found : i + found;
+}
+
+static BOOL cpu_has_avx2(void) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return FALSE;
+    
+    // AVX needs OSXSAVE and the OS saving the YMM registers
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return FALSE;
+    if ((_xgetbv(0) & 6) != 6) return FALSE;
+    
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static BOOL cpu_has_sse2(void) {
+#if defined(_M_X64) || defined(__x86_64__)
+    return TRUE;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif // STRSCAN_X86
+
+static const FindKernel kernels[STR_SCAN_LEVELS] = {
+    find_scalar,
+#ifdef STRSCAN_X86
+    find_sse2,
+    find_avx2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+// Selected on first use; a race only makes two threads pick the same level
+static int active_level = -1;
+static int best_level = -1;
+
+static int detect_level(void) {
+    if (best_level < 0) {
+        int level = STR_SCAN_SCALAR;
+#ifdef STRSCAN_X86
+        if (cpu_has_sse2()) {
+            level = cpu_has_avx2() ? STR_SCAN_AVX2 : STR_SCAN_SSE2;
+        }
+#endif
+        best_level = level;
+    }
+    return best_level;
+}
+
+int str_scan_level(void) {
+    if (active_level < 0) {
+        active_level = detect_level();
+    }
+    return active_level;
+}
+
+BOOL str_scan_supported(int level) {
+    return level >= STR_SCAN_SCALAR && level <= detect_level();
+}
+
+int str_scan_set_level(int level) {
+    int best = detect_level();
+    if (level < STR_SCAN_SCALAR) level = STR_SCAN_SCALAR;
+    active_level = level > best ? best : level;
+    return active_level;
+}
+
+const char* str_scan_level_name(int level) {
+    return level >= 0 && level < STR_SCAN_LEVELS ? level_names[level] : "unknown";
+}
+
+size_t str_find_nocase(const char* text, size_t length, const char* needle, size_t needle_length) {
+    if (needle_length == 0) return 0;
+    if (!text || !needle || needle_length > length) return STR_NOT_FOUND;
+    
+    return kernels[str_scan_level()](text, length, needle, needle_length);
+}
+
+void string_pool_init(StringPool* pool) {
+    memset(pool, 0, sizeof(StringPool));
+}
+
+void string_pool_free(StringPool* pool) {
+    MEM_FREE(pool->text);
+    MEM_FREE(pool->offsets);
+    string_pool_init(pool);
+}
+
+BOOL string_pool_append(StringPool* pool, const char* text) {
+    size_t length = strlen(text) + 1;
+    if (pool->size + length > pool->capacity) {
+        size_t capacity = pool->capacity > 0 ? pool->capacity * 2 : STRING_POOL_INITIAL_BYTES;
+        while (capacity < pool->size + length) {
+            capacity *= 2;
+        }
+        char* grown = (char*)MEM_REALLOC_TAGGED(pool->text, capacity, MEM_CAT_INDEX);
+        if (!grown) return FALSE;
+        
+        pool->text = grown;
+        pool->capacity = capacity;
+    }
+    
+    if (pool->count == pool->entry_capacity) {
+        UINT32 capacity = pool->entry_capacity > 0 ? pool->entry_capacity * 2 : STRING_POOL_INITIAL_ENTRIES;
+        UINT32* grown = (UINT32*)MEM_REALLOC_TAGGED(pool->offsets, (size_t)capacity * sizeof(UINT32), MEM_CAT_INDEX);
+        if (!grown) return FALSE;
+        
+        pool->offsets = grown;
+        pool->entry_capacity = capacity;
+    }
+    
+    memcpy(pool->text + pool->size, text, length);
+    pool->offsets[pool->count++] = (UINT32)pool->size;
+    pool->size += length;
+    return TRUE;
+}
+
+void string_pool_truncate(StringPool* pool, UINT32 count) {
+    if (count >= pool->count) return;
+    
+    pool->size = pool->offsets[count];
+    pool->count = count;
+}
+
+void string_pool_compact(StringPool* pool, const UINT32* remap) {
+    size_t size = 0;
+    UINT32 kept = 0;
+    for (UINT32 entry = 0; entry < pool->count; entry++) {
+        if (remap[entry] == (UINT32)-1) continue;
+        
+        size_t start = pool->offsets[entry];
+        size_t end = entry + 1 < pool->count ? pool->offsets[entry + 1] : pool->size;
+        memmove(pool->text + size, pool->text + start, end - start);
+        pool->offsets[kept++] = (UINT32)size;
+        size += end - start;
+    }
+    pool->count = kept;
+    pool->size = size;
+}
+
+// Entry holding byte offset of the pool
+static UINT32 entry_at(const StringPool* pool, size_t offset) {
+    UINT32 low = 0;
+    UINT32 high = pool->count;
+    while (high - low > 1) {
+        UINT32 middle = low + (high - low) / 2;
+        if (pool->offsets[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int string_pool_find(const StringPool* pool, const char* needle, size_t needle_length,
+                     void (*match)(UINT32 entry, void* context), void* context) {
+    if (!pool || !needle || pool->count == 0) return 0;
+    
+    // A needle never contains the terminators, so a match never spans two entries
+    int matches = 0;
+    size_t position = 0;
+    while (position < pool->size) {
+        size_t found = needle_length == 0 ? 0
+                                          : str_find_nocase(pool->text + position, pool->size - position, needle,
+                                                            needle_length);
+        if (found == STR_NOT_FOUND) break;
+        
+        UINT32 entry = entry_at(pool, position + found);
+        if (match) match(entry, context);
+        matches++;
+        
+        // One match per entry: go on from the next one
+        position = entry + 1 < pool->count ? pool->offsets[entry + 1] : pool->size;
+    }
+    return matches;
+}
@@ -0,0 +1,1131 @@
+#include "../include/textindex.h"
+#include "../include/memory.h"
+#include <ctype.h>
+
+#define TEXT_INITIAL_CAPACITY 4096
+#define TEXT_INITIAL_DOCS 1024
+#define TEXT_INITIAL_POSTINGS 4
+#define TRIGRAM_INITIAL_CAPACITY 4096
+#define TRIGRAM_INITIAL_WORDS 4
+
+// Marks both ends of a word in its trigrams
+#define TRIGRAM_BOUNDARY 0x01
+
+// query_hits of a word already matched by the current query word
+#define TEXT_WORD_DONE 0xFFFF
+
+// Folded form of U+00C0..U+00FF: a letter, ' ' for a separator, or an uppercase
+// code for two letters (A = "ae", T = "th", S = "ss")
+static const char latin1_fold[] = "aaaaaaAceeeeiiiidnooooo ouuuuyTS"
+                                  "aaaaaaAceeeeiiiidnooooo ouuuuyTy";
+
+// Folded form of U+0100..U+017F (Latin Extended-A), I = "ij", O = "oe"
+static const char latin_ext_fold[] = "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii"
+                                     "IIjjkkkllllllllllnnnnnnnnnooooooOOrrrrrrssssssss"
+                                     "ttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+
+static const char* text_field_names[TEXT_FIELD_COUNT] = { "title", "artist", "album", "genre", "any" };
+
+int text_field_from_name(const char* name) {
+    for (int i = 0; i < TEXT_FIELD_COUNT; i++) {
+        if (_stricmp(name, text_field_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Decode one character: UTF-8 when the sequence is valid, otherwise the byte
+// itself as Latin-1 (tags written with the ANSI code page)
+static UINT32 next_char(const unsigned char** text) {
+    const unsigned char* p = *text;
+    UINT32 c = p[0];
+    int extra = 0;
+    
+    if (c >= 0xC2 && c <= 0xDF) {
+        extra = 1;
+        c &= 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        extra = 2;
+        c &= 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        extra = 3;
+        c &= 0x07;
+    }
+    
+    for (int i = 1; i <= extra; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            *text = p + 1;
+            return p[0];
+        }
+        c = (c << 6) | (p[i] & 0x3F);
+    }
+    
+    *text = p + 1 + extra;
+    return c;
+}
+
+// Append the folded form of c to the token; FALSE if c separates words
+static BOOL fold_char(UINT32 c, char* token, int* length) {
+    char folded[4];
+    int count = 0;
+    
+    if (c < 0x80) {
+        if (c == '\'') return TRUE; // "Don't" is indexed as "dont"
+        if (!isalnum((int)c)) return FALSE;
+        folded[count++] = (char)tolower((int)c);
+    } else if (c < 0xC0) {
+        return FALSE; // Controls, punctuation and symbols of Latin-1
+    } else if (c < 0x180) {
+        char code = c < 0x100 ? latin1_fold[c - 0xC0] : latin_ext_fold[c - 0x100];
+        switch (code) {
+            case ' ': return FALSE;
+            case 'A': folded[count++] = 'a'; folded[count++] = 'e'; break;
+            case 'T': folded[count++] = 't'; folded[count++] = 'h'; break;
+            case 'S': folded[count++] = 's'; folded[count++] = 's'; break;
+            case 'I': folded[count++] = 'i'; folded[count++] = 'j'; break;
+            case 'O': folded[count++] = 'o'; folded[count++] = 'e'; break;
+            default: folded[count++] = code; break;
+        }
+    } else if ((c >= 0x2000 && c <= 0x206F) || c == 0x3000) {
+        return FALSE; // General punctuation and the ideographic space
+    } else {
+        // Other scripts are kept as they are (UTF-8)
+        if (c < 0x800) {
+            folded[count++] = (char)(0xC0 | (c >> 6));
+        } else if (c < 0x10000) {
+            folded[count++] = (char)(0xE0 | (c >> 12));
+            folded[count++] = (char)(0x80 | ((c >> 6) & 0x3F));
+        } else {
+            folded[count++] = (char)(0xF0 | (c >> 18));
+            folded[count++] = (char)(0x80 | ((c >> 12) & 0x3F));
+            folded[count++] = (char)(0x80 | ((c >> 6) & 0x3F));
+        }
+        folded[count++] = (char)(0x80 | (c & 0x3F));
+    }
+    
+    // Words longer than the limit are cut
+    if (*length + count < TEXT_TOKEN_MAX) {
+        memcpy(token + *length, folded, count);
+        *length += count;
+    }
+    return TRUE;
+}
+
+int text_tokenize(const char* text, void (*emit)(const char* token, int length, void* context), void* context) {
+    if (!text) return 0;
+    
+    const unsigned char* p = (const unsigned char*)text;
+    char token[TEXT_TOKEN_MAX];
+    int length = 0;
+    int tokens = 0;
+    
+    while (TRUE) {
+        UINT32 c = *p ? next_char(&p) : 0;
+        if (c != 0 && fold_char(c, token, &length)) continue;
+        
+        if (length > 0) {
+            token[length] = '\0';
+            emit(token, length, context);
+            tokens++;
+            length = 0;
+        }
+        if (c == 0) break;
+    }
+    
+    return tokens;
+}
+
+// FNV-1a of the token, seeded with the field
+static UINT32 token_hash(int field, const char* token, int length) {
+    UINT32 hash = 2166136261u ^ (UINT32)(field * 0x9E3779B1u);
+    for (int i = 0; i < length; i++) {
+        hash ^= (unsigned char)token[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static TextToken** find_slot(TextToken** slots, int capacity, UINT32 hash, int field, const char* token, int length) {
+    int mask = capacity - 1;
+    int slot = (int)(hash & mask);
+    
+    while (slots[slot]) {
+        TextToken* entry = slots[slot];
+        if (entry->hash == hash && entry->field == field && entry->length == length &&
+            memcmp(entry->text, token, length) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return &slots[slot];
+}
+
+// Put an entry known to be absent into a table
+static void place_entry(TextToken** slots, int capacity, TextToken* entry) {
+    int mask = capacity - 1;
+    int slot = (int)(entry->hash & mask);
+    while (slots[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = entry;
+}
+
+static BOOL rehash(TextIndex* index, int capacity) {
+    TextToken** slots = (TextToken**)MEM_CALLOC_TAGGED(capacity, sizeof(TextToken*), MEM_CAT_INDEX);
+    if (!slots) return FALSE;
+    
+    for (int i = 0; i < index->capacity; i++) {
+        if (index->slots[i]) {
+            place_entry(slots, capacity, index->slots[i]);
+        }
+    }
+    
+    MEM_FREE(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    return TRUE;
+}
+
+static UINT32 trigram_key(const unsigned char* bytes) {
+    return ((UINT32)bytes[0] << 16) | ((UINT32)bytes[1] << 8) | bytes[2];
+}
+
+// Trigrams of a word padded with the boundary byte: one per character
+static int word_trigrams(const char* text, int length, UINT32* keys) {
+    unsigned char padded[TEXT_TOKEN_MAX + 2];
+    padded[0] = TRIGRAM_BOUNDARY;
+    memcpy(padded + 1, text, length);
+    padded[length + 1] = TRIGRAM_BOUNDARY;
+    
+    for (int i = 0; i < length; i++) {
+        keys[i] = trigram_key(padded + i);
+    }
+    return length;
+}
+
+static TrigramList* find_trigram(TrigramList* table, int capacity, UINT32 key) {
+    int mask = capacity - 1;
+    int slot = (int)((key * 0x9E3779B1u) >> 7) & mask;
+    
+    while (table[slot].key != 0 && table[slot].key != key) {
+        slot = (slot + 1) & mask;
+    }
+    return &table[slot];
+}
+
+static BOOL trigram_rehash(TextIndex* index, int capacity) {
+    TrigramList* table = (TrigramList*)MEM_CALLOC_TAGGED(capacity, sizeof(TrigramList), MEM_CAT_INDEX);
+    if (!table) return FALSE;
+    
+    for (int i = 0; i < index->trigram_capacity; i++) {
+        if (index->trigrams[i].key != 0) {
+            *find_trigram(table, capacity, index->trigrams[i].key) = index->trigrams[i];
+        }
+    }
+    
+    MEM_FREE(index->trigrams);
+    index->trigrams = table;
+    index->trigram_capacity = capacity;
+    return TRUE;
+}
+
+// Undo the first count trigrams registered for a new word
+static void drop_word_trigrams(TextIndex* index, TextToken* word, const UINT32* keys, int count) {
+    for (int i = 0; i < count; i++) {
+        TrigramList* list = find_trigram(index->trigrams, index->trigram_capacity, keys[i]);
+        if (list->key != 0 && list->count > 0 && list->words[list->count - 1] == word) {
+            list->count--;
+        }
+    }
+}
+
+// List a new word under each of its trigrams
+static BOOL add_word_trigrams(TextIndex* index, TextToken* word) {
+    UINT32 keys[TEXT_TOKEN_MAX];
+    int count = word_trigrams(word->text, word->length, keys);
+    
+    for (int i = 0; i < count; i++) {
+        if ((index->trigram_count + 1) * 2 > index->trigram_capacity &&
+            !trigram_rehash(index, index->trigram_capacity * 2)) {
+            drop_word_trigrams(index, word, keys, i);
+            return FALSE;
+        }
+        
+        TrigramList* list = find_trigram(index->trigrams, index->trigram_capacity, keys[i]);
+        if (list->key == 0) {
+            list->key = keys[i];
+            index->trigram_count++;
+        }
+        if (list->count > 0 && list->words[list->count - 1] == word) {
+            continue; // Trigram repeated in the word
+        }
+        
+        if (list->count == list->capacity) {
+            int capacity = list->capacity > 0 ? list->capacity * 2 : TRIGRAM_INITIAL_WORDS;
+            TextToken** words = (TextToken**)MEM_REALLOC_TAGGED(list->words, (size_t)capacity * sizeof(TextToken*),
+                                                                MEM_CAT_INDEX);
+            if (!words) {
+                drop_word_trigrams(index, word, keys, i);
+                return FALSE;
+            }
+            
+            index->trigram_bytes += (size_t)(capacity - list->capacity) * sizeof(TextToken*);
+            list->words = words;
+            list->capacity = capacity;
+        }
+        list->words[list->count++] = word;
+    }
+    return TRUE;
+}
+
+TextIndex* text_index_create(void) {
+    TextIndex* index = (TextIndex*)MEM_CALLOC_TAGGED(1, sizeof(TextIndex), MEM_CAT_INDEX);
+    if (!index) return NULL;
+    
+    index->slots = (TextToken**)MEM_CALLOC_TAGGED(TEXT_INITIAL_CAPACITY, sizeof(TextToken*), MEM_CAT_INDEX);
+    if (!index->slots) {
+        MEM_FREE(index);
+        return NULL;
+    }
+    index->capacity = TEXT_INITIAL_CAPACITY;
+    
+    index->trigrams = (TrigramList*)MEM_CALLOC_TAGGED(TRIGRAM_INITIAL_CAPACITY, sizeof(TrigramList), MEM_CAT_INDEX);
+    if (!index->trigrams) {
+        MEM_FREE(index->slots);
+        MEM_FREE(index);
+        return NULL;
+    }
+    index->trigram_capacity = TRIGRAM_INITIAL_CAPACITY;
+    return index;
+}
+
+void text_index_free(TextIndex* index) {
+    if (!index) return;
+    
+    for (int i = 0; i < index->capacity; i++) {
+        if (index->slots[i]) {
+            MEM_FREE(index->slots[i]->postings);
+            MEM_FREE(index->slots[i]);
+        }
+    }
+    MEM_FREE(index->slots);
+    
+    for (int i = 0; i < index->trigram_capacity; i++) {
+        MEM_FREE(index->trigrams[i].words);
+    }
+    MEM_FREE(index->trigrams);
+    
+    for (int field = 0; field < TEXT_FIELD_ANY; field++) {
+        string_pool_free(&index->pools[field]);
+    }
+    MEM_FREE(index->docs);
+    MEM_FREE(index->doc_hits);
+    MEM_FREE(index->doc_scores);
+    MEM_FREE(index->touched);
+    MEM_FREE(index->ranks);
+    MEM_FREE(index->result_docs);
+    MEM_FREE(index);
+}
+
+// Append doc to the posting list of (field, token), once per document
+static BOOL add_posting(TextIndex* index, int field, const char* token, int length, UINT32 doc) {
+    if ((index->token_count + 1) * 2 > index->capacity && !rehash(index, index->capacity * 2)) {
+        return FALSE;
+    }
+    
+    UINT32 hash = token_hash(field, token, length);
+    TextToken** slot = find_slot(index->slots, index->capacity, hash, field, token, length);
+    TextToken* entry = *slot;
+    
+    if (!entry) {
+        entry = (TextToken*)MEM_ALLOC_TAGGED(sizeof(TextToken) + length + 1, MEM_CAT_INDEX);
+        if (!entry) return FALSE;
+        
+        entry->hash = hash;
+        entry->field = (unsigned char)field;
+        entry->length = (unsigned char)length;
+        entry->postings = NULL;
+        entry->count = 0;
+        entry->capacity = 0;
+        entry->query_hits = 0;
+        entry->query_stamp = 0;
+        memcpy(entry->text, token, length);
+        entry->text[length] = '\0';
+        
+        // Words of the combined field feed substring and fuzzy matching
+        if (field == TEXT_FIELD_ANY && !add_word_trigrams(index, entry)) {
+            MEM_FREE(entry);
+            return FALSE;
+        }
+        *slot = entry;
+        index->token_count++;
+        index->token_bytes += sizeof(TextToken) + length + 1;
+    }
+    
+    if (entry->count > 0 && entry->postings[entry->count - 1] == doc) {
+        return TRUE; // Word repeated in the same field
+    }
+    
+    if (entry->count == entry->capacity) {
+        int capacity = entry->capacity > 0 ? entry->capacity * 2 : TEXT_INITIAL_POSTINGS;
+        UINT32* postings = (UINT32*)MEM_REALLOC_TAGGED(entry->postings, (size_t)capacity * sizeof(UINT32), MEM_CAT_INDEX);
+        if (!postings) return FALSE;
+        
+        index->posting_bytes += (size_t)(capacity - entry->capacity) * sizeof(UINT32);
+        entry->postings = postings;
+        entry->capacity = capacity;
+    }
+    
+    entry->postings[entry->count++] = doc;
+    return TRUE;
+}
+
+typedef struct {
+    TextIndex* index;
+    UINT32 doc;
+    int field;
+    BOOL failed;
+} AddContext;
+
+static void add_token(const char* token, int length, void* context) {
+    AddContext* add = (AddContext*)context;
+    if (add->failed) return;
+    
+    if (!add_posting(add->index, add->field, token, length, add->doc) ||
+        !add_posting(add->index, TEXT_FIELD_ANY, token, length, add->doc)) {
+        add->failed = TRUE;
+    }
+}
+
+BOOL text_index_add(TextIndex* index, MP3File* file) {
+    if (!index || !file) return FALSE;
+    
+    file->search_doc = TEXT_NO_DOC;
+    if (index->doc_count == index->doc_capacity) {
+        UINT32 capacity = index->doc_capacity > 0 ? index->doc_capacity * 2 : TEXT_INITIAL_DOCS;
+        TrackId* docs = (TrackId*)MEM_REALLOC_TAGGED(index->docs, (size_t)capacity * sizeof(TrackId), MEM_CAT_INDEX);
+        if (!docs) return FALSE;
+        
+        index->docs = docs;
+        index->doc_capacity = capacity;
+    }
+    
+    // The pools take one entry per document number, so a failure here hands none out
+    const char* fields[4] = { file->metadata.title, file->metadata.artist, file->metadata.album, file->metadata.genre };
+    for (int field = 0; field < TEXT_FIELD_ANY; field++) {
+        if (!string_pool_append(&index->pools[field], fields[field])) {
+            for (int added = 0; added <= field; added++) {
+                string_pool_truncate(&index->pools[added], index->doc_count);
+            }
+            return FALSE;
+        }
+    }
+    
+    AddContext add = { index, index->doc_count, 0, FALSE };
+    index->docs[add.doc] = file->id;
+    index->doc_count++;
+    
+    for (add.field = 0; add.field < 4 && !add.failed; add.field++) {
+        text_tokenize(fields[add.field], add_token, &add);
+    }
+    
+    if (add.failed) {
+        // Postings already written point to a removed document and are skipped
+        index->docs[add.doc] = INVALID_TRACK_ID;
+        index->deleted_count++;
+        return FALSE;
+    }
+    
+    file->search_doc = add.doc;
+    return TRUE;
+}
+
+void text_index_remove(TextIndex* index, MP3Library* library, MP3File* file) {
+    if (!index || !file) return;
+    
+    UINT32 doc = file->search_doc;
+    if (doc >= index->doc_count || index->docs[doc] != file->id) return;
+    
+    index->docs[doc] = INVALID_TRACK_ID;
+    index->deleted_count++;
+    file->search_doc = TEXT_NO_DOC;
+    
+    if (index->deleted_count >= TEXT_COMPACT_MIN_DELETED && index->deleted_count * 2 > index->doc_count) {
+        text_index_compact(index, library);
+    }
+}
+
+BOOL text_index_compact(TextIndex* index, MP3Library* library) {
+    if (!index || !library) return FALSE;
+    if (index->deleted_count == 0) return TRUE;
+    
+    UINT32* remap = (UINT32*)MEM_ALLOC((size_t)(index->doc_count > 0 ? index->doc_count : 1) * sizeof(UINT32));
+    if (!remap) return FALSE;
+    
+    // Live documents keep their relative order, so the lists stay sorted
+    UINT32 live = 0;
+    for (UINT32 doc = 0; doc < index->doc_count; doc++) {
+        if (index->docs[doc] == INVALID_TRACK_ID) {
+            remap[doc] = TEXT_NO_DOC;
+            continue;
+        }
+        
+        MP3File* file = library_get_track(library, index->docs[doc]);
+        if (file) {
+            file->search_doc = live;
+        }
+        remap[doc] = live;
+        index->docs[live++] = index->docs[doc];
+    }
+    
+    for (int field = 0; field < TEXT_FIELD_ANY; field++) {
+        string_pool_compact(&index->pools[field], remap);
+    }
+    
+    BOOL emptied = FALSE;
+    for (int i = 0; i < index->capacity; i++) {
+        TextToken* entry = index->slots[i];
+        if (!entry) continue;
+        
+        int kept = 0;
+        for (int p = 0; p < entry->count; p++) {
+            UINT32 doc = remap[entry->postings[p]];
+            if (doc != TEXT_NO_DOC) {
+                entry->postings[kept++] = doc;
+            }
+        }
+        entry->count = kept;
+        
+        if (kept == 0) {
+            index->posting_bytes -= (size_t)entry->capacity * sizeof(UINT32);
+            MEM_FREE(entry->postings);
+            entry->postings = NULL;
+            entry->capacity = 0;
+            emptied = TRUE;
+        }
+    }
+    
+    index->doc_count = live;
+    index->deleted_count = 0;
+    MEM_FREE(remap);
+    
+    // Drop the tokens left without postings. Removing entries in place would break
+    // the probe chains, so the table is rebuilt; without memory they simply stay.
+    if (emptied) {
+        TextToken** slots = (TextToken**)MEM_CALLOC_TAGGED(index->capacity, sizeof(TextToken*), MEM_CAT_INDEX);
+        if (slots) {
+            // Take the words about to be freed out of the trigram lists
+            for (int i = 0; i < index->trigram_capacity; i++) {
+                TrigramList* list = &index->trigrams[i];
+                int kept = 0;
+                for (int w = 0; w < list->count; w++) {
+                    if (list->words[w]->count > 0) {
+                        list->words[kept++] = list->words[w];
+                    }
+                }
+                list->count = kept;
+            }
+            
+            for (int i = 0; i < index->capacity; i++) {
+                TextToken* entry = index->slots[i];
+                if (!entry) continue;
+                
+                if (entry->count > 0) {
+                    place_entry(slots, index->capacity, entry);
+                } else {
+                    index->token_bytes -= sizeof(TextToken) + entry->length + 1;
+                    index->token_count--;
+                    MEM_FREE(entry);
+                }
+            }
+            MEM_FREE(index->slots);
+            index->slots = slots;
+        }
+    }
+    return TRUE;
+}
+
+typedef struct {
+    TextIndex* index;
+    int field;
+    TextToken* lists[TEXT_QUERY_MAX_TOKENS];
+    int count;
+    BOOL missing;                    // A word has no posting list: nothing can match
+} QueryContext;
+
+static void query_token(const char* token, int length, void* context) {
+    QueryContext* query = (QueryContext*)context;
+    if (query->missing || query->count == TEXT_QUERY_MAX_TOKENS) return;
+    
+    UINT32 hash = token_hash(query->field, token, length);
+    TextToken* entry = *find_slot(query->index->slots, query->index->capacity, hash, query->field, token, length);
+    if (!entry || entry->count == 0) {
+        query->missing = TRUE;
+        return;
+    }
+    
+    for (int i = 0; i < query->count; i++) {
+        if (query->lists[i] == entry) return;
+    }
+    query->lists[query->count++] = entry;
+}
+
+// First position at or after from holding a document >= target (exponential then binary search)
+static int gallop(const UINT32* postings, int count, int from, UINT32 target) {
+    int low = from;
+    int high = from;
+    int step = 1;
+    
+    while (high < count && postings[high] < target) {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    if (high > count) high = count;
+    
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (postings[middle] < target) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int text_index_search(TextIndex* index, int field, const char* query, TrackView* result) {
+    if (!index || !query || !result || field < 0 || field >= TEXT_FIELD_COUNT) return -1;
+    
+    track_view_clear(result);
+    
+    QueryContext context;
+    context.index = index;
+    context.field = field;
+    context.count = 0;
+    context.missing = FALSE;
+    text_tokenize(query, query_token, &context);
+    if (context.missing || context.count == 0) return 0;
+    
+    // Walk the shortest list and look its documents up in the others
+    for (int i = 1; i < context.count; i++) {
+        TextToken* entry = context.lists[i];
+        int j = i - 1;
+        while (j >= 0 && context.lists[j]->count > entry->count) {
+            context.lists[j + 1] = context.lists[j];
+            j--;
+        }
+        context.lists[j + 1] = entry;
+    }
+    
+    int cursors[TEXT_QUERY_MAX_TOKENS] = { 0 };
+    const TextToken* shortest = context.lists[0];
+    
+    // No result can be longer than the shortest list
+    if (!track_view_reserve(result, shortest->count)) return -1;
+    
+    // Leapfrog: a list that has nothing at the current document tells the
+    // shortest one where the next possible match is, skipping whole runs
+    int p = 0;
+    while (p < shortest->count) {
+        UINT32 doc = shortest->postings[p];
+        BOOL match = TRUE;
+        
+        for (int i = 1; i < context.count; i++) {
+            const TextToken* entry = context.lists[i];
+            cursors[i] = gallop(entry->postings, entry->count, cursors[i], doc);
+            if (cursors[i] == entry->count) {
+                return result->count; // A list is exhausted: no later document can match
+            }
+            if (entry->postings[cursors[i]] != doc) {
+                p = gallop(shortest->postings, shortest->count, p + 1, entry->postings[cursors[i]]);
+                match = FALSE;
+                break;
+            }
+        }
+        if (!match) continue;
+        
+        TrackId id = index->docs[doc];
+        if (id != INVALID_TRACK_ID) {
+            result->ids[result->count++] = id;
+        }
+        p++;
+    }
+    
+    return result->count;
+}
+
+// Words of a query, folded like the indexed text
+typedef struct {
+    char text[TEXT_QUERY_MAX_TOKENS][TEXT_TOKEN_MAX];
+    int length[TEXT_QUERY_MAX_TOKENS];
+    int count;
+} QueryWords;
+
+static void collect_query_word(const char* token, int length, void* context) {
+    QueryWords* words = (QueryWords*)context;
+    if (words->count == TEXT_QUERY_MAX_TOKENS) return;
+    
+    for (int i = 0; i < words->count; i++) {
+        if (words->length[i] == length && memcmp(words->text[i], token, length) == 0) return;
+    }
+    memcpy(words->text[words->count], token, length + 1);
+    words->length[words->count++] = length;
+}
+
+// Index words matched by one query word, with their rank
+typedef struct {
+    TextToken* word;
+    int rank;
+} WordMatch;
+
+typedef struct {
+    WordMatch* items;
+    int count;
+    int capacity;
+} WordMatches;
+
+static BOOL append_match(WordMatches* matches, TextToken* word, int rank) {
+    if (matches->count == matches->capacity) {
+        int capacity = matches->capacity > 0 ? matches->capacity * 2 : 64;
+        WordMatch* items = (WordMatch*)MEM_REALLOC(matches->items, (size_t)capacity * sizeof(WordMatch));
+        if (!items) return FALSE;
+        
+        matches->items = items;
+        matches->capacity = capacity;
+    }
+    
+    matches->items[matches->count].word = word;
+    matches->items[matches->count].rank = rank;
+    matches->count++;
+    return TRUE;
+}
+
+// Record a word matched by the current query word
+static BOOL push_match(WordMatches* matches, TextToken* word, int rank) {
+    word->query_hits = TEXT_WORD_DONE;
+    return append_match(matches, word, rank);
+}
+
+static TextToken* lookup_token(TextIndex* index, int field, const char* text, int length) {
+    UINT32 hash = token_hash(field, text, length);
+    return *find_slot(index->slots, index->capacity, hash, field, text, length);
+}
+
+// Optimal string alignment distance (a transposition counts as one edit),
+// or limit + 1 as soon as it must exceed limit
+static int edit_distance(const char* a, int a_length, const char* b, int b_length, int limit) {
+    int rows[3][TEXT_TOKEN_MAX + 1];
+    int* before = rows[0];
+    int* previous = rows[1];
+    int* current = rows[2];
+    
+    for (int j = 0; j <= b_length; j++) {
+        previous[j] = j;
+    }
+    
+    for (int i = 1; i <= a_length; i++) {
+        current[0] = i;
+        int best = i;
+        for (int j = 1; j <= b_length; j++) {
+            int cost = a[i - 1] != b[j - 1];
+            int value = previous[j - 1] + cost;
+            if (previous[j] + 1 < value) value = previous[j] + 1;
+            if (current[j - 1] + 1 < value) value = current[j - 1] + 1;
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] && before[j - 2] + 1 < value) {
+                value = before[j - 2] + 1;
+            }
+            current[j] = value;
+            if (value < best) best = value;
+        }
+        if (best > limit) return limit + 1;
+        
+        int* recycled = before;
+        before = previous;
+        previous = current;
+        current = recycled;
+    }
+    
+    return previous[b_length];
+}
+
+// Collect the index words one query word matches
+static BOOL match_query_word(TextIndex* index, const char* word, int length, DWORD options, WordMatches* matches) {
+    UINT32 stamp = ++index->query_stamp;
+    matches->count = 0;
+    
+    TextToken* exact = lookup_token(index, TEXT_FIELD_ANY, word, length);
+    if (exact && exact->count > 0) {
+        exact->query_stamp = stamp;
+        if (!push_match(matches, exact, TEXT_RANK_EXACT)) return FALSE;
+    }
+    
+    if (options & TEXT_MATCH_SUBSTRING) {
+        if (length >= 3) {
+            // Only words listed under every trigram can contain the fragment:
+            // walk the shortest list and check each word
+            TrigramList* shortest = NULL;
+            for (int i = 0; i + 3 <= length; i++) {
+                TrigramList* list = find_trigram(index->trigrams, index->trigram_capacity,
+                                                 trigram_key((const unsigned char*)word + i));
+                if (list->key == 0) {
+                    shortest = NULL;
+                    break;
+                }
+                if (!shortest || list->count < shortest->count) {
+                    shortest = list;
+                }
+            }
+            
+            for (int w = 0; shortest && w < shortest->count; w++) {
+                TextToken* candidate = shortest->words[w];
+                if (candidate->query_stamp == stamp || candidate->count == 0 || candidate->length < length) continue;
+                
+                const char* found = strstr(candidate->text, word);
+                if (found) {
+                    candidate->query_stamp = stamp;
+                    if (!push_match(matches, candidate, found == candidate->text ? TEXT_RANK_PREFIX : TEXT_RANK_INFIX)) {
+                        return FALSE;
+                    }
+                }
+            }
+        } else if (length == 2) {
+            // Too short for a plain trigram: words starting with it
+            unsigned char start[3] = { TRIGRAM_BOUNDARY, (unsigned char)word[0], (unsigned char)word[1] };
+            TrigramList* list = find_trigram(index->trigrams, index->trigram_capacity, trigram_key(start));
+            for (int w = 0; list->key != 0 && w < list->count; w++) {
+                TextToken* candidate = list->words[w];
+                if (candidate->query_stamp == stamp || candidate->count == 0) continue;
+                
+                candidate->query_stamp = stamp;
+                if (!push_match(matches, candidate, TEXT_RANK_PREFIX)) return FALSE;
+            }
+        } else {
+            // A single character: every word starting with it is listed under one of the
+            // "\x01c?" trigrams, and the trigram table is far smaller than the vocabulary
+            UINT32 start = ((UINT32)TRIGRAM_BOUNDARY << 8) | (unsigned char)word[0];
+            for (int i = 0; i < index->trigram_capacity; i++) {
+                TrigramList* list = &index->trigrams[i];
+                if (list->key == 0 || (list->key >> 8) != start) continue;
+                
+                for (int w = 0; w < list->count; w++) {
+                    TextToken* candidate = list->words[w];
+                    if (candidate->query_stamp == stamp || candidate->count == 0) continue;
+                    
+                    candidate->query_stamp = stamp;
+                    if (!push_match(matches, candidate, TEXT_RANK_PREFIX)) return FALSE;
+                }
+            }
+        }
+    }
+    
+    if ((options & TEXT_MATCH_FUZZY) && length >= 4) {
+        // An edit changes at most 3 padded trigrams and a transposition 4, so a word within
+        // distance edits of the query shares at least length - 4 * distance trigrams with it
+        int distance = length >= 8 ? 2 : 1;
+        int needed = length - 4 * distance;
+        if (needed < 1) needed = 1;
+        
+        UINT32 keys[TEXT_TOKEN_MAX];
+        int key_count = word_trigrams(word, length, keys);
+        
+        for (int k = 0; k < key_count; k++) {
+            TrigramList* list = find_trigram(index->trigrams, index->trigram_capacity, keys[k]);
+            for (int w = 0; list->key != 0 && w < list->count; w++) {
+                TextToken* candidate = list->words[w];
+                if (candidate->query_stamp != stamp) {
+                    candidate->query_stamp = stamp;
+                    candidate->query_hits = 1;
+                } else if (candidate->query_hits != TEXT_WORD_DONE) {
+                    candidate->query_hits++;
+                }
+            }
+        }
+        
+        for (int k = 0; k < key_count; k++) {
+            TrigramList* list = find_trigram(index->trigrams, index->trigram_capacity, keys[k]);
+            for (int w = 0; list->key != 0 && w < list->count; w++) {
+                TextToken* candidate = list->words[w];
+                if (candidate->query_hits == TEXT_WORD_DONE || candidate->query_hits < needed) continue;
+                
+                candidate->query_hits = TEXT_WORD_DONE;
+                if (candidate->count == 0 || abs(candidate->length - length) > distance) continue;
+                
+                int found = edit_distance(word, length, candidate->text, candidate->length, distance);
+                if (found <= distance) {
+                    if (!push_match(matches, candidate, TEXT_RANK_FUZZY + found)) return FALSE;
+                }
+            }
+        }
+    }
+    
+    return TRUE;
+}
+
+// Grow the per document scratch to the number of documents (new parts zeroed)
+static BOOL reserve_scratch(TextIndex* index) {
+    if (index->scratch_capacity >= index->doc_count) return TRUE;
+    
+    UINT32 capacity = index->doc_capacity;
+    unsigned char* hits = (unsigned char*)MEM_REALLOC_TAGGED(index->doc_hits, capacity, MEM_CAT_INDEX);
+    if (!hits) return FALSE;
+    index->doc_hits = hits;
+    
+    unsigned short* scores = (unsigned short*)MEM_REALLOC_TAGGED(index->doc_scores, (size_t)capacity * sizeof(unsigned short),
+                                                                 MEM_CAT_INDEX);
+    if (!scores) return FALSE;
+    index->doc_scores = scores;
+    
+    UINT32* touched = (UINT32*)MEM_REALLOC_TAGGED(index->touched, (size_t)capacity * sizeof(UINT32), MEM_CAT_INDEX);
+    if (!touched) return FALSE;
+    index->touched = touched;
+    
+    memset(hits + index->scratch_capacity, 0, capacity - index->scratch_capacity);
+    memset(scores + index->scratch_capacity, 0, (size_t)(capacity - index->scratch_capacity) * sizeof(unsigned short));
+    index->scratch_capacity = capacity;
+    return TRUE;
+}
+
+// Binary search of a posting list
+static BOOL token_has_doc(const TextToken* token, UINT32 doc) {
+    int low = 0;
+    int high = token->count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (token->postings[middle] < doc) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < token->count && token->postings[low] == doc;
+}
+
+// Comparisons of a binary search in a list of count postings
+static size_t probe_cost(int count) {
+    size_t cost = 1;
+    while (count > 0) {
+        cost++;
+        count >>= 1;
+    }
+    return cost;
+}
+
+// Ranked matching shared by text_index_match and text_index_match_within.
+// Documents still in the running are those whose doc_hits equals the number of
+// constraints met so far (the within set counts as one). Each query word either
+// walks the postings of its matching words, or, when fewer documents are left than
+// that, checks each of them by binary search.
+static int match_documents(TextIndex* index, int field, const char* query, DWORD options, const UINT32* within,
+                           int within_count, TrackView* result, unsigned short** ranks) {
+    if (!index || !query || !result || field < 0 || field >= TEXT_FIELD_COUNT) return -1;
+    
+    track_view_clear(result);
+    if (ranks) *ranks = NULL;
+    
+    QueryWords* words = (QueryWords*)MEM_ALLOC(sizeof(QueryWords));
+    if (!words) return -1;
+    words->count = 0;
+    text_tokenize(query, collect_query_word, words);
+    
+    if (words->count == 0 || !reserve_scratch(index)) {
+        int status = words->count == 0 ? 0 : -1;
+        MEM_FREE(words);
+        return status;
+    }
+    
+    WordMatches matches = { NULL, 0, 0 };
+    WordMatches tokens = { NULL, 0, 0 };
+    int touched_count = 0;
+    int alive = 0;
+    int base = 0;
+    BOOL ok = TRUE;
+    
+    // The allowed documents are the first constraint, in their given order
+    if (within) {
+        base = 1;
+        for (int i = 0; i < within_count; i++) {
+            UINT32 doc = within[i];
+            if (doc < index->doc_count && index->docs[doc] != INVALID_TRACK_ID && index->doc_hits[doc] == 0) {
+                index->doc_hits[doc] = 1;
+                index->touched[touched_count++] = doc;
+            }
+        }
+        alive = touched_count;
+    }
+    
+    for (int q = 0; q < words->count && ok && (alive > 0 || base + q == 0); q++) {
+        ok = match_query_word(index, words->text[q], words->length[q], options, &matches);
+        
+        // Tokens of the field for the matching words, best ranks first, so each
+        // document keeps the best way it matched this word
+        tokens.count = 0;
+        size_t walk = 0;
+        size_t probe = 0;
+        for (int rank = TEXT_RANK_EXACT; ok && rank <= TEXT_RANK_FUZZY + 2; rank++) {
+            for (int m = 0; ok && m < matches.count; m++) {
+                if (matches.items[m].rank != rank) continue;
+                
+                TextToken* token = matches.items[m].word;
+                if (field != TEXT_FIELD_ANY) {
+                    token = lookup_token(index, field, token->text, token->length);
+                    if (!token) continue;
+                }
+                
+                ok = append_match(&tokens, token, rank);
+                walk += (size_t)token->count;
+                probe += probe_cost(token->count);
+            }
+        }
+        
+        unsigned char expected = (unsigned char)(base + q);
+        int advanced = 0;
+        if (ok && base + q > 0 && (size_t)alive * probe < walk) {
+            for (int t = 0; t < touched_count; t++) {
+                UINT32 doc = index->touched[t];
+                if (index->doc_hits[doc] != expected) continue;
+                
+                for (int m = 0; m < tokens.count; m++) {
+                    if (token_has_doc(tokens.items[m].word, doc)) {
+                        index->doc_hits[doc] = (unsigned char)(expected + 1);
+                        index->doc_scores[doc] += (unsigned short)tokens.items[m].rank;
+                        advanced++;
+                        break;
+                    }
+                }
+            }
+        } else {
+            for (int m = 0; ok && m < tokens.count; m++) {
+                TextToken* token = tokens.items[m].word;
+                for (int p = 0; p < token->count; p++) {
+                    UINT32 doc = token->postings[p];
+                    if (index->doc_hits[doc] != expected) continue;
+                    
+                    index->doc_hits[doc] = (unsigned char)(expected + 1);
+                    index->doc_scores[doc] += (unsigned short)tokens.items[m].rank;
+                    advanced++;
+                    if (base + q == 0) {
+                        index->touched[touched_count++] = doc;
+                    }
+                }
+            }
+        }
+        alive = advanced;
+    }
+    
+    // Order by rank with a counting sort (ranks are small), keeping the match order within a rank
+    unsigned char matched = (unsigned char)(base + words->count);
+    int buckets[TEXT_QUERY_MAX_TOKENS * (TEXT_RANK_FUZZY + 2) + 2];
+    memset(buckets, 0, sizeof(buckets));
+    int total = 0;
+    for (int t = 0; ok && alive > 0 && t < touched_count; t++) {
+        UINT32 doc = index->touched[t];
+        if (index->doc_hits[doc] == matched && index->docs[doc] != INVALID_TRACK_ID) {
+            buckets[index->doc_scores[doc] + 1]++;
+            total++;
+        }
+    }
+    
+    if (ok && total > 0) {
+        ok = track_view_reserve(result, total);
+        if (ok && index->result_capacity < total) {
+            unsigned short* grown = (unsigned short*)MEM_REALLOC_TAGGED(index->ranks, (size_t)total * sizeof(unsigned short),
+                                                                        MEM_CAT_INDEX);
+            if (grown) {
+                index->ranks = grown;
+            }
+            UINT32* docs = grown ? (UINT32*)MEM_REALLOC_TAGGED(index->result_docs, (size_t)total * sizeof(UINT32),
+                                                               MEM_CAT_INDEX) : NULL;
+            if (docs) {
+                index->result_docs = docs;
+                index->result_capacity = total;
+            }
+            ok = docs != NULL;
+        }
+    }
+    
+    if (ok && total > 0) {
+        int bucket_count = (int)(sizeof(buckets) / sizeof(buckets[0]));
+        for (int b = 1; b < bucket_count; b++) {
+            buckets[b] += buckets[b - 1];
+        }
+        for (int t = 0; t < touched_count; t++) {
+            UINT32 doc = index->touched[t];
+            if (index->doc_hits[doc] == matched && index->docs[doc] != INVALID_TRACK_ID) {
+                int position = buckets[index->doc_scores[doc]]++;
+                result->ids[position] = index->docs[doc];
+                index->ranks[position] = index->doc_scores[doc];
+                index->result_docs[position] = doc;
+            }
+        }
+        result->count = total;
+        if (ranks) *ranks = index->ranks;
+    }
+    
+    // Leave the scratch zeroed for the next query
+    for (int t = 0; t < touched_count; t++) {
+        index->doc_hits[index->touched[t]] = 0;
+        index->doc_scores[index->touched[t]] = 0;
+    }
+    
+    MEM_FREE(tokens.items);
+    MEM_FREE(matches.items);
+    MEM_FREE(words);
+    return ok ? result->count : -1;
+}
+
+const StringPool* text_index_pool(const TextIndex* index, int field) {
+    if (!index || field < 0 || field >= TEXT_FIELD_ANY) return NULL;
+    return &index->pools[field];
+}
+
+int text_index_estimate(TextIndex* index, int field, const char* query, DWORD options, size_t* walk) {
+    if (walk) *walk = 0;
+    if (!index || !query || field < 0 || field >= TEXT_FIELD_COUNT) return -1;
+    
+    QueryWords* words = (QueryWords*)MEM_ALLOC(sizeof(QueryWords));
+    if (!words) return -1;
+    words->count = 0;
+    text_tokenize(query, collect_query_word, words);
+    
+    WordMatches matches = { NULL, 0, 0 };
+    size_t fewest = words->count > 0 ? (size_t)-1 : 0;
+    size_t total = 0;
+    BOOL ok = TRUE;
+    for (int q = 0; q < words->count && ok; q++) {
+        ok = match_query_word(index, words->text[q], words->length[q], options, &matches);
+        
+        size_t postings = 0;
+        for (int m = 0; ok && m < matches.count; m++) {
+            TextToken* token = matches.items[m].word;
+            if (field != TEXT_FIELD_ANY) {
+                token = lookup_token(index, field, token->text, token->length);
+                if (!token) continue;
+            }
+            postings += (size_t)token->count;
+        }
+        
+        total += postings;
+        if (postings < fewest) {
+            fewest = postings;
+        }
+    }
+    
+    MEM_FREE(matches.items);
+    MEM_FREE(words);
+    if (!ok) return -1;
+    
+    if (walk) *walk = total;
+    size_t live = index->doc_count - index->deleted_count;
+    return (int)(fewest < live ? fewest : live);
+}
+
+int text_index_match(TextIndex* index, int field, const char* query, DWORD options, TrackView* result,
+                     unsigned short** ranks) {
+    return match_documents(index, field, query, options, NULL, 0, result, ranks);
+}
+
+int text_index_match_within(TextIndex* index, int field, const char* query, DWORD options, const UINT32* within,
+                            int within_count, TrackView* result, unsigned short** ranks) {
+    if (!within) return -1;
+    return match_documents(index, field, query, options, within, within_count, result, ranks);
+}
@@ -0,0 +1,188 @@
+#include "../include/threadpool.h"
+#include "../include/memory.h"
+
+// A queued job: workers claim indices until all have been handed out
+struct ThreadPoolJob {
+    ThreadPoolTask task;
+    void* context;
+    int task_count;
+    int next_index;            // Next index to hand out (protected by the pool lock)
+    volatile LONG remaining;   // Indices not yet completed
+    HANDLE done_event;         // Signaled when remaining reaches zero
+    ThreadPoolJob* next;
+};
+
+// Number of processors available to the process
+int thread_pool_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+// Take the next index of the first queued job, or wait for work
+static ThreadPoolJob* claim_task(ThreadPool* pool, int* index) {
+    while (1) {
+        EnterCriticalSection(&pool->lock);
+        
+        if (pool->shutdown) {
+            LeaveCriticalSection(&pool->lock);
+            return NULL;
+        }
+        
+        ThreadPoolJob* job = pool->head;
+        if (job) {
+            *index = job->next_index++;
+            
+            // Every index has been handed out: the job leaves the queue
+            if (job->next_index >= job->task_count) {
+                pool->head = job->next;
+                if (!pool->head) {
+                    pool->tail = NULL;
+                }
+            }
+            
+            LeaveCriticalSection(&pool->lock);
+            return job;
+        }
+        
+        // Nothing to do: sleep until a job is queued
+        ResetEvent(pool->work_event);
+        LeaveCriticalSection(&pool->lock);
+        WaitForSingleObject(pool->work_event, INFINITE);
+    }
+}
+
+// Worker thread loop
+static DWORD WINAPI worker_thread(LPVOID param) {
+    ThreadPool* pool = (ThreadPool*)param;
+    ThreadPoolJob* job;
+    int index;
+    
+    while ((job = claim_task(pool, &index)) != NULL) {
+        job->task(job->context, index);
+        
+        if (InterlockedDecrement(&job->remaining) == 0) {
+            SetEvent(job->done_event);
+        }
+    }
+    
+    return 0;
+}
+
+// Create a pool (thread_count <= 0 uses one thread per processor)
+ThreadPool* thread_pool_create(int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = thread_pool_cpu_count();
+    }
+    
+    ThreadPool* pool = (ThreadPool*)MEM_CALLOC(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+    
+    pool->threads = (HANDLE*)MEM_CALLOC(thread_count, sizeof(HANDLE));
+    pool->work_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!pool->threads || !pool->work_event) {
+        if (pool->work_event) CloseHandle(pool->work_event);
+        MEM_FREE(pool->threads);
+        MEM_FREE(pool);
+        return NULL;
+    }
+    
+    InitializeCriticalSection(&pool->lock);
+    
+    for (int i = 0; i < thread_count; i++) {
+        pool->threads[i] = CreateThread(NULL, 0, worker_thread, pool, 0, NULL);
+        if (!pool->threads[i]) break;
+        pool->thread_count++;
+    }
+    
+    if (pool->thread_count == 0) {
+        thread_pool_free(pool);
+        return NULL;
+    }
+    
+    return pool;
+}
+
+// Stop the workers and free the pool (queued jobs must have been waited for)
+void thread_pool_free(ThreadPool* pool) {
+    if (!pool) return;
+    
+    EnterCriticalSection(&pool->lock);
+    pool->shutdown = TRUE;
+    SetEvent(pool->work_event);
+    LeaveCriticalSection(&pool->lock);
+    
+    for (int i = 0; i < pool->thread_count; i++) {
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+    }
+    
+    DeleteCriticalSection(&pool->lock);
+    CloseHandle(pool->work_event);
+    MEM_FREE(pool->threads);
+    MEM_FREE(pool);
+}
+
+// Queue a job and return immediately; the handle must be passed to thread_pool_wait
+ThreadPoolJob* thread_pool_submit(ThreadPool* pool, int task_count, ThreadPoolTask task, void* context) {
+    if (!pool || !task || task_count < 0) return NULL;
+    
+    ThreadPoolJob* job = (ThreadPoolJob*)MEM_CALLOC(1, sizeof(ThreadPoolJob));
+    if (!job) return NULL;
+    
+    job->done_event = CreateEvent(NULL, TRUE, task_count == 0, NULL);
+    if (!job->done_event) {
+        MEM_FREE(job);
+        return NULL;
+    }
+    
+    job->task = task;
+    job->context = context;
+    job->task_count = task_count;
+    job->remaining = task_count;
+    
+    if (task_count == 0) {
+        return job;
+    }
+    
+    EnterCriticalSection(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    SetEvent(pool->work_event);
+    LeaveCriticalSection(&pool->lock);
+    
+    return job;
+}
+
+// Check whether a submitted job has finished
+BOOL thread_pool_is_done(ThreadPoolJob* job) {
+    return !job || WaitForSingleObject(job->done_event, 0) == WAIT_OBJECT_0;
+}
+
+// Wait for a submitted job to finish and release its handle
+void thread_pool_wait(ThreadPoolJob* job) {
+    if (!job) return;
+    
+    WaitForSingleObject(job->done_event, INFINITE);
+    CloseHandle(job->done_event);
+    MEM_FREE(job);
+}
+
+// Run a job and wait for it (runs inline if the pool is NULL or the job cannot be queued)
+void thread_pool_run(ThreadPool* pool, int task_count, ThreadPoolTask task, void* context) {
+    if (!task) return;
+    
+    ThreadPoolJob* job = thread_pool_submit(pool, task_count, task, context);
+    if (job) {
+        thread_pool_wait(job);
+        return;
+    }
+    
+    for (int i = 0; i < task_count; i++) {
+        task(context, i);
+    }
+}
@@ -0,0 +1,588 @@
+#include "../include/trackseq.h"
+#include "../include/memory.h"
+#include <string.h>
+
+#define TRACK_SEQ_MOVE_BUFFER 64     // Ids moved without allocating
+
+typedef struct {
+    int count;
+    TrackId ids[TRACK_SEQ_LEAF_SIZE];
+} SeqLeaf;
+
+typedef struct {
+    int count;                       // Children
+    int sizes[TRACK_SEQ_FANOUT];     // Ids under each child
+    void* children[TRACK_SEQ_FANOUT]; // Leaves when the node is at height 1
+} SeqInner;
+
+// Lists of the nodes an insertion split off at each level; the level above reads the
+// one below while writing the other
+typedef struct {
+    TrackSequence* seq;
+    void** lists[2];
+    void** combined;                 // Children of an inner node that overflowed
+} InsertJob;
+
+static int node_size(const void* node, int height) {
+    if (height == 0) return ((const SeqLeaf*)node)->count;
+    
+    const SeqInner* inner = (const SeqInner*)node;
+    int size = 0;
+    for (int i = 0; i < inner->count; i++) {
+        size += inner->sizes[i];
+    }
+    return size;
+}
+
+static void free_node(void* node, int height) {
+    if (height > 0) {
+        SeqInner* inner = (SeqInner*)node;
+        for (int i = 0; i < inner->count; i++) {
+            free_node(inner->children[i], height - 1);
+        }
+    }
+    MEM_FREE(node);
+}
+
+static void free_spares(void** list, int* count) {
+    while (*list) {
+        void* node = *list;
+        *list = *(void**)node;
+        MEM_FREE(node);
+    }
+    *count = 0;
+}
+
+static BOOL add_spares(void** list, int* count, int wanted, size_t size) {
+    while (*count < wanted) {
+        void* node = MEM_ALLOC_TAGGED(size, MEM_CAT_PLAYLIST);
+        if (!node) return FALSE;
+        
+        *(void**)node = *list;
+        *list = node;
+        (*count)++;
+    }
+    return TRUE;
+}
+
+static SeqLeaf* take_leaf(TrackSequence* seq) {
+    SeqLeaf* leaf = (SeqLeaf*)seq->spare_leaves;
+    seq->spare_leaves = *(void**)leaf;
+    seq->spare_leaf_count--;
+    leaf->count = 0;
+    return leaf;
+}
+
+static SeqInner* take_inner(TrackSequence* seq) {
+    SeqInner* inner = (SeqInner*)seq->spare_inners;
+    seq->spare_inners = *(void**)inner;
+    seq->spare_inner_count--;
+    inner->count = 0;
+    return inner;
+}
+
+void track_seq_init(TrackSequence* seq) {
+    memset(seq, 0, sizeof(TrackSequence));
+}
+
+void track_seq_free(TrackSequence* seq) {
+    if (seq->root) {
+        free_node(seq->root, seq->height);
+    }
+    free_spares(&seq->spare_leaves, &seq->spare_leaf_count);
+    free_spares(&seq->spare_inners, &seq->spare_inner_count);
+    MEM_FREE(seq->scratch);
+    MEM_FREE(seq->flat);
+    track_seq_init(seq);
+}
+
+// Leaf holding index, and the position of index in it
+static SeqLeaf* find_leaf(const TrackSequence* seq, int index, int* offset) {
+    void* node = seq->root;
+    for (int height = seq->height; height > 0; height--) {
+        const SeqInner* inner = (const SeqInner*)node;
+        int i = 0;
+        while (index >= inner->sizes[i]) {
+            index -= inner->sizes[i++];
+        }
+        node = inner->children[i];
+    }
+    *offset = index;
+    return (SeqLeaf*)node;
+}
+
+TrackId track_seq_get(const TrackSequence* seq, int index) {
+    if (index < 0 || index >= seq->count) return INVALID_TRACK_ID;
+    if (!seq->root) return seq->flat[index];
+    
+    int offset;
+    return find_leaf(seq, index, &offset)->ids[offset];
+}
+
+const TrackId* track_seq_run(const TrackSequence* seq, int index, int* length) {
+    if (index < 0 || index >= seq->count) {
+        *length = 0;
+        return NULL;
+    }
+    
+    if (!seq->root) {
+        *length = seq->count - index;
+        return seq->flat + index;
+    }
+    
+    int offset;
+    SeqLeaf* leaf = find_leaf(seq, index, &offset);
+    *length = leaf->count - offset;
+    return leaf->ids + offset;
+}
+
+int track_seq_copy(const TrackSequence* seq, int first, int count, TrackId* out) {
+    int copied = 0;
+    while (copied < count) {
+        int length;
+        const TrackId* run = track_seq_run(seq, first + copied, &length);
+        if (!run) break;
+        
+        if (length > count - copied) length = count - copied;
+        memcpy(out + copied, run, (size_t)length * sizeof(TrackId));
+        copied += length;
+    }
+    return copied;
+}
+
+// Copy n items from position p of old[0, index) + added + old[index, old_count)
+static void copy_spliced(char* dest, size_t item, int p, int n, const char* old, int index, int old_count,
+                         const char* added, int added_count) {
+    while (n > 0) {
+        const char* source;
+        int available;
+        if (p < index) {
+            source = old + (size_t)p * item;
+            available = index - p;
+        } else if (p < index + added_count) {
+            source = added + (size_t)(p - index) * item;
+            available = index + added_count - p;
+        } else {
+            source = old + (size_t)(p - added_count) * item;
+            available = old_count + added_count - p;
+        }
+        
+        int take = n < available ? n : available;
+        memcpy(dest, source, (size_t)take * item);
+        dest += (size_t)take * item;
+        p += take;
+        n -= take;
+    }
+}
+
+// Items of the k-th of parts nodes sharing total. Appending at the end fills the nodes
+// before the last one, so that a sequence built in order keeps full leaves.
+static int part_size(int total, int parts, int k, int capacity, BOOL at_end) {
+    if (at_end) return k < parts - 1 ? capacity : total - capacity * (parts - 1);
+    return total / parts + (k < total % parts);
+}
+
+static void fill_inner(SeqInner* node, void** children, int count, int child_height) {
+    node->count = count;
+    for (int i = 0; i < count; i++) {
+        node->children[i] = children[i];
+        node->sizes[i] = node_size(children[i], child_height);
+    }
+}
+
+static int insert_leaf(InsertJob* job, SeqLeaf* leaf, int index, const TrackId* ids, int count) {
+    int total = leaf->count + count;
+    if (total <= TRACK_SEQ_LEAF_SIZE) {
+        memmove(leaf->ids + index + count, leaf->ids + index, (size_t)(leaf->count - index) * sizeof(TrackId));
+        memcpy(leaf->ids + index, ids, (size_t)count * sizeof(TrackId));
+        leaf->count = total;
+        return 0;
+    }
+    
+    // Spread the old ids and the new ones over as many leaves as they need
+    TrackId old[TRACK_SEQ_LEAF_SIZE];
+    int old_count = leaf->count;
+    memcpy(old, leaf->ids, (size_t)old_count * sizeof(TrackId));
+    
+    int parts = (total + TRACK_SEQ_LEAF_SIZE - 1) / TRACK_SEQ_LEAF_SIZE;
+    int position = 0;
+    for (int k = 0; k < parts; k++) {
+        SeqLeaf* target = k == 0 ? leaf : take_leaf(job->seq);
+        int size = part_size(total, parts, k, TRACK_SEQ_LEAF_SIZE, index == old_count);
+        copy_spliced((char*)target->ids, sizeof(TrackId), position, size, (const char*)old, index, old_count,
+                     (const char*)ids, count);
+        target->count = size;
+        position += size;
+        if (k > 0) job->lists[0][k - 1] = target;
+    }
+    return parts - 1;
+}
+
+// Insert into the subtree of node. Returns the number of nodes it split off, to be
+// placed right after it (listed in job->lists[height % 2]).
+static int insert_into(InsertJob* job, void* node, int height, int index, const TrackId* ids, int count) {
+    if (height == 0) return insert_leaf(job, (SeqLeaf*)node, index, ids, count);
+    
+    // An index at the boundary of two children goes to the end of the first one
+    SeqInner* inner = (SeqInner*)node;
+    int i = 0;
+    while (i < inner->count - 1 && index > inner->sizes[i]) {
+        index -= inner->sizes[i++];
+    }
+    
+    int added_count = insert_into(job, inner->children[i], height - 1, index, ids, count);
+    if (added_count == 0) {
+        inner->sizes[i] += count;
+        return 0;
+    }
+    
+    void** added = job->lists[(height - 1) % 2];
+    int total = inner->count + added_count;
+    if (total <= TRACK_SEQ_FANOUT) {
+        memmove(inner->children + i + 1 + added_count, inner->children + i + 1,
+                (size_t)(inner->count - i - 1) * sizeof(void*));
+        memmove(inner->sizes + i + 1 + added_count, inner->sizes + i + 1, (size_t)(inner->count - i - 1) * sizeof(int));
+        inner->sizes[i] = node_size(inner->children[i], height - 1);
+        for (int k = 0; k < added_count; k++) {
+            inner->children[i + 1 + k] = added[k];
+            inner->sizes[i + 1 + k] = node_size(added[k], height - 1);
+        }
+        inner->count = total;
+        return 0;
+    }
+    
+    // Too many children for one node: split it too
+    copy_spliced((char*)job->combined, sizeof(void*), 0, total, (const char*)inner->children, i + 1, inner->count,
+                 (const char*)added, added_count);
+    int parts = (total + TRACK_SEQ_FANOUT - 1) / TRACK_SEQ_FANOUT;
+    BOOL at_end = i == inner->count - 1;
+    int position = 0;
+    for (int k = 0; k < parts; k++) {
+        SeqInner* target = k == 0 ? inner : take_inner(job->seq);
+        int size = part_size(total, parts, k, TRACK_SEQ_FANOUT, at_end);
+        fill_inner(target, job->combined + position, size, height - 1);
+        position += size;
+        if (k > 0) job->lists[height % 2][k - 1] = target;
+    }
+    return parts - 1;
+}
+
+// Get the nodes and lists an insertion of count ids can need, so that it cannot fail
+// once it has started changing the tree
+static BOOL prepare_insert(TrackSequence* seq, int count) {
+    int leaves = count / TRACK_SEQ_LEAF_SIZE + 1;
+    
+    // Each level splits off at most one node per TRACK_SEQ_FANOUT added below it,
+    // and the root may need new levels above it
+    int inners = 0;
+    int added = leaves;
+    for (int level = 1; level <= seq->height; level++) {
+        added = (added + TRACK_SEQ_FANOUT - 1) / TRACK_SEQ_FANOUT;
+        inners += added;
+    }
+    while (added > 0) {
+        int parts = (added + TRACK_SEQ_FANOUT) / TRACK_SEQ_FANOUT;
+        inners += parts;
+        added = parts - 1;
+    }
+    
+    int list_size = leaves + TRACK_SEQ_FANOUT;
+    if (seq->scratch_capacity < 3 * list_size) {
+        void** scratch = (void**)MEM_REALLOC_TAGGED(seq->scratch, (size_t)(3 * list_size) * sizeof(void*),
+                                                    MEM_CAT_PLAYLIST);
+        if (!scratch) return FALSE;
+        
+        seq->scratch = scratch;
+        seq->scratch_capacity = 3 * list_size;
+    }
+    
+    return add_spares(&seq->spare_leaves, &seq->spare_leaf_count, leaves + (seq->root == NULL), sizeof(SeqLeaf)) &&
+           add_spares(&seq->spare_inners, &seq->spare_inner_count, inners, sizeof(SeqInner));
+}
+
+static void insert_prepared(TrackSequence* seq, int index, const TrackId* ids, int count) {
+    if (!seq->root) {
+        seq->root = take_leaf(seq);
+        seq->height = 0;
+    }
+    
+    int list_size = seq->scratch_capacity / 3;
+    InsertJob job = { seq, { seq->scratch, seq->scratch + list_size }, seq->scratch + 2 * list_size };
+    int added_count = insert_into(&job, seq->root, seq->height, index, ids, count);
+    
+    // The root split: grow the tree by a level until one node holds everything
+    while (added_count > 0) {
+        void** added = job.lists[seq->height % 2];
+        int total = added_count + 1;
+        job.combined[0] = seq->root;
+        memcpy(job.combined + 1, added, (size_t)added_count * sizeof(void*));
+        
+        int parts = (total + TRACK_SEQ_FANOUT - 1) / TRACK_SEQ_FANOUT;
+        int position = 0;
+        for (int k = 0; k < parts; k++) {
+            SeqInner* target = take_inner(seq);
+            int size = part_size(total, parts, k, TRACK_SEQ_FANOUT, FALSE);
+            fill_inner(target, job.combined + position, size, seq->height);
+            position += size;
+            if (k == 0) {
+                seq->root = target;
+            } else {
+                job.lists[(seq->height + 1) % 2][k - 1] = target;
+            }
+        }
+        seq->height++;
+        added_count = parts - 1;
+    }
+    
+    seq->count += count;
+}
+
+// Insert into the flat array, which has room for them
+static void flat_insert(TrackSequence* seq, int index, const TrackId* ids, int count) {
+    memmove(seq->flat + index + count, seq->flat + index, (size_t)(seq->count - index) * sizeof(TrackId));
+    memcpy(seq->flat + index, ids, (size_t)count * sizeof(TrackId));
+    seq->count += count;
+}
+
+// Make room for count more ids in the flat array, doubling it up to TRACK_SEQ_FLAT_SIZE
+static BOOL reserve_flat(TrackSequence* seq, int count) {
+    int needed = seq->count + count;
+    if (needed <= seq->flat_capacity) return TRUE;
+    
+    int capacity = seq->flat_capacity > 0 ? seq->flat_capacity : 16;
+    while (capacity < needed) capacity *= 2;
+    if (capacity > TRACK_SEQ_FLAT_SIZE) capacity = TRACK_SEQ_FLAT_SIZE;
+    
+    TrackId* flat = (TrackId*)MEM_REALLOC_TAGGED(seq->flat, (size_t)capacity * sizeof(TrackId), MEM_CAT_PLAYLIST);
+    if (!flat) return FALSE;
+    
+    seq->flat = flat;
+    seq->flat_capacity = capacity;
+    return TRUE;
+}
+
+// Move the ids of the flat array into a tree. FALSE without memory, leaving it flat.
+static BOOL promote_flat(TrackSequence* seq) {
+    if (!prepare_insert(seq, seq->count)) return FALSE;
+    
+    int count = seq->count;
+    seq->count = 0;
+    insert_prepared(seq, 0, seq->flat, count);
+    MEM_FREE(seq->flat);
+    seq->flat = NULL;
+    seq->flat_capacity = 0;
+    return TRUE;
+}
+
+BOOL track_seq_insert(TrackSequence* seq, int index, const TrackId* ids, int count) {
+    if (index < 0 || index > seq->count || count < 0) return FALSE;
+    if (count == 0) return TRUE;
+    
+    if (!seq->root && seq->count + count <= TRACK_SEQ_FLAT_SIZE) {
+        if (!reserve_flat(seq, count)) return FALSE;
+        flat_insert(seq, index, ids, count);
+        return TRUE;
+    }
+    
+    // Growing past the flat array: the same ids as a tree, so failing after it still
+    // leaves the sequence unchanged
+    if (!seq->root && seq->count > 0 && !promote_flat(seq)) return FALSE;
+    if (!prepare_insert(seq, count)) return FALSE;
+    
+    insert_prepared(seq, index, ids, count);
+    return TRUE;
+}
+
+BOOL track_seq_append(TrackSequence* seq, const TrackId* ids, int count) {
+    return track_seq_insert(seq, seq->count, ids, count);
+}
+
+static int node_entries(const void* node, int height) {
+    return height == 0 ? ((const SeqLeaf*)node)->count : ((const SeqInner*)node)->count;
+}
+
+// Fold child i + 1 of an inner node into child i
+static void merge_children(SeqInner* inner, int i, int child_height) {
+    void* left = inner->children[i];
+    void* right = inner->children[i + 1];
+    if (child_height == 0) {
+        SeqLeaf* a = (SeqLeaf*)left;
+        SeqLeaf* b = (SeqLeaf*)right;
+        memcpy(a->ids + a->count, b->ids, (size_t)b->count * sizeof(TrackId));
+        a->count += b->count;
+    } else {
+        SeqInner* a = (SeqInner*)left;
+        SeqInner* b = (SeqInner*)right;
+        memcpy(a->children + a->count, b->children, (size_t)b->count * sizeof(void*));
+        memcpy(a->sizes + a->count, b->sizes, (size_t)b->count * sizeof(int));
+        a->count += b->count;
+    }
+    MEM_FREE(right);
+    
+    inner->sizes[i] += inner->sizes[i + 1];
+    memmove(inner->children + i + 1, inner->children + i + 2, (size_t)(inner->count - i - 2) * sizeof(void*));
+    memmove(inner->sizes + i + 1, inner->sizes + i + 2, (size_t)(inner->count - i - 2) * sizeof(int));
+    inner->count--;
+}
+
+// Merge the children in [first, last] that fell under a quarter full with a neighbour
+// they fit in
+static void merge_small(SeqInner* inner, int first, int last, int child_height) {
+    int capacity = child_height == 0 ? TRACK_SEQ_LEAF_SIZE : TRACK_SEQ_FANOUT;
+    for (int i = first; i <= last && i < inner->count; i++) {
+        int entries = node_entries(inner->children[i], child_height);
+        if (entries >= capacity / 4) continue;
+        
+        if (i + 1 < inner->count && entries + node_entries(inner->children[i + 1], child_height) <= capacity) {
+            merge_children(inner, i, child_height);
+            last--;
+        } else if (i > 0 && entries + node_entries(inner->children[i - 1], child_height) <= capacity) {
+            merge_children(inner, i - 1, child_height);
+            i--;
+            last--;
+        }
+    }
+}
+
+static void remove_from(void* node, int height, int first, int count) {
+    if (height == 0) {
+        SeqLeaf* leaf = (SeqLeaf*)node;
+        memmove(leaf->ids + first, leaf->ids + first + count,
+                (size_t)(leaf->count - first - count) * sizeof(TrackId));
+        leaf->count -= count;
+        return;
+    }
+    
+    SeqInner* inner = (SeqInner*)node;
+    int i = 0;
+    while (first >= inner->sizes[i]) {
+        first -= inner->sizes[i++];
+    }
+    
+    // Children inside the range go whole, the ones at its edges lose part of their ids
+    int j = i;
+    while (count > 0) {
+        int take = inner->sizes[j] - first < count ? inner->sizes[j] - first : count;
+        if (take == inner->sizes[j]) {
+            free_node(inner->children[j], height - 1);
+            inner->children[j] = NULL;
+        } else {
+            remove_from(inner->children[j], height - 1, first, take);
+            inner->sizes[j] -= take;
+        }
+        count -= take;
+        first = 0;
+        j++;
+    }
+    
+    int kept = i;
+    for (int k = i; k < inner->count; k++) {
+        if (inner->children[k]) {
+            inner->children[kept] = inner->children[k];
+            inner->sizes[kept] = inner->sizes[k];
+            kept++;
+        }
+    }
+    inner->count = kept;
+    
+    merge_small(inner, i > 0 ? i - 1 : 0, i + 1, height - 1);
+}
+
+// Remove count ids, keeping the sequence in the form it has
+static void remove_ids(TrackSequence* seq, int first, int count) {
+    if (!seq->root) {
+        memmove(seq->flat + first, seq->flat + first + count, (size_t)(seq->count - first - count) * sizeof(TrackId));
+        seq->count -= count;
+        return;
+    }
+    
+    if (count == seq->count) {
+        free_node(seq->root, seq->height);
+        seq->root = NULL;
+        seq->height = 0;
+        seq->count = 0;
+        return;
+    }
+    
+    remove_from(seq->root, seq->height, first, count);
+    seq->count -= count;
+    
+    // Drop the levels left with a single child
+    while (seq->height > 0 && ((SeqInner*)seq->root)->count == 1) {
+        void* child = ((SeqInner*)seq->root)->children[0];
+        MEM_FREE(seq->root);
+        seq->root = child;
+        seq->height--;
+    }
+}
+
+// Turn a tree that fell under half of TRACK_SEQ_FLAT_SIZE back into a flat array (it
+// stays a tree without memory for it). The gap keeps it from switching back and forth.
+static void demote_tree(TrackSequence* seq) {
+    if (!seq->root || seq->count > TRACK_SEQ_FLAT_SIZE / 2) return;
+    
+    TrackId* flat = (TrackId*)MEM_ALLOC_TAGGED(TRACK_SEQ_FLAT_SIZE * sizeof(TrackId), MEM_CAT_PLAYLIST);
+    if (!flat) return;
+    
+    track_seq_copy(seq, 0, seq->count, flat);
+    free_node(seq->root, seq->height);
+    seq->root = NULL;
+    seq->height = 0;
+    MEM_FREE(seq->flat);
+    seq->flat = flat;
+    seq->flat_capacity = TRACK_SEQ_FLAT_SIZE;
+}
+
+void track_seq_remove(TrackSequence* seq, int first, int count) {
+    if (first < 0 || count <= 0 || first + count > seq->count) return;
+    
+    remove_ids(seq, first, count);
+    demote_tree(seq);
+}
+
+// Move ids within the flat array by rotating the stretch from the first position
+// involved to the last one: the shorter side of it (never over half the array) is set
+// aside while the other slides over
+static void flat_move(TrackSequence* seq, int first, int count, int to) {
+    TrackId saved[TRACK_SEQ_FLAT_SIZE / 2];
+    TrackId* start = seq->flat + (first < to ? first : to);
+    int length = (first < to ? to - first : first - to) + count;
+    int left = first < to ? count : first - to;
+    int right = length - left;
+    
+    if (left <= right) {
+        memcpy(saved, start, (size_t)left * sizeof(TrackId));
+        memmove(start, start + left, (size_t)right * sizeof(TrackId));
+        memcpy(start + right, saved, (size_t)left * sizeof(TrackId));
+    } else {
+        memcpy(saved, start + left, (size_t)right * sizeof(TrackId));
+        memmove(start + right, start, (size_t)left * sizeof(TrackId));
+        memcpy(start, saved, (size_t)right * sizeof(TrackId));
+    }
+}
+
+BOOL track_seq_move(TrackSequence* seq, int first, int count, int to) {
+    if (first < 0 || count < 0 || first + count > seq->count || to < 0 || to + count > seq->count) return FALSE;
+    if (count == 0 || first == to) return TRUE;
+    
+    if (!seq->root) {
+        flat_move(seq, first, count, to);
+        return TRUE;
+    }
+    
+    TrackId local[TRACK_SEQ_MOVE_BUFFER];
+    TrackId* moved = count <= TRACK_SEQ_MOVE_BUFFER ? local
+                                                    : (TrackId*)MEM_ALLOC_TAGGED((size_t)count * sizeof(TrackId),
+                                                                                 MEM_CAT_PLAYLIST);
+    
+    // Reserved before removing anything, so the ids cannot be lost halfway
+    BOOL ok = moved && prepare_insert(seq, count);
+    if (ok) {
+        track_seq_copy(seq, first, count, moved);
+        remove_ids(seq, first, count);
+        insert_prepared(seq, to, moved, count);
+    }
+    
+    if (moved != local) MEM_FREE(moved);
+    return ok;
+}
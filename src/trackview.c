@@ -0,0 +1,78 @@
+#include "../include/trackview.h"
+#include "../include/memory.h"
+
+#define TRACK_VIEW_INITIAL_CAPACITY 256
+
+void track_view_init(TrackView* view) {
+    view->ids = NULL;
+    view->count = 0;
+    view->capacity = 0;
+}
+
+void track_view_free(TrackView* view) {
+    if (!view) return;
+    
+    MEM_FREE(view->ids);
+    track_view_init(view);
+}
+
+void track_view_clear(TrackView* view) {
+    if (view) {
+        view->count = 0;
+    }
+}
+
+BOOL track_view_reserve(TrackView* view, int capacity) {
+    if (capacity <= view->capacity) return TRUE;
+    
+    TrackId* ids = (TrackId*)MEM_REALLOC_TAGGED(view->ids, (size_t)capacity * sizeof(TrackId), MEM_CAT_FILTER);
+    if (!ids) return FALSE;
+    
+    view->ids = ids;
+    view->capacity = capacity;
+    return TRUE;
+}
+
+BOOL track_view_add(TrackView* view, TrackId id) {
+    if (view->count == view->capacity &&
+        !track_view_reserve(view, view->capacity > 0 ? view->capacity * 2 : TRACK_VIEW_INITIAL_CAPACITY)) {
+        return FALSE;
+    }
+    
+    view->ids[view->count++] = id;
+    return TRUE;
+}
+
+int track_view_page(MP3Library* library, const TrackView* view, int first, int count, MP3File** out) {
+    if (!library || !view || !out || first < 0) return 0;
+    
+    int end = first + count < view->count ? first + count : view->count;
+    int resolved = 0;
+    for (int i = first; i < end; i++) {
+        MP3File* file = library_get_track(library, view->ids[i]);
+        if (file) {
+            out[resolved++] = file;
+        }
+    }
+    return resolved;
+}
+
+BOOL track_view_sort(MP3Library* library, TrackView* view, const SortSpec* spec, ThreadPool* pool) {
+    if (!library || !view || !spec) return FALSE;
+    if (view->count == 0) return TRUE;
+    
+    MP3File** tracks = (MP3File**)MEM_ALLOC((size_t)view->count * sizeof(MP3File*));
+    if (!tracks) return FALSE;
+    
+    int count = track_view_page(library, view, 0, view->count, tracks);
+    BOOL sorted = sort_track_array(library, tracks, count, spec, pool);
+    if (sorted) {
+        for (int i = 0; i < count; i++) {
+            view->ids[i] = tracks[i]->id;
+        }
+        view->count = count;
+    }
+    
+    MEM_FREE(tracks);
+    return sorted;
+}